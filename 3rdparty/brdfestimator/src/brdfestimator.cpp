@@ -314,6 +314,11 @@ void BRDFEstimator::estimate(const int nsample, const Material* mat)
 					Ray primary;
 					primary.o = center_ + radius_ * disk.x * frame.tangent() + radius_ * disk.y * frame.binormal() + radius_ * wo;
 					primary.d = -wo;
+					if (scene_.tile_count() > 1 && wo.y > 0.f) {
+						//start above the tiled surface so that grazing rays do not begin inside a neighboring tile
+						const float lift = (scene_.bbmax.y - primary.o.y) / wo.y;
+						if (lift > 0.f) primary.o = primary.o + lift * wo;
+					}
 					bool hit = false;
 					const col3 col = calculate_throughput(primary, light, hit, mat);
 					if (hit) {
@@ -398,74 +403,83 @@ void BRDFEstimator::visualize( const EnvMap& map, const char* filename ) const
             col3 col( 0.f );
 
             for( int i = 0; i < map_width; ++i ) {
-                for( int j = 0; j < map_height; ++j ) {
-                     const float u = ( i + 0.5f ) / ( float ) map_width;
-                     const float v = ( j + 0.5f ) / ( float ) map_height;
-                     const float sth = sinf( v * pi );                
-                     const vec3 wi = map.latitude_longitude_to_vec( u, v );                     
-                     const float cosine = dot( wi, normal );
+                const float u = ( i + 0.5f ) / ( float ) map_width;
+                //radiance of 8 texels per batch, the tail of a column repeats its last texel
+                for( int j0 = 0; j0 < map_height; j0 += 8 ) {
+                    vec3 wi8[ 8 ];
+                    col3 Li8[ 8 ];
+                    for( int k = 0; k < 8; ++k ) {
+                        wi8[ k ] = map.latitude_longitude_to_vec( u, ( std::min( j0 + k, map_height - 1 ) + 0.5f ) / ( float ) map_height );
+                    }
+                    map.lookup8( wi8, Li8 );
+                    for( int j = j0; j < std::min( j0 + 8, map_height ); ++j ) {
+                         const float v = ( j + 0.5f ) / ( float ) map_height;
+                         const float sth = sinf( v * pi );                
+                         const vec3& wi = wi8[ j - j0 ];
+                         const float cosine = dot( wi, normal );
                      
-                     if( cosine > 0.f ) {
-                          const col3 Li = map.lookup( wi ) * sth;
-                          const vec3 lwi = frame.toLocal( wi );
-
-                          float thi = acosf( clamp( lwi.z, 0.f, 1.f ) );
-                          float phi = atan2f( lwi.y, lwi.x ); if( phi < 0.f ) phi += 2.f * pi;
-                          float tho = acosf( clamp( lwo.z, 0.f, 1.f ) );
-                          float pho = atan2f( lwo.y, lwo.x ); if( pho < 0.f ) pho += 2.f * pi;
-
-                          const int thi_idx0 = clamp( ( int ) floor( thi / dth ), 0, nth_ - 1 );
-                          const int thi_idx1 = clamp( thi_idx0 + 1, 0, nth_ - 1 );
-                          const int phi_idx0 = clamp( ( int ) floor( phi / dph ), 0, nph_ - 1 );
-                          const int phi_idx1 = clamp( phi_idx0 + 1, 0, nph_ - 1 );
-
-                          const int tho_idx0 = clamp( ( int ) floor( tho / dth ), 0, nth_ - 1 );
-                          const int tho_idx1 = clamp( tho_idx0 + 1, 0, nth_ - 1 );
-                          const int pho_idx0 = clamp( ( int ) floor( pho / dph ), 0, nph_ - 1 );
-                          const int pho_idx1 = clamp( pho_idx0 + 1, 0, nph_ - 1 );
-
-                          int iidx[ 4 ], oidx[ 4 ];
-                          float tw[ 2 ], pw[ 2 ];
-                          float weighti[ 4 ], weighto[ 4 ];
-
-                          tw[ 0 ] = clamp( ( thi - thi_idx0 * dth ) / dth, 0.f, 1.f );
-                          pw[ 0 ] = clamp( ( phi - phi_idx0 * dph ) / dph, 0.f, 1.f );
-                          tw[ 1 ] = clamp( ( tho - tho_idx0 * dth ) / dth, 0.f, 1.f );
-                          pw[ 1 ] = clamp( ( pho - pho_idx0 * dph ) / dph, 0.f, 1.f );
-
-                          weighti[ 0 ] = ( 1.f - tw[ 0 ] ) * ( 1.f - pw[ 0 ] );
-                          weighti[ 1 ] = ( 1.f - tw[ 0 ] ) *         pw[ 0 ]  ;
-                          weighti[ 2 ] =         tw[ 0 ]   * ( 1.f - pw[ 0 ] );
-                          weighti[ 3 ] =         tw[ 0 ]   *         pw[ 0 ]  ;
-
-                          weighto[ 0 ] = ( 1.f - tw[ 1 ] ) * ( 1.f - pw[ 1 ] );
-                          weighto[ 1 ] = ( 1.f - tw[ 1 ] ) *         pw[ 1 ]  ;
-                          weighto[ 2 ] =         tw[ 1 ]   * ( 1.f - pw[ 1 ] );
-                          weighto[ 3 ] =         tw[ 1 ]   *         pw[ 1 ]  ;
-
-                          iidx[ 0 ] = thi_idx0 * nph_ + phi_idx0;
-                          iidx[ 1 ] = thi_idx0 * nph_ + phi_idx1;
-                          iidx[ 2 ] = thi_idx1 * nph_ + phi_idx0;
-                          iidx[ 3 ] = thi_idx1 * nph_ + phi_idx1;
-
-                          oidx[ 0 ] = tho_idx0 * nph_ + pho_idx0;
-                          oidx[ 1 ] = tho_idx0 * nph_ + pho_idx1;
-                          oidx[ 2 ] = tho_idx1 * nph_ + pho_idx0;
-                          oidx[ 3 ] = tho_idx1 * nph_ + pho_idx1;
-
-                          col3 fr;
-                          for( int ii = 0; ii < 4; ++ii ) {
-                              for( int jj = 0; jj < 4; ++jj ) {
-                                  if( iidx[ ii ] * size + oidx[ jj ] > size * size ) {
-                                      std::cout << iidx[ ii ] << " : " << oidx[ jj ] << "\n";
-                                      std::cout << tho_idx0 << " : " << tho_idx1 << " : " << pho_idx0 << " : " << pho_idx1 << "\n";
+                         if( cosine > 0.f ) {
+                              const col3 Li = Li8[ j - j0 ] * sth;
+                              const vec3 lwi = frame.toLocal( wi );
+
+                              float thi = acosf( clamp( lwi.z, 0.f, 1.f ) );
+                              float phi = atan2f( lwi.y, lwi.x ); if( phi < 0.f ) phi += 2.f * pi;
+                              float tho = acosf( clamp( lwo.z, 0.f, 1.f ) );
+                              float pho = atan2f( lwo.y, lwo.x ); if( pho < 0.f ) pho += 2.f * pi;
+
+                              const int thi_idx0 = clamp( ( int ) floor( thi / dth ), 0, nth_ - 1 );
+                              const int thi_idx1 = clamp( thi_idx0 + 1, 0, nth_ - 1 );
+                              const int phi_idx0 = clamp( ( int ) floor( phi / dph ), 0, nph_ - 1 );
+                              const int phi_idx1 = clamp( phi_idx0 + 1, 0, nph_ - 1 );
+
+                              const int tho_idx0 = clamp( ( int ) floor( tho / dth ), 0, nth_ - 1 );
+                              const int tho_idx1 = clamp( tho_idx0 + 1, 0, nth_ - 1 );
+                              const int pho_idx0 = clamp( ( int ) floor( pho / dph ), 0, nph_ - 1 );
+                              const int pho_idx1 = clamp( pho_idx0 + 1, 0, nph_ - 1 );
+
+                              int iidx[ 4 ], oidx[ 4 ];
+                              float tw[ 2 ], pw[ 2 ];
+                              float weighti[ 4 ], weighto[ 4 ];
+
+                              tw[ 0 ] = clamp( ( thi - thi_idx0 * dth ) / dth, 0.f, 1.f );
+                              pw[ 0 ] = clamp( ( phi - phi_idx0 * dph ) / dph, 0.f, 1.f );
+                              tw[ 1 ] = clamp( ( tho - tho_idx0 * dth ) / dth, 0.f, 1.f );
+                              pw[ 1 ] = clamp( ( pho - pho_idx0 * dph ) / dph, 0.f, 1.f );
+
+                              weighti[ 0 ] = ( 1.f - tw[ 0 ] ) * ( 1.f - pw[ 0 ] );
+                              weighti[ 1 ] = ( 1.f - tw[ 0 ] ) *         pw[ 0 ]  ;
+                              weighti[ 2 ] =         tw[ 0 ]   * ( 1.f - pw[ 0 ] );
+                              weighti[ 3 ] =         tw[ 0 ]   *         pw[ 0 ]  ;
+
+                              weighto[ 0 ] = ( 1.f - tw[ 1 ] ) * ( 1.f - pw[ 1 ] );
+                              weighto[ 1 ] = ( 1.f - tw[ 1 ] ) *         pw[ 1 ]  ;
+                              weighto[ 2 ] =         tw[ 1 ]   * ( 1.f - pw[ 1 ] );
+                              weighto[ 3 ] =         tw[ 1 ]   *         pw[ 1 ]  ;
+
+                              iidx[ 0 ] = thi_idx0 * nph_ + phi_idx0;
+                              iidx[ 1 ] = thi_idx0 * nph_ + phi_idx1;
+                              iidx[ 2 ] = thi_idx1 * nph_ + phi_idx0;
+                              iidx[ 3 ] = thi_idx1 * nph_ + phi_idx1;
+
+                              oidx[ 0 ] = tho_idx0 * nph_ + pho_idx0;
+                              oidx[ 1 ] = tho_idx0 * nph_ + pho_idx1;
+                              oidx[ 2 ] = tho_idx1 * nph_ + pho_idx0;
+                              oidx[ 3 ] = tho_idx1 * nph_ + pho_idx1;
+
+                              col3 fr;
+                              for( int ii = 0; ii < 4; ++ii ) {
+                                  for( int jj = 0; jj < 4; ++jj ) {
+                                      if( iidx[ ii ] * size + oidx[ jj ] > size * size ) {
+                                          std::cout << iidx[ ii ] << " : " << oidx[ jj ] << "\n";
+                                          std::cout << tho_idx0 << " : " << tho_idx1 << " : " << pho_idx0 << " : " << pho_idx1 << "\n";
+                                      }
+                                      fr += weighti[ ii ] * weighto[ jj ] * fr_[ iidx[ ii ] * size + oidx[ jj ] ];
                                   }
-                                  fr += weighti[ ii ] * weighto[ jj ] * fr_[ iidx[ ii ] * size + oidx[ jj ] ];
                               }
-                          }
 
-                          col += Li * fr * cosine;
-                     }
+                              col += Li * fr * cosine;
+                         }
+                    }
                 }
             }
             buffer.set( w, h, col * scale * Config::envmap_scale );
@@ -480,15 +494,12 @@ void BRDFEstimator::write_result(const char* filename) const
 {
 	const int size = nth_ * nph_;
 	std::cout << "Writing result to " << filename << " in Bitmap " << size << "x" << size << std::endl;
-	Framebuffer buffer(size, size);
-	for (int i = 0; i < size; i++)
+	//pixel ( i, j ) is fr_[ i * size + j ], encoded straight from the table without a transposed copy
+	if (!savehdr(filename, (const float*)fr_.get(), size, size, 4, 4 * size, 4))
 	{
-		for (int j = 0; j < size; j++)
-		{
-			buffer.set(i, j, fr_[i * size + j]);
-		}
+		std::cerr << "Cannot write file : " << filename << std::endl;
+		return;
 	}
-	buffer.saveHDR(filename);
 
 	std::cout << "Writing Completed!" << std::endl;
 }
@@ -9,11 +9,18 @@ int Config::windowsizex = 512;
 int Config::windowsizey = 512;
 int Config::nth = 32;
 int Config::nph = 32;
+int Config::tile_count = 1;
 std::string Config::scene_object_path;
 std::string Config::scene_object_filename;
 float Config::eye[ 3 ];
 float Config::ref[ 3 ];
 float Config::fovy;
+std::string Config::procedural_type;
+float Config::procedural_size = 1.f;
+int Config::procedural_resolution = 64;
+float Config::procedural_height = 0.05f;
+int Config::procedural_count = 16;
+int Config::procedural_seed = 1234;
 
 float Config::EPS_RAY    = 1e-3f;
 float Config::EPS_COSINE = 0.f;//1e-9f;
@@ -24,6 +31,7 @@ int Config::nsample = 1;
 std::string Config::outputfilename;
 std::string Config::envmap_filename;
 float Config::envmap_scale;
+int Config::envmap_octahedral = 0;
 int Config::max_path_length;
 
 
@@ -53,6 +61,24 @@ void Config::load( const char* filename )
 			} else if( param == std::string( "scene_object_path" ) ) {
 				input >> scene_object_path;
 				std::cout << "scene_object_path : " << scene_object_path << "\n";
+			} else if( param == std::string( "procedural_type" ) ) {
+				input >> procedural_type;
+				std::cout << param << " : " << procedural_type << "\n";
+			} else if( param == std::string( "procedural_size" ) ) {
+				input >> procedural_size;
+				std::cout << param << " : " << procedural_size << "\n";
+			} else if( param == std::string( "procedural_resolution" ) ) {
+				input >> procedural_resolution;
+				std::cout << param << " : " << procedural_resolution << "\n";
+			} else if( param == std::string( "procedural_height" ) ) {
+				input >> procedural_height;
+				std::cout << param << " : " << procedural_height << "\n";
+			} else if( param == std::string( "procedural_count" ) ) {
+				input >> procedural_count;
+				std::cout << param << " : " << procedural_count << "\n";
+			} else if( param == std::string( "procedural_seed" ) ) {
+				input >> procedural_seed;
+				std::cout << param << " : " << procedural_seed << "\n";
 			} else if( param == std::string( "camera" ) ) {
 				std::cout << param << "\n";
 				input >> eye[ 0 ] >> eye[ 1 ] >> eye[ 2 ];
@@ -67,6 +93,9 @@ void Config::load( const char* filename )
 			} else if( param == std::string( "nph") ) {
 				input >> nph;
 				std::cout << param << " : " << nph << "\n";
+			} else if( param == std::string( "tile_count" ) ) {
+				input >> tile_count;
+				std::cout << param << " : " << tile_count << "\n";
 			} else if( param == std::string( "nsample" ) ) {
 				input >> nsample;
 				std::cout << param << " : " << nsample << "\n";
@@ -79,6 +108,9 @@ void Config::load( const char* filename )
             } else if( param == std::string( "envmap_scale" ) ) {
                 input >> envmap_scale;
                 std::cout << param << " : " << envmap_scale << "\n";
+            } else if( param == std::string( "envmap_octahedral" ) ) {
+                input >> envmap_octahedral;
+                std::cout << param << " : " << envmap_octahedral << "\n";
             } else if( param == std::string( "max_path_length" ) ) {
                 input >> max_path_length;
                 std::cout << param << " : " << max_path_length << "\n";
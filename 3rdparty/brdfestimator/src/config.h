@@ -26,14 +26,23 @@ public:
 	
 	static std::string scene_object_path;
 	static std::string scene_object_filename;
+    static std::string procedural_type;
+    static float procedural_size;
+    static int procedural_resolution;
+    static float procedural_height;
+    static int procedural_count;
+    static int procedural_seed;
     static std::string envmap_filename;
     static float envmap_scale;
+    static int envmap_octahedral;
 
     static std::string outputfilename;
     
 	static int nth;
 	static int nph;
 
+	static int tile_count;
+
 	static int nsample;
 	static int max_path_length;
 	static float EPS_COSINE;
@@ -2,6 +2,7 @@
 #define _DISTRIBUTION_H_
 
 #include <algorithm>
+#include <cfloat>
 #include <vector>
 #include <memory>
 #include <cassert>
@@ -134,6 +135,154 @@ public:
 };
 
 
+/**
+ * @struct AliasDistribution1D
+ * @brief piecewise constant function sampled in O( 1 ) with Vose's alias method
+ *        sampleContinuous returns the same density as Distribution1D ( uniform inside the chosen bin ),
+ *        but the mapping from u is not monotonic, so stratification of u is not preserved
+ */
+struct AliasDistribution1D
+{
+public:
+
+    AliasDistribution1D( float *f, int n ) : count( n )
+    {
+        func.reset( new float [ count ] );
+        prob.reset( new float [ count ] );
+        alias.reset( new int [ count ] );
+
+        funcInt = 0.f;
+        for( int i = 0; i < count; i++ ) {
+            func[ i ] = f[ i ];
+            funcInt += func[ i ] / ( float ) count;
+        }
+
+        //scaled weights average to one, bins below one are topped up by a single bin above one
+        std::vector< float > scaled( count );
+        std::vector< int > small, large;
+        small.reserve( count );
+        large.reserve( count );
+        for( int i = 0; i < count; i++ ) {
+            scaled[ i ] = ( funcInt == 0.f ) ? 1.f : func[ i ] / funcInt;
+            if( scaled[ i ] < 1.f ) small.push_back( i );
+            else large.push_back( i );
+        }
+        while( !small.empty() && !large.empty() ) {
+            const int s = small.back(); small.pop_back();
+            const int l = large.back(); large.pop_back();
+            prob[ s ] = scaled[ s ];
+            alias[ s ] = l;
+            scaled[ l ] = ( scaled[ l ] + scaled[ s ] ) - 1.f;
+            if( scaled[ l ] < 1.f ) small.push_back( l );
+            else large.push_back( l );
+        }
+        //whatever is left is one up to round-off
+        for( size_t i = 0; i < large.size(); i++ ) {
+            prob[ large[ i ] ] = 1.f;
+            alias[ large[ i ] ] = large[ i ];
+        }
+        for( size_t i = 0; i < small.size(); i++ ) {
+            prob[ small[ i ] ] = 1.f;
+            alias[ small[ i ] ] = small[ i ];
+        }
+    }
+
+    ~AliasDistribution1D()
+    {}
+
+    /**
+     * @fn float sampleContinuous( float u, float *pdf, int *off = nullptr ) const
+     * @brief u picks a column of the table, the remainder picks the bin or its alias and the offset inside it
+     */
+    float sampleContinuous( float u, float *pdf, int *off = nullptr ) const
+    {
+        float du;
+        const int offset = select( u, &du );
+        if( off != nullptr ) *off = offset;
+        if( pdf != nullptr ) *pdf = ( funcInt == 0.f ) ? 1.f : func[ offset ] / funcInt;
+        return ( offset + du ) / ( float ) count;
+    }
+
+    int sampleDiscrete( float u, float *pdf ) const
+    {
+        const int offset = select( u, nullptr );
+        if( pdf != nullptr ) *pdf = ( funcInt == 0.f ) ? 1.f / ( float ) count : func[ offset ] / ( funcInt * count );
+        return offset;
+    }
+
+
+    std::unique_ptr< float [] > func;
+    std::unique_ptr< float [] > prob;
+    std::unique_ptr< int [] > alias;
+    float funcInt;
+    int count;
+
+private:
+
+    int select( float u, float *du ) const
+    {
+        const float x = u * count;
+        const int i = std::min( std::max( 0, ( int ) x ), count - 1 );
+        //u == 1 lands on the far edge of the last bin, r stays below 1 ( the largest float under it ) so the alias branch never divides 0 by 0 when prob[ i ] == 1
+        const float r = std::min( std::max( 0.f, x - i ), 1.f - FLT_EPSILON * 0.5f );
+        if( r < prob[ i ] ) {
+            if( du != nullptr ) *du = r / prob[ i ];
+            return i;
+        }
+        if( du != nullptr ) *du = std::min( ( r - prob[ i ] ) / ( 1.f - prob[ i ] ), 1.f );
+        return alias[ i ];
+    }
+
+};
+
+/***
+ * @class AliasDistribution2D
+ * @brief Distribution2D built from alias tables, sampling costs two table lookups instead of two binary searches
+ */
+struct AliasDistribution2D {
+
+public:
+
+    AliasDistribution2D( const std::unique_ptr< float [] >& func, int nu, int nv )
+    {
+        conditional.reserve( nv );
+        for( int i = 0; i < nv; i++ ) {
+            conditional.emplace_back( new AliasDistribution1D( &func[ i * nu ], nu ) );
+        }
+        std::vector< float > marginalfunc;
+        marginalfunc.reserve( nv );
+        for( int i = 0; i < nv; i++ ) {
+            marginalfunc.push_back( conditional[ i ]->funcInt );
+        }
+        marginal.reset( new AliasDistribution1D( &marginalfunc[ 0 ], nv ) );
+    }
+
+    ~AliasDistribution2D() {
+    }
+
+    void sampleContinuous( float u0, float u1, float uv[ 2 ], float *pdf ) const {
+        float pdfs[ 2 ];
+        int v;
+        uv[ 1 ] = marginal->sampleContinuous( u1, &pdfs[ 1 ], &v );
+        uv[ 0 ] = conditional[ v ]->sampleContinuous( u0, &pdfs[ 0 ] );
+        *pdf = pdfs[ 0 ] * pdfs[ 1 ];
+    }
+
+    float pdf( float u, float v ) const {
+        int iu = std::min( std::max( 0, ( int ) ( u * conditional[ 0 ]->count ) ), conditional[ 0 ]->count - 1 );
+        int iv = std::min( std::max( 0, ( int ) ( v * marginal->count ) ), marginal->count - 1 );
+        if( conditional[ iv ]->funcInt * marginal->funcInt == 0.f ) return 0.f;
+        return ( conditional[ iv ]->func[ iu ] * marginal->func[ iv ] ) / ( conditional[ iv ]->funcInt * marginal->funcInt );
+    }
+
+
+    std::vector< std::unique_ptr< AliasDistribution1D > > conditional;
+    std::unique_ptr< AliasDistribution1D > marginal;
+
+
+};
+
+
 
 
 #endif
\ No newline at end of file
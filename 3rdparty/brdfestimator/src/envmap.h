@@ -6,6 +6,7 @@
 #include "utility.h"
 #include "image.h"
 #include "distribution.h"
+#include "octenvmap.h"
 
 /**
  * @class EnvMap
@@ -33,7 +34,7 @@ public:
         pdfw = 0.5f * invpi * invpi * pdf / sintheta( uv[ 1 ], img->h() );
         const vec3 w = latitude_longitude_to_vec( uv[ 0 ], uv[ 1 ] );
         if( rad != nullptr ) {
-            *rad = radiance( uv[ 0 ], uv[ 1 ] );
+            *rad = oct ? oct->lookup( w ) : radiance( uv[ 0 ], uv[ 1 ] );
         }
         return w;
     }
@@ -44,14 +45,45 @@ public:
      */
     col3 lookup( const vec3& w, float *pdfw = nullptr ) const
     {
+        if( oct && pdfw == nullptr ) {
+            return oct->lookup( w );
+        }
         vec3 uv = vec_to_latitude_longitude( w );
-        col3 rad = radiance( uv.x, uv.y );
+        col3 rad = oct ? oct->lookup( w ) : radiance( uv.x, uv.y );
         if( pdfw != nullptr ) {
             *pdfw = 0.5f * invpi * invpi * distribution->pdf( uv.x, uv.y ) / sintheta( uv.y, img->h() );        
         }
         return rad;
     }
 
+    /**
+     * @fn void lookup8( const vec3 w[ 8 ], col3 rad[ 8 ] ) const
+     * @brief radiance of 8 directions, batched through the octahedral map when it has been built
+     */
+    void lookup8( const vec3 w[ 8 ], col3 rad[ 8 ] ) const
+    {
+        if( oct ) {
+            oct->lookup8( w, rad );
+        } else {
+            for( int i = 0; i < 8; i++ ) rad[ i ] = lookup( w[ i ] );
+        }
+    }
+
+    /**
+     * @fn void build_octahedral( const int resolution = 0 )
+     * @brief resample the map onto an octahedral map with mip levels, lookup / sample / lookup8 then read from it.
+     *        resolution 0 keeps about as many texels as the latitude longitude map
+     */
+    void build_octahedral( const int resolution = 0 )
+    {
+        const int n = ( resolution > 0 ) ? resolution : ( int ) sqrtf( ( float ) img->w() * img->h() );
+        oct.reset( new OctEnvMap( n, [this]( const vec3& w ) {
+            const vec3 uv = vec_to_latitude_longitude( w );
+            return radiance( uv.x, uv.y );
+        } ) );
+        std::cout << "octahedral envmap : " << oct->resolution() << "x" << oct->resolution() << ", " << oct->levels() << " levels\n";
+    }
+
     /**
      * @fn vec3 latitude_longitude_to_vec( const float u, const float v ) const
      * @brief mapping ( u, v ) to direction vector
@@ -128,7 +160,7 @@ public:
                 p[ offset + w ] = sinth * luminance( img->operator()( w, h ) );
             }
         }
-        distribution.reset( new Distribution2D( p, width, height ) );
+        distribution.reset( new AliasDistribution2D( p, width, height ) );
     }
 
 
@@ -147,7 +179,8 @@ public:
 
     std::unique_ptr< image > img;
     //std::unique_ptr< Distribution1D > distribution;
-    std::unique_ptr< Distribution2D > distribution; 
+    std::unique_ptr< AliasDistribution2D > distribution;
+    std::unique_ptr< OctEnvMap > oct;
 
 
 
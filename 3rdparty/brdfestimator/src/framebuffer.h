@@ -10,6 +10,7 @@
 #include <memory>
 #include <fstream>
 #include "col3.h"
+#include "savehdr.h"
 
 class Framebuffer {
     
@@ -178,32 +179,10 @@ public:
     // Saving HDR
     void saveHDR( const char* aFilename )
     {
-        std::ofstream hdr( aFilename, std::ios::binary );
-        
-        hdr << "#?RADIANCE" << '\n';
-        hdr << "# " << '\n';
-        hdr << "FORMAT=32-bit_rle_rgbe" << '\n' << '\n';
-        hdr << "-Y " << resY << " +X " << resX << '\n';
-        
-        for( int y = 0; y < resY; y++ ) {
-            for( int x = 0; x < resX; x++ ) {
-                typedef unsigned char byte;
-                byte rgbe[ 4 ] = { 0, 0, 0, 0 };
-                const col3 &rgbF = pixel[ y * resX + x ];
-                float v = std::max( rgbF.r, std::max( rgbF.g, rgbF.b ) );
-                if(v >= 1e-32f) {
-                    int e;
-                    v = float( frexp( v, &e ) * 256.f / v );
-                    rgbe[ 0 ] = byte( rgbF.r * v);
-                    rgbe[ 1 ] = byte( rgbF.g * v);
-                    rgbe[ 2 ] = byte( rgbF.b * v);
-                    rgbe[ 3 ] = byte(e + 128);
-                }
-                
-                hdr.write( ( char* ) &rgbe[ 0 ], 4 );
-            }
+        //col3 is four packed floats, scanlines are encoded in parallel
+        if( !savehdr( aFilename, ( const float* ) pixel.get(), resX, resY, 4, 4, 4 * resX ) ) {
+            std::cerr << "Cannot write file : " << aFilename << "\n";
         }
-		hdr.close();
     }
 
     
@@ -3,12 +3,351 @@
 
 #include <vector>
 #include <string>
-#include <fstream>
 #include <sstream>
+#include <thread>
+#include <atomic>
 #include <algorithm>
+#include <string.h>
+#include <math.h>
+#include <smmintrin.h>
+#include "mappedfile.h"
 
-inline void loadhdr( const std::string& filename, int& width, int& height, int& channel, std::vector< unsigned)
+/**
+ * @fn template< typename F > void hdr_parallel_rows( const int n, const F& f )
+ * @brief call f( begin, end ) on contiguous bands of [ 0, n ), the viewer does not link TBB so this uses plain threads
+ */
+template< typename F >
+inline void hdr_parallel_rows( const int n, const F& f )
+{
+    const int threads = std::max( 1, std::min( ( int ) std::thread::hardware_concurrency(), n / 32 ) );
+    std::vector< std::thread > pool;
+    for( int t = 1; t < threads; t++ ) {
+        pool.emplace_back( [&f, n, threads, t]() { f( n * t / threads, n * ( t + 1 ) / threads ); } );
+    }
+    f( 0, n / threads );
+    for( size_t t = 0; t < pool.size(); t++ ) pool[ t ].join();
+}
 
+/**
+ * @class HDRDecoder
+ * @brief Radiance RGBE reader shared by the estimator and the viewer.
+ *        the file is mapped and a single pass over the run length codes records where every scanline starts,
+ *        after which scanlines are decoded independently and converted to float 4 pixels at a time through a 256 entry exponent table.
+ *        only Y major files ( -Y h +X w and its flipped variants ) are supported, which is all that is written here.
+ */
+class HDRDecoder {
+public:
 
+    HDRDecoder( const std::string& filename ) : file_( filename ), width_( 0 ), height_( 0 ), flip_x_( false ), flip_y_( false ), rle_( false )
+    {
+        //filled here rather than as a function static, the decoding threads only ever read it
+        for( int e = 0; e < 256; e++ ) {
+            scale_[ e ] = e ? ( float ) ldexp( 1.0, e - ( 128 + 8 ) ) : 0.f;
+        }
+        if( !file_.valid() ) {
+            error_ = "cannot open file";
+            return;
+        }
+        if( parse_header() ) index_scanlines();
+    }
 
-#endif
\ No newline at end of file
+    bool valid( void ) const
+    {
+        return error_.empty();
+    }
+
+    const std::string& error( void ) const
+    {
+        return error_;
+    }
+
+    int width( void ) const
+    {
+        return width_;
+    }
+
+    int height( void ) const
+    {
+        return height_;
+    }
+
+    /**
+     * @fn int scanline_row( const int i, const bool bottom_up ) const
+     * @brief image row of the i-th scanline in the file, rows count from the top unless bottom_up
+     */
+    int scanline_row( const int i, const bool bottom_up ) const
+    {
+        const int top = flip_y_ ? height_ - 1 - i : i;
+        return bottom_up ? height_ - 1 - top : top;
+    }
+
+    /**
+     * @fn bool decode( float* dst, const int pixel_stride, const bool bottom_up ) const
+     * @brief decode the whole image into dst, pixel ( x, y ) goes to dst[ ( y * width + x ) * pixel_stride ].
+     *        pixel_stride is 3 for packed rgb or 4 for rgba with alpha cleared, y = 0 is the top row unless bottom_up
+     */
+    bool decode( float* dst, const int pixel_stride, const bool bottom_up ) const
+    {
+        if( !valid() ) return false;
+        std::atomic< bool > ok( true );
+        hdr_parallel_rows( height_, [&]( const int begin, const int end ) {
+            std::vector< unsigned char > planes( 4 * width_ );
+            for( int i = begin; i < end && ok; i++ ) {
+                float* row = dst + ( size_t ) scanline_row( i, bottom_up ) * width_ * pixel_stride;
+                if( !decode_scanline( i, row, pixel_stride, &planes[ 0 ] ) ) ok = false;
+            }
+        } );
+        return ok;
+    }
+
+    /**
+     * @fn bool decode_region( const int x, const int y, const int w, const int h, float* dst, const int pixel_stride ) const
+     * @brief decode the w x h block at ( x, y ), rows counted from the top, into dst with rows of w pixels.
+     *        only the scanlines of the block are touched and runs outside its columns are skipped without being expanded
+     */
+    bool decode_region( const int x, const int y, const int w, const int h, float* dst, const int pixel_stride ) const
+    {
+        if( !valid() || x < 0 || y < 0 || w <= 0 || h <= 0 || x + w > width_ || y + h > height_ ) return false;
+        std::atomic< bool > ok( true );
+        hdr_parallel_rows( h, [&]( const int begin, const int end ) {
+            std::vector< unsigned char > planes( 4 * w );
+            for( int r = begin; r < end && ok; r++ ) {
+                //scanline_row is its own inverse
+                if( !decode_span( scanline_row( y + r, false ), x, x + w, dst + ( size_t ) r * w * pixel_stride, pixel_stride, &planes[ 0 ] ) ) ok = false;
+            }
+        } );
+        return ok;
+    }
+
+    /**
+     * @fn bool decode_scanline( const int i, float* dst, const int pixel_stride, unsigned char* planes ) const
+     * @brief decode the i-th scanline of the file into one row of width pixels, planes is scratch space of 4 * width bytes
+     */
+    bool decode_scanline( const int i, float* dst, const int pixel_stride, unsigned char* planes ) const
+    {
+        return decode_span( i, 0, width_, dst, pixel_stride, planes );
+    }
+
+    /**
+     * @fn bool decode_span( const int i, const int x0, const int x1, float* dst, const int pixel_stride, unsigned char* planes ) const
+     * @brief decode image columns [ x0, x1 ) of the i-th scanline of the file, planes is scratch space of 4 * ( x1 - x0 ) bytes
+     */
+    bool decode_span( const int i, const int x0, const int x1, float* dst, const int pixel_stride, unsigned char* planes ) const
+    {
+        //the same columns in file order
+        const int n = x1 - x0;
+        const int f0 = flip_x_ ? width_ - x1 : x0;
+        const int f1 = f0 + n;
+
+        const unsigned char* src = ( const unsigned char* ) file_.data + offsets_[ i ];
+        if( !rle_ ) {
+            convert( src + 4 * f0, 4, n, dst, pixel_stride );
+            return true;
+        }
+
+        const unsigned char* end = ( const unsigned char* ) file_.data + offsets_[ i + 1 ];
+        src += 4;
+        for( int c = 0; c < 4; c++ ) {
+            unsigned char* plane = planes + c * n;
+            for( int k = 0; k < width_; ) {
+                if( src >= end ) return false;
+                const int code = *src++;
+                const int count = ( code > 128 ) ? code - 128 : code;
+                if( count == 0 || count > width_ - k ) return false;
+                const int a = std::max( k, f0 );
+                const int b = std::min( k + count, f1 );
+                if( code > 128 ) {
+                    if( src >= end ) return false;
+                    if( a < b ) memset( plane + ( a - f0 ), *src, b - a );
+                    src++;
+                } else {
+                    if( end - src < count ) return false;
+                    if( a < b ) memcpy( plane + ( a - f0 ), src + ( a - k ), b - a );
+                    src += count;
+                }
+                k += count;
+            }
+        }
+        convert( planes, 1, n, dst, pixel_stride );
+        return true;
+    }
+
+private:
+
+    /**
+     * @fn void convert( const unsigned char* src, const int layout, const int n, float* dst, const int pixel_stride ) const
+     * @brief rgbe to float for n pixels in file order, layout 1 reads four planes of n bytes and layout 4 reads interleaved rgbe pixels
+     */
+    void convert( const unsigned char* src, const int layout, const int n, float* dst, const int pixel_stride ) const
+    {
+        //gathers the r, g, b and e bytes of 4 interleaved pixels into 4 dwords
+        const __m128i deinterleave = _mm_setr_epi8( 0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15 );
+        const int step = flip_x_ ? - pixel_stride : pixel_stride;
+        float* out = flip_x_ ? dst + ( n - 1 ) * pixel_stride : dst;
+
+        int j = 0;
+        for( ; j + 4 <= n; j += 4, out += 4 * step ) {
+            __m128i q;
+            if( layout == 4 ) {
+                q = _mm_shuffle_epi8( _mm_loadu_si128( ( const __m128i* ) ( src + 4 * j ) ), deinterleave );
+            } else {
+                int r, g, b, e;
+                memcpy( &r, src + j, 4 );
+                memcpy( &g, src + n + j, 4 );
+                memcpy( &b, src + 2 * n + j, 4 );
+                memcpy( &e, src + 3 * n + j, 4 );
+                q = _mm_setr_epi32( r, g, b, e );
+            }
+            __declspec( align( 16 ) ) unsigned char e[ 16 ];
+            _mm_store_si128( ( __m128i* ) e, q );
+            const __m128 s = _mm_setr_ps( scale_[ e[ 12 ] ], scale_[ e[ 13 ] ], scale_[ e[ 14 ] ], scale_[ e[ 15 ] ] );
+            __m128 r = _mm_mul_ps( _mm_cvtepi32_ps( _mm_cvtepu8_epi32( q ) ), s );
+            __m128 g = _mm_mul_ps( _mm_cvtepi32_ps( _mm_cvtepu8_epi32( _mm_srli_si128( q, 4 ) ) ), s );
+            __m128 b = _mm_mul_ps( _mm_cvtepi32_ps( _mm_cvtepu8_epi32( _mm_srli_si128( q, 8 ) ) ), s );
+            __m128 a = _mm_setzero_ps();
+            _MM_TRANSPOSE4_PS( r, g, b, a );
+            store( out, r, pixel_stride );
+            store( out + step, g, pixel_stride );
+            store( out + 2 * step, b, pixel_stride );
+            store( out + 3 * step, a, pixel_stride );
+        }
+
+        //distance between the r, g, b and e bytes of one pixel
+        const int d = ( layout == 4 ) ? 1 : n;
+        for( ; j < n; j++, out += step ) {
+            const unsigned char* p = src + layout * j;
+            const float s = scale_[ p[ 3 * d ] ];
+            out[ 0 ] = p[ 0 ] * s;
+            out[ 1 ] = p[ d ] * s;
+            out[ 2 ] = p[ 2 * d ] * s;
+            if( pixel_stride == 4 ) out[ 3 ] = 0.f;
+        }
+    }
+
+    static void store( float* out, const __m128 v, const int pixel_stride )
+    {
+        if( pixel_stride == 4 ) {
+            _mm_storeu_ps( out, v );
+        } else {
+            _mm_storel_pi( ( __m64* ) out, v );
+            _mm_store_ss( out + 2, _mm_movehl_ps( v, v ) );
+        }
+    }
+
+    bool fail( const std::string& message )
+    {
+        error_ = message;
+        return false;
+    }
+
+    /**
+     * @fn bool next_line( const char*& p, std::string& line ) const
+     * @brief read one header line without its newline, false at the end of the mapping
+     */
+    bool next_line( const char*& p, std::string& line ) const
+    {
+        const char* end = file_.data + file_.size;
+        const char* eol = std::find( p, end, '\n' );
+        if( eol == end ) return false;
+        line.assign( p, eol );
+        p = eol + 1;
+        return true;
+    }
+
+    bool parse_header( void )
+    {
+        const char* p = file_.data;
+        std::string line;
+        if( !next_line( p, line ) || line.compare( 0, 2, "#?" ) != 0 ) return fail( "not a hdr image" );
+        for( ;; ) {
+            if( !next_line( p, line ) ) return fail( "truncated header" );
+            if( line.empty() ) break;
+            if( line.compare( 0, 7, "FORMAT=" ) == 0 && line != std::string( "FORMAT=32-bit_rle_rgbe" ) ) return fail( "unsupported " + line );
+        }
+
+        if( !next_line( p, line ) ) return fail( "missing resolution" );
+        std::stringstream ss( line );
+        std::string buf1, buf2;
+        ss >> buf1 >> height_ >> buf2 >> width_;
+        if( ss.fail() || buf1.size() != 2 || buf2.size() != 2 || buf1[ 1 ] != 'Y' || buf2[ 1 ] != 'X' || width_ <= 0 || height_ <= 0 ) {
+            return fail( "unsupported resolution " + line );
+        }
+        flip_y_ = ( buf1[ 0 ] == '+' );
+        flip_x_ = ( buf2[ 0 ] == '-' );
+        offsets_.assign( 1, ( size_t ) ( p - file_.data ) );
+        return true;
+    }
+
+    /**
+     * @fn bool index_scanlines( void )
+     * @brief walks the run length codes without expanding them to find the start of every scanline,
+     *        files whose first scanline is not new style run length encoded are read as flat rgbe
+     */
+    bool index_scanlines( void )
+    {
+        const unsigned char* data = ( const unsigned char* ) file_.data;
+        const unsigned char* end = data + file_.size;
+        const unsigned char* p = data + offsets_[ 0 ];
+
+        rle_ = width_ >= 8 && width_ < 0x8000 && end - p >= 4 && p[ 0 ] == 2 && p[ 1 ] == 2 && ( p[ 2 ] & 0x80 ) == 0;
+        offsets_.resize( height_ + 1 );
+        if( !rle_ ) {
+            if( ( size_t ) ( end - p ) / 4 / width_ < ( size_t ) height_ ) return fail( "truncated pixel data" );
+            for( int i = 0; i <= height_; i++ ) offsets_[ i ] = offsets_[ 0 ] + ( size_t ) i * 4 * width_;
+            return true;
+        }
+
+        for( int i = 0; i < height_; i++ ) {
+            offsets_[ i ] = ( size_t ) ( p - data );
+            if( end - p < 4 || p[ 0 ] != 2 || p[ 1 ] != 2 || ( ( p[ 2 ] << 8 ) | p[ 3 ] ) != width_ ) return fail( "bad scanline header" );
+            p += 4;
+            for( int c = 0; c < 4; c++ ) {
+                for( int k = 0; k < width_; ) {
+                    if( p >= end ) return fail( "truncated pixel data" );
+                    const int code = *p++;
+                    const int count = ( code > 128 ) ? code - 128 : code;
+                    if( count == 0 || count > width_ - k ) return fail( "bad scanline data" );
+                    p += ( code > 128 ) ? 1 : count;
+                    k += count;
+                }
+            }
+            if( p > end ) return fail( "truncated pixel data" );
+        }
+        offsets_[ height_ ] = ( size_t ) ( p - data );
+        return true;
+    }
+
+    MappedFile file_;
+    std::string error_;
+    int width_, height_;
+    bool flip_x_, flip_y_, rle_;
+    std::vector< size_t > offsets_;
+    float scale_[ 256 ];
+
+    HDRDecoder( const HDRDecoder& );
+    HDRDecoder& operator=( const HDRDecoder& );
+
+};
+
+/**
+ * @fn bool loadhdr( const std::string& filename, int& width, int& height, std::vector< float >& rgb, std::string& error )
+ * @brief packed rgb floats, top row first
+ */
+inline bool loadhdr( const std::string& filename, int& width, int& height, std::vector< float >& rgb, std::string& error )
+{
+    HDRDecoder hdr( filename );
+    if( !hdr.valid() ) {
+        error = hdr.error();
+        return false;
+    }
+    width = hdr.width();
+    height = hdr.height();
+    rgb.resize( ( size_t ) 3 * width * height );
+    if( !hdr.decode( &rgb[ 0 ], 3, false ) ) {
+        error = "bad scanline data";
+        return false;
+    }
+    return true;
+}
+
+#endif
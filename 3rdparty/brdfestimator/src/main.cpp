@@ -179,7 +179,18 @@ void initScene( void )
 	scene.reset( new Scene() );
 	scene->setCamera();
     scene->setBackground();
-	scene->loadObj( Config::scene_object_path.c_str(), Config::scene_object_filename.c_str() );
+	scene->setTiling( Config::tile_count );
+	if( !Config::procedural_type.empty() ) {
+		Procedural::Params param;
+		param.size       = Config::procedural_size;
+		param.resolution = Config::procedural_resolution;
+		param.height     = Config::procedural_height;
+		param.count      = Config::procedural_count;
+		param.seed       = Config::procedural_seed;
+		scene->loadProcedural( Config::procedural_type, param );
+	} else {
+		scene->loadObj( Config::scene_object_path.c_str(), Config::scene_object_filename.c_str() );
+	}
 }
 
 void initRender( void )
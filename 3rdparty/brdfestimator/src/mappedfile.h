@@ -0,0 +1,84 @@
+//
+//  mappedfile.h
+//
+//  read-only memory mapping of a whole file, shared by the parallel obj parser and the mesh cache
+//
+
+#ifndef _MAPPEDFILE_H_
+#define _MAPPEDFILE_H_
+
+#include <stddef.h>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/*! read-only memory mapping of a whole file */
+class MappedFile {
+
+public:
+
+    MappedFile( const std::string& filename ) : data( NULL ), size( 0 ) {
+#ifdef _WIN32
+        file = CreateFileA( filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+        mapping = NULL;
+        if (file == INVALID_HANDLE_VALUE) return;
+        LARGE_INTEGER fsize;
+        if (!GetFileSizeEx(file, &fsize) || fsize.QuadPart == 0) return;
+        mapping = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL );
+        if (!mapping) return;
+        data = (const char*) MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+        if (data) size = (size_t) fsize.QuadPart;
+#else
+        fd = open( filename.c_str(), O_RDONLY );
+        if (fd < 0) return;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) return;
+        void *ptr = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        if (ptr == MAP_FAILED) return;
+        data = (const char*) ptr;  size = (size_t) st.st_size;
+#endif
+    }
+
+    ~MappedFile() {
+#ifdef _WIN32
+        if (data) UnmapViewOfFile(data);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+        if (data) munmap((void*) data, size);
+        if (fd >= 0) close(fd);
+#endif
+    }
+
+    bool valid() const { return data != NULL; }
+
+    const char *data;
+    size_t size;
+
+private:
+
+#ifdef _WIN32
+    HANDLE file, mapping;
+#else
+    int fd;
+#endif
+
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+};
+
+#endif
@@ -0,0 +1,506 @@
+//
+//  meshcache.h
+//
+//  versioned binary mesh cache shared by the estimator and the viewer.
+//  the cache is written next to the source file ( <source>.<tag>.mcache ) and memory-mapped on later loads,
+//  so a large scan is paged in instead of being parsed again.
+//
+
+#ifndef _MESHCACHE_H_
+#define _MESHCACHE_H_
+
+#include <stdio.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include "mappedfile.h"
+
+namespace MeshCache {
+
+static const char MAGIC[ 8 ] = { 'M', 'E', 'S', 'H', 'C', 'A', 'C', 'H' };
+
+/*! bump whenever the layout below or the meaning of a stream changes */
+static const uint32_t VERSION = 2;
+
+/*! vertex and index streams of a mesh, positions / normals / tangents are 3 floats, texcoords 2 floats, indices 1 uint32 */
+enum Stream {
+    POSITION = 0,
+    NORMAL,
+    TANGENT,
+    TEXCOORD,
+    INDEX,
+    STREAM_COUNT
+};
+
+static const uint32_t STREAM_STRIDE[ STREAM_COUNT ] = { 12, 12, 12, 8, 4 };
+
+struct Header {
+    char magic[ 8 ];
+    uint32_t version;
+    uint32_t header_size;       //sizeof( Header ), catches layout changes between compilers
+    char tag[ 16 ];             //loader that produced the data, the estimator and the viewer build different vertices
+    uint64_t source_size;
+    uint64_t source_time;
+    uint64_t source_hash;       //FNV-1a of the source file
+    uint64_t file_size;         //size of the complete cache, catches truncated writes
+    uint32_t mesh_count;
+    uint32_t material_count;
+    uint64_t mesh_offset;       //MeshRecord[ mesh_count ]
+    uint64_t material_offset;   //serialized materials
+    float sphere[ 4 ];          //bounding sphere of the whole model ( center, radius )
+    uint32_t dependency_count;
+    uint64_t dependency_offset; //serialized files the source pulls in ( .mtl ), each a path and its SourceStamp
+};
+
+struct MeshRecord {
+    uint32_t count[ STREAM_COUNT ];     //elements per stream, 0 when the stream is absent
+    uint32_t material_id;
+    uint64_t offset[ STREAM_COUNT ];
+    float sphere[ 4 ];
+};
+
+/**
+ * @struct Material
+ * @brief loader defined material, each loader decides what its strings ( names, texture files ) and values mean
+ */
+struct Material {
+    std::vector< std::string > strings;
+    std::vector< float > values;
+};
+
+/**
+ * @struct MeshData
+ * @brief pointers to the streams of one mesh, used both to write a cache and to read from the mapping
+ */
+struct MeshData {
+
+    MeshData() : material_id( 0 ) {
+        for( int s = 0; s < STREAM_COUNT; s++ ) {
+            count[ s ] = 0;
+            data[ s ] = NULL;
+        }
+        sphere[ 0 ] = sphere[ 1 ] = sphere[ 2 ] = sphere[ 3 ] = 0.f;
+    }
+
+    void set( const Stream s, const void* ptr, const size_t n ) {
+        data[ s ] = n ? ptr : NULL;
+        count[ s ] = static_cast< uint32_t >( n );
+    }
+
+    const float* floats( const Stream s ) const {
+        return static_cast< const float* >( data[ s ] );
+    }
+
+    const uint32_t* indices( void ) const {
+        return static_cast< const uint32_t* >( data[ INDEX ] );
+    }
+
+    uint32_t count[ STREAM_COUNT ];
+    const void* data[ STREAM_COUNT ];
+    uint32_t material_id;
+    float sphere[ 4 ];
+};
+
+/**
+ * @struct SourceStamp
+ * @brief identity of the source file, the hash is only computed when size or modification time do not settle it
+ */
+struct SourceStamp {
+    uint64_t size;
+    uint64_t time;
+    uint64_t hash;
+};
+
+inline uint64_t hashBytes( const char* data, const size_t size )
+{
+    uint64_t h = 14695981039346656037ULL;
+    for( size_t i = 0; i < size; i++ ) {
+        h ^= static_cast< unsigned char >( data[ i ] );
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+inline bool statSource( const std::string& source, SourceStamp& stamp )
+{
+#ifdef _WIN32
+    struct _stat64 st;
+    if( _stat64( source.c_str(), &st ) != 0 ) return false;
+#else
+    struct stat st;
+    if( stat( source.c_str(), &st ) != 0 ) return false;
+#endif
+    stamp.size = static_cast< uint64_t >( st.st_size );
+    stamp.time = static_cast< uint64_t >( st.st_mtime );
+    stamp.hash = 0;
+    return true;
+}
+
+inline bool hashSource( const std::string& source, SourceStamp& stamp )
+{
+    //an empty file cannot be mapped
+    if( stamp.size == 0 ) {
+        stamp.hash = hashBytes( NULL, 0 );
+        return true;
+    }
+    MappedFile file( source );
+    if( !file.valid() ) return false;
+    stamp.hash = hashBytes( file.data, file.size );
+    return true;
+}
+
+/*! size of the stamp of a dependency that did not exist when the cache was written, the cache is stale once it appears */
+static const uint64_t MISSING_SIZE = ~0ULL;
+
+/**
+ * @fn bool checkSource( const std::string& source, const SourceStamp& cached )
+ * @brief whether source still matches the stamp it had when the cache was written
+ */
+inline bool checkSource( const std::string& source, const SourceStamp& cached )
+{
+    SourceStamp stamp;
+    if( !statSource( source, stamp ) ) return cached.size == MISSING_SIZE;
+    if( stamp.size != cached.size ) return false;
+    if( stamp.time != cached.time ) {
+        //touched but possibly unchanged, fall back to the content hash
+        if( !hashSource( source, stamp ) || stamp.hash != cached.hash ) return false;
+    }
+    return true;
+}
+
+/**
+ * @fn std::vector< std::string > materialLibraries( const std::string& source )
+ * @brief the mtllib files of an .obj source resolved against its directory, empty for other formats.
+ *        the materials and texture names in a cache come from these files, so the cache depends on them too
+ */
+inline std::vector< std::string > materialLibraries( const std::string& source )
+{
+    std::vector< std::string > libraries;
+    const size_t dot = source.find_last_of( '.' );
+    if( dot == std::string::npos || source.size() - dot != 4 ||
+        tolower( source[ dot + 1 ] ) != 'o' || tolower( source[ dot + 2 ] ) != 'b' || tolower( source[ dot + 3 ] ) != 'j' ) {
+        return libraries;
+    }
+    MappedFile file( source );
+    if( !file.valid() ) return libraries;
+
+    const size_t slash = source.find_last_of( "/\\" );
+    const std::string dir = ( slash == std::string::npos ) ? std::string() : source.substr( 0, slash + 1 );
+    const char* p = file.data;
+    const char* end = file.data + file.size;
+    while( p < end ) {
+        const char* eol = static_cast< const char* >( memchr( p, '\n', end - p ) );
+        if( !eol ) eol = end;
+        while( p < eol && ( *p == ' ' || *p == '\t' ) ) p++;
+        if( eol - p > 6 && memcmp( p, "mtllib", 6 ) == 0 && ( p[ 6 ] == ' ' || p[ 6 ] == '\t' ) ) {
+            //one statement may name several libraries
+            p += 6;
+            while( p < eol ) {
+                while( p < eol && ( *p == ' ' || *p == '\t' || *p == '\r' ) ) p++;
+                const char* name = p;
+                while( p < eol && *p != ' ' && *p != '\t' && *p != '\r' ) p++;
+                if( p > name ) libraries.push_back( dir + std::string( name, p ) );
+            }
+        }
+        p = eol + 1;
+    }
+    return libraries;
+}
+
+inline std::string cachePath( const std::string& source, const std::string& tag )
+{
+    return source + "." + tag + ".mcache";
+}
+
+inline void setTag( char out[ 16 ], const std::string& tag )
+{
+    memset( out, 0, 16 );
+    memcpy( out, tag.c_str(), tag.size() < 15 ? tag.size() : 15 );
+}
+
+/**
+ * @fn void boundingSphere( const float* positions, const size_t n, float sphere[ 4 ] )
+ * @brief sphere around the center of the bounding box, good enough for framing and culling
+ */
+inline void boundingSphere( const float* positions, const size_t n, float sphere[ 4 ] )
+{
+    sphere[ 0 ] = sphere[ 1 ] = sphere[ 2 ] = sphere[ 3 ] = 0.f;
+    if( n == 0 ) return;
+    float bmin[ 3 ] = { positions[ 0 ], positions[ 1 ], positions[ 2 ] };
+    float bmax[ 3 ] = { positions[ 0 ], positions[ 1 ], positions[ 2 ] };
+    for( size_t i = 1; i < n; i++ ) {
+        for( int k = 0; k < 3; k++ ) {
+            const float p = positions[ 3 * i + k ];
+            if( p < bmin[ k ] ) bmin[ k ] = p;
+            if( p > bmax[ k ] ) bmax[ k ] = p;
+        }
+    }
+    float r2 = 0.f;
+    for( int k = 0; k < 3; k++ ) sphere[ k ] = 0.5f * ( bmin[ k ] + bmax[ k ] );
+    for( size_t i = 0; i < n; i++ ) {
+        const float dx = positions[ 3 * i     ] - sphere[ 0 ];
+        const float dy = positions[ 3 * i + 1 ] - sphere[ 1 ];
+        const float dz = positions[ 3 * i + 2 ] - sphere[ 2 ];
+        const float d2 = dx * dx + dy * dy + dz * dz;
+        if( d2 > r2 ) r2 = d2;
+    }
+    sphere[ 3 ] = sqrtf( r2 );
+}
+
+/**
+ * @class Reader
+ * @brief maps a cache and exposes its streams in place, the pointers stay valid as long as the reader lives
+ */
+class Reader {
+
+public:
+
+    Reader() : file_( NULL ), header_( NULL ) {
+    }
+
+    ~Reader() {
+        delete file_;
+    }
+
+    /**
+     * @fn bool open( const std::string& source, const std::string& tag )
+     * @brief open the cache of source written by tag, false when it is missing, from another version or stale
+     */
+    bool open( const std::string& source, const std::string& tag )
+    {
+        SourceStamp stamp;
+        if( !statSource( source, stamp ) ) return false;
+
+        delete file_;
+        file_ = new MappedFile( cachePath( source, tag ) );
+        header_ = NULL;
+        if( !file_->valid() || file_->size < sizeof( Header ) ) return false;
+
+        const Header* header = reinterpret_cast< const Header* >( file_->data );
+        char t[ 16 ];
+        setTag( t, tag );
+        if( memcmp( header->magic, MAGIC, 8 ) != 0 || header->version != VERSION || header->header_size != sizeof( Header ) ||
+            memcmp( header->tag, t, 16 ) != 0 || header->file_size != file_->size ) {
+            return false;
+        }
+        if( header->source_size != stamp.size ) return false;
+        if( header->source_time != stamp.time ) {
+            //touched but possibly unchanged, fall back to the content hash
+            if( !hashSource( source, stamp ) || stamp.hash != header->source_hash ) return false;
+        }
+        if( header->mesh_offset + header->mesh_count * sizeof( MeshRecord ) > file_->size || header->material_offset > file_->size ||
+            header->dependency_offset > file_->size ) {
+            return false;
+        }
+
+        const MeshRecord* record = reinterpret_cast< const MeshRecord* >( file_->data + header->mesh_offset );
+        for( uint32_t i = 0; i < header->mesh_count; i++ ) {
+            for( int s = 0; s < STREAM_COUNT; s++ ) {
+                if( record[ i ].offset[ s ] + static_cast< uint64_t >( record[ i ].count[ s ] ) * STREAM_STRIDE[ s ] > file_->size ) return false;
+            }
+        }
+        header_ = header;
+        return checkDependencies() && readMaterials();
+    }
+
+    size_t meshCount( void ) const {
+        return header_ ? header_->mesh_count : 0;
+    }
+
+    MeshData mesh( const size_t i ) const
+    {
+        const MeshRecord& record = reinterpret_cast< const MeshRecord* >( file_->data + header_->mesh_offset )[ i ];
+        MeshData mesh;
+        for( int s = 0; s < STREAM_COUNT; s++ ) {
+            mesh.set( static_cast< Stream >( s ), file_->data + record.offset[ s ], record.count[ s ] );
+        }
+        mesh.material_id = record.material_id;
+        memcpy( mesh.sphere, record.sphere, sizeof( mesh.sphere ) );
+        return mesh;
+    }
+
+    const std::vector< Material >& materials( void ) const {
+        return materials_;
+    }
+
+    const float* sphere( void ) const {
+        return header_->sphere;
+    }
+
+private:
+
+    bool checkDependencies( void )
+    {
+        const char* p = file_->data + header_->dependency_offset;
+        const char* end = file_->data + file_->size;
+        for( uint32_t d = 0; d < header_->dependency_count; d++ ) {
+            uint32_t len;
+            SourceStamp cached;
+            if( !read( p, end, &len, sizeof( len ) ) || static_cast< size_t >( end - p ) < len ) return fail();
+            const std::string path( p, len );
+            p += len;
+            if( !read( p, end, &cached, sizeof( cached ) ) || !checkSource( path, cached ) ) return fail();
+        }
+        return true;
+    }
+
+    bool readMaterials( void )
+    {
+        materials_.clear();
+        const char* p = file_->data + header_->material_offset;
+        const char* end = file_->data + file_->size;
+        for( uint32_t m = 0; m < header_->material_count; m++ ) {
+            Material material;
+            uint32_t ns, nv;
+            if( !read( p, end, &ns, sizeof( ns ) ) || !read( p, end, &nv, sizeof( nv ) ) ) return fail();
+            material.strings.resize( ns );
+            for( uint32_t i = 0; i < ns; i++ ) {
+                uint32_t len;
+                if( !read( p, end, &len, sizeof( len ) ) || static_cast< size_t >( end - p ) < len ) return fail();
+                material.strings[ i ].assign( p, len );
+                p += len;
+            }
+            material.values.resize( nv );
+            if( nv && !read( p, end, &material.values[ 0 ], nv * sizeof( float ) ) ) return fail();
+            materials_.push_back( material );
+        }
+        return true;
+    }
+
+    static bool read( const char*& p, const char* end, void* out, const size_t size )
+    {
+        if( static_cast< size_t >( end - p ) < size ) return false;
+        memcpy( out, p, size );
+        p += size;
+        return true;
+    }
+
+    bool fail( void )
+    {
+        header_ = NULL;
+        materials_.clear();
+        return false;
+    }
+
+    MappedFile* file_;
+    const Header* header_;
+    std::vector< Material > materials_;
+
+    Reader( const Reader& );
+    Reader& operator=( const Reader& );
+};
+
+/**
+ * @fn bool write( const std::string& source, const std::string& tag, const std::vector< MeshData >& meshes, const std::vector< Material >& materials, const float sphere[ 4 ], const std::vector< std::string >& dependencies )
+ * @brief write the cache of source next to it, a failure ( e.g. read-only directory ) only costs the next load a parse.
+ *        dependencies are the other files the data was built from ( see materialLibraries ), the cache goes stale with any of them
+ */
+inline bool write( const std::string& source, const std::string& tag, const std::vector< MeshData >& meshes,
+                   const std::vector< Material >& materials, const float sphere[ 4 ], const std::vector< std::string >& dependencies )
+{
+    SourceStamp stamp;
+    if( !statSource( source, stamp ) || !hashSource( source, stamp ) ) return false;
+
+    //streams are 16-byte aligned so they can be handed to SIMD code or uploaded straight from the mapping
+    std::vector< MeshRecord > records( meshes.size() );
+    uint64_t offset = ( sizeof( Header ) + records.size() * sizeof( MeshRecord ) + 15 ) & ~15ULL;
+    for( size_t i = 0; i < meshes.size(); i++ ) {
+        for( int s = 0; s < STREAM_COUNT; s++ ) {
+            records[ i ].count[ s ] = meshes[ i ].count[ s ];
+            records[ i ].offset[ s ] = offset;
+            offset = ( offset + static_cast< uint64_t >( meshes[ i ].count[ s ] ) * STREAM_STRIDE[ s ] + 15 ) & ~15ULL;
+        }
+        records[ i ].material_id = meshes[ i ].material_id;
+        memcpy( records[ i ].sphere, meshes[ i ].sphere, sizeof( records[ i ].sphere ) );
+    }
+
+    std::vector< char > table;
+    for( size_t m = 0; m < materials.size(); m++ ) {
+        const uint32_t ns = static_cast< uint32_t >( materials[ m ].strings.size() );
+        const uint32_t nv = static_cast< uint32_t >( materials[ m ].values.size() );
+        table.insert( table.end(), reinterpret_cast< const char* >( &ns ), reinterpret_cast< const char* >( &ns ) + sizeof( ns ) );
+        table.insert( table.end(), reinterpret_cast< const char* >( &nv ), reinterpret_cast< const char* >( &nv ) + sizeof( nv ) );
+        for( uint32_t i = 0; i < ns; i++ ) {
+            const std::string& str = materials[ m ].strings[ i ];
+            const uint32_t len = static_cast< uint32_t >( str.size() );
+            table.insert( table.end(), reinterpret_cast< const char* >( &len ), reinterpret_cast< const char* >( &len ) + sizeof( len ) );
+            table.insert( table.end(), str.begin(), str.end() );
+        }
+        if( nv ) {
+            const char* values = reinterpret_cast< const char* >( &materials[ m ].values[ 0 ] );
+            table.insert( table.end(), values, values + nv * sizeof( float ) );
+        }
+    }
+
+    const uint64_t dependency_offset = offset + table.size();
+    for( size_t d = 0; d < dependencies.size(); d++ ) {
+        SourceStamp dep;
+        if( !statSource( dependencies[ d ], dep ) ) {
+            dep.size = MISSING_SIZE;
+            dep.time = dep.hash = 0;
+        } else if( !hashSource( dependencies[ d ], dep ) ) {
+            return false;
+        }
+        const uint32_t len = static_cast< uint32_t >( dependencies[ d ].size() );
+        table.insert( table.end(), reinterpret_cast< const char* >( &len ), reinterpret_cast< const char* >( &len ) + sizeof( len ) );
+        table.insert( table.end(), dependencies[ d ].begin(), dependencies[ d ].end() );
+        table.insert( table.end(), reinterpret_cast< const char* >( &dep ), reinterpret_cast< const char* >( &dep ) + sizeof( dep ) );
+    }
+
+    Header header;
+    memset( &header, 0, sizeof( header ) );
+    memcpy( header.magic, MAGIC, 8 );
+    header.version = VERSION;
+    header.header_size = sizeof( Header );
+    setTag( header.tag, tag );
+    header.source_size = stamp.size;
+    header.source_time = stamp.time;
+    header.source_hash = stamp.hash;
+    header.mesh_count = static_cast< uint32_t >( meshes.size() );
+    header.material_count = static_cast< uint32_t >( materials.size() );
+    header.mesh_offset = sizeof( Header );
+    header.material_offset = offset;
+    header.dependency_count = static_cast< uint32_t >( dependencies.size() );
+    header.dependency_offset = dependency_offset;
+    header.file_size = offset + table.size();
+    memcpy( header.sphere, sphere, sizeof( header.sphere ) );
+
+    //write to a temporary file and rename it, so a concurrent or interrupted run never sees a partial cache
+    const std::string path = cachePath( source, tag );
+    const std::string tmp = path + ".tmp";
+    FILE* fp = fopen( tmp.c_str(), "wb" );
+    if( !fp ) return false;
+
+    static const char zero[ 16 ] = { 0 };
+    bool ok = fwrite( &header, sizeof( header ), 1, fp ) == 1;
+    if( !records.empty() ) ok = ok && fwrite( &records[ 0 ], sizeof( MeshRecord ), records.size(), fp ) == records.size();
+    uint64_t pos = sizeof( Header ) + records.size() * sizeof( MeshRecord );
+    for( size_t i = 0; i < meshes.size() && ok; i++ ) {
+        for( int s = 0; s < STREAM_COUNT && ok; s++ ) {
+            ok = fwrite( zero, 1, static_cast< size_t >( records[ i ].offset[ s ] - pos ), fp ) == records[ i ].offset[ s ] - pos;
+            pos = records[ i ].offset[ s ];
+            const size_t bytes = static_cast< size_t >( records[ i ].count[ s ] ) * STREAM_STRIDE[ s ];
+            if( bytes ) ok = ok && fwrite( meshes[ i ].data[ s ], 1, bytes, fp ) == bytes;
+            pos += bytes;
+        }
+    }
+    if( ok ) ok = fwrite( zero, 1, static_cast< size_t >( header.material_offset - pos ), fp ) == header.material_offset - pos;
+    if( ok && !table.empty() ) ok = fwrite( &table[ 0 ], 1, table.size(), fp ) == table.size();
+    ok = ( fclose( fp ) == 0 ) && ok;
+
+    remove( path.c_str() );
+    if( !ok || rename( tmp.c_str(), path.c_str() ) != 0 ) {
+        remove( tmp.c_str() );
+        return false;
+    }
+    return true;
+}
+
+}
+
+#endif
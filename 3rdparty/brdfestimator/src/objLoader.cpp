@@ -110,6 +110,15 @@ void OBJLoader::flushFaceGroup(std::vector<std::vector<Vec3i> > &faceGroup, cons
         }
     } 
 
+    fixMesh(mesh);
+
+    /*! append the mesh to the model */
+    if (faceGroup.size()) model.push_back(mesh);  
+    faceGroup.clear();
+}
+
+void OBJLoader::fixMesh(Mesh &mesh) {
+
     /* fix some materials */
     if (//mesh.material.name == "BeltStrap1" ||
         //mesh.material.name == "BeltBuckle1" || 
@@ -125,10 +134,6 @@ void OBJLoader::flushFaceGroup(std::vector<std::vector<Vec3i> > &faceGroup, cons
     /* fix some texture coordinate issues */
     for (size_t i=0; i<mesh.texcoords.size(); i++)
       mesh.texcoords[i].y = 1.0f-mesh.texcoords[i].y;
-    
-    /*! append the mesh to the model */
-    if (faceGroup.size()) model.push_back(mesh);  
-    faceGroup.clear();
 }
 
 void OBJLoader::flushMaterial(Material &material, const std::string materialName) {
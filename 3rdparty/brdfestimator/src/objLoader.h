@@ -74,7 +74,10 @@ public:
     
     OBJLoader( const std::string& _path, FILE *objFile );
     
-private:
+protected:
+
+    /*! constructor for derived loaders that parse the file themselves */
+    OBJLoader( const std::string& _path ) : path( _path ) {}
 
     std::string path;
     
@@ -104,6 +107,20 @@ private:
     /*! load an OBJ material library */
     void loadMTL(const std::string libraryName);
 
+    /*! apply the material and texture coordinate fixes to a finished mesh */
+    void fixMesh(Mesh &mesh);
+
+};
+
+/*! OBJ loader that memory-maps the file and parses line-aligned chunks in parallel,
+ *  producing the same meshes as OBJLoader */
+class ParallelOBJLoader : public OBJLoader {
+
+public:
+
+    /*! constructor */
+    ParallelOBJLoader( const std::string& _path, const std::string& filename );
+
 };
 
 inline std::vector<Mesh> loadOBJ(const char *fileName) {
@@ -118,13 +135,19 @@ inline std::vector<Mesh> loadOBJ(const char *fileName) {
 }
 
 
+/*! read the model back from the binary cache written next to fileName, false when the cache is missing or stale */
+bool loadCache( const std::string& fileName, std::vector<Mesh>& model );
+
+/*! write the binary cache of model next to fileName */
+bool saveCache( const std::string& fileName, const std::vector<Mesh>& model );
+
 inline std::vector< Mesh > loadOBJ( const std::string& _path, const std::string& _filename )
 {
-    const std::string filename = _path + _filename;
-    FILE *objFile = fopen( filename.c_str(), "r" );
-    if( !objFile ) std::cerr << " ERROR : unable to open " << filename << "\n", exit( 1 );
-    OBJLoader loader( _path, objFile );
-    fclose( objFile );
+    std::vector< Mesh > model;
+    if( loadCache( _path + _filename, model ) ) return ( model );
+
+    ParallelOBJLoader loader( _path, _path + _filename );
+    if( !saveCache( _path + _filename, loader.model ) ) std::cerr << " WARNING : unable to write the mesh cache of " << _path + _filename << "\n";
     return ( loader.model );
 }
 
@@ -0,0 +1,98 @@
+//
+//  objLoaderCache.cpp
+//
+//  binary mesh cache of the meshes produced by the OBJ loaders, see meshcache.h for the file layout
+//
+
+#include "objLoader.h"
+#include "meshcache.h"
+
+namespace ObjLoader {
+
+namespace {
+
+/*! tag of the caches written by the estimator, the viewer writes its own */
+const char *cacheTag = "estimator";
+
+/*! a material is stored as its name and texture maps followed by its scalar values */
+MeshCache::Material packMaterial(const Material &material) {
+
+    MeshCache::Material packed;
+    const std::string strings[] = { material.name, material.map_d, material.map_Ka, material.map_Kd, material.map_Ks, material.map_Ns, material.map_Bump };
+    packed.strings.assign(strings, strings + 7);
+    const float values[] = { material.d, material.Ka.r, material.Ka.g, material.Ka.b, material.Kd.r, material.Kd.g, material.Kd.b,
+                             material.Ks.r, material.Ks.g, material.Ks.b, material.Ns };
+    packed.values.assign(values, values + 11);
+    return packed;
+}
+
+bool unpackMaterial(const MeshCache::Material &packed, Material &material) {
+
+    if (packed.strings.size() != 7 || packed.values.size() != 11) return false;
+    material.name  = packed.strings[0];  material.map_d  = packed.strings[1];  material.map_Ka = packed.strings[2];
+    material.map_Kd = packed.strings[3]; material.map_Ks = packed.strings[4];  material.map_Ns = packed.strings[5];
+    material.map_Bump = packed.strings[6];
+    const float *v = &packed.values[0];
+    material.d = v[0];
+    material.Ka.r = v[1];  material.Ka.g = v[2];  material.Ka.b = v[3];
+    material.Kd.r = v[4];  material.Kd.g = v[5];  material.Kd.b = v[6];
+    material.Ks.r = v[7];  material.Ks.g = v[8];  material.Ks.b = v[9];
+    material.Ns = v[10];
+    return true;
+}
+
+template< typename T >
+void assignStream(std::vector<T> &out, const MeshCache::MeshData &mesh, const MeshCache::Stream s) {
+    const T *data = static_cast<const T*>(mesh.data[s]);
+    if (mesh.count[s]) out.assign(data, data + mesh.count[s] * MeshCache::STREAM_STRIDE[s] / sizeof(T));
+    else out.clear();
+}
+
+}
+
+bool loadCache( const std::string& fileName, std::vector<Mesh>& model ) {
+
+    MeshCache::Reader reader;
+    if (!reader.open(fileName, cacheTag)) return false;
+
+    const std::vector<MeshCache::Material> &materials = reader.materials();
+    std::vector<Mesh> meshes(reader.meshCount());
+    for (size_t i = 0; i < meshes.size(); i++) {
+        const MeshCache::MeshData data = reader.mesh(i);
+        if (data.material_id >= materials.size() || !unpackMaterial(materials[data.material_id], meshes[i].material)) return false;
+        if (data.count[MeshCache::INDEX] % 3) return false;
+
+        /*! the streams are laid out exactly like the mesh vectors, so every stream is a single copy out of the mapping */
+        assignStream(meshes[i].positions, data, MeshCache::POSITION);
+        assignStream(meshes[i].normals,   data, MeshCache::NORMAL);
+        assignStream(meshes[i].texcoords, data, MeshCache::TEXCOORD);
+        assignStream(meshes[i].triangles, data, MeshCache::INDEX);
+    }
+
+    model.swap(meshes);
+    return true;
+}
+
+bool saveCache( const std::string& fileName, const std::vector<Mesh>& model ) {
+
+    std::vector<MeshCache::MeshData> meshes(model.size());
+    std::vector<MeshCache::Material> materials(model.size());
+    std::vector<Vec3f> points;
+    for (size_t i = 0; i < model.size(); i++) {
+        const Mesh &mesh = model[i];
+        meshes[i].set(MeshCache::POSITION, mesh.positions.empty() ? NULL : &mesh.positions[0], mesh.positions.size());
+        meshes[i].set(MeshCache::NORMAL,   mesh.normals.empty()   ? NULL : &mesh.normals[0],   mesh.normals.size());
+        meshes[i].set(MeshCache::TEXCOORD, mesh.texcoords.empty() ? NULL : &mesh.texcoords[0], mesh.texcoords.size());
+        meshes[i].set(MeshCache::INDEX,    mesh.triangles.empty() ? NULL : &mesh.triangles[0], 3 * mesh.triangles.size());
+        meshes[i].material_id = (uint32_t) i;
+        MeshCache::boundingSphere(meshes[i].floats(MeshCache::POSITION), mesh.positions.size(), meshes[i].sphere);
+        materials[i] = packMaterial(mesh.material);
+        points.insert(points.end(), mesh.positions.begin(), mesh.positions.end());
+    }
+
+    float sphere[4];
+    MeshCache::boundingSphere(points.empty() ? NULL : &points[0].x, points.size(), sphere);
+    return MeshCache::write(fileName, cacheTag, meshes, materials, sphere, MeshCache::materialLibraries(fileName));
+}
+
+}
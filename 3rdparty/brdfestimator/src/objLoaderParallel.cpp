@@ -0,0 +1,328 @@
+//
+//  objLoaderParallel.cpp
+//
+//  memory-mapped OBJ parser : the file is split into line-aligned chunks that are
+//  parsed in parallel, then every face group is assembled into a mesh in parallel
+//
+
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <unordered_map>
+#include "objLoader.h"
+#include "mappedfile.h"
+
+#define USE_TBB
+
+#ifdef USE_TBB
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <tbb/task_scheduler_init.h>
+#endif
+
+namespace ObjLoader {
+
+namespace {
+
+/*! usemtl statement, recorded at the position it occurs in the chunk's face stream */
+struct MaterialMark {
+    size_t corner;           /*! number of triangle corners emitted before this statement */
+    size_t faces;            /*! number of faces parsed before this statement */
+    std::string name;
+};
+
+/*! parse state and output of one line-aligned chunk */
+struct Chunk {
+    const char *begin, *end;
+    size_t nv, nvn, nvt;                 /*! number of v, vn, vt statements in this chunk */
+    size_t faces;                        /*! number of face statements */
+    std::vector<Vec3i> corners;          /*! fan-triangulated face corners, 3 per triangle */
+    std::vector<MaterialMark> marks;
+    std::vector<std::string> libraries;  /*! mtllib statements */
+};
+
+/*! contiguous run of corners from one chunk that belongs to a face group */
+struct Span { size_t chunk, begin, end; };
+
+struct FaceGroup {
+    std::vector<Span> spans;
+    size_t faces;
+    Material material;
+};
+
+struct Vec3iHash {
+    size_t operator()(const Vec3i &v) const {
+        size_t h = (size_t) (uint32_t) v.i * 73856093u;
+        h ^= (size_t) (uint32_t) v.j * 19349663u;
+        h ^= (size_t) (uint32_t) v.k * 83492791u;
+        return h;
+    }
+};
+
+struct Vec3iEqual {
+    bool operator()(const Vec3i &a, const Vec3i &b) const {
+        return a.i == b.i && a.j == b.j && a.k == b.k;
+    }
+};
+
+static inline bool isBlank(const char c) { return c == ' ' || c == '\t'; }
+
+static inline const char* skipBlank(const char *p, const char *end) {
+    while (p < end && isBlank(*p)) p++;
+    return p;
+}
+
+static inline const char* lineEnd(const char *p, const char *end) {
+    const char *e = (const char*) memchr(p, '\n', end - p);
+    return e ? e : end;
+}
+
+/*! parse a decimal integer, returns false if no digit was found */
+static inline bool parseInt(const char *&p, const char *end, int &value) {
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+')) neg = (*p++ == '-');
+    if (p >= end || *p < '0' || *p > '9') return false;
+    int v = 0;
+    while (p < end && *p >= '0' && *p <= '9') v = v * 10 + (*p++ - '0');
+    value = neg ? -v : v;
+    return true;
+}
+
+/*! parse a floating point value in the style of from_chars : no locale, no allocation */
+static inline float parseFloat(const char *&p, const char *end) {
+    static const double pow10[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    p = skipBlank(p, end);
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+')) neg = (*p++ == '-');
+
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); digits++; } else exponent++;
+        p++;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); digits++; exponent--; }
+            p++;
+        }
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char *q = p + 1;
+        int e;
+        if (parseInt(q, end, e)) { exponent += e; p = q; }
+    }
+
+    double value = (double) mantissa;
+    if (exponent < 0) value = (exponent >= -22) ? value / pow10[-exponent] : value * pow(10.0, exponent);
+    else if (exponent > 0) value = (exponent <= 22) ? value * pow10[exponent] : value * pow(10.0, exponent);
+    return (float) (neg ? -value : value);
+}
+
+/*! keyword at the start of a line, must be followed by whitespace or the end of line */
+static inline bool keyword(const char *p, const char *end, const char *word, const size_t length) {
+    return (size_t) (end - p) >= length && !memcmp(p, word, length) && (p + length == end || isBlank(p[length]) || p[length] == '\r');
+}
+
+/*! read a whitespace delimited name */
+static inline std::string parseName(const char *p, const char *end) {
+    p = skipBlank(p, end);
+    const char *q = p;
+    while (q < end && !isBlank(*q) && *q != '\r') q++;
+    return std::string(p, q);
+}
+
+/*! resolve an OBJ index the same way OBJLoader::loadFace does */
+static inline int resolveIndex(const int index, const size_t count) {
+    return (index > 0) ? index - 1 : (index == 0 ? 0 : (int) count + index);
+}
+
+/*! first pass : count vertex attribute statements so that the second pass knows the global offsets */
+static void countChunk(Chunk &chunk) {
+    chunk.nv = chunk.nvn = chunk.nvt = 0;
+    for (const char *p = chunk.begin; p < chunk.end; ) {
+        const char *e = lineEnd(p, chunk.end);
+        const char *q = skipBlank(p, e);
+        if (q < e && *q == 'v') {
+            if (keyword(q, e, "v", 1)) chunk.nv++;
+            else if (keyword(q, e, "vn", 2)) chunk.nvn++;
+            else if (keyword(q, e, "vt", 2)) chunk.nvt++;
+        }
+        p = e + 1;
+    }
+}
+
+/*! second pass : parse attributes into the global arrays at the chunk's offsets and collect faces */
+static void parseChunk(Chunk &chunk, size_t iv, size_t ivn, size_t ivt,
+                       std::vector<Vec3f> &v, std::vector<Vec3f> &vn, std::vector<Vec2f> &vt) {
+    std::vector<Vec3i> face;
+    chunk.faces = 0;
+    for (const char *p = chunk.begin; p < chunk.end; ) {
+        const char *e = lineEnd(p, chunk.end);
+        const char *q = skipBlank(p, e);
+        p = e + 1;
+        if (q >= e) continue;
+
+        if (keyword(q, e, "v", 1)) {
+            q += 1;
+            Vec3f &value = v[iv++];
+            value.x = parseFloat(q, e);  value.y = parseFloat(q, e);  value.z = parseFloat(q, e);
+        } else if (keyword(q, e, "vn", 2)) {
+            q += 2;
+            Vec3f &value = vn[ivn++];
+            value.x = parseFloat(q, e);  value.y = parseFloat(q, e);  value.z = parseFloat(q, e);
+        } else if (keyword(q, e, "vt", 2)) {
+            q += 2;
+            Vec2f &value = vt[ivt++];
+            value.x = parseFloat(q, e);  value.y = parseFloat(q, e);
+        } else if (keyword(q, e, "f", 1)) {
+            q += 1;
+            face.clear();
+            for (q = skipBlank(q, e); q < e && *q != '\r'; q = skipBlank(q, e)) {
+                Vec3i vertex;  vertex.i = -1, vertex.j = -1, vertex.k = -1;
+                int index;
+                if (!parseInt(q, e, index)) break;
+                vertex.i = resolveIndex(index, iv);
+                if (q < e && *q == '/') {
+                    q++;
+                    if (q < e && *q != '/') { if (parseInt(q, e, index)) vertex.k = resolveIndex(index, ivt); }
+                    if (q < e && *q == '/') { q++; if (parseInt(q, e, index)) vertex.j = resolveIndex(index, ivn); }
+                }
+                face.push_back(vertex);
+                while (q < e && !isBlank(*q) && *q != '\r') q++;
+            }
+            for (size_t j = 1, k = 2; k < face.size(); j++, k++) {
+                chunk.corners.push_back(face[0]);
+                chunk.corners.push_back(face[j]);
+                chunk.corners.push_back(face[k]);
+            }
+            chunk.faces++;
+        } else if (keyword(q, e, "usemtl", 6)) {
+            MaterialMark mark;
+            mark.corner = chunk.corners.size();
+            mark.faces = chunk.faces;
+            mark.name = parseName(q + 6, e);
+            chunk.marks.push_back(mark);
+        } else if (keyword(q, e, "mtllib", 6)) {
+            chunk.libraries.push_back(parseName(q + 6, e));
+        }
+    }
+}
+
+template< typename F >
+static void parallelRange(const size_t n, const F &f) {
+#ifdef USE_TBB
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, n), [&](const tbb::blocked_range<size_t> &range) {
+        for (size_t i = range.begin(); i < range.end(); i++) f(i);
+    }, tbb::simple_partitioner());
+#else
+    for (size_t i = 0; i < n; i++) f(i);
+#endif
+}
+
+}
+
+ParallelOBJLoader::ParallelOBJLoader( const std::string& _path, const std::string& filename ) : OBJLoader( _path ) {
+
+    MappedFile file(filename);
+    if (!file.valid()) std::cerr << " ERROR : unable to open " << filename << "\n", exit( 1 );
+
+    /*! split the file into line-aligned chunks, a few per worker thread */
+#ifdef USE_TBB
+    const size_t workers = (size_t) tbb::task_scheduler_init::default_num_threads();
+#else
+    const size_t workers = 1;
+#endif
+    const size_t minChunk = 1 << 20;
+    const size_t nchunk = std::max<size_t>(1, std::min<size_t>(4 * workers, file.size / minChunk));
+    std::vector<Chunk> chunks(nchunk);
+    const char *fileEnd = file.data + file.size;
+    const char *cursor = file.data;
+    for (size_t c = 0; c < nchunk; c++) {
+        const char *end = (c + 1 == nchunk) ? fileEnd : std::max(cursor, file.data + file.size / nchunk * (c + 1));
+        if (end < fileEnd) end = lineEnd(end, fileEnd) + 1;
+        chunks[c].begin = cursor;
+        chunks[c].end = std::min(end, fileEnd);
+        cursor = chunks[c].end;
+    }
+
+    /*! count attributes per chunk and compute the global offsets */
+    parallelRange(nchunk, [&](const size_t c) { countChunk(chunks[c]); });
+    std::vector<size_t> baseV(nchunk + 1, 0), baseVN(nchunk + 1, 0), baseVT(nchunk + 1, 0);
+    for (size_t c = 0; c < nchunk; c++) {
+        baseV[c + 1]  = baseV[c]  + chunks[c].nv;
+        baseVN[c + 1] = baseVN[c] + chunks[c].nvn;
+        baseVT[c + 1] = baseVT[c] + chunks[c].nvt;
+    }
+    v.resize(baseV[nchunk]);
+    vn.resize(baseVN[nchunk]);
+    vt.resize(baseVT[nchunk]);
+
+    parallelRange(nchunk, [&](const size_t c) { parseChunk(chunks[c], baseV[c], baseVN[c], baseVT[c], v, vn, vt); });
+
+    /*! load material libraries before any group looks up its material */
+    for (size_t c = 0; c < nchunk; c++)
+        for (size_t l = 0; l < chunks[c].libraries.size(); l++) loadMTL(path + chunks[c].libraries[l]);
+
+    /*! split the face stream into groups at usemtl statements, as OBJLoader::flushFaceGroup does */
+    std::vector<FaceGroup> groups;
+    FaceGroup current;  current.faces = 0;
+    std::string materialName = "default";
+    for (size_t c = 0; c < nchunk; c++) {
+        size_t corner = 0, faces = 0;
+        for (size_t m = 0; m <= chunks[c].marks.size(); m++) {
+            const bool last = (m == chunks[c].marks.size());
+            const size_t markCorner = last ? chunks[c].corners.size() : chunks[c].marks[m].corner;
+            const size_t markFaces  = last ? chunks[c].faces : chunks[c].marks[m].faces;
+            if (markCorner > corner) { Span span = { c, corner, markCorner };  current.spans.push_back(span); }
+            current.faces += markFaces - faces;
+            corner = markCorner;  faces = markFaces;
+            if (last) break;
+            if (current.faces) { current.material = materials[materialName];  groups.push_back(current); }
+            current.spans.clear();  current.faces = 0;
+            materialName = chunks[c].marks[m].name;
+        }
+    }
+    if (current.faces) { current.material = materials[materialName];  groups.push_back(current); }
+
+    /*! build every mesh in parallel, deduplicating vertices with a hash map */
+    model.resize(groups.size());
+    parallelRange(groups.size(), [&](const size_t g) {
+        Mesh &mesh = model[g];
+        mesh.material = groups[g].material;
+        size_t ncorner = 0;
+        for (size_t s = 0; s < groups[g].spans.size(); s++) ncorner += groups[g].spans[s].end - groups[g].spans[s].begin;
+        mesh.triangles.reserve(ncorner / 3);
+
+        std::unordered_map<Vec3i, uint32_t, Vec3iHash, Vec3iEqual> vertexMap;
+        vertexMap.reserve(ncorner / 2 + 1);
+        for (size_t s = 0; s < groups[g].spans.size(); s++) {
+            const Span &span = groups[g].spans[s];
+            const std::vector<Vec3i> &corners = chunks[span.chunk].corners;
+            for (size_t i = span.begin; i < span.end; i += 3) {
+                int index[3];
+                for (int n = 0; n < 3; n++) {
+                    const Vec3i &vertex = corners[i + n];
+                    std::pair<std::unordered_map<Vec3i, uint32_t, Vec3iHash, Vec3iEqual>::iterator, bool> entry = vertexMap.insert(std::make_pair(vertex, 0u));
+                    if (entry.second) {
+                        if (vertex.i >= 0) mesh.positions.push_back(v[vertex.i]);
+                        if (vertex.j >= 0) mesh.normals.push_back(vn[vertex.j]);
+                        if (vertex.k >= 0) mesh.texcoords.push_back(vt[vertex.k]);
+                        entry.first->second = int(mesh.positions.size()) - 1;
+                    }
+                    index[n] = entry.first->second;
+                }
+                Vec3i triangle;  triangle.i = index[0];  triangle.j = index[1];  triangle.k = index[2];
+                mesh.triangles.push_back(triangle);
+            }
+        }
+        fixMesh(mesh);
+    });
+
+}
+
+}
@@ -0,0 +1,178 @@
+#ifndef _OCTENVMAP_H_
+#define _OCTENVMAP_H_
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <xmmintrin.h>
+#include <smmintrin.h>
+#include "vec3.h"
+#include "col3.h"
+#include "image.h"
+
+/**
+ * @class OctEnvMap
+ * @brief environment map resampled onto an octahedral parameterization ( y is the pole axis ) with a mip chain.
+ *        direction to texel is a handful of abs / mul / select without any trigonometry or branch,
+ *        and every level keeps a one texel border folded across the octahedron edges so bilinear taps never wrap.
+ */
+class OctEnvMap {
+public:
+
+    /**
+     * @fn OctEnvMap( const int resolution, const F& radiance )
+     * @brief resolution is rounded up to a power of two, radiance( const vec3& w ) gives the value at each texel center
+     */
+    template< typename F >
+    OctEnvMap( const int resolution, const F& radiance )
+    {
+        int n = 1;
+        while( n < resolution ) n *= 2;
+
+        levels_.emplace_back( new image( n + 2, n + 2 ) );
+        image& top = *levels_[ 0 ];
+        for( int j = 0; j < n; j++ ) {
+            for( int i = 0; i < n; i++ ) {
+                top( i + 1, j + 1 ) = radiance( decode( ( i + 0.5f ) / n * 2.f - 1.f, ( j + 0.5f ) / n * 2.f - 1.f ) );
+            }
+        }
+        fill_border( top, n );
+
+        //box filtered mip chain down to a single texel
+        for( int m = n / 2; m >= 1; m /= 2 ) {
+            const image& src = *levels_.back();
+            std::unique_ptr< image > dst( new image( m + 2, m + 2 ) );
+            for( int j = 0; j < m; j++ ) {
+                for( int i = 0; i < m; i++ ) {
+                    ( *dst )( i + 1, j + 1 ) = ( src( 2 * i + 1, 2 * j + 1 ) + src( 2 * i + 2, 2 * j + 1 ) + src( 2 * i + 1, 2 * j + 2 ) + src( 2 * i + 2, 2 * j + 2 ) ) * 0.25f;
+                }
+            }
+            fill_border( *dst, m );
+            levels_.push_back( std::move( dst ) );
+        }
+    }
+
+    int resolution( void ) const
+    {
+        return levels_[ 0 ]->w() - 2;
+    }
+
+    int levels( void ) const
+    {
+        return ( int ) levels_.size();
+    }
+
+    /**
+     * @fn col3 lookup( const vec3& w, const int level = 0 ) const
+     * @brief bilinear lookup of direction w ( not necessarily normalized ) at the given mip level
+     */
+    col3 lookup( const vec3& w, const int level = 0 ) const
+    {
+        const image& img = *levels_[ std::min( std::max( level, 0 ), levels() - 1 ) ];
+        const float n = ( float ) ( img.w() - 2 );
+        const float inv = 1.f / ( fabsf( w.x ) + fabsf( w.y ) + fabsf( w.z ) );
+        const float nx = w.x * inv;
+        const float ny = w.y * inv;
+        const float nz = w.z * inv;
+        //lower hemisphere is folded over the diagonals, the select compiles to a blend
+        const float fu = copysign( 1.f - fabsf( nz ), nx );
+        const float fv = copysign( 1.f - fabsf( nx ), nz );
+        const float u = ( ny < 0.f ) ? fu : nx;
+        const float v = ( ny < 0.f ) ? fv : nz;
+        //storage coordinates : the border shifts texel centers to i + 1.5, so x = s + 0.5
+        const float x = std::min( std::max( ( u * 0.5f + 0.5f ) * n + 0.5f, 0.f ), n + 0.999f );
+        const float y = std::min( std::max( ( v * 0.5f + 0.5f ) * n + 0.5f, 0.f ), n + 0.999f );
+        const int x0 = ( int ) x;
+        const int y0 = ( int ) y;
+        const float tx = x - x0;
+        const float ty = y - y0;
+        return ( img( x0, y0 ) * ( 1.f - tx ) + img( x0 + 1, y0 ) * tx ) * ( 1.f - ty ) + ( img( x0, y0 + 1 ) * ( 1.f - tx ) + img( x0 + 1, y0 + 1 ) * tx ) * ty;
+    }
+
+    /**
+     * @fn void lookup8( const vec3 w[ 8 ], col3 rad[ 8 ], const int level = 0 ) const
+     * @brief 8 directions at once, the mapping runs on SoA registers 4 lanes at a time and only the texel fetches are per lane
+     */
+    void lookup8( const vec3 w[ 8 ], col3 rad[ 8 ], const int level = 0 ) const
+    {
+        const image& img = *levels_[ std::min( std::max( level, 0 ), levels() - 1 ) ];
+        const __m128 n = _mm_set1_ps( ( float ) ( img.w() - 2 ) );
+        const __m128 hi = _mm_add_ps( n, _mm_set1_ps( 0.999f ) );
+        const __m128 half = _mm_set1_ps( 0.5f );
+        const __m128 one = _mm_set1_ps( 1.f );
+        const __m128 sign = _mm_set1_ps( -0.f );
+
+        for( int b = 0; b < 8; b += 4 ) {
+            //transpose 4 AoS vectors into x, y, z registers
+            __m128 r0 = w[ b ].v, r1 = w[ b + 1 ].v, r2 = w[ b + 2 ].v, r3 = w[ b + 3 ].v;
+            _MM_TRANSPOSE4_PS( r0, r1, r2, r3 );
+            const __m128 inv = _mm_div_ps( one, _mm_add_ps( _mm_add_ps( _mm_andnot_ps( sign, r0 ), _mm_andnot_ps( sign, r1 ) ), _mm_andnot_ps( sign, r2 ) ) );
+            const __m128 nx = _mm_mul_ps( r0, inv );
+            const __m128 ny = _mm_mul_ps( r1, inv );
+            const __m128 nz = _mm_mul_ps( r2, inv );
+            const __m128 fu = _mm_or_ps( _mm_sub_ps( one, _mm_andnot_ps( sign, nz ) ), _mm_and_ps( nx, sign ) );
+            const __m128 fv = _mm_or_ps( _mm_sub_ps( one, _mm_andnot_ps( sign, nx ) ), _mm_and_ps( nz, sign ) );
+            const __m128 lower = _mm_cmplt_ps( ny, _mm_setzero_ps() );
+            const __m128 u = _mm_blendv_ps( nx, fu, lower );
+            const __m128 v = _mm_blendv_ps( nz, fv, lower );
+            const __m128 x = _mm_min_ps( _mm_max_ps( _mm_add_ps( _mm_mul_ps( _mm_add_ps( _mm_mul_ps( u, half ), half ), n ), half ), _mm_setzero_ps() ), hi );
+            const __m128 y = _mm_min_ps( _mm_max_ps( _mm_add_ps( _mm_mul_ps( _mm_add_ps( _mm_mul_ps( v, half ), half ), n ), half ), _mm_setzero_ps() ), hi );
+            const __m128 xf = _mm_floor_ps( x );
+            const __m128 yf = _mm_floor_ps( y );
+
+            __declspec( align( 16 ) ) int xi[ 4 ], yi[ 4 ];
+            __declspec( align( 16 ) ) float tx[ 4 ], ty[ 4 ];
+            _mm_store_si128( ( __m128i* ) xi, _mm_cvttps_epi32( xf ) );
+            _mm_store_si128( ( __m128i* ) yi, _mm_cvttps_epi32( yf ) );
+            _mm_store_ps( tx, _mm_sub_ps( x, xf ) );
+            _mm_store_ps( ty, _mm_sub_ps( y, yf ) );
+
+            for( int k = 0; k < 4; k++ ) {
+                const int x0 = xi[ k ], y0 = yi[ k ];
+                rad[ b + k ] = ( img( x0, y0 ) * ( 1.f - tx[ k ] ) + img( x0 + 1, y0 ) * tx[ k ] ) * ( 1.f - ty[ k ] ) + ( img( x0, y0 + 1 ) * ( 1.f - tx[ k ] ) + img( x0 + 1, y0 + 1 ) * tx[ k ] ) * ty[ k ];
+            }
+        }
+    }
+
+    /**
+     * @fn static vec3 decode( const float u, const float v )
+     * @brief octahedral coordinates in [ -1, 1 ]^2 to unit direction
+     */
+    static vec3 decode( const float u, const float v )
+    {
+        float x = u;
+        float z = v;
+        const float y = 1.f - fabsf( u ) - fabsf( v );
+        if( y < 0.f ) {
+            x = copysign( 1.f - fabsf( v ), u );
+            z = copysign( 1.f - fabsf( u ), v );
+        }
+        const float inorm = 1.f / sqrtf( x * x + y * y + z * z );
+        return vec3( x * inorm, y * inorm, z * inorm );
+    }
+
+private:
+
+    /**
+     * @fn static void fill_border( image& img, const int n )
+     * @brief the octahedron edges are mirrored about their midpoints and the four corners all meet at the lower pole
+     */
+    static void fill_border( image& img, const int n )
+    {
+        for( int i = 0; i < n; i++ ) {
+            img( i + 1, 0 )     = img( n - i, 1 );
+            img( i + 1, n + 1 ) = img( n - i, n );
+            img( 0, i + 1 )     = img( 1, n - i );
+            img( n + 1, i + 1 ) = img( n, n - i );
+        }
+        img( 0, 0 )         = img( n, n );
+        img( n + 1, 0 )     = img( 1, n );
+        img( 0, n + 1 )     = img( n, 1 );
+        img( n + 1, n + 1 ) = img( 1, 1 );
+    }
+
+    std::vector< std::unique_ptr< image > > levels_;
+
+};
+
+#endif
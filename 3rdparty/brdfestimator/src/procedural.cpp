@@ -0,0 +1,274 @@
+//
+//  procedural.cpp
+//
+
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include <algorithm>
+#include "procedural.h"
+#include "rng.h"
+
+#define USE_TBB
+
+#ifdef USE_TBB
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#endif
+
+namespace Procedural {
+
+static const float PI = ( float ) M_PI;
+
+/**
+ * @fn static void parallel_range( const int n, const F& f )
+ * @brief call f( i ) for i in [ 0, n ), in parallel when TBB is enabled
+ */
+template< typename F >
+static void parallel_range( const int n, const F& f )
+{
+#ifdef USE_TBB
+    tbb::parallel_for( tbb::blocked_range< int >( 0, n ), [&]( const tbb::blocked_range< int >& range ) {
+        for( int i = range.begin(); i < range.end(); i++ ) f( i );
+    } );
+#else
+    for( int i = 0; i < n; i++ ) f( i );
+#endif
+}
+
+static inline ObjLoader::Vec3f make_vec3f( const float x, const float y, const float z )
+{
+    ObjLoader::Vec3f v; v.x = x; v.y = y; v.z = z;
+    return v;
+}
+
+static inline ObjLoader::Vec3i make_vec3i( const int i, const int j, const int k )
+{
+    ObjLoader::Vec3i t; t.i = i; t.j = j; t.k = k;
+    return t;
+}
+
+/**
+ * @fn static ObjLoader::Mesh ground_plane( const float size )
+ * @brief single quad at y = 0 facing +y
+ */
+static ObjLoader::Mesh ground_plane( const float size )
+{
+    const float h = 0.5f * size;
+    ObjLoader::Mesh mesh;
+    mesh.positions.push_back( make_vec3f( - h, 0.f, - h ) );
+    mesh.positions.push_back( make_vec3f(   h, 0.f, - h ) );
+    mesh.positions.push_back( make_vec3f( - h, 0.f,   h ) );
+    mesh.positions.push_back( make_vec3f(   h, 0.f,   h ) );
+    mesh.normals.assign( 4, make_vec3f( 0.f, 1.f, 0.f ) );
+    mesh.triangles.push_back( make_vec3i( 0, 2, 1 ) );
+    mesh.triangles.push_back( make_vec3i( 1, 2, 3 ) );
+    return mesh;
+}
+
+/**
+ * @fn std::vector< ObjLoader::Mesh > bumpField( const Params& param )
+ * @brief h( x, z ) = height * sum_k exp( - d_k^2 / 2s^2 ) with d_k the periodic distance to the k-th center
+ */
+std::vector< ObjLoader::Mesh > bumpField( const Params& param )
+{
+    const int n = std::max( 1, param.resolution );
+    const int nv = n + 1;
+    const int count = std::max( 1, param.count );
+    const float size = param.size;
+    const float sigma = 0.5f * size / sqrtf( ( float ) count );
+    const float inv2s2 = 1.f / ( 2.f * sigma * sigma );
+
+    Rng rng( param.seed );
+    std::vector< float > cx( count ), cz( count );
+    for( int k = 0; k < count; k++ ) {
+        cx[ k ] = ( rng.getFloat() - 0.5f ) * size;
+        cz[ k ] = ( rng.getFloat() - 0.5f ) * size;
+    }
+
+    ObjLoader::Mesh mesh;
+    mesh.positions.resize( nv * nv );
+    mesh.normals.resize( nv * nv );
+    mesh.triangles.resize( 2 * n * n );
+
+    //one row of vertices per task
+    parallel_range( nv, [&]( const int j ) {
+        const float z = ( ( float ) j / ( float ) n - 0.5f ) * size;
+        for( int i = 0; i < nv; i++ ) {
+            const float x = ( ( float ) i / ( float ) n - 0.5f ) * size;
+            float h = 0.f, dhdx = 0.f, dhdz = 0.f;
+            for( int k = 0; k < count; k++ ) {
+                float dx = x - cx[ k ];
+                float dz = z - cz[ k ];
+                dx -= size * floorf( dx / size + 0.5f );
+                dz -= size * floorf( dz / size + 0.5f );
+                const float g = param.height * expf( - ( dx * dx + dz * dz ) * inv2s2 );
+                h    += g;
+                dhdx -= 2.f * inv2s2 * dx * g;
+                dhdz -= 2.f * inv2s2 * dz * g;
+            }
+            const float inorm = 1.f / sqrtf( dhdx * dhdx + 1.f + dhdz * dhdz );
+            mesh.positions[ j * nv + i ] = make_vec3f( x, h, z );
+            mesh.normals[ j * nv + i ]   = make_vec3f( - dhdx * inorm, inorm, - dhdz * inorm );
+        }
+    } );
+
+    parallel_range( n, [&]( const int j ) {
+        for( int i = 0; i < n; i++ ) {
+            const int v00 = j * nv + i;
+            const int v10 = v00 + 1;
+            const int v01 = v00 + nv;
+            const int v11 = v01 + 1;
+            mesh.triangles[ 2 * ( j * n + i )     ] = make_vec3i( v00, v01, v10 );
+            mesh.triangles[ 2 * ( j * n + i ) + 1 ] = make_vec3i( v10, v01, v11 );
+        }
+    } );
+
+    std::vector< ObjLoader::Mesh > model;
+    model.push_back( mesh );
+    return model;
+}
+
+/**
+ * @fn std::vector< ObjLoader::Mesh > fibers( const Params& param )
+ * @brief fibers are stratified along z and jittered without overlapping when they fit
+ */
+std::vector< ObjLoader::Mesh > fibers( const Params& param )
+{
+    const int count = std::max( 1, param.count );
+    const int slices = std::max( 8, param.resolution );
+    const float size = param.size;
+    const float r = param.height;
+    const float spacing = size / ( float ) count;
+    const float jitter = std::max( 0.f, spacing - 2.f * r );
+
+    Rng rng( param.seed );
+    std::vector< float > cz( count );
+    for( int k = 0; k < count; k++ ) {
+        cz[ k ] = - 0.5f * size + k * spacing + 0.5f * ( spacing - jitter ) + jitter * rng.getFloat();
+    }
+
+    //each fiber is a ring of slices + 1 vertices at both ends ( seam duplicated )
+    const int vpf = 2 * ( slices + 1 );
+    const int tpf = 2 * slices;
+    ObjLoader::Mesh mesh;
+    mesh.positions.resize( count * vpf );
+    mesh.normals.resize( count * vpf );
+    mesh.triangles.resize( count * tpf );
+
+    parallel_range( count, [&]( const int k ) {
+        const int voff = k * vpf;
+        const int toff = k * tpf;
+        for( int s = 0; s <= slices; s++ ) {
+            const float a = 2.f * PI * s / ( float ) slices;
+            const float ny = cosf( a );
+            const float nz = sinf( a );
+            for( int e = 0; e < 2; e++ ) {
+                const float x = ( e - 0.5f ) * size;
+                mesh.positions[ voff + e * ( slices + 1 ) + s ] = make_vec3f( x, r + r * ny, cz[ k ] + r * nz );
+                mesh.normals[ voff + e * ( slices + 1 ) + s ]   = make_vec3f( 0.f, ny, nz );
+            }
+        }
+        for( int s = 0; s < slices; s++ ) {
+            const int a = voff + s;
+            const int b = a + 1;
+            const int c = a + slices + 1;
+            const int d = c + 1;
+            mesh.triangles[ toff + 2 * s     ] = make_vec3i( a, b, c );
+            mesh.triangles[ toff + 2 * s + 1 ] = make_vec3i( c, b, d );
+        }
+    } );
+
+    std::vector< ObjLoader::Mesh > model;
+    model.push_back( ground_plane( size ) );
+    model.push_back( mesh );
+    return model;
+}
+
+/**
+ * @fn std::vector< ObjLoader::Mesh > spherePack( const Params& param )
+ * @brief spheres are placed by dart throwing inside the patch, so fewer than count may be generated
+ */
+std::vector< ObjLoader::Mesh > spherePack( const Params& param )
+{
+    const int count = std::max( 1, param.count );
+    const int slices = std::max( 8, param.resolution );
+    const int stacks = std::max( 4, slices / 2 );
+    const float size = param.size;
+    const float r = std::min( param.height, 0.5f * size );
+    const float range = size - 2.f * r;
+    const float mind2 = 4.f * r * r;
+
+    Rng rng( param.seed );
+    std::vector< float > cx, cz;
+    cx.reserve( count );
+    cz.reserve( count );
+    for( int attempt = 0, n = 100 * count; attempt < n && ( int ) cx.size() < count; attempt++ ) {
+        const float x = ( rng.getFloat() - 0.5f ) * range;
+        const float z = ( rng.getFloat() - 0.5f ) * range;
+        bool overlap = false;
+        for( size_t k = 0; k < cx.size() && !overlap; k++ ) {
+            overlap = ( ( x - cx[ k ] ) * ( x - cx[ k ] ) + ( z - cz[ k ] ) * ( z - cz[ k ] ) < mind2 );
+        }
+        if( !overlap ) {
+            cx.push_back( x );
+            cz.push_back( z );
+        }
+    }
+    if( ( int ) cx.size() < count ) {
+        std::cout << "spherePack : placed " << cx.size() << " of " << count << " spheres\n";
+    }
+
+    //the pole rows keep one triangle per slice to avoid degenerate triangles
+    const int nsphere = ( int ) cx.size();
+    const int vps = ( stacks + 1 ) * ( slices + 1 );
+    const int tps = slices * ( 2 * stacks - 2 );
+    ObjLoader::Mesh mesh;
+    mesh.positions.resize( nsphere * vps );
+    mesh.normals.resize( nsphere * vps );
+    mesh.triangles.resize( nsphere * tps );
+
+    parallel_range( nsphere, [&]( const int k ) {
+        const int voff = k * vps;
+        int tid = k * tps;
+        for( int t = 0; t <= stacks; t++ ) {
+            const float th = PI * t / ( float ) stacks;
+            for( int s = 0; s <= slices; s++ ) {
+                const float ph = 2.f * PI * s / ( float ) slices;
+                const float nx = sinf( th ) * cosf( ph );
+                const float ny = cosf( th );
+                const float nz = sinf( th ) * sinf( ph );
+                mesh.positions[ voff + t * ( slices + 1 ) + s ] = make_vec3f( cx[ k ] + r * nx, r + r * ny, cz[ k ] + r * nz );
+                mesh.normals[ voff + t * ( slices + 1 ) + s ]   = make_vec3f( nx, ny, nz );
+            }
+        }
+        for( int t = 0; t < stacks; t++ ) {
+            for( int s = 0; s < slices; s++ ) {
+                const int a = voff + t * ( slices + 1 ) + s;
+                const int b = a + 1;
+                const int c = a + slices + 1;
+                const int d = c + 1;
+                if( t != 0 )          mesh.triangles[ tid++ ] = make_vec3i( a, b, c );
+                if( t != stacks - 1 ) mesh.triangles[ tid++ ] = make_vec3i( c, b, d );
+            }
+        }
+    } );
+
+    std::vector< ObjLoader::Mesh > model;
+    model.push_back( ground_plane( size ) );
+    if( nsphere > 0 ) model.push_back( mesh );
+    return model;
+}
+
+std::vector< ObjLoader::Mesh > generate( const std::string& type, const Params& param )
+{
+    if( type == std::string( "bump" ) ) {
+        return bumpField( param );
+    } else if( type == std::string( "fiber" ) ) {
+        return fibers( param );
+    } else if( type == std::string( "sphere" ) ) {
+        return spherePack( param );
+    }
+    return std::vector< ObjLoader::Mesh >();
+}
+
+}
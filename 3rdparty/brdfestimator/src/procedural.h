@@ -0,0 +1,57 @@
+//
+//  procedural.h
+//
+//  procedural micro-geometry generators that produce ObjLoader::Mesh directly in memory
+//
+
+#ifndef _PROCEDURAL_H_
+#define _PROCEDURAL_H_
+
+#include <vector>
+#include "objLoader.h"
+
+namespace Procedural {
+
+/**
+ * @struct Params
+ * @brief parameters shared by the generators ( patch spans [ -size/2, size/2 ] on the xz-plane, y is up )
+ */
+struct Params {
+
+    Params() : size( 1.f ), resolution( 64 ), height( 0.05f ), count( 16 ), seed( 1234 ) {
+    }
+
+    float size;       //edge length of the square patch
+    int resolution;   //grid resolution of the bump field / tessellation of fibers and spheres
+    float height;     //bump amplitude, fiber radius or sphere radius
+    int count;        //number of bumps, fibers or spheres
+    int seed;         //random seed for placement
+};
+
+/**
+ * @fn std::vector< ObjLoader::Mesh > bumpField( const Params& param )
+ * @brief height field made of count gaussian bumps, periodic over the patch so it tiles seamlessly
+ */
+std::vector< ObjLoader::Mesh > bumpField( const Params& param );
+
+/**
+ * @fn std::vector< ObjLoader::Mesh > fibers( const Params& param )
+ * @brief count cylinders of radius height running along x and lying on a ground plane
+ */
+std::vector< ObjLoader::Mesh > fibers( const Params& param );
+
+/**
+ * @fn std::vector< ObjLoader::Mesh > spherePack( const Params& param )
+ * @brief count non-overlapping spheres of radius height lying on a ground plane
+ */
+std::vector< ObjLoader::Mesh > spherePack( const Params& param );
+
+/**
+ * @fn std::vector< ObjLoader::Mesh > generate( const std::string& type, const Params& param )
+ * @brief dispatch by name ( "bump", "fiber" or "sphere" ), returns an empty vector for unknown types
+ */
+std::vector< ObjLoader::Mesh > generate( const std::string& type, const Params& param );
+
+}
+
+#endif
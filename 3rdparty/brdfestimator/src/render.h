@@ -317,22 +317,31 @@ public:
                             BRDF brdf( ray, isect, scene_ );
                             col.r = 0.f; col.g = 0.f; col.b = 0.f;
                             for( int h = 0; h < height; h++ ) {
-                                for( int w = 0; w < width; w++ ) {
-                                    const float u = ( w + 0.5f ) / ( float ) width;
-                                    const float v = ( h + 0.5f ) / ( float ) height;
-                                    const float sth = sinf( v * pi );
-                                    //const col3 Li = map->img->operator()( w, h ) * sth;
-                                    const vec3 wi = map->latitude_longitude_to_vec( u, v );
-                                    const col3 Li = map->lookup( wi ) * sth;
-                                    const col3 fr = brdf.evaluate( wi, ctho );
-                                    const float cth = dot( wi, isect.normal_ ); 
-                                    //if( fabs( ctho - cth ) > 1e-5f ) std::cout << ctho << " : " << cth << "\n";
-                                    if( cth > 0.f ) {
-                                        Ray shadowray;
-                                        shadowray.o = hitpoint;
-                                        shadowray.d = wi;
-                                        if( !scene_.occlusion( shadowray ) ) {
-                                            col += Li * fr * cth;
+                                const float v = ( h + 0.5f ) / ( float ) height;
+                                const float sth = sinf( v * pi );
+                                //radiance of 8 texels per batch, the tail of a row repeats its last texel
+                                for( int w0 = 0; w0 < width; w0 += 8 ) {
+                                    vec3 wi8[ 8 ];
+                                    col3 Li8[ 8 ];
+                                    for( int k = 0; k < 8; k++ ) {
+                                        const float u = ( std::min( w0 + k, width - 1 ) + 0.5f ) / ( float ) width;
+                                        wi8[ k ] = map->latitude_longitude_to_vec( u, v );
+                                    }
+                                    map->lookup8( wi8, Li8 );
+                                    for( int k = 0; k < 8 && w0 + k < width; k++ ) {
+                                        //const col3 Li = map->img->operator()( w, h ) * sth;
+                                        const vec3& wi = wi8[ k ];
+                                        const col3 Li = Li8[ k ] * sth;
+                                        const col3 fr = brdf.evaluate( wi, ctho );
+                                        const float cth = dot( wi, isect.normal_ ); 
+                                        //if( fabs( ctho - cth ) > 1e-5f ) std::cout << ctho << " : " << cth << "\n";
+                                        if( cth > 0.f ) {
+                                            Ray shadowray;
+                                            shadowray.o = hitpoint;
+                                            shadowray.d = wi;
+                                            if( !scene_.occlusion( shadowray ) ) {
+                                                col += Li * fr * cth;
+                                            }
                                         }
                                     }
                                 }
@@ -0,0 +1,169 @@
+#ifndef _SAVE_HDR_H_
+#define _SAVE_HDR_H_
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <string.h>
+#include <smmintrin.h>
+#include "loadhdr.h"
+
+/**
+ * @fn void rgbe_planes( const float* src, const int width, const int channels, const int pixel_stride, unsigned char* planes )
+ * @brief float to rgbe for one scanline, written as four planes of width bytes ( r, g, b then e ).
+ *        the exponent and the 2^( 8 - e ) scale are taken straight from the float bits instead of frexp, 4 pixels at a time.
+ *        channels is the number of floats that may be read at each pixel ( 3 or 4 ), pixel_stride the distance between pixels
+ */
+inline void rgbe_planes( const float* src, const int width, const int channels, const int pixel_stride, unsigned char* planes )
+{
+    const __m128 tiny = _mm_set1_ps( 1e-32f );
+    const __m128i mask = _mm_set1_epi32( 0xff );
+    const __m128i bias = _mm_set1_epi32( 127 + 8 + 126 );
+
+    int j = 0;
+    for( ; j + 4 <= width; j += 4 ) {
+        __m128 px[ 4 ];
+        for( int k = 0; k < 4; k++ ) {
+            const float* p = src + ( size_t ) ( j + k ) * pixel_stride;
+            px[ k ] = ( channels == 4 ) ? _mm_loadu_ps( p ) : _mm_movelh_ps( _mm_loadl_pi( _mm_setzero_ps(), ( const __m64* ) p ), _mm_load_ss( p + 2 ) );
+        }
+        _MM_TRANSPOSE4_PS( px[ 0 ], px[ 1 ], px[ 2 ], px[ 3 ] );
+
+        //frexp exponent is the biased exponent - 126, the scale 256 / 2^e is rebuilt as float bits
+        const __m128 v = _mm_max_ps( px[ 0 ], _mm_max_ps( px[ 1 ], px[ 2 ] ) );
+        const __m128 keep = _mm_cmpge_ps( v, tiny );
+        const __m128i eb = _mm_and_si128( _mm_srli_epi32( _mm_castps_si128( v ), 23 ), mask );
+        const __m128 s = _mm_and_ps( _mm_castsi128_ps( _mm_slli_epi32( _mm_sub_epi32( bias, eb ), 23 ) ), keep );
+        const __m128i r = _mm_cvttps_epi32( _mm_mul_ps( px[ 0 ], s ) );
+        const __m128i g = _mm_cvttps_epi32( _mm_mul_ps( px[ 1 ], s ) );
+        const __m128i b = _mm_cvttps_epi32( _mm_mul_ps( px[ 2 ], s ) );
+        const __m128i e = _mm_and_si128( _mm_add_epi32( eb, _mm_set1_epi32( 2 ) ), _mm_castps_si128( keep ) );
+        const __m128i q = _mm_packus_epi16( _mm_packus_epi32( r, g ), _mm_packus_epi32( b, e ) );
+
+        __declspec( align( 16 ) ) int dw[ 4 ];
+        _mm_store_si128( ( __m128i* ) dw, q );
+        for( int c = 0; c < 4; c++ ) memcpy( planes + c * width + j, &dw[ c ], 4 );
+    }
+
+    for( ; j < width; j++ ) {
+        const float* p = src + ( size_t ) j * pixel_stride;
+        const float v = std::max( p[ 0 ], std::max( p[ 1 ], p[ 2 ] ) );
+        if( v >= 1e-32f ) {
+            int bits;
+            memcpy( &bits, &v, 4 );
+            const int eb = ( bits >> 23 ) & 0xff;
+            int sbits = ( 127 + 8 + 126 - eb ) << 23;
+            float s;
+            memcpy( &s, &sbits, 4 );
+            planes[ j ]             = ( unsigned char ) ( p[ 0 ] * s );
+            planes[ width + j ]     = ( unsigned char ) ( p[ 1 ] * s );
+            planes[ 2 * width + j ] = ( unsigned char ) ( p[ 2 ] * s );
+            planes[ 3 * width + j ] = ( unsigned char ) ( eb + 2 );
+        } else {
+            planes[ j ] = planes[ width + j ] = planes[ 2 * width + j ] = planes[ 3 * width + j ] = 0;
+        }
+    }
+}
+
+/**
+ * @fn void rle_bytes( const unsigned char* data, const int numbytes, std::vector< unsigned char >& out )
+ * @brief run length encode one channel of a scanline, same runs as the reference RGBE_WriteBytes_RLE so the files are byte identical
+ */
+inline void rle_bytes( const unsigned char* data, const int numbytes, std::vector< unsigned char >& out )
+{
+    const int minrun = 4;
+    int cur = 0;
+    while( cur < numbytes ) {
+        //find the next run of at least minrun bytes if there is one
+        int beg_run = cur;
+        int run_count = 0, old_run_count = 0;
+        while( run_count < minrun && beg_run < numbytes ) {
+            beg_run += run_count;
+            old_run_count = run_count;
+            run_count = 1;
+            while( beg_run + run_count < numbytes && run_count < 127 && data[ beg_run ] == data[ beg_run + run_count ] ) run_count++;
+        }
+        //a short run right before it is still written as a run
+        if( old_run_count > 1 && old_run_count == beg_run - cur ) {
+            out.push_back( ( unsigned char ) ( 128 + old_run_count ) );
+            out.push_back( data[ cur ] );
+            cur = beg_run;
+        }
+        while( cur < beg_run ) {
+            const int count = std::min( beg_run - cur, 128 );
+            out.push_back( ( unsigned char ) count );
+            out.insert( out.end(), data + cur, data + cur + count );
+            cur += count;
+        }
+        if( run_count >= minrun ) {
+            out.push_back( ( unsigned char ) ( 128 + run_count ) );
+            out.push_back( data[ beg_run ] );
+            cur += run_count;
+        }
+    }
+}
+
+/**
+ * @fn bool write_rgbe( const float* data, const int width, const int height, const int channels, const int pixel_stride, const int row_stride, const W& write )
+ * @brief encode all scanlines and hand them to write( const unsigned char* bytes, size_t size ) in order.
+ *        pixel ( x, y ) is read at data[ y * row_stride + x * pixel_stride ], scanlines are encoded in parallel into their own buffers
+ *        a block at a time and every block is passed to write in one call. widths the format cannot run length encode are written flat
+ */
+template< typename W >
+inline bool write_rgbe( const float* data, const int width, const int height, const int channels, const int pixel_stride, const int row_stride, const W& write )
+{
+    const bool rle = ( width >= 8 && width <= 0x7fff );
+    const int block = 256;
+    std::vector< std::vector< unsigned char > > scanlines( std::min( block, height ) );
+    std::vector< unsigned char > staging;
+
+    for( int y0 = 0; y0 < height; y0 += block ) {
+        const int n = std::min( block, height - y0 );
+        hdr_parallel_rows( n, [&]( const int begin, const int end ) {
+            std::vector< unsigned char > planes( 4 * width );
+            for( int i = begin; i < end; i++ ) {
+                std::vector< unsigned char >& out = scanlines[ i ];
+                out.clear();
+                rgbe_planes( data + ( size_t ) ( y0 + i ) * row_stride, width, channels, pixel_stride, &planes[ 0 ] );
+                if( rle ) {
+                    const unsigned char header[] = { 2, 2, ( unsigned char ) ( width >> 8 ), ( unsigned char ) ( width & 0xff ) };
+                    out.insert( out.end(), header, header + 4 );
+                    for( int c = 0; c < 4; c++ ) rle_bytes( &planes[ c * width ], width, out );
+                } else {
+                    out.resize( 4 * width );
+                    for( int j = 0; j < width; j++ ) {
+                        for( int c = 0; c < 4; c++ ) out[ 4 * j + c ] = planes[ c * width + j ];
+                    }
+                }
+            }
+        } );
+
+        staging.clear();
+        for( int i = 0; i < n; i++ ) staging.insert( staging.end(), scanlines[ i ].begin(), scanlines[ i ].end() );
+        if( !write( &staging[ 0 ], staging.size() ) ) return false;
+    }
+    return true;
+}
+
+/**
+ * @fn bool savehdr( const std::string& filename, const float* data, const int width, const int height, const int channels, const int pixel_stride, const int row_stride )
+ * @brief write a -Y height +X width run length encoded file, see write_rgbe for the pixel layout
+ */
+inline bool savehdr( const std::string& filename, const float* data, const int width, const int height, const int channels, const int pixel_stride, const int row_stride )
+{
+    std::ofstream hdr( filename, std::ios::binary );
+    if( hdr.fail() ) return false;
+
+    hdr << "#?RADIANCE" << '\n';
+    hdr << "# " << '\n';
+    hdr << "FORMAT=32-bit_rle_rgbe" << '\n' << '\n';
+    hdr << "-Y " << height << " +X " << width << '\n';
+
+    return write_rgbe( data, width, height, channels, pixel_stride, row_stride, [&]( const unsigned char* bytes, const size_t size ) {
+        hdr.write( ( const char* ) bytes, size );
+        return !hdr.fail();
+    } );
+}
+
+#endif
@@ -72,6 +72,11 @@ bool Scene::occlusion( const Ray& ray ) const
  */
 void Scene::setRTCGeometry( const std::vector< ObjLoader::Mesh >& _mesh )
 {
+    if( tile_count_ > 1 ) {
+        patch_ = rtcNewScene( RTC_SCENE_STATIC, RTC_INTERSECT1 );
+    }
+    RTCScene target = ( tile_count_ > 1 ) ? patch_ : scene_;
+
     const size_t geometry_size = _mesh.size();
     std::vector< unsigned int > geometryID;
     
@@ -81,10 +86,10 @@ void Scene::setRTCGeometry( const std::vector< ObjLoader::Mesh >& _mesh )
         const unsigned int tsize = static_cast< unsigned int >( _mesh[ i ].triangles.size() );
         const unsigned int vsize = static_cast< unsigned int >( _mesh[ i ].positions.size() );
         
-        unsigned int geomID = rtcNewTriangleMesh( scene_, RTC_GEOMETRY_STATIC, tsize, vsize );
+        unsigned int geomID = rtcNewTriangleMesh( target, RTC_GEOMETRY_STATIC, tsize, vsize );
         geometryID.push_back( geomID );
         
-        Vertex *vertex = ( Vertex* ) rtcMapBuffer( scene_, geomID, RTC_VERTEX_BUFFER );
+        Vertex *vertex = ( Vertex* ) rtcMapBuffer( target, geomID, RTC_VERTEX_BUFFER );
         
         for( unsigned int j = 0; j < vsize; j++ ) {
             vertex[ j ].x = _mesh[ i ].positions[ j ].x;
@@ -92,17 +97,49 @@ void Scene::setRTCGeometry( const std::vector< ObjLoader::Mesh >& _mesh )
             vertex[ j ].z = _mesh[ i ].positions[ j ].z;
         }
         
-        rtcUnmapBuffer( scene_, geomID, RTC_VERTEX_BUFFER );
+        rtcUnmapBuffer( target, geomID, RTC_VERTEX_BUFFER );
         
-        Triangle *triangle = ( Triangle* ) rtcMapBuffer( scene_, geomID, RTC_INDEX_BUFFER );
+        Triangle *triangle = ( Triangle* ) rtcMapBuffer( target, geomID, RTC_INDEX_BUFFER );
         for( unsigned int j = 0; j < tsize; j++ ) {
             triangle[ j ].v0 = _mesh[ i ].triangles[ j ].i;
             triangle[ j ].v1 = _mesh[ i ].triangles[ j ].j;
             triangle[ j ].v2 = _mesh[ i ].triangles[ j ].k;
         }
         
-        rtcUnmapBuffer( scene_, geomID, RTC_INDEX_BUFFER );
+        rtcUnmapBuffer( target, geomID, RTC_INDEX_BUFFER );
         
     }
+
+    if( tile_count_ > 1 ) {
+        rtcCommit( patch_ );
+        setRTCTiling();
+    }
     rtcCommit( scene_ );
+}
+
+/**
+ * @fn void Scene::setRTCTiling( void )
+ * @brief instance the sample patch in a tile_count_ x tile_count_ grid on the xz-plane
+ *        every instance shares the geometry of patch_, so geomID still indexes mesh_
+ */
+void Scene::setRTCTiling( void )
+{
+    const float sx = bbmax.x - bbmin.x;
+    const float sz = bbmax.z - bbmin.z;
+    const int half = tile_count_ / 2;
+
+    for( int i = - half; i <= half; i++ ) {
+        for( int j = - half; j <= half; j++ ) {
+            //column major 3x4 matrix : translation only
+            const float xfm[ 12 ] = {
+                1.f, 0.f, 0.f,
+                0.f, 1.f, 0.f,
+                0.f, 0.f, 1.f,
+                i * sx, 0.f, j * sz,
+            };
+            const unsigned int instID = rtcNewInstance( scene_, patch_ );
+            rtcSetTransform( scene_, instID, RTC_MATRIX_COLUMN_MAJOR, xfm );
+        }
+    }
+    std::cout << "tiling : " << tile_count_ << " x " << tile_count_ << " instances of " << sx << " x " << sz << " patch\n";
 }
\ No newline at end of file
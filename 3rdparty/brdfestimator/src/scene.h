@@ -8,10 +8,12 @@
 #include <iostream>
 #include <vector>
 #include <memory>
+#include <algorithm>
 #include "config.h"
 #include "camera.h"
 #include "ray.h"
 #include "objLoader.h"
+#include "procedural.h"
 #include "material.h"
 #include "light.h"
 #include <embree2/rtcore.h>
@@ -29,7 +31,7 @@ class Scene {
     
 public:
     
-    Scene()
+    Scene() : patch_( nullptr ), tile_count_( 1 )
     {
         rtcInit();
         scene_ = rtcNewScene( RTC_SCENE_STATIC, RTC_INTERSECT1 );
@@ -43,6 +45,7 @@ public:
     ~Scene()
     {
         rtcDeleteScene( scene_ );
+        if( patch_ != nullptr ) rtcDeleteScene( patch_ );
         rtcExit();
     }
     
@@ -66,6 +69,9 @@ public:
         background_->sphere_.center_ = vec3( 0.f, 0.f, 0.f );
         background_->sphere_.radius_ = 1e3f;
         background_->sphere_.invradius2_ = 1.f / ( background_->sphere_.radius_ * background_->sphere_.radius_ );
+        if( Config::envmap_octahedral > 0 ) {
+            background_->envmap()->build_octahedral( Config::envmap_octahedral );
+        }
     }
     
     void setCamera( void )
@@ -76,6 +82,22 @@ public:
         cameraptr_.reset( new Camera( eye, ref, fovy, Config::windowsizex, Config::windowsizey ) );
     }
     
+    /**
+     * @fn void setTiling( const int n )
+     * @brief repeat the sample patch n x n times on the xz-plane (must be called before loadObj)
+     *        n is rounded up to an odd number so that the original patch stays in the middle.
+     */
+    void setTiling( const int n )
+    {
+        tile_count_ = std::max( 1, n );
+        if( tile_count_ % 2 == 0 ) tile_count_++;
+    }
+
+    int tile_count( void ) const
+    {
+        return tile_count_;
+    }
+
     void loadObj( const char* path, const char* filename )
     {
 		mesh_ = ObjLoader::loadOBJ( path, filename );
@@ -83,6 +105,22 @@ public:
         std::cout << "bounding box : " << bbmin << " : " << bbmax << "\n";
         setRTCGeometry( mesh_ );
     }
+
+    /**
+     * @fn void loadProcedural( const std::string& type, const Procedural::Params& param )
+     * @brief generate micro-geometry in memory ( "bump", "fiber" or "sphere" ) instead of loading an obj file
+     */
+    void loadProcedural( const std::string& type, const Procedural::Params& param )
+    {
+        mesh_ = Procedural::generate( type, param );
+        if( mesh_.empty() ) {
+            std::cerr << "Unknown procedural geometry " << type << "\n";
+            exit( -1 );
+        }
+        boundingbox( mesh_, bbmin, bbmax );
+        std::cout << "bounding box : " << bbmin << " : " << bbmax << "\n";
+        setRTCGeometry( mesh_ );
+    }
     
     bool intersect( const Ray& ray, Isect &isect ) const;
 
@@ -111,8 +149,11 @@ public:
 private:
 
     RTCScene scene_;
+    RTCScene patch_;    //shared geometry of the sample patch, instanced into scene_ when tiling
+    int tile_count_;
 	std::vector< ObjLoader::Mesh > mesh_;
     void setRTCGeometry( const std::vector< ObjLoader::Mesh >& _mesh );
+    void setRTCTiling( void );
 
 	
     inline void set_isect( const RTCRay& ray, Isect& isect ) const
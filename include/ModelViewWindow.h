@@ -9,6 +9,8 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
+#include <future>
+
 namespace BRDFModel
 {
 	struct SphericalSpace {
@@ -67,11 +69,12 @@ namespace BRDFModel
 	};
 
 	struct Texture {
-		GLuint id;
+		std::string path;
 		std::string name;
 		unsigned int type;
 	};
 
+	// CPU copy of one part of a model and where it ended up in the model's shared buffers
 	class Mesh {
 	public:
 		std::vector<Vertex> m_vertices;
@@ -79,62 +82,124 @@ namespace BRDFModel
 		std::vector<Texture> m_textures;
 
 		SphericalSpace m_space;
+		unsigned int m_uiMaterialId;
+
+		GLuint m_uiBaseVertex;
+		GLuint m_uiFirstIndex;
+		GLint m_iTexLayer;
 
 		Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures)
 			: m_vertices(vertices)
 			, m_indices(indices)
 			, m_textures(textures)
+			, m_uiMaterialId(0)
+			, m_uiBaseVertex(0)
+			, m_uiFirstIndex(0)
+			, m_iTexLayer(-1)
 		{
-			SetupMesh();
+			CalcSpace();
 		}
 
-		~Mesh()
+		// Bounding space already known, e.g. read back from the mesh cache
+		Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures, const SphericalSpace &space)
+			: m_vertices(vertices)
+			, m_indices(indices)
+			, m_textures(textures)
+			, m_space(space)
+			, m_uiMaterialId(0)
+			, m_uiBaseVertex(0)
+			, m_uiFirstIndex(0)
+			, m_iTexLayer(-1)
 		{
-			for (auto &texture : m_textures)
-			{
-				glDeleteTextures(1, &texture.id);
-			}
-			glDeleteVertexArrays(1,&m_iVAO);
-			glDeleteBuffers(1,&m_iVBO);
-			glDeleteBuffers(1,&m_iEBO);
 		}
 
-		void Draw(NPGLHelper::Effect &effect);
-
 	protected:
-		GLuint m_iVAO;
-		GLuint m_iVBO;
-		GLuint m_iEBO;
-
-		void SetupMesh();
+		void CalcSpace();
 	};
 
 	class Model {
 	public:
-		Model();
-		~Model() 
-		{
-			for (auto &mesh : m_meshes)
-			{
-				if (mesh)
-					delete mesh;
-			}
-			m_meshes.clear(); 
-		}
+		// unit of the diffuse texture array, the floor keeps units 0 and 1
+		static const GLuint TEXTURE_ARRAY_UNIT;
 
-		void Draw(NPGLHelper::Effect &effect);
-		bool LoadModel(const char* path);
+		Model();
+		~Model();
+
+		// Queues every mesh as one multi-draw, depthOnly uses the position-only stream and no textures
+		void Submit(NPGLHelper::RenderPass &pass, NPGLHelper::Effect* effect
+			, const std::vector<NPGLHelper::RenderPass::TextureBinding> &textures, const NPGLHelper::RenderPass::SetupFunc &setup
+			, const bool depthOnly = false);
+		// Reads the cache or imports the file, decodes the textures and packs everything for Upload. Makes no GL calls,
+		// so it can run on a worker. maxTextureSize is GL_MAX_TEXTURE_SIZE of the context that will draw the model
+		bool Import(const char* path, const int maxTextureSize);
+		// Creates the GL objects on the first call and copies at most budget bytes of the imported data,
+		// at least one texture row. True once everything is on the GPU
+		bool Upload(const size_t budget);
 		inline SphericalSpace GetSphericalSpace() { return m_space; }
 
 	protected:
 		void ProcessNode(aiNode* node, const aiScene* scene);
-		Mesh* ProcessMesh(aiMesh* mesh, const aiScene* scene);
+		// cache and fetch optimized, split so every part fits 16 bit indices
+		std::vector<Mesh*> ProcessMesh(aiMesh* mesh, const aiScene* scene);
 		std::vector<Texture> LoadMaterialTextures(aiMaterial* mat, aiTextureType type, const char* name, const unsigned int typeId);
+		bool LoadModelCache(const std::string &path);
+		void SaveModelCache(const std::string &path, const aiScene* scene);
+		void PackBuffers();
+		void DecodeTextures(const int maxTextureSize);
+		void CreateGLObjects();
+
+		// most vertices a mesh can have and still be drawn with GL_UNSIGNED_SHORT indices
+		static const unsigned int SHORT_INDEX_VERTICES;
+
+		// GPU vertex, 24 bytes: snorm 10:10:10:2 normal and tangent, half float texture coordinates
+		struct PackedVertex {
+			GLfloat position[3];
+			GLuint normal;
+			GLuint tangent;
+			GLushort texCoords[2];
+		};
+
+		// DrawElementsIndirectCommand, baseInstance indexes the per-draw texture layer
+		struct DrawCommand {
+			GLuint count;
+			GLuint instanceCount;
+			GLuint firstIndex;
+			GLint baseVertex;
+			GLuint baseInstance;
+		};
+
+		// imported data waiting for Upload, dropped once it is all on the GPU
+		struct Staging {
+			std::vector<PackedVertex> vertices;
+			std::vector<GLfloat> positions;
+			std::vector<GLuint> indices;
+			std::vector<GLushort> shortIndices;
+			std::vector<DrawCommand> commands;
+			std::vector<GLfloat> layers;
+			int texWidth, texHeight, texLayers;
+			std::vector<unsigned char> texels; // texLayers RGB layers, the white one last, empty when the array is shared
+			std::vector<GLint> fileLayers; // kept with the array for the models that share it
+			GLint whiteLayer;
+			unsigned int stream; // vertices, positions, indices then texels
+			size_t offset; // bytes of the current stream already copied
+		};
+		Staging* m_pStaging;
 
 		std::vector<Mesh*> m_meshes;
 		std::string m_sDirectory;
 
 		SphericalSpace m_space;
+
+		GLuint m_uiVAO;
+		GLuint m_uiDepthVAO;
+		GLuint m_uiVBO;
+		GLuint m_uiPositionVBO;
+		GLuint m_uiEBO;
+		GLuint m_uiLayerVBO;
+		GLuint m_uiIndirectBuffer;
+		GLuint m_uiTexArray;
+		std::string m_sTexArrayKey; // the array is shared with every model built from the same maps
+		GLenum m_eIndexType;
 	};
 }
 
@@ -155,6 +220,7 @@ public:
 	virtual int OnTick(const float deltaTime);
 	virtual void OnTerminate();
 	virtual void OnHandleInputMSG(const INPUTMSG &msg);
+	virtual bool GetIsIdle() { return m_bIsRenderIdle; }
 
 	void OpenModelData();
 	void SetBRDFData(const char* path, unsigned int n_th, unsigned int n_ph);
@@ -190,9 +256,13 @@ public:
 
 protected:
 	void UpdateBRDFData();
+	void StartModelImport(const std::string& path);
+	void UpdateModelLoading();
 
 	// Rendering methods
 	RENDERINGMETHODS m_eRenderingMethod;
+	// the env shadow methods add their samples into the HDR buffer with the sample count in alpha
+	bool GetIsSampleSum() const;
 
 	void RenderMethod_DiffuseDirLight();
 	void RenderMethod_BlinnPhongDirLight();
@@ -204,6 +274,11 @@ protected:
 	void RenderMethod_BlinnPhongEnvMapS();
 	void RenderMethod_BRDFEnvMapS();
 
+	// Pass configurations shared by the rendering methods of one family
+	void Render_DirLightPass(NPGLHelper::Effect* modelEffect, NPGLHelper::Effect* floorEffect, const bool isBRDF);
+	void Render_EnvMapPass(NPGLHelper::Effect* modelEffect, const unsigned int maxSamp, const bool isBRDF);
+	void Render_Skybox(const GLenum polygonMode);
+
 	void RenderMethod_DiffuseDirLightInit();
 	void RenderMethod_BlinnPhongDirLightInit();
 	void RenderMethod_BRDFDirLightInit();
@@ -224,7 +299,55 @@ protected:
 	void RenderMethod_DiffuseEnvMapSQuit();
 	void RenderMethod_BlinnPhongEnvMapSQuit();
 
-	void Render_ShadowMap(const NPMathHelper::Vec3 lightDir);
+	NPMathHelper::Mat4x4 GetShadowMapMat(const NPMathHelper::Vec3 lightDir);
+	void Render_ShadowMap(const NPMathHelper::Vec3 lightDir, const GLuint depthArrayTex = 0, const int layer = 0);
+	unsigned int Render_EnvShadowBatch();
+	void SetEnvShadowBatch(NPGLHelper::Effect* effect, const unsigned int count);
+
+	enum ENVSSHADING
+	{
+		ENVSSHADING_DIFFUSE,
+		ENVSSHADING_BLINNPHONG,
+		ENVSSHADING_BRDF
+	};
+	void Render_EnvSDeferred(const NPMathHelper::Mat4x4& proj, const NPMathHelper::Mat4x4& modelMat, const unsigned int sampCount
+		, const ENVSSHADING floorShading, const ENVSSHADING modelShading);
+	void Render_EnvMapSPass(NPGLHelper::Effect* modelEffect, NPGLHelper::Effect* floorEffect
+		, const ENVSSHADING floorShading, const ENVSSHADING modelShading);
+	bool SaveEnvHistory();
+	void Render_EnvReproject(const NPMathHelper::Mat4x4& proj);
+	void UpdateEnvConvergence();
+
+	// Per-frame uniform blocks (std140 layout, padded to vec4), bound to the binding point of their index
+	enum FRAMEBLOCK
+	{
+		FRAMEBLOCK_CAMERA,
+		FRAMEBLOCK_LIGHT,
+		FRAMEBLOCK_SAMPLING,
+		FRAMEBLOCK_N
+	};
+	struct CameraBlock {
+		float view[16];
+		float projection[16];
+		float viewPos[4];
+	};
+	struct LightBlock {
+		float dir[4];
+		float ambient[4];
+		float diffuse[4];
+		float specular[4];
+		float color[4];
+	};
+	struct SamplingBlock {
+		int n_th;
+		int n_ph;
+		int init_samp;
+		int max_samp;
+		float env_multiplier;
+		float pad[3];
+	};
+	void UpdateFrameUniforms(const unsigned int maxSamp);
+	NPGLHelper::UniformRingBuffer m_frameUniforms;
 
 	// Render Quad
 	void RenderScreenQuad();
@@ -235,8 +358,16 @@ protected:
 	GLuint m_uiHDRFBO;
 	GLuint m_uiHDRCB;
 	GLuint m_uiHDRDB;
+	GLuint m_uiHDRMomentCB;
 	NPGLHelper::Effect* m_pFinalComposeEffect;
 	float m_fExposure;
+
+	// Dynamic Resolution (the HDR targets are only filled in their lower left corner while interacting)
+	bool m_bIsDynamicRes;
+	float m_fInteractScale;
+	float m_fRenderScale;
+	int m_iRenderW, m_iRenderH;
+	static const float RENDERSCALE_MIN;
 	NPCamHelper::RotateCamera m_Cam;
 
 	NPGLHelper::Effect* m_pDiffuseModelEffect;
@@ -250,6 +381,7 @@ protected:
 	NPGLHelper::Effect* m_pBRDFEnvSModelEffect;
 	unsigned int m_uiEnvInitSamp;
 	unsigned int m_uiEnvShadowMaxSamp;
+	unsigned int m_uiEnvSampIndex; // halton index of the next sample, keeps running through a reprojected restart
 	NPMathHelper::Mat4x4 m_matLastCam;
 	NPMathHelper::Mat4x4 m_matLastModel;
 	float m_fRenderingProgress;
@@ -288,11 +420,28 @@ protected:
 
 	};
 
+	// Draw submission, the passes only touch GL state that differs from m_renderState
+	typedef std::vector<NPGLHelper::RenderPass::TextureBinding> TextureBindings;
+	NPGLHelper::RenderState m_renderState;
+	NPMathHelper::Mat4x4 GetModelMat();
+	static void SetMaterial(NPGLHelper::Effect& effect, const Material& material);
+	void SetDirLightShadow(NPGLHelper::Effect& effect);
+	void AddModelDraws(NPGLHelper::RenderPass& pass, NPGLHelper::Effect* effect, const NPMathHelper::Mat4x4& modelMat
+		, const TextureBindings& textures, const NPGLHelper::RenderPass::SetupFunc& setup);
+	void AddFloorDraw(NPGLHelper::RenderPass& pass, NPGLHelper::Effect* effect
+		, const TextureBindings& textures, const NPGLHelper::RenderPass::SetupFunc& setup);
+
 	// Model
 	bool m_bIsLoadModel;
 	BRDFModel::Model* m_pModel;
 	std::string m_sModelName;
 	Material m_modelBlinnPhongMaterial;
+	// a new model is imported on a worker, then uploaded a budget per tick while m_pModel keeps drawing
+	static const unsigned int MODEL_UPLOAD_BUDGET_MB;
+	std::future<BRDFModel::Model*> m_futureModelImport;
+	std::string m_sImportPath;
+	std::string m_sQueuedImportPath;
+	BRDFModel::Model* m_pUploadModel;
 
 	// Display Options
 	bool m_bIsWireFrame;
@@ -317,6 +466,82 @@ protected:
 	static const unsigned int SHADOW_WIDTH;
 	static const unsigned int SHADOW_HEIGHT;
 
+	// Env Shadow Batch (one depth layer per sample direction of the frame)
+	enum { ENVSHADOW_MAX_BATCH = 8 };
+	GLuint m_uiEnvDepthMapFBO;
+	GLuint m_uiEnvDepthMapArrayTex;
+	NPMathHelper::Mat4x4 m_matEnvShadowMapMat[ENVSHADOW_MAX_BATCH];
+	NPMathHelper::Vec3 m_v3EnvSampDir[ENVSHADOW_MAX_BATCH];
+	unsigned int m_uiEnvBatch;
+	unsigned int m_uiEnvMaxBatch;
+	float m_fEnvFrameBudget;
+	float m_fLastFrameTime;
+	bool m_bIsRenderIdle;
+	GLuint m_uiEnvBatchArrayTex;
+	unsigned int m_uiEnvBatchLayerOffset;
+
+	// Env Shadow Cache (lower resolution depth of the first samples, kept across camera moves)
+	GLuint m_uiEnvShadowCacheTex;
+	unsigned int m_uiEnvShadowCacheLayers;
+	unsigned int m_uiEnvShadowCacheCount;
+	NPMathHelper::Mat4x4 m_matEnvShadowCacheModel;
+	bool m_bIsEnvShadowCacheFloor;
+	static const unsigned int ENVSHADOW_CACHE_SIZE;
+	static const unsigned int ENVSHADOW_CACHE_BUDGET_MB;
+
+	// Env Deferred (G-buffer written once per camera / model change, one screen pass per batch)
+	enum GBUFFERTARGET
+	{
+		GBUFFER_POSITION,
+		GBUFFER_NORMAL,
+		GBUFFER_TANGENT,
+		GBUFFER_SHADINGNORMAL,
+		GBUFFER_DIFFUSE,
+		GBUFFER_N
+	};
+	bool m_bIsEnvDeferred;
+	bool m_bIsGBufferDirty;
+	GLuint m_uiGBufferFBO;
+	GLuint m_uiGBufferTex[GBUFFER_N];
+	NPGLHelper::Effect* m_pGBufferEffect;
+	NPGLHelper::Effect* m_pEnvSDeferredEffect;
+
+	// Env Reprojection (on camera moves the accumulated sums are warped to the new view through the G-buffer positions)
+	enum ENVHISTORYTARGET
+	{
+		ENVHISTORY_SUM,
+		ENVHISTORY_MOMENT,
+		ENVHISTORY_POSITION,
+		ENVHISTORY_N
+	};
+	bool m_bIsEnvReproject;
+	bool m_bIsEnvHistoryValid;
+	bool m_bIsEnvReprojectPending;
+	float m_fEnvReprojectRejectDist;
+	// the sums in the HDR buffer were rendered at m_iEnvSumW x m_iEnvSumH from m_matEnvSumView,
+	// the saved history keeps its own size and view so it can outlive the reduced resolution frames
+	int m_iEnvSumW, m_iEnvSumH;
+	NPMathHelper::Mat4x4 m_matEnvSumView;
+	bool m_bIsEnvHistorySaved;
+	int m_iEnvHistoryW, m_iEnvHistoryH;
+	NPMathHelper::Mat4x4 m_matEnvHistoryView;
+	GLuint m_uiEnvHistoryFBO;
+	GLuint m_uiEnvHistoryTex[ENVHISTORY_N];
+	NPGLHelper::Effect* m_pEnvReprojectEffect;
+
+	// Env Convergence (per tile error of the accumulated sum, checked every few samples)
+	GLuint m_uiConvergeFBO;
+	GLuint m_uiConvergeTex;
+	unsigned int m_uiConvergeTilesW, m_uiConvergeTilesH;
+	NPGLHelper::Effect* m_pEnvConvergeEffect;
+	float m_fEnvConvergeThreshold;
+	float m_fEnvConvergeError;
+	bool m_bIsEnvConverged;
+	unsigned int m_uiEnvLastConvergeSamp;
+	static const unsigned int CONVERGE_TILE_SIZE;
+	static const unsigned int CONVERGE_INTERVAL;
+	static const unsigned int CONVERGE_MIN_SAMP;
+
 	// Env Map
 	float m_fEnvMapMultiplier;
 	bool m_bIsEnvMapLoaded;
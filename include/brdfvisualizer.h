@@ -5,6 +5,7 @@
 #include "camhelper.h"
 #include "mathhelper.h"
 #include "macrohelper.h"
+#include "hdrhelper.h"
 
 class BRDFVisualizer : public NPGLHelper::Window
 {
@@ -17,12 +18,21 @@ public:
 	virtual void OnTerminate(); 
 	virtual bool ShouldTerminateProgramOnTerminate() { return true; }
 	virtual void OnHandleInputMSG(const INPUTMSG &msg);
+	virtual bool GetIsIdle() { return !m_bIsCamRotate && !m_bIsInRotate; }
 
 	void OpenBRDFData();
 	void OpenModelWindow();
 
 protected:
+	void UpdateBRDFSlice();
+
 	GLuint m_iBRDFEstTex;
+	NPHDRHelper::RGBE_StreamReader m_BRDFReader;
+	std::vector<float> m_vBRDFSlice;
+	glm::vec2 m_v2SliceIndex;
+	int m_iSliceTH, m_iSlicePH;
+	unsigned int m_uiSliceNTH, m_uiSliceNPH;
+	bool m_bIsSliceLoaded;
 	bool m_bIsLoadTexture;
 	std::string m_sBRDFTextureName;
 	NPGLHelper::Effect* m_pBRDFVisEffect;
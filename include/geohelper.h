@@ -24,6 +24,20 @@ namespace NPGeoHelper
 	Geometry GetSlicedHemisphereShape(const float radius, const unsigned int vertSlice, unsigned int horiSlice);
 	Geometry GetFloorPlaneShape(const float width, const float height, const float uvmultiplier = 1.f);
 	Geometry GetBoxShape(const float width, const float height, const float depth);
+
+	// Reorders the triangles of a list for the post-transform vertex cache (Forsyth), in place
+	void OptimizeVertexCache(std::vector<unsigned int> &indices, const unsigned int vertexCount);
+
+	// Part of a triangle list with its own vertex numbering, vertices[i] is the source vertex of local index i
+	struct IndexBatch
+	{
+		std::vector<unsigned int> vertices;
+		std::vector<unsigned int> indices;
+	};
+	// Renumbers vertices in first use order so fetches walk memory forward, starting a new batch whenever one
+	// would reference more than maxVertices vertices. Triangle order is kept, unreferenced vertices are dropped
+	std::vector<IndexBatch> OptimizeVertexFetch(const std::vector<unsigned int> &indices, const unsigned int vertexCount
+		, const unsigned int maxVertices = 0xffffffff);
 }
 
 #endif
\ No newline at end of file
@@ -15,6 +15,8 @@
 #include <vector>
 #include <queue>
 #include <map>
+#include <unordered_map>
+#include <functional>
 
 #include "geohelper.h"
 #include "mathhelper.h"
@@ -53,6 +55,12 @@ namespace NPGLHelper
 	bool checkProgramError(GLuint program, GLuint checking, std::string &info);
 
 	bool loadHDRTextureFromFile(const char* path, GLuint &id, GLint warpS, GLint warpT, GLint minFil, GLint maxFil);
+	// Tabulated BRDF, column i_th * n_ph + i_ph of the file for the incident direction and row o_th * n_ph + o_ph for the
+	// outgoing one, as a linear filtered GL_RGB9_E5 GL_TEXTURE_3D without mips. Each incident th is a block of x o_ph, y o_th,
+	// z i_ph where ph wraps and th clamps through one extra texel, so the filter taps never reach the next block. The blocks
+	// are stacked along y and the rows that do not fit GL_MAX_3D_TEXTURE_SIZE continue along z : block b starts at
+	// y (b % rows) * (n_th + 1), z (b / rows) * (n_ph + 1), with rows = height / (n_th + 1) of the texture
+	bool loadBRDFTextureFromFile(const char* path, GLuint &id, const unsigned int n_th, const unsigned int n_ph);
 	bool loadTextureFromFile(const char* path, GLuint &id, GLint warpS, GLint warpT, GLint minFil, GLint maxFil, bool sRGB = true);
 	bool loadCubemapFromFiles(std::string faces[6], GLuint &id, bool sRGB = true);
 
@@ -87,19 +95,165 @@ namespace NPGLHelper
 		bool linkEffect();
 		bool activeEffect();
 		bool deactiveEffect();
-		
+
+		// Index into the uniform table reflected at link time, -1 when the program has no such uniform
+		typedef int UniformID;
+		UniformID GetUniformID(const char* var);
+
 		void SetMatrix(const char* var, const float* mat);
 		void SetInt(const char* var, const int value);
 		void SetFloat(const char* var, const float value);
+		void SetVec2(const char* var, const float x, const float y);
 		void SetVec3(const char* var, const float x, const float y, const float z);
 		void SetVec3(const char* var, const NPMathHelper::Vec3 &value);
+		void SetMatrixArray(const char* var, const float* mat, const int count);
+		void SetVec3Array(const char* var, const float* value, const int count);
+
+		// Pre-resolved setters, values equal to the last upload are skipped
+		void SetMatrix(const UniformID id, const float* mat);
+		void SetInt(const UniformID id, const int value);
+		void SetFloat(const UniformID id, const float value);
+		void SetVec2(const UniformID id, const float x, const float y);
+		void SetVec3(const UniformID id, const float x, const float y, const float z);
+		void SetVec3(const UniformID id, const NPMathHelper::Vec3 &value);
+		void SetMatrixArray(const UniformID id, const float* mat, const int count);
+		void SetVec3Array(const UniformID id, const float* value, const int count);
 
 		inline const bool GetIsLinked() { return m_bIsLinked; }
+		inline const GLuint GetProgram() { return m_iProgram; }
+
+		// Uniform blocks with a registered name are bound to their binding point whenever an effect links
+		static void SetUniformBlockBinding(const char* block, const GLuint binding);
 
 	protected:
+		struct Uniform
+		{
+			GLint location;
+			bool isUploaded;
+			std::vector<unsigned char> value;
+		};
+		void ReflectUniforms();
+		UniformID AddUniform(const std::string& name, const GLint location);
+		bool UpdateUniformCache(const UniformID id, const void* value, const size_t size);
+
 		GLuint m_iProgram;
 		bool m_bIsLinked;
 		std::vector<GLuint> m_vAttachedShader;
+		std::vector<Uniform> m_vUniforms;
+		std::unordered_map<std::string, UniformID> m_mapUniformIDs;
+
+		static std::map<std::string, GLuint> g_mapUniformBlockBindings;
+	};
+
+	// Uniform blocks shared by all effects, written once per frame into one slot of a ring
+	// Block i is bound to binding point i, a slot is only rewritten after the GPU passed its fence
+	class UniformRingBuffer
+	{
+	public:
+		UniformRingBuffer();
+		~UniformRingBuffer();
+
+		bool Init(const GLsizeiptr* blockSizes, const unsigned int blockCount, const unsigned int slotCount = 3);
+		void Update(const void* const* blockData);
+		void Release();
+
+	protected:
+		GLuint m_uiBuffer;
+		unsigned char* m_pMapped;
+		std::vector<GLsizeiptr> m_vBlockSizes;
+		std::vector<GLintptr> m_vBlockOffsets;
+		GLsizeiptr m_iSlotSize;
+		unsigned int m_uiSlotCount;
+		unsigned int m_uiCurrentSlot;
+		std::vector<GLsync> m_vSlotFences;
+	};
+
+	// Last value set per piece of GL state of one context, calls setting the same value again are dropped
+	// Code changing this state directly has to call Invalidate afterwards
+	class RenderState
+	{
+	public:
+		RenderState();
+
+		void Invalidate();
+		void UseProgram(const GLuint program);
+		void BindVertexArray(const GLuint vao);
+		void BindDrawIndirectBuffer(const GLuint buffer);
+		void BindTexture(const GLuint unit, const GLenum target, const GLuint texture);
+		void SetBlend(const bool enable, const GLenum src = GL_ONE, const GLenum dst = GL_ONE);
+		void SetCullFace(const bool enable, const GLenum face = GL_BACK);
+		void SetDepthTest(const bool enable);
+		void SetPolygonMode(const GLenum mode);
+
+		enum { MAX_TEXTURE_UNITS = 16 };
+
+	protected:
+		GLuint m_uiProgram;
+		GLuint m_uiVAO;
+		GLuint m_uiIndirectBuffer;
+		GLuint m_uiActiveUnit;
+		GLenum m_eTexTargets[MAX_TEXTURE_UNITS];
+		GLuint m_uiTextures[MAX_TEXTURE_UNITS];
+		int m_iBlend;
+		GLenum m_eBlendSrc, m_eBlendDst;
+		int m_iCullFace;
+		GLenum m_eCullFace;
+		int m_iDepthTest;
+		GLenum m_ePolygonMode;
+	};
+
+	// Fixed function state and indexed draws of one pass, issued sorted by program and first texture
+	class RenderPass
+	{
+	public:
+		struct TextureBinding
+		{
+			GLuint unit;
+			GLenum target;
+			GLuint id;
+			const char* sampler; // set to unit on the draw's effect when not null
+		};
+		typedef std::function<void(Effect&)> SetupFunc;
+		static TextureBinding MakeTexture(const GLuint unit, const GLenum target, const GLuint id, const char* sampler = nullptr)
+		{
+			TextureBinding binding = { unit, target, id, sampler };
+			return binding;
+		}
+
+		RenderPass();
+
+		void SetPolygonMode(const GLenum mode) { m_ePolygonMode = mode; }
+		void SetBlend(const bool enable, const GLenum src = GL_ONE, const GLenum dst = GL_ONE);
+		void SetCullFace(const bool enable, const GLenum face = GL_BACK);
+		void SetDepthTest(const bool enable) { m_bIsDepthTest = enable; }
+
+		// textures are listed with the draw's own ones first, setup sets the per draw uniforms
+		void AddDraw(Effect* effect, const GLuint vao, const GLsizei count
+			, const std::vector<TextureBinding>& textures, const SetupFunc& setup);
+		// drawCount DrawElementsIndirectCommand records read from the start of indirectBuffer, indices of indexType
+		void AddMultiDraw(Effect* effect, const GLuint vao, const GLuint indirectBuffer, const GLsizei drawCount
+			, const GLenum indexType, const std::vector<TextureBinding>& textures, const SetupFunc& setup);
+		void Submit(RenderState& state);
+
+	protected:
+		struct DrawItem
+		{
+			Effect* effect;
+			GLuint vao;
+			GLsizei count;
+			GLuint indirect;
+			GLenum indexType;
+			std::vector<TextureBinding> textures;
+			SetupFunc setup;
+		};
+
+		GLenum m_ePolygonMode;
+		bool m_bIsBlend;
+		GLenum m_eBlendSrc, m_eBlendDst;
+		bool m_bIsCullFace;
+		GLenum m_eCullFace;
+		bool m_bIsDepthTest;
+		std::vector<DrawItem> m_vItems;
 	};
 
 	class ShareContent
@@ -202,9 +356,12 @@ namespace NPGLHelper
 		virtual void OnTerminate() = 0;
 		virtual bool ShouldTerminateProgramOnTerminate() { return false; }
 		virtual void OnHandleInputMSG(const INPUTMSG &msg) = 0;
+		// an idle window has nothing new to show, it is not ticked again until it gets input
+		virtual bool GetIsIdle() { return false; }
 
 		void AddInputMSG(INPUTMSG msg);
 		void ProcessInputMSGQueue();
+		inline bool GetHasInputMSG() { return !m_queueInputMSG.empty(); }
 
 
 		inline GLEWContext* GetGLEWContext() { return m_pGLEWContext; }
@@ -265,6 +422,7 @@ namespace NPGLHelper
 		int GLInit();
 		bool WindowsUpdate();
 		void TerminateShouldQuitWindows();
+		bool GetIsAllWindowsIdle();
 
 		bool m_bIsInit;
 		int m_iSizeW, m_iSizeH;
@@ -278,6 +436,8 @@ namespace NPGLHelper
 	private:
 		float m_fDeltaTime;
 		float m_fLastTime;
+
+		static const double IDLE_WAIT_TIMEOUT;
 	};
 
 
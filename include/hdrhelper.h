@@ -2,6 +2,8 @@
 #define HDRHELPER_H
 #include <stdio.h>
 
+class HDRDecoder;
+
 namespace NPHDRHelper{
 
 	typedef struct {
@@ -32,14 +34,39 @@ namespace NPHDRHelper{
 	/* read or write pixels */
 	/* can read or write pixels in chunks of any size including single pixels*/
 	int RGBE_WritePixels(FILE *fp, float *data, int numpixels);
-	int RGBE_ReadPixels(FILE *fp, float *data, int numpixels);
 
 	/* read or write run length encoded files */
 	/* must be called to read or write whole scanlines */
 	int RGBE_WritePixels_RLE(FILE *fp, float *data, int scanline_width,
 		int num_scanlines);
-	int RGBE_ReadPixels_RLE(FILE *fp, float *data, int scanline_width,
-		int num_scanlines);
+	/* pixels are read through RGBE_StreamReader, which shares its decoder with loadhdr */
+
+	/* streaming reads of large files : the file is mapped and its scanline index is */
+	/* built once by Open and kept, later reads only decode the requested pixels */
+	class RGBE_StreamReader
+	{
+	public:
+		RGBE_StreamReader();
+		~RGBE_StreamReader();
+
+		bool Open(const char* path);
+		void Close();
+		bool GetIsOpen() const;
+		int GetWidth() const;
+		int GetHeight() const;
+
+		/* w x h pixels from column x of row y, rows counted from the first scanline */
+		/* as loadHDRTextureFromFile uploads them, 3 floats per pixel */
+		bool ReadRegion(int x, int y, int w, int h, float *data) const;
+		bool ReadScanlines(int y, int h, float *data) const;
+
+	protected:
+		HDRDecoder* m_pDecoder;
+
+	private:
+		RGBE_StreamReader(const RGBE_StreamReader&);
+		RGBE_StreamReader& operator=(const RGBE_StreamReader&);
+	};
 };
 
 #endif
\ No newline at end of file
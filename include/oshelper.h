@@ -28,6 +28,9 @@ namespace NPOSHelper
 
 	std::string GetOSCurrentDirectory();
 	void SetOSCurrentDirectory(std::string &dir);
+
+	// absolute, without '.' and '..' parts and lower case, so every spelling of one file gives the same string
+	std::string GetResolvedPath(const std::string &path);
 }
 
 #endif
\ No newline at end of file
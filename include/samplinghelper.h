@@ -39,5 +39,37 @@ namespace NPSamplingHelper
 	// ================
 	// Hammersley - End
 	// ================
+
+	// ==============
+	// Halton - Begin
+	// ==============
+
+	float radicalInverse_3(unsigned int i) {
+		float f = 1.f / 3.f;
+		float result = 0.f;
+		while (i > 0)
+		{
+			result += f * (float)(i % 3);
+			i /= 3;
+			f /= 3.f;
+		}
+		return result;
+	}
+
+	// unlike hammersley2d it needs no sample count up front, every prefix of the sequence is stratified
+	NPMathHelper::Vec2 halton2d(unsigned int i) {
+		return NPMathHelper::Vec2(radicalInverse_VdC(i), radicalInverse_3(i));
+	}
+
+	NPMathHelper::Vec3 sphereSample_uniform(float u, float v) {
+		float phi = v * 2.0 * M_PI;
+		float cosTheta = 1.0 - 2.0 * u;
+		float sinTheta = sqrt(1.0 - cosTheta * cosTheta);
+		return NPMathHelper::Vec3(cos(phi) * sinTheta, cosTheta, sin(phi) * sinTheta);
+	}
+
+	// ============
+	// Halton - End
+	// ============
 };
 #endif
\ No newline at end of file
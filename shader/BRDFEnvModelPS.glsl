@@ -3,21 +3,31 @@
 #define ITR_COUNT 1
 
 in vec2 outTexCoord;
+flat in float outTexLayer;
 in vec3 outNormal;
 in vec4 outTangent;
 in vec3 outPosW;
 
 out vec4 color;
 
-uniform sampler2D texture_brdf;
-uniform sampler2D texture_diffuse1;
-uniform sampler2D texture_specular1;
+uniform sampler3D texture_brdf;
+uniform sampler2DArray texture_diffuse_array;
 
-uniform float env_multiplier;
-uniform int n_th;
-uniform int n_ph;
-uniform int init_samp;
-uniform vec3 viewPos;
+layout(std140) uniform SamplingBlock
+{
+	int n_th;
+	int n_ph;
+	int init_samp;
+	int max_samp;
+	float env_multiplier;
+};
+
+layout(std140) uniform CameraBlock
+{
+	mat4 view;
+	mat4 projection;
+	vec3 viewPos;
+};
 
 uniform samplerCube envmap;
 
@@ -30,81 +40,35 @@ struct Material {
 
 uniform Material material;
 
-void GetVectorIndex(vec3 value, out float th, out float ph)
+// table coordinates of a local direction, th in [0, n_th] away from the normal and ph in [0, n_ph) around it
+vec2 GetVectorIndex(vec3 value)
 {
 	value = normalize(value);
-	float tAngle = acos(value.y);
-	th = tAngle / (0.5f * M_PI) * n_th;
-	vec3 valueHori = normalize(vec3(value.x, 0.f, value.z));
-	float pAngle;
-	if (valueHori.x > 0)
-	{
-		if (valueHori.z >= 0)
-		{
-			pAngle = 3.f / 2.f * M_PI + acos(valueHori.z);
-		}
-		else
-		{
-			pAngle = asin(-valueHori.z);
-		}
-	}
-	else
-	{
-		if (valueHori.z >= 0)
-		{
-			pAngle = M_PI + asin(valueHori.z);
-		}
-		else
-		{
-			pAngle = 0.5f * M_PI + asin(-valueHori.x);
-		}
-	}
-	ph = pAngle / (2.f * M_PI) * n_ph;
+	float th = acos(clamp(value.y, -1.f, 1.f)) / (0.5f * M_PI) * n_th;
+	float ph = fract(atan(-value.z, value.x) / (2.f * M_PI)) * n_ph;
+	return vec2(min(th, float(n_th)), ph);
 }
 
-vec3 FetchBRDF(int i_th, int i_ph, int o_th, int o_ph)
+// see NPGLHelper::loadBRDFTextureFromFile for the layout : incident th block b starts at row (b % rows) * (n_th + 1)
+// and slice (b / rows) * (n_ph + 1), inside it the filter interpolates o_ph, o_th and i_ph
+vec3 FetchBRDFBlock(int i_th, float i_ph, vec2 o_vec)
 {
-	ivec2 fTarget;
-	fTarget.x = i_th * n_ph + i_ph;
-	fTarget.y = (n_ph * n_th - 1) - (o_th * n_ph + o_ph);
-	return texelFetch(texture_brdf, fTarget, 0).xyz;
-}
-
-vec3 OutFourPointsSample(ivec2 i_vec, vec2 o_vec)
-{
-	ivec2 o_f_vec = ivec2(floor(o_vec));
-	ivec2 o_c_vec = ivec2(ceil(o_vec));
-	vec2 o_d_vec = o_vec - o_f_vec;
-
-	vec3 resultA = FetchBRDF(i_vec.x, i_vec.y, o_f_vec.x, o_f_vec.y);
-	vec3 resultB = FetchBRDF(i_vec.x, i_vec.y, o_c_vec.x, o_f_vec.y);
-	vec3 resultFirst = mix(resultA, resultB, o_d_vec.x);
-
-	vec3 resultC = FetchBRDF(i_vec.x, i_vec.y, o_f_vec.x, o_c_vec.y);
-	vec3 resultD = FetchBRDF(i_vec.x, i_vec.y, o_c_vec.x, o_c_vec.y);
-	vec3 resultSecond = mix(resultC, resultD, o_d_vec.x);
-
-	return mix(resultFirst, resultSecond, o_d_vec.y);
+	vec3 size = vec3(textureSize(texture_brdf, 0));
+	int rows = int(size.y) / (n_th + 1);
+	vec3 coord = vec3(o_vec.y, (i_th % rows) * (n_th + 1) + o_vec.x, (i_th / rows) * (n_ph + 1) + i_ph) + 0.5f;
+	return texture(texture_brdf, coord / size).xyz;
 }
 
+// the two incident th blocks around iL are mixed here
 vec3 SampleBRDF_Linear(vec3 iL, vec3 oL)
 {
-	vec2 i_vec, o_vec;
-	GetVectorIndex(iL, i_vec.x, i_vec.y);
-	GetVectorIndex(oL, o_vec.x, o_vec.y);
-	ivec2 i_f_vec = ivec2(floor(i_vec));
-	ivec2 i_c_vec = ivec2(ceil(i_vec));
-	vec2 i_d_vec = i_vec - i_f_vec;
-
-	vec3 resultA = OutFourPointsSample(i_f_vec, o_vec);
-	vec3 resultB = OutFourPointsSample(ivec2(i_c_vec.x, i_f_vec.y), o_vec);
-	vec3 resultFirst = mix(resultA, resultB, i_d_vec.x);
-
-	vec3 resultC = OutFourPointsSample(ivec2(i_f_vec.x, i_c_vec.y), o_vec);
-	vec3 resultD = OutFourPointsSample(i_c_vec, o_vec);
-	vec3 resultSecond = mix(resultC, resultD, i_d_vec.x);
+	vec2 i_vec = GetVectorIndex(iL);
+	vec2 o_vec = GetVectorIndex(oL);
+	int i_th = min(int(i_vec.x), n_th - 1);
 
-	return mix(resultFirst, resultSecond, i_d_vec.y);
+	vec3 resultFloor = FetchBRDFBlock(i_th, i_vec.y, o_vec);
+	vec3 resultCeil = FetchBRDFBlock(i_th + 1, i_vec.y, o_vec);
+	return mix(resultFloor, resultCeil, i_vec.x - i_th);
 }
 
 void main()
@@ -118,7 +82,7 @@ void main()
 
 	vec4 result = vec4(0.f, 0.f, 0.f, 0.f);
 	vec3 viewDirL = tnb * viewDir;
-	vec4 diff = texture(texture_diffuse1, outTexCoord);
+	vec4 diff = texture(texture_diffuse_array, vec3(outTexCoord, outTexLayer));
 
 	for (int i = 0; i < ITR_COUNT; i++)
 	{
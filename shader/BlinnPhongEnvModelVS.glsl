@@ -11,8 +11,14 @@ out vec3 outNormal;
 out vec4 outTangent;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+
+layout(std140) uniform CameraBlock
+{
+	mat4 view;
+	mat4 projection;
+	vec3 viewPos;
+};
+
 uniform mat4 tranInvModel;
 
 void main()
@@ -29,8 +29,20 @@ struct DirLight {
 };
 
 uniform Material material;
-uniform DirLight light;
-uniform vec3 viewPos;
+
+layout(std140) uniform LightBlock
+{
+	DirLight light;
+	vec3 lightColor;
+};
+
+layout(std140) uniform CameraBlock
+{
+	mat4 view;
+	mat4 projection;
+	vec3 viewPos;
+};
+
 uniform float biasMin;
 uniform float biasMax;
 
@@ -2,6 +2,7 @@
 #define M_PI 3.1415926535897932384626433832795
 
 in vec2 outTexCoord;
+flat in float outTexLayer;
 in vec3 outNormal;
 in vec4 outTangent;
 in vec3 outPosW;
@@ -9,8 +10,7 @@ in vec3 outPosW;
 out vec4 color;
 
 uniform sampler2D texture_brdf;
-uniform sampler2D texture_diffuse1;
-uniform sampler2D texture_specular1;
+uniform sampler2DArray texture_diffuse_array;
 
 uniform samplerCube envmap;
 
@@ -22,11 +22,22 @@ struct Material {
 };
 
 uniform Material material;
-uniform vec3 viewPos;
 
-uniform float env_multiplier;
-uniform int max_samp;
-uniform int init_samp;
+layout(std140) uniform CameraBlock
+{
+	mat4 view;
+	mat4 projection;
+	vec3 viewPos;
+};
+
+layout(std140) uniform SamplingBlock
+{
+	int n_th;
+	int n_ph;
+	int init_samp;
+	int max_samp;
+	float env_multiplier;
+};
 
 // ==================
 // Hammersley - Begin
@@ -74,7 +85,7 @@ void main()
 	vec3 viewDir = normalize(outPosW - viewPos);
 
 	vec3 normalW = normalize(outNormal);
-	vec4 diffTex = texture(texture_diffuse1, outTexCoord);
+	vec4 diffTex = texture(texture_diffuse_array, vec3(outTexCoord, outTexLayer));
 
 	vec2 sampHemiSpace = hammersley2d(uint(init_samp), uint(max_samp));
 	vec3 sampDir = normalize(hemisphereSample_cos(sampHemiSpace.x, sampHemiSpace.y));
@@ -2,6 +2,7 @@
 #define M_PI 3.1415926535897932384626433832795
 
 in vec2 outTexCoord;
+flat in float outTexLayer;
 in vec3 outNormal;
 in vec4 outTangent;
 in vec3 outPosW;
@@ -9,8 +10,7 @@ in vec4 outShadowPosW;
 
 out vec4 color;
 
-uniform sampler2D texture_diffuse1;
-uniform sampler2D texture_specular1;
+uniform sampler2DArray texture_diffuse_array;
 uniform sampler2D texture_shadow;
 
 struct Material {
@@ -28,8 +28,20 @@ struct DirLight {
 };
 
 uniform Material material;
-uniform DirLight light;
-uniform vec3 viewPos;
+
+layout(std140) uniform LightBlock
+{
+	DirLight light;
+	vec3 lightColor;
+};
+
+layout(std140) uniform CameraBlock
+{
+	mat4 view;
+	mat4 projection;
+	vec3 viewPos;
+};
+
 uniform float biasMin;
 uniform float biasMax;
 
@@ -58,7 +70,7 @@ float shadowCalculation(vec4 shadowpos, float bias)
 void main()
 {
 	vec3 normalW = normalize(outNormal);
-	vec4 diffTex = texture(texture_diffuse1, outTexCoord);
+	vec4 diffTex = texture(texture_diffuse_array, vec3(outTexCoord, outTexLayer));
 	vec3 viewDir = normalize(outPosW - viewPos);
 
 	float kEnergyConvervation = (8.0f + material.shininess) / (8.0 * M_PI);
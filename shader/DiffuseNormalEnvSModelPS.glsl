@@ -1,22 +1,30 @@
 #version 330 core
 #define M_PI 3.1415926535897932384626433832795
-#define ITR_COUNT 1
+#define MAX_BATCH 8
 
 in vec2 outTexCoord;
 in vec3 outNormal;
 in vec4 outTangent;
 in vec3 outPosW;
-in vec4 outShadowPosW;
 
-out vec4 color;
+layout(location = 0) out vec4 color;
+layout(location = 1) out vec4 moment;
 
 uniform sampler2D texture_diffuse1;
 uniform sampler2D texture_normal1;
 uniform sampler2D texture_specular1;
-uniform sampler2D texture_shadow;
+uniform sampler2DArray texture_shadow;
 
 uniform samplerCube envmap;
-uniform float env_multiplier;
+
+layout(std140) uniform SamplingBlock
+{
+	int n_th;
+	int n_ph;
+	int init_samp;
+	int max_samp;
+	float env_multiplier;
+};
 
 struct Material {
 	vec3 ambient;
@@ -26,28 +34,37 @@ struct Material {
 };
 
 uniform Material material;
-uniform vec3 viewPos;
-uniform vec3 samp_dir_w;
-uniform int max_samp;
-uniform int init_samp;
+
+layout(std140) uniform CameraBlock
+{
+	mat4 view;
+	mat4 projection;
+	vec3 viewPos;
+};
+
+uniform vec3 samp_dir_w[MAX_BATCH];
+uniform mat4 shadowMaps[MAX_BATCH];
+uniform int samp_count;
+uniform int shadow_layer_offset;
 uniform float biasMin;
 uniform float biasMax;
 
-float shadowCalculation(vec4 shadowpos, float bias)
+float shadowCalculation(int layer, float bias)
 {
+	vec4 shadowpos = shadowMaps[layer] * vec4(outPosW, 1.0f);
 	vec3 projCoords = (shadowpos / shadowpos.w).xyz;
 	projCoords = projCoords * 0.5f + 0.5f;
 	if (projCoords.z > 1.0)
 		return 0.0;
-	float closestDepth = texture(texture_shadow, projCoords.xy).r;
+	float closestDepth = texture(texture_shadow, vec3(projCoords.xy, shadow_layer_offset + layer)).r;
 	float currentDepth = projCoords.z;
 	float shadow = 0.f;
-	vec2 texelSize = 1.0f / textureSize(texture_shadow, 0);
+	vec2 texelSize = 1.0f / textureSize(texture_shadow, 0).xy;
 	for (int x = -1; x <= 1; x++)
 	{
 		for (int y = -1; y <= 1; y++)
 		{
-			float pcfDepth = texture(texture_shadow, projCoords.xy + vec2(x, y) * texelSize).r;
+			float pcfDepth = texture(texture_shadow, vec3(projCoords.xy + vec2(x, y) * texelSize, shadow_layer_offset + layer)).r;
 			shadow += currentDepth - bias > pcfDepth ? 1.0f : 0.f;
 		}
 	}
@@ -69,26 +86,37 @@ void main()
 	vec3 normalW = tnb * normValue;
 
 	vec4 result = vec4(0.f, 0.f, 0.f, 0.f);
+	vec3 resultSq = vec3(0.f, 0.f, 0.f);
+	float sampCount = 0.f;
 	vec3 viewDirL = ttnb * viewDir;
 	vec4 diffTex = texture(texture_diffuse1, outTexCoord);
 
-	vec3 sampDir = ttnb * normalize(samp_dir_w);
-	if (sampDir.y > 0.f)
+	for (int k = 0; k < samp_count; k++)
 	{
-		vec3 lightColor = env_multiplier * texture(envmap, samp_dir_w).rgb;
-		float kEnergyConvervation = (8.0f + material.shininess) / (8.0 * M_PI);
-		vec3 halfVec = normalize(-viewDir + samp_dir_w);
-		vec3 spec = lightColor * material.specular * kEnergyConvervation
-			* pow(clamp(dot(normalW, halfVec), 0.f, 1.f), material.shininess);
-		vec4 diff = diffTex * vec4(lightColor * material.diffuse
-			* clamp(dot(samp_dir_w, normalW), 0.f, 1.f), 1.f);
-
-		result = 2.f * vec4(/*spec + */diff.xyz, 1.0f * diff.w);
-
-		float shadowBias = max(biasMax * (1.0f - dot(n, samp_dir_w)), biasMin);
-		float shadowFraction = shadowCalculation(outShadowPosW, shadowBias);
-		result = (1.f - shadowFraction) * result;
+		vec3 sampDir = ttnb * normalize(samp_dir_w[k]);
+		if (sampDir.y > 0.f)
+		{
+			vec3 lightColor = env_multiplier * texture(envmap, samp_dir_w[k]).rgb;
+			float kEnergyConvervation = (8.0f + material.shininess) / (8.0 * M_PI);
+			vec3 halfVec = normalize(-viewDir + samp_dir_w[k]);
+			vec3 spec = lightColor * material.specular * kEnergyConvervation
+				* pow(clamp(dot(normalW, halfVec), 0.f, 1.f), material.shininess);
+			vec4 diff = diffTex * vec4(lightColor * material.diffuse
+				* clamp(dot(samp_dir_w[k], normalW), 0.f, 1.f), 1.f);
+
+			vec4 sampResult = vec4(/*spec + */diff.xyz, 1.0f * diff.w);
+
+			float shadowBias = max(biasMax * (1.0f - dot(n, samp_dir_w[k])), biasMin);
+			float shadowFraction = shadowCalculation(k, shadowBias);
+			vec3 sampColor = (1.f - shadowFraction) * sampResult.rgb;
+			result.rgb += sampColor;
+			resultSq += sampColor * sampColor;
+			sampCount += 1.f;
+		}
 	}
-	result.a = float(ITR_COUNT) / (init_samp + float(ITR_COUNT));
+	// sums are added up in the accumulation buffers, alpha only counts the samples above the horizon : the
+	// ones below add nothing and would only make the pixel look less noisy than it is
+	result.a = sampCount;
 	color = result;
+	moment = vec4(resultSq, sampCount);
 }
\ No newline at end of file
@@ -0,0 +1,40 @@
+#version 330 core
+#define TILE_SIZE 16
+
+out vec4 color;
+
+uniform sampler2D sumBuffer;
+uniform sampler2D momentBuffer;
+uniform vec2 render_size;
+
+void main()
+{
+	// one fragment per tile : mean relative standard error of the pixel means inside the tile
+	ivec2 base = ivec2(gl_FragCoord.xy) * TILE_SIZE;
+	ivec2 size = ivec2(render_size);
+	float errSum = 0.f;
+	float pixels = 0.f;
+	for (int y = 0; y < TILE_SIZE; y++)
+	{
+		for (int x = 0; x < TILE_SIZE; x++)
+		{
+			ivec2 p = base + ivec2(x, y);
+			if (p.x >= size.x || p.y >= size.y)
+				continue;
+			vec4 m = texelFetch(momentBuffer, p, 0);
+			float n = m.a;
+			// alpha only counts the samples above the pixel's horizon, with fewer than two there is no variance yet
+			pixels += 1.f;
+			if (n < 2.f)
+			{
+				errSum += 1.f;
+				continue;
+			}
+			vec3 mean = texelFetch(sumBuffer, p, 0).rgb / n;
+			vec3 variance = max(m.rgb / n - mean * mean, vec3(0.f));
+			float stdErr = sqrt(dot(variance, vec3(1.f)) / n);
+			errSum += stdErr / max(dot(mean, vec3(1.f)), 1e-3f);
+		}
+	}
+	color = vec4((pixels > 0.f) ? errSum / pixels : 0.f, 0.f, 0.f, 1.f);
+}
\ No newline at end of file
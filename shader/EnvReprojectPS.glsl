@@ -0,0 +1,52 @@
+#version 330 core
+
+layout(location = 0) out vec4 sum;
+layout(location = 1) out vec4 moment;
+
+uniform sampler2D gbuffer_position;
+uniform sampler2D history_sum;
+uniform sampler2D history_moment;
+uniform sampler2D history_position;
+
+uniform mat4 history_view_proj;
+
+layout(std140) uniform CameraBlock
+{
+	mat4 view;
+	mat4 projection;
+	vec3 viewPos;
+};
+
+uniform float reject_dist;
+// the history may have been rendered at another resolution than the current frame
+uniform vec2 history_size;
+
+void main()
+{
+	ivec2 coord = ivec2(gl_FragCoord.xy);
+	vec4 posId = texelFetch(gbuffer_position, coord, 0);
+	int matId = int(posId.w + 0.5f);
+	if (matId == 0)
+		discard;
+
+	// every covered pixel is written, rejected ones restart from an empty sum
+	sum = vec4(0.f);
+	moment = vec4(0.f);
+
+	vec4 historyClip = history_view_proj * vec4(posId.xyz, 1.f);
+	if (historyClip.w <= 0.f)
+		return;
+	vec2 historyUV = historyClip.xy / historyClip.w * 0.5f + 0.5f;
+	if (any(lessThan(historyUV, vec2(0.f))) || any(greaterThanEqual(historyUV, vec2(1.f))))
+		return;
+	ivec2 historyCoord = ivec2(historyUV * history_size);
+
+	// disocclusion : the old view has to have seen the same surface at that pixel
+	vec4 historyPosId = texelFetch(history_position, historyCoord, 0);
+	if (int(historyPosId.w + 0.5f) != matId
+		|| distance(historyPosId.xyz, posId.xyz) > reject_dist * distance(posId.xyz, viewPos))
+		return;
+
+	sum = texelFetch(history_sum, historyCoord, 0);
+	moment = texelFetch(history_moment, historyCoord, 0);
+}
\ No newline at end of file
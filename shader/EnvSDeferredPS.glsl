@@ -0,0 +1,177 @@
+#version 330 core
+#define M_PI 3.1415926535897932384626433832795
+#define MAX_BATCH 8
+#define SHADING_DIFFUSE 0
+#define SHADING_BLINNPHONG 1
+#define SHADING_BRDF 2
+
+layout(location = 0) out vec4 color;
+layout(location = 1) out vec4 moment;
+
+uniform sampler2D gbuffer_position;
+uniform sampler2D gbuffer_normal;
+uniform sampler2D gbuffer_tangent;
+uniform sampler2D gbuffer_shading_normal;
+uniform sampler2D gbuffer_diffuse;
+
+uniform sampler3D texture_brdf;
+uniform sampler2DArray texture_shadow;
+
+uniform samplerCube envmap;
+
+layout(std140) uniform SamplingBlock
+{
+	int n_th;
+	int n_ph;
+	int init_samp;
+	int max_samp;
+	float env_multiplier;
+};
+
+struct Material {
+	vec3 ambient;
+	vec3 diffuse;
+	vec3 specular;
+	float shininess;
+};
+
+// index 0 is the floor, 1 the model ( mat_id - 1 )
+uniform Material material[2];
+uniform int shading[2];
+
+uniform vec3 samp_dir_w[MAX_BATCH];
+uniform mat4 shadowMaps[MAX_BATCH];
+uniform int samp_count;
+uniform int shadow_layer_offset;
+
+layout(std140) uniform CameraBlock
+{
+	mat4 view;
+	mat4 projection;
+	vec3 viewPos;
+};
+
+uniform float biasMin;
+uniform float biasMax;
+
+float shadowCalculation(vec3 posW, int layer, float bias)
+{
+	vec4 shadowpos = shadowMaps[layer] * vec4(posW, 1.0f);
+	vec3 projCoords = (shadowpos / shadowpos.w).xyz;
+	projCoords = projCoords * 0.5f + 0.5f;
+	if (projCoords.z > 1.0)
+		return 0.0;
+	float closestDepth = texture(texture_shadow, vec3(projCoords.xy, shadow_layer_offset + layer)).r;
+	float currentDepth = projCoords.z;
+	float shadow = 0.f;
+	vec2 texelSize = 1.0f / textureSize(texture_shadow, 0).xy;
+	for (int x = -1; x <= 1; x++)
+	{
+		for (int y = -1; y <= 1; y++)
+		{
+			float pcfDepth = texture(texture_shadow, vec3(projCoords.xy + vec2(x, y) * texelSize, shadow_layer_offset + layer)).r;
+			shadow += currentDepth - bias > pcfDepth ? 1.0f : 0.f;
+		}
+	}
+	shadow /= 9.0f;
+	return shadow;
+}
+
+// table coordinates of a local direction, th in [0, n_th] away from the normal and ph in [0, n_ph) around it
+vec2 GetVectorIndex(vec3 value)
+{
+	value = normalize(value);
+	float th = acos(clamp(value.y, -1.f, 1.f)) / (0.5f * M_PI) * n_th;
+	float ph = fract(atan(-value.z, value.x) / (2.f * M_PI)) * n_ph;
+	return vec2(min(th, float(n_th)), ph);
+}
+
+// see NPGLHelper::loadBRDFTextureFromFile for the layout : incident th block b starts at row (b % rows) * (n_th + 1)
+// and slice (b / rows) * (n_ph + 1), inside it the filter interpolates o_ph, o_th and i_ph
+vec3 FetchBRDFBlock(int i_th, float i_ph, vec2 o_vec)
+{
+	vec3 size = vec3(textureSize(texture_brdf, 0));
+	int rows = int(size.y) / (n_th + 1);
+	vec3 coord = vec3(o_vec.y, (i_th % rows) * (n_th + 1) + o_vec.x, (i_th / rows) * (n_ph + 1) + i_ph) + 0.5f;
+	return texture(texture_brdf, coord / size).xyz;
+}
+
+// the two incident th blocks around iL are mixed here
+vec3 SampleBRDF_Linear(vec3 iL, vec3 oL)
+{
+	vec2 i_vec = GetVectorIndex(iL);
+	vec2 o_vec = GetVectorIndex(oL);
+	int i_th = min(int(i_vec.x), n_th - 1);
+
+	vec3 resultFloor = FetchBRDFBlock(i_th, i_vec.y, o_vec);
+	vec3 resultCeil = FetchBRDFBlock(i_th + 1, i_vec.y, o_vec);
+	return mix(resultFloor, resultCeil, i_vec.x - i_th);
+}
+
+void main()
+{
+	ivec2 coord = ivec2(gl_FragCoord.xy);
+	vec4 posId = texelFetch(gbuffer_position, coord, 0);
+	int matId = int(posId.w + 0.5f);
+	if (matId == 0)
+		discard;
+
+	vec3 posW = posId.xyz;
+	vec3 n = texelFetch(gbuffer_normal, coord, 0).xyz;
+	vec3 t = texelFetch(gbuffer_tangent, coord, 0).xyz;
+	vec3 normalW = texelFetch(gbuffer_shading_normal, coord, 0).xyz;
+	vec4 diffTex = texelFetch(gbuffer_diffuse, coord, 0);
+	Material mat = material[matId - 1];
+	int shadingModel = shading[matId - 1];
+
+	vec3 b = normalize(cross(t, n));
+	mat3 tnb = mat3(t, n, b);
+	mat3 ttnb = transpose(tnb);
+	vec3 viewDir = normalize(posW - viewPos);
+	vec3 viewDirL = ttnb * viewDir;
+
+	vec4 result = vec4(0.f, 0.f, 0.f, 0.f);
+	vec3 resultSq = vec3(0.f, 0.f, 0.f);
+	float sampCount = 0.f;
+	for (int k = 0; k < samp_count; k++)
+	{
+		vec3 sampDir = ttnb * normalize(samp_dir_w[k]);
+		if (sampDir.y > 0.f)
+		{
+			vec3 lightColor = env_multiplier * texture(envmap, samp_dir_w[k]).rgb;
+			vec4 sampResult;
+			if (shadingModel == SHADING_BRDF)
+			{
+				vec3 brdf = clamp(SampleBRDF_Linear(sampDir, -viewDirL), vec3(0.f), vec3(1.0f));
+				sampResult = vec4(lightColor, 1.0f) * clamp(dot(sampDir, vec3(0.f, 1.f, 0.f)), 0.f, 1.f) * (vec4(mat.specular, 1.0f) * vec4(brdf, 1.0f)
+					* vec4(mat.diffuse, 1.0f) * diffTex )
+					+ vec4(mat.ambient, 1.0f);
+			}
+			else
+			{
+				float kEnergyConvervation = (8.0f + mat.shininess) / (8.0 * M_PI);
+				vec3 halfVec = normalize(-viewDir + samp_dir_w[k]);
+				vec3 spec = lightColor * mat.specular * kEnergyConvervation
+					* pow(clamp(dot(normalW, halfVec), 0.f, 1.f), mat.shininess);
+				vec4 diff = diffTex * vec4(lightColor * mat.diffuse
+					* clamp(dot(samp_dir_w[k], normalW), 0.f, 1.f), 1.f);
+				if (shadingModel == SHADING_DIFFUSE)
+					spec = vec3(0.f);
+
+				sampResult = vec4(spec + diff.xyz, 1.0f * diff.w);
+			}
+
+			float shadowBias = max(biasMax * (1.0f - dot(n, samp_dir_w[k])), biasMin);
+			float shadowFraction = shadowCalculation(posW, k, shadowBias);
+			vec3 sampColor = (1.f - shadowFraction) * sampResult.rgb;
+			result.rgb += sampColor;
+			resultSq += sampColor * sampColor;
+			sampCount += 1.f;
+		}
+	}
+	// sums are added up in the accumulation buffers, alpha only counts the samples above the horizon : the
+	// ones below add nothing and would only make the pixel look less noisy than it is
+	result.a = sampCount;
+	color = result;
+	moment = vec4(resultSq, sampCount);
+}
\ No newline at end of file
@@ -6,11 +6,18 @@ out vec4 color;
 
 uniform sampler2D hdrBuffer;
 uniform float exposure;
+uniform vec2 render_scale;
+uniform int use_sample_count;
 
 void main()
 {
 	const float gamma = 2.2f;
-	vec3 hdrColor = texture(hdrBuffer, outTexCoord).rgb;
+	// the env shadow methods store a running sum with the sample count in alpha, the other methods leave
+	// whatever their shaders wrote in alpha ( the lit BRDF pass goes well above 1 ) so it is ignored for them
+	// only the lower left render_scale of the buffer is rendered, the clamp keeps the bilinear taps inside it
+	vec2 uv = min(outTexCoord * render_scale, render_scale - 0.5f / vec2(textureSize(hdrBuffer, 0)));
+	vec4 hdrSum = texture(hdrBuffer, uv);
+	vec3 hdrColor = (use_sample_count != 0) ? hdrSum.rgb / max(hdrSum.a, 1.0f) : hdrSum.rgb;
 	//vec3 result = hdrColor / (hdrColor + vec3(1.0));
 	vec3 result = vec3(1.0f) - exp(-hdrColor * exposure);
 	result = pow(result, vec3(1.0f / gamma));
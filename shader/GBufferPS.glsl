@@ -0,0 +1,55 @@
+#version 330 core
+
+in vec2 outTexCoord;
+flat in float outTexLayer;
+in vec3 outNormal;
+in vec4 outTangent;
+in vec3 outPosW;
+
+layout(location = 0) out vec4 gPosition;
+layout(location = 1) out vec4 gNormal;
+layout(location = 2) out vec4 gTangent;
+layout(location = 3) out vec4 gShadingNormal;
+layout(location = 4) out vec4 gDiffuse;
+
+uniform sampler2D texture_diffuse1;
+uniform sampler2D texture_normal1;
+uniform sampler2DArray texture_diffuse_array;
+
+uniform int mat_id;
+uniform int use_normal_map;
+uniform int use_diffuse_array;
+uniform vec3 forced_tangent_w;
+
+void main()
+{
+	vec3 n = normalize(outNormal);
+	vec3 t = normalize(outTangent.xyz - dot(n, outTangent.xyz) * n);
+	if (length(forced_tangent_w) > 0.1f)
+	{
+		vec3 temp_tangent = normalize(forced_tangent_w - dot(n, forced_tangent_w) * n);
+		if (length(temp_tangent) > 0.1f)
+		{
+			t = temp_tangent;
+		}
+	}
+	vec3 b = normalize(cross(t, n));
+	mat3 tnb = mat3(t, n, b);
+
+	vec3 normalW = n;
+	if (use_normal_map > 0)
+	{
+		vec3 normValue = texture(texture_normal1, outTexCoord).rbg;
+		normValue = normValue * 2.f - vec3(1.f);
+		normalW = tnb * normValue;
+	}
+
+	gPosition = vec4(outPosW, float(mat_id));
+	gNormal = vec4(n, 0.f);
+	gTangent = vec4(t, 0.f);
+	gShadingNormal = vec4(normalW, 0.f);
+	if (use_diffuse_array > 0)
+		gDiffuse = texture(texture_diffuse_array, vec3(outTexCoord, outTexLayer));
+	else
+		gDiffuse = texture(texture_diffuse1, outTexCoord);
+}
\ No newline at end of file
@@ -4,16 +4,24 @@ layout(location = 0) in vec3 position;
 layout(location = 1) in vec3 normal;
 layout(location = 2) in vec3 tangent;
 layout(location = 3) in vec2 texCoord;
+layout(location = 4) in float texLayer;
 
 out vec3 outPosW;
 out vec2 outTexCoord;
 out vec3 outNormal;
 out vec4 outTangent;
 out vec4 outShadowPosW;
+flat out float outTexLayer;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+
+layout(std140) uniform CameraBlock
+{
+	mat4 view;
+	mat4 projection;
+	vec3 viewPos;
+};
+
 uniform mat4 tranInvModel;
 uniform mat4 shadowMap;
 
@@ -25,4 +33,5 @@ void main()
 	outNormal = (tranInvModel * vec4(normal, 0.0)).xyz;
 	outTangent = model * vec4(tangent, 0.0);
 	outTexCoord = texCoord;
+	outTexLayer = texLayer;
 }
\ No newline at end of file
@@ -8,13 +8,20 @@ layout(location = 3) in vec2 texCoord;
 out vec3 outDir;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+
+layout(std140) uniform CameraBlock
+{
+	mat4 view;
+	mat4 projection;
+	vec3 viewPos;
+};
+
 uniform mat4 tranInvModel;
 
 void main()
 {
 	outDir = normalize(position);
-	gl_Position = projection * view * model * vec4(position, 1.0);
+	// the sky follows the camera rotation only
+	gl_Position = projection * mat4(mat3(view)) * model * vec4(position, 1.0);
 	gl_Position.z = gl_Position.w;
 }
\ No newline at end of file
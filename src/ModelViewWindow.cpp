@@ -3,114 +3,612 @@
 #include <iostream>
 #include <string>
 #include <sstream>
+#include <algorithm>
+#include <map>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <string.h>
 #include <SOIL.h>
+#include <glm/gtc/packing.hpp>
 
 #include "geohelper.h"
 #include "oshelper.h"
 #include "atbhelper.h"
 #include "samplinghelper.h"
+#include "../3rdparty/brdfestimator/src/meshcache.h"
 
 #define ITR_COUNT 1
+#define MODEL_CACHE_TAG "viewer_opt"
+
+// running sum and second moment of the progressive methods
+static const GLenum ENV_ACCUM_BUFFERS[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+static const GLfloat ENV_ACCUM_ZERO[] = { 0.f, 0.f, 0.f, 0.f };
 
 namespace BRDFModel
 {
-	void Mesh::Draw(NPGLHelper::Effect &effect)
+	void Mesh::CalcSpace()
+	{
+		std::vector<NPMathHelper::Vec3> points;
+		for (auto &vertex : m_vertices)
+		{
+			points.push_back(vertex.position);
+		}
+		m_space = SphericalSpace::CalcSpaceFromPoints(points);
+	}
+
+	const GLuint Model::TEXTURE_ARRAY_UNIT = 2;
+	const unsigned int Model::SHORT_INDEX_VERTICES = 65536;
+
+	namespace
+	{
+		// Diffuse arrays by the resolved paths of their maps, alive while a model holds a reference. Imports
+		// look them up on the worker, GL objects are only made and deleted on the render thread
+		struct SharedTexArray
+		{
+			GLuint id;
+			unsigned int refCount;
+			std::vector<GLint> fileLayers; // layer of every map in key order, -1 when it did not load
+			GLint whiteLayer;
+		};
+		std::map<std::string, SharedTexArray> sharedTexArrays;
+		std::mutex sharedTexArrayMutex;
+	}
+
+	Model::Model()
+		: m_pStaging(nullptr)
+		, m_uiVAO(0)
+		, m_uiDepthVAO(0)
+		, m_uiVBO(0)
+		, m_uiPositionVBO(0)
+		, m_uiEBO(0)
+		, m_uiLayerVBO(0)
+		, m_uiIndirectBuffer(0)
+		, m_uiTexArray(0)
+		, m_eIndexType(GL_UNSIGNED_INT)
+	{
+
+	}
+
+	Model::~Model()
+	{
+		for (auto &mesh : m_meshes)
+		{
+			if (mesh)
+				delete mesh;
+		}
+		m_meshes.clear();
+
+		// a failed import is deleted on the worker, before it has any GL objects
+		if (m_uiVAO)
+		{
+			glDeleteVertexArrays(1, &m_uiVAO);
+			glDeleteVertexArrays(1, &m_uiDepthVAO);
+			glDeleteBuffers(1, &m_uiVBO);
+			glDeleteBuffers(1, &m_uiPositionVBO);
+			glDeleteBuffers(1, &m_uiEBO);
+			glDeleteBuffers(1, &m_uiLayerVBO);
+			glDeleteBuffers(1, &m_uiIndirectBuffer);
+		}
+
+		// the reference is taken at import when the array already exists, otherwise once it is created
+		if (!m_sTexArrayKey.empty() && (m_uiTexArray || (m_pStaging && m_pStaging->texels.empty())))
+		{
+			std::lock_guard<std::mutex> lock(sharedTexArrayMutex);
+			auto it = sharedTexArrays.find(m_sTexArrayKey);
+			if (it != sharedTexArrays.end() && --it->second.refCount == 0)
+			{
+				glDeleteTextures(1, &it->second.id);
+				sharedTexArrays.erase(it);
+			}
+		}
+
+		if (m_pStaging)
+			delete m_pStaging;
+	}
+
+	void Model::Submit(NPGLHelper::RenderPass &pass, NPGLHelper::Effect* effect
+		, const std::vector<NPGLHelper::RenderPass::TextureBinding> &textures, const NPGLHelper::RenderPass::SetupFunc &setup
+		, const bool depthOnly)
+	{
+		if (m_meshes.empty() || m_pStaging)
+			return;
+
+		std::vector<NPGLHelper::RenderPass::TextureBinding> bindings;
+		if (!depthOnly)
+			bindings.push_back(NPGLHelper::RenderPass::MakeTexture(TEXTURE_ARRAY_UNIT, GL_TEXTURE_2D_ARRAY, m_uiTexArray, "texture_diffuse_array"));
+		bindings.insert(bindings.end(), textures.begin(), textures.end());
+		pass.AddMultiDraw(effect, depthOnly ? m_uiDepthVAO : m_uiVAO, m_uiIndirectBuffer, (GLsizei)m_meshes.size(), m_eIndexType, bindings, setup);
+	}
+
+	bool Model::Import(const char* path, const int maxTextureSize)
+	{
+		std::string sPath = path;
+		m_sDirectory = sPath.substr(0, sPath.find_last_of('\\'));
+		if (!LoadModelCache(sPath))
+		{
+			Assimp::Importer importer;
+			const aiScene* scene = importer.ReadFile(sPath.c_str(), aiProcess_Triangulate | aiProcess_FlipUVs 
+				| aiProcess_CalcTangentSpace | aiProcess_GenNormals);
+			if (!scene || scene->mFlags == AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+				return false;
+			ProcessNode(scene->mRootNode, scene);
+			SaveModelCache(sPath, scene);
+		}
+
+		m_pStaging = new Staging();
+		m_pStaging->stream = 0;
+		m_pStaging->offset = 0;
+		PackBuffers();
+		DecodeTextures(maxTextureSize);
+		return true;
+	}
+
+	bool Model::Upload(const size_t budget)
 	{
-		unsigned int diffuseNr = 1;
-		unsigned int specularNr = 1;
-		for (unsigned int i = 0; i < m_textures.size(); i++)
+		if (!m_pStaging)
+			return true;
+		if (!m_uiVAO)
+			CreateGLObjects();
+
+		Staging &staging = *m_pStaging;
+		const bool isShort = (m_eIndexType == GL_UNSIGNED_SHORT);
+		const GLuint buffers[] = { m_uiVBO, m_uiPositionVBO, m_uiEBO };
+		const void* data[] = { staging.vertices.data(), staging.positions.data()
+			, isShort ? (const void*)staging.shortIndices.data() : (const void*)staging.indices.data(), staging.texels.data() };
+		const size_t sizes[] = { staging.vertices.size() * sizeof(PackedVertex), staging.positions.size() * sizeof(GLfloat)
+			, isShort ? staging.shortIndices.size() * sizeof(GLushort) : staging.indices.size() * sizeof(GLuint), staging.texels.size() };
+		const unsigned int texelStream = 3;
+
+		size_t remaining = budget;
+		while (remaining > 0 && staging.stream <= texelStream)
 		{
-			glActiveTexture(GL_TEXTURE1 + i);
-			std::string texName = m_textures[i].name;
-			if (m_textures[i].type == 0)
+			const unsigned int stream = staging.stream;
+			const char* src = (const char*)data[stream] + staging.offset;
+			if (stream < texelStream)
+			{
+				// the copy target leaves the VAOs' element buffers alone
+				const size_t bytes = std::min(remaining, sizes[stream] - staging.offset);
+				if (bytes > 0)
+				{
+					glBindBuffer(GL_COPY_WRITE_BUFFER, buffers[stream]);
+					glBufferSubData(GL_COPY_WRITE_BUFFER, staging.offset, bytes, src);
+				}
+				staging.offset += bytes;
+				remaining -= bytes;
+			}
+			else if (sizes[stream] > 0)
 			{
-				texName += std::to_string(diffuseNr++);
+				// whole rows of one layer at a time
+				const size_t rowBytes = 3 * staging.texWidth;
+				const int row = (int)(staging.offset / rowBytes);
+				const int layer = row / staging.texHeight;
+				const int y = row % staging.texHeight;
+				const int rows = (int)std::max(std::min(remaining / rowBytes, (size_t)(staging.texHeight - y)), (size_t)1);
+				glBindTexture(GL_TEXTURE_2D_ARRAY, m_uiTexArray);
+				glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+				glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, y, layer, staging.texWidth, rows, 1, GL_RGB, GL_UNSIGNED_BYTE, src);
+				glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+				glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+				staging.offset += rows * rowBytes;
+				remaining -= std::min(remaining, rows * rowBytes);
 			}
+
+			if (staging.offset >= sizes[stream])
+			{
+				staging.stream++;
+				staging.offset = 0;
+			}
+		}
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		CHECK_GL_ERROR;
+
+		if (staging.stream <= texelStream)
+			return false;
+		if (!staging.texels.empty())
+		{
+			glBindTexture(GL_TEXTURE_2D_ARRAY, m_uiTexArray);
+			glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		}
+		delete m_pStaging;
+		m_pStaging = nullptr;
+		return true;
+	}
+
+	void Model::PackBuffers()
+	{
+		// All meshes share one vertex and one index buffer, each one is an indirect command into them.
+		// Indices are mesh relative, so they are 16 bit unless a mesh from an older cache is too large
+		m_eIndexType = GL_UNSIGNED_SHORT;
+		for (auto &mesh : m_meshes)
+		{
+			if (mesh->m_vertices.size() > SHORT_INDEX_VERTICES)
+				m_eIndexType = GL_UNSIGNED_INT;
+		}
+
+		Staging &staging = *m_pStaging;
+		for (auto &mesh : m_meshes)
+		{
+			mesh->m_uiBaseVertex = (GLuint)staging.vertices.size();
+			mesh->m_uiFirstIndex = (GLuint)(staging.indices.size() + staging.shortIndices.size());
+			if (m_eIndexType == GL_UNSIGNED_SHORT)
+				staging.shortIndices.insert(staging.shortIndices.end(), mesh->m_indices.begin(), mesh->m_indices.end());
 			else
+				staging.indices.insert(staging.indices.end(), mesh->m_indices.begin(), mesh->m_indices.end());
+			for (auto &vertex : mesh->m_vertices)
 			{
-				texName += std::to_string(specularNr++);
+				staging.positions.push_back(vertex.position._x);
+				staging.positions.push_back(vertex.position._y);
+				staging.positions.push_back(vertex.position._z);
+
+				PackedVertex packed;
+				packed.position[0] = vertex.position._x;
+				packed.position[1] = vertex.position._y;
+				packed.position[2] = vertex.position._z;
+				packed.normal = glm::packSnorm3x10_1x2(glm::vec4(vertex.normal._x, vertex.normal._y, vertex.normal._z, 0.f));
+				packed.tangent = glm::packSnorm3x10_1x2(glm::vec4(vertex.tangent._x, vertex.tangent._y, vertex.tangent._z, 0.f));
+				const glm::uint32 texCoords = glm::packHalf2x16(glm::vec2(vertex.texCoords._x, vertex.texCoords._y));
+				packed.texCoords[0] = (GLushort)(texCoords & 0xffff);
+				packed.texCoords[1] = (GLushort)(texCoords >> 16);
+				staging.vertices.push_back(packed);
 			}
-			glBindTexture(GL_TEXTURE_2D, m_textures[i].id);
-			effect.SetInt(texName.c_str(), i + 1);
+
+			DrawCommand command;
+			command.count = (GLuint)mesh->m_indices.size();
+			command.instanceCount = 1;
+			command.firstIndex = mesh->m_uiFirstIndex;
+			command.baseVertex = (GLint)mesh->m_uiBaseVertex;
+			command.baseInstance = (GLuint)staging.commands.size();
+			staging.commands.push_back(command);
 		}
-		glBindVertexArray(m_iVAO);
-		glDrawElements(GL_TRIANGLES, m_indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
 	}
 
-	void Mesh::SetupMesh()
+	void Model::DecodeTextures(const int maxTextureSize)
 	{
-		glGenVertexArrays(1, &m_iVAO);
-		glGenBuffers(1, &m_iVBO);
-		glGenBuffers(1, &m_iEBO);
+		// Only the first diffuse map of a mesh is sampled, and every file is read once however many meshes use it
+		std::vector<std::string> files;
+		std::vector<int> meshFiles;
+		std::map<std::string, int> fileIds;
+		for (auto &mesh : m_meshes)
+		{
+			int file = -1;
+			for (auto &texture : mesh->m_textures)
+			{
+				if (texture.type != 0)
+					continue;
+				const std::string path = NPOSHelper::GetResolvedPath(texture.path);
+				auto it = fileIds.find(path);
+				if (it == fileIds.end())
+				{
+					it = fileIds.insert(std::make_pair(path, (int)files.size())).first;
+					files.push_back(path);
+				}
+				file = it->second;
+				break;
+			}
+			meshFiles.push_back(file);
+		}
+
+		std::stringstream key;
+		key << maxTextureSize << "\n";
+		for (auto &file : files)
+			key << file << "\n";
+		m_sTexArrayKey = key.str();
+
+		Staging &staging = *m_pStaging;
+		std::vector<GLint> fileLayers(files.size(), -1);
+		GLint whiteLayer = 0;
+		bool isShared = false;
+		{
+			std::lock_guard<std::mutex> lock(sharedTexArrayMutex);
+			auto it = sharedTexArrays.find(m_sTexArrayKey);
+			if (it != sharedTexArrays.end())
+			{
+				// the reference keeps it alive until Upload picks it up
+				it->second.refCount++;
+				fileLayers = it->second.fileLayers;
+				whiteLayer = it->second.whiteLayer;
+				isShared = true;
+			}
+		}
+
+		if (!isShared)
+		{
+			// files are handed out one at a time to as many threads as there are cores
+			std::vector<unsigned char*> images(files.size(), nullptr);
+			std::vector<int> imageW(files.size(), 0), imageH(files.size(), 0);
+			std::atomic<unsigned int> nextFile(0);
+			auto decode = [&]()
+			{
+				for (unsigned int i = nextFile++; i < files.size(); i = nextFile++)
+					images[i] = SOIL_load_image(files[i].c_str(), &imageW[i], &imageH[i], 0, SOIL_LOAD_RGB);
+			};
+			const unsigned int threadCount = std::min((unsigned int)files.size(), std::max(std::thread::hardware_concurrency(), 1u));
+			std::vector<std::future<void>> decodes;
+			for (unsigned int t = 1; t < threadCount; t++)
+				decodes.push_back(std::async(std::launch::async, decode));
+			decode();
+			for (auto &task : decodes)
+				task.get();
+
+			// maps are resized to the largest one, nearest like the sampling, meshes without one read the white last layer
+			int width = 1, height = 1;
+			std::vector<unsigned int> loaded;
+			for (unsigned int i = 0; i < files.size(); i++)
+			{
+				if (!images[i])
+				{
+					DEBUG_COUT("Cannot load texture " << files[i]);
+					continue;
+				}
+				fileLayers[i] = (GLint)loaded.size();
+				loaded.push_back(i);
+				width = std::max(width, imageW[i]);
+				height = std::max(height, imageH[i]);
+			}
+			whiteLayer = (GLint)loaded.size();
+
+			staging.texWidth = std::min(width, maxTextureSize);
+			staging.texHeight = std::min(height, maxTextureSize);
+			staging.texLayers = whiteLayer + 1;
+			const size_t layerBytes = 3 * staging.texWidth * staging.texHeight;
+			staging.texels.resize(layerBytes * staging.texLayers);
+			for (unsigned int l = 0; l < loaded.size(); l++)
+			{
+				const unsigned int i = loaded[l];
+				unsigned char* dst = &staging.texels[l * layerBytes];
+				if (imageW[i] != staging.texWidth || imageH[i] != staging.texHeight)
+				{
+					for (int y = 0; y < staging.texHeight; y++)
+					{
+						const int sy = y * imageH[i] / staging.texHeight;
+						for (int x = 0; x < staging.texWidth; x++)
+						{
+							const int sx = x * imageW[i] / staging.texWidth;
+							memcpy(&dst[3 * (y * staging.texWidth + x)], &images[i][3 * (sy * imageW[i] + sx)], 3);
+						}
+					}
+				}
+				else
+				{
+					memcpy(dst, images[i], layerBytes);
+				}
+			}
+			std::fill(staging.texels.begin() + whiteLayer * layerBytes, staging.texels.end(), (unsigned char)255);
+			for (auto &image : images)
+			{
+				if (image)
+					SOIL_free_image_data(image);
+			}
+			staging.fileLayers = fileLayers;
+			staging.whiteLayer = whiteLayer;
+		}
+
+		for (unsigned int m = 0; m < m_meshes.size(); m++)
+		{
+			const GLint layer = (meshFiles[m] < 0) ? -1 : fileLayers[meshFiles[m]];
+			m_meshes[m]->m_iTexLayer = (layer < 0) ? whiteLayer : layer;
+			staging.layers.push_back((GLfloat)m_meshes[m]->m_iTexLayer);
+		}
+	}
 
-		glBindVertexArray(m_iVAO);
-		glBindBuffer(GL_ARRAY_BUFFER, m_iVBO);
-		glBufferData(GL_ARRAY_BUFFER, m_vertices.size() * sizeof(Vertex), m_vertices.data(), GL_STATIC_DRAW);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_iEBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_indices.size() * sizeof(GLuint), m_indices.data(), GL_STATIC_DRAW);
+	void Model::CreateGLObjects()
+	{
+		// storage for everything, only the small per-draw data is filled here
+		Staging &staging = *m_pStaging;
+		glGenVertexArrays(1, &m_uiVAO);
+		glGenVertexArrays(1, &m_uiDepthVAO);
+		glGenBuffers(1, &m_uiVBO);
+		glGenBuffers(1, &m_uiPositionVBO);
+		glGenBuffers(1, &m_uiEBO);
+		glGenBuffers(1, &m_uiLayerVBO);
+		glGenBuffers(1, &m_uiIndirectBuffer);
+
+		glBindVertexArray(m_uiVAO);
+		glBindBuffer(GL_ARRAY_BUFFER, m_uiVBO);
+		glBufferData(GL_ARRAY_BUFFER, staging.vertices.size() * sizeof(PackedVertex), nullptr, GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_uiEBO);
+		if (m_eIndexType == GL_UNSIGNED_SHORT)
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, staging.shortIndices.size() * sizeof(GLushort), nullptr, GL_STATIC_DRAW);
+		else
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, staging.indices.size() * sizeof(GLuint), nullptr, GL_STATIC_DRAW);
 
+		// the packed attributes still arrive in the shaders as vec3 and vec2
 		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(PackedVertex), (GLvoid*)0);
 		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, normal));
+		glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(PackedVertex), (GLvoid*)offsetof(PackedVertex, normal));
 		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, tangent));
+		glVertexAttribPointer(2, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(PackedVertex), (GLvoid*)offsetof(PackedVertex, tangent));
 		glEnableVertexAttribArray(3);
-		glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, texCoords));
-
+		glVertexAttribPointer(3, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (GLvoid*)offsetof(PackedVertex, texCoords));
+
+		// texture layer of the draw
+		glBindBuffer(GL_ARRAY_BUFFER, m_uiLayerVBO);
+		glBufferData(GL_ARRAY_BUFFER, staging.layers.size() * sizeof(GLfloat), staging.layers.data(), GL_STATIC_DRAW);
+		glEnableVertexAttribArray(4);
+		glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE, sizeof(GLfloat), (GLvoid*)0);
+		glVertexAttribDivisor(4, 1);
+
+		// the depth passes only read positions, packed tight in their own buffer
+		glBindVertexArray(m_uiDepthVAO);
+		glBindBuffer(GL_ARRAY_BUFFER, m_uiPositionVBO);
+		glBufferData(GL_ARRAY_BUFFER, staging.positions.size() * sizeof(GLfloat), nullptr, GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_uiEBO);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
 		glBindVertexArray(0);
 
-		std::vector<NPMathHelper::Vec3> points;
-		for (auto &vertex : m_vertices)
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_uiIndirectBuffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, staging.commands.size() * sizeof(DrawCommand), staging.commands.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		// another import of the same maps may have created the array since this one looked
+		std::lock_guard<std::mutex> lock(sharedTexArrayMutex);
+		auto it = sharedTexArrays.find(m_sTexArrayKey);
+		if (it != sharedTexArrays.end())
 		{
-			points.push_back(vertex.position);
+			if (!staging.texels.empty())
+			{
+				it->second.refCount++;
+				std::vector<unsigned char>().swap(staging.texels);
+			}
+			m_uiTexArray = it->second.id;
+			CHECK_GL_ERROR;
+			return;
 		}
-		m_space = SphericalSpace::CalcSpaceFromPoints(points);
-	}
 
+		// mipmaps are built once the last layer is in
+		GLsizei levels = 1;
+		for (int size = std::max(staging.texWidth, staging.texHeight); size > 1; size /= 2)
+			levels++;
+		glGenTextures(1, &m_uiTexArray);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, m_uiTexArray);
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, GL_RGB8, staging.texWidth, staging.texHeight, staging.texLayers);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		CHECK_GL_ERROR;
+
+		SharedTexArray shared;
+		shared.id = m_uiTexArray;
+		shared.refCount = 1;
+		shared.fileLayers = staging.fileLayers;
+		shared.whiteLayer = staging.whiteLayer;
+		sharedTexArrays[m_sTexArrayKey] = shared;
+	}
+
+	bool Model::LoadModelCache(const std::string &path)
+	{
+		MeshCache::Reader reader;
+		if (!reader.open(path, MODEL_CACHE_TAG))
+			return false;
 
-	Model::Model()
-	{
+		const std::vector<MeshCache::Material> &materials = reader.materials();
+		for (size_t i = 0; i < reader.meshCount(); i++)
+		{
+			MeshCache::MeshData data = reader.mesh(i);
+			const unsigned int vertCount = data.count[MeshCache::POSITION];
+			if (data.count[MeshCache::NORMAL] != vertCount || data.count[MeshCache::TANGENT] != vertCount
+				|| data.count[MeshCache::TEXCOORD] != vertCount || data.count[MeshCache::INDEX] % 3 != 0
+				|| data.material_id >= materials.size())
+				return false;
+		}
+
+		for (size_t i = 0; i < reader.meshCount(); i++)
+		{
+			MeshCache::MeshData data = reader.mesh(i);
+			const unsigned int vertCount = data.count[MeshCache::POSITION];
+			const float* position = data.floats(MeshCache::POSITION);
+			const float* normal = data.floats(MeshCache::NORMAL);
+			const float* tangent = data.floats(MeshCache::TANGENT);
+			const float* texCoord = data.floats(MeshCache::TEXCOORD);
+
+			std::vector<Vertex> vertices(vertCount);
+			for (unsigned int j = 0; j < vertCount; j++)
+			{
+				vertices[j].position = NPMathHelper::Vec3(position[3 * j], position[3 * j + 1], position[3 * j + 2]);
+				vertices[j].normal = NPMathHelper::Vec3(normal[3 * j], normal[3 * j + 1], normal[3 * j + 2]);
+				vertices[j].tangent = NPMathHelper::Vec3(tangent[3 * j], tangent[3 * j + 1], tangent[3 * j + 2]);
+				vertices[j].texCoords = NPMathHelper::Vec2(texCoord[2 * j], texCoord[2 * j + 1]);
+			}
+			std::vector<GLuint> indices(data.indices(), data.indices() + data.count[MeshCache::INDEX]);
+
+			// Material strings are (sampler name, texture file) pairs, values the texture type ids
+			std::vector<Texture> textures;
+			const MeshCache::Material &material = materials[data.material_id];
+			for (size_t t = 0; t < material.values.size() && 2 * t + 1 < material.strings.size(); t++)
+			{
+				Texture texture;
+				texture.path = m_sDirectory + "\\" + material.strings[2 * t + 1];
+				texture.name = material.strings[2 * t];
+				texture.type = (unsigned int)material.values[t];
+				textures.push_back(texture);
+			}
+
+			SphericalSpace space;
+			space.m_v3Center = NPMathHelper::Vec3(data.sphere[0], data.sphere[1], data.sphere[2]);
+			space.m_fRadius = data.sphere[3];
+			Mesh* loadedMesh = new Mesh(vertices, indices, textures, space);
+			loadedMesh->m_uiMaterialId = data.material_id;
+			m_meshes.push_back(loadedMesh);
+		}
 
+		const float* sphere = reader.sphere();
+		m_space.m_v3Center = NPMathHelper::Vec3(sphere[0], sphere[1], sphere[2]);
+		m_space.m_fRadius = sphere[3];
+		return true;
 	}
 
-	void Model::Draw(NPGLHelper::Effect &effect)
+	void Model::SaveModelCache(const std::string &path, const aiScene* scene)
 	{
-		for (auto &mesh : m_meshes)
+		std::vector<std::vector<float>> streams(m_meshes.size() * 4);
+		std::vector<MeshCache::MeshData> meshes(m_meshes.size());
+		for (size_t i = 0; i < m_meshes.size(); i++)
 		{
-			mesh->Draw(effect);
+			const std::vector<Vertex> &vertices = m_meshes[i]->m_vertices;
+			std::vector<float> &position = streams[4 * i];
+			std::vector<float> &normal = streams[4 * i + 1];
+			std::vector<float> &tangent = streams[4 * i + 2];
+			std::vector<float> &texCoord = streams[4 * i + 3];
+			for (auto &vertex : vertices)
+			{
+				position.push_back(vertex.position._x); position.push_back(vertex.position._y); position.push_back(vertex.position._z);
+				normal.push_back(vertex.normal._x); normal.push_back(vertex.normal._y); normal.push_back(vertex.normal._z);
+				tangent.push_back(vertex.tangent._x); tangent.push_back(vertex.tangent._y); tangent.push_back(vertex.tangent._z);
+				texCoord.push_back(vertex.texCoords._x); texCoord.push_back(vertex.texCoords._y);
+			}
+			meshes[i].set(MeshCache::POSITION, position.data(), vertices.size());
+			meshes[i].set(MeshCache::NORMAL, normal.data(), vertices.size());
+			meshes[i].set(MeshCache::TANGENT, tangent.data(), vertices.size());
+			meshes[i].set(MeshCache::TEXCOORD, texCoord.data(), vertices.size());
+			meshes[i].set(MeshCache::INDEX, m_meshes[i]->m_indices.data(), m_meshes[i]->m_indices.size());
+			meshes[i].material_id = m_meshes[i]->m_uiMaterialId;
+			const SphericalSpace &space = m_meshes[i]->m_space;
+			meshes[i].sphere[0] = space.m_v3Center._x; meshes[i].sphere[1] = space.m_v3Center._y;
+			meshes[i].sphere[2] = space.m_v3Center._z; meshes[i].sphere[3] = space.m_fRadius;
 		}
-	}
 
-	bool Model::LoadModel(const char* path)
-	{
-		Assimp::Importer importer;
-		std::string sPath = path;
-		const aiScene* scene = importer.ReadFile(sPath.c_str(), aiProcess_Triangulate | aiProcess_FlipUVs 
-			| aiProcess_CalcTangentSpace | aiProcess_GenNormals);
-		if (!scene || scene->mFlags == AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+		const aiTextureType types[] = { aiTextureType_DIFFUSE, aiTextureType_SPECULAR };
+		const char* names[] = { "texture_diffuse", "texture_specular" };
+		std::vector<MeshCache::Material> materials(scene->mNumMaterials);
+		for (unsigned int m = 0; m < scene->mNumMaterials; m++)
 		{
-			NPOSHelper::CreateMessageBox("Cannot load model.", "Model loading", NPOSHelper::MSGBOX_OK);
-			return false;
+			for (unsigned int typeId = 0; typeId < 2; typeId++)
+			{
+				for (unsigned int i = 0; i < scene->mMaterials[m]->GetTextureCount(types[typeId]); i++)
+				{
+					aiString str;
+					scene->mMaterials[m]->GetTexture(types[typeId], i, &str);
+					materials[m].strings.push_back(names[typeId]);
+					materials[m].strings.push_back(str.C_Str());
+					materials[m].values.push_back((float)typeId);
+				}
+			}
 		}
-		m_sDirectory = sPath.substr(0, sPath.find_last_of('\\'));
-		ProcessNode(scene->mRootNode, scene);
 
-		return true;
+		const float sphere[4] = { m_space.m_v3Center._x, m_space.m_v3Center._y, m_space.m_v3Center._z, m_space.m_fRadius };
+		MeshCache::write(path, MODEL_CACHE_TAG, meshes, materials, sphere, MeshCache::materialLibraries(path));
 	}
 
 	void Model::ProcessNode(aiNode* node, const aiScene* scene)
 	{
 		for (unsigned int i = 0; i < node->mNumMeshes; i++)
 		{
-			Mesh *loadedMesh = ProcessMesh(scene->mMeshes[node->mMeshes[i]], scene);
-			m_meshes.push_back(loadedMesh);
+			for (auto &loadedMesh : ProcessMesh(scene->mMeshes[node->mMeshes[i]], scene))
+			{
+				m_meshes.push_back(loadedMesh);
 
-			if (i == 0)
-				m_space = loadedMesh->m_space;
-			else
-				m_space = m_space.Merge(loadedMesh->m_space);
+				if (m_meshes.size() == 1)
+					m_space = loadedMesh->m_space;
+				else
+					m_space = m_space.Merge(loadedMesh->m_space);
+			}
 		}
 
 		for (unsigned int i = 0; i < node->mNumChildren; i++)
@@ -119,7 +617,7 @@ namespace BRDFModel
 		}
 	}
 
-	Mesh* Model::ProcessMesh(aiMesh* mesh, const aiScene* scene)
+	std::vector<Mesh*> Model::ProcessMesh(aiMesh* mesh, const aiScene* scene)
 	{
 		std::vector<Vertex> vertices;
 		std::vector<GLuint> indices;
@@ -164,8 +662,23 @@ namespace BRDFModel
 			
 		}
 
-		return new Mesh(vertices, indices, textures);
+		// triangles in cache order first, then each part numbers its vertices in the order that order reads them
+		NPGeoHelper::OptimizeVertexCache(indices, (unsigned int)vertices.size());
+		std::vector<NPGeoHelper::IndexBatch> batches
+			= NPGeoHelper::OptimizeVertexFetch(indices, (unsigned int)vertices.size(), SHORT_INDEX_VERTICES);
 
+		std::vector<Mesh*> result;
+		for (auto &batch : batches)
+		{
+			std::vector<Vertex> batchVertices;
+			batchVertices.reserve(batch.vertices.size());
+			for (auto &v : batch.vertices)
+				batchVertices.push_back(vertices[v]);
+			Mesh* loadedMesh = new Mesh(batchVertices, batch.indices, textures);
+			loadedMesh->m_uiMaterialId = mesh->mMaterialIndex;
+			result.push_back(loadedMesh);
+		}
+		return result;
 	}
 
 	std::vector<Texture> Model::LoadMaterialTextures(aiMaterial* mat, aiTextureType type, const char* name, const unsigned int typeId)
@@ -176,13 +689,10 @@ namespace BRDFModel
 			aiString str;
 			mat->GetTexture(type, i, &str);
 			Texture texture;
-			std::string fullpath = m_sDirectory + "\\" + str.C_Str();
-			if (NPGLHelper::loadTextureFromFile(fullpath.c_str(), texture.id, GL_CLAMP, GL_CLAMP, GL_LINEAR, GL_LINEAR))
-			{
-				texture.name = name;
-				texture.type = typeId;
-				textures.push_back(texture);
-			}
+			texture.path = m_sDirectory + "\\" + str.C_Str();
+			texture.name = name;
+			texture.type = typeId;
+			textures.push_back(texture);
 		}
 
 		return textures;
@@ -256,6 +766,13 @@ void TW_CALL RecordingStopButton(void* window)
 
 const unsigned int ModelViewWindow::SHADOW_WIDTH = 2048;
 const unsigned int ModelViewWindow::SHADOW_HEIGHT = 2048;
+const unsigned int ModelViewWindow::ENVSHADOW_CACHE_SIZE = 1024;
+const unsigned int ModelViewWindow::ENVSHADOW_CACHE_BUDGET_MB = 512;
+const unsigned int ModelViewWindow::CONVERGE_TILE_SIZE = 16;
+const unsigned int ModelViewWindow::CONVERGE_INTERVAL = 32;
+const unsigned int ModelViewWindow::CONVERGE_MIN_SAMP = 64;
+const float ModelViewWindow::RENDERSCALE_MIN = 0.25f;
+const unsigned int ModelViewWindow::MODEL_UPLOAD_BUDGET_MB = 8;
 
 ModelViewWindow::ModelViewWindow(const char* name, const int sizeW, const int sizeH)
 	: Window(name, sizeW, sizeH)
@@ -276,6 +793,7 @@ ModelViewWindow::ModelViewWindow(const char* name, const int sizeW, const int si
 	, m_bIsLoadModel(false)
 	, m_sModelName("None")
 	, m_pModel(nullptr)
+	, m_pUploadModel(nullptr)
 	, m_v3LightColor(1.f,1.f,1.f)
 	, m_bIsWireFrame(false)
 	, m_bIsSceneGUI(true)
@@ -293,6 +811,7 @@ ModelViewWindow::ModelViewWindow(const char* name, const int sizeW, const int si
 	, m_uiHDRFBO(0)
 	, m_uiHDRCB(0)
 	, m_uiHDRDB(0)
+	, m_uiHDRMomentCB(0)
 	, m_pFinalComposeEffect(nullptr)
 	, m_pDiffuseModelEffect(nullptr)
 	, m_pBlinnPhongModelEffect(nullptr)
@@ -304,6 +823,11 @@ ModelViewWindow::ModelViewWindow(const char* name, const int sizeW, const int si
 	, m_pBRDFEnvModelEffect(nullptr)
 	, m_pDepthEffect(nullptr)
 	, m_fExposure(1.f)
+	, m_bIsDynamicRes(true)
+	, m_fInteractScale(0.5f)
+	, m_fRenderScale(1.f)
+	, m_iRenderW(sizeW)
+	, m_iRenderH(sizeH)
 	, m_fEnvMapMultiplier(1.f)
 	, m_bIsShowFloor(true)
 	, m_iFloorTex(0)
@@ -313,6 +837,45 @@ ModelViewWindow::ModelViewWindow(const char* name, const int sizeW, const int si
 	, m_fShadowBiasMin(0.005f)
 	, m_fShadowBiasMax(0.05f)
 	, m_uiEnvShadowMaxSamp(2048)
+	, m_uiEnvSampIndex(0)
+	, m_uiEnvDepthMapFBO(0)
+	, m_uiEnvDepthMapArrayTex(0)
+	, m_uiEnvBatch(1)
+	, m_uiEnvMaxBatch(ENVSHADOW_MAX_BATCH)
+	, m_fEnvFrameBudget(33.f)
+	, m_fLastFrameTime(0.f)
+	, m_bIsRenderIdle(false)
+	, m_uiEnvBatchArrayTex(0)
+	, m_uiEnvBatchLayerOffset(0)
+	, m_uiEnvShadowCacheTex(0)
+	, m_uiEnvShadowCacheLayers(0)
+	, m_uiEnvShadowCacheCount(0)
+	, m_bIsEnvShadowCacheFloor(true)
+	, m_bIsEnvDeferred(true)
+	, m_bIsGBufferDirty(true)
+	, m_uiGBufferFBO(0)
+	, m_pGBufferEffect(nullptr)
+	, m_pEnvSDeferredEffect(nullptr)
+	, m_bIsEnvReproject(true)
+	, m_bIsEnvHistoryValid(false)
+	, m_bIsEnvReprojectPending(false)
+	, m_fEnvReprojectRejectDist(0.01f)
+	, m_iEnvSumW(sizeW)
+	, m_iEnvSumH(sizeH)
+	, m_bIsEnvHistorySaved(false)
+	, m_iEnvHistoryW(sizeW)
+	, m_iEnvHistoryH(sizeH)
+	, m_uiEnvHistoryFBO(0)
+	, m_pEnvReprojectEffect(nullptr)
+	, m_uiConvergeFBO(0)
+	, m_uiConvergeTex(0)
+	, m_uiConvergeTilesW(0)
+	, m_uiConvergeTilesH(0)
+	, m_pEnvConvergeEffect(nullptr)
+	, m_fEnvConvergeThreshold(0.02f)
+	, m_fEnvConvergeError(0.f)
+	, m_bIsEnvConverged(false)
+	, m_uiEnvLastConvergeSamp(0)
 	, m_recStatus(REC_NONE)
 	, m_fRecFPS(24)
 	, m_fRecCirSec(5.0f)
@@ -363,6 +926,12 @@ int ModelViewWindow::OnInit()
 		" label='Exposure' help='View Exposure' group='Display' step=0.1"));
 	ATB_ASSERT(TwAddVarRW(mainBar, "Show Floor", TW_TYPE_BOOLCPP, &m_bIsShowFloor,
 		" label='Show Floor' help='Show Floor' group='Display'"));
+	ATB_ASSERT(TwAddVarRW(mainBar, "Dynamic Resolution", TW_TYPE_BOOLCPP, &m_bIsDynamicRes,
+		" label='Dynamic Resolution' help='Render at a lower resolution while dragging' group='Display'"));
+	ATB_ASSERT(TwAddVarRW(mainBar, "Interact Scale", TW_TYPE_FLOAT, &m_fInteractScale,
+		" label='Interact Scale' help='Resolution scale while dragging' group='Display' min=0.25 max=1 step=0.05"));
+	ATB_ASSERT(TwAddVarRO(mainBar, "Render Scale", TW_TYPE_FLOAT, &m_fRenderScale,
+		" label='Render Scale' help='Resolution scale of the last frame' group='Display'"));
 	
 	TwEnumVal renderEV[] = { 
 		{ RENDERINGMETHOD_DIFFUSEDIRLIGHT, "Diffuse DirLight" },
@@ -381,6 +950,10 @@ int ModelViewWindow::OnInit()
 
 	ATB_ASSERT(TwAddVarRO(mainBar, "Rendering Progress", TW_TYPE_FLOAT, &m_fRenderingProgress,
 		"group='Display'"));
+	ATB_ASSERT(TwAddVarRW(mainBar, "Converge Threshold", TW_TYPE_FLOAT, &m_fEnvConvergeThreshold,
+		" label='Converge Threshold' help='Relative standard error every tile has to reach before the env shadow methods stop' group='Display' min=0 step=0.001"));
+	ATB_ASSERT(TwAddVarRO(mainBar, "Converge Error", TW_TYPE_FLOAT, &m_fEnvConvergeError,
+		" label='Converge Error' help='Worst tile error of the last check' group='Display'"));
 
 	ATB_ASSERT(TwAddVarRW(mainBar, "Light Ambient Color", TW_TYPE_COLOR3F, &m_dirLight.ambient, " group='Directional Light' "));
 	ATB_ASSERT(TwAddVarRW(mainBar, "Light Diffuse Color", TW_TYPE_COLOR3F, &m_dirLight.diffuse, " group='Directional Light' "));
@@ -394,6 +967,18 @@ int ModelViewWindow::OnInit()
 		"group='Shadow Mapping'"));
 	ATB_ASSERT(TwAddVarRW(mainBar, "Bias Max", TW_TYPE_FLOAT, &m_fShadowBiasMax,
 		"group='Shadow Mapping'"));
+	ATB_ASSERT(TwAddVarRW(mainBar, "Env Frame Budget", TW_TYPE_FLOAT, &m_fEnvFrameBudget,
+		" label='Env Frame Budget (ms)' help='Frame time the env shadow samples per frame adapt to' group='Shadow Mapping' min=1 step=1"));
+	ATB_ASSERT(TwAddVarRW(mainBar, "Env Max Batch", TW_TYPE_UINT32, &m_uiEnvMaxBatch,
+		" label='Env Max Batch' help='Most env shadow samples per frame' group='Shadow Mapping' min=1 max=8"));
+	ATB_ASSERT(TwAddVarRO(mainBar, "Env Batch", TW_TYPE_UINT32, &m_uiEnvBatch,
+		" label='Env Batch' help='Env shadow samples of the last frame' group='Shadow Mapping'"));
+	ATB_ASSERT(TwAddVarRW(mainBar, "Env Deferred", TW_TYPE_BOOLCPP, &m_bIsEnvDeferred,
+		" label='Env Deferred' help='Shade env shadow samples from a G-buffer' group='Shadow Mapping'"));
+	ATB_ASSERT(TwAddVarRW(mainBar, "Env Reproject", TW_TYPE_BOOLCPP, &m_bIsEnvReproject,
+		" label='Env Reproject' help='Keep the accumulated samples across camera moves (deferred only)' group='Shadow Mapping'"));
+	ATB_ASSERT(TwAddVarRW(mainBar, "Env Reject Dist", TW_TYPE_FLOAT, &m_fEnvReprojectRejectDist,
+		" label='Env Reject Dist' help='Largest position mismatch kept by the reprojection, relative to the view distance' group='Shadow Mapping' min=0 step=0.001"));
 
 	ATB_ASSERT(TwAddVarRW(mainBar, "Model Ambient Color", TW_TYPE_COLOR3F, &m_modelBlinnPhongMaterial.ambient, " group='Material' "));
 	ATB_ASSERT(TwAddVarRW(mainBar, "Model Diffuse Color", TW_TYPE_COLOR3F, &m_modelBlinnPhongMaterial.diffuse, " group='Material' "));
@@ -449,6 +1034,14 @@ int ModelViewWindow::OnInit()
 	m_AxisLine[2].Init(m_pShareContent);
 	m_InLine.Init(m_pShareContent);
 	CHECK_GL_ERROR;
+
+	// Frame Uniforms (bindings have to be known before the effects below are linked)
+	NPGLHelper::Effect::SetUniformBlockBinding("CameraBlock", FRAMEBLOCK_CAMERA);
+	NPGLHelper::Effect::SetUniformBlockBinding("LightBlock", FRAMEBLOCK_LIGHT);
+	NPGLHelper::Effect::SetUniformBlockBinding("SamplingBlock", FRAMEBLOCK_SAMPLING);
+	const GLsizeiptr frameBlockSizes[FRAMEBLOCK_N] = { sizeof(CameraBlock), sizeof(LightBlock), sizeof(SamplingBlock) };
+	m_frameUniforms.Init(frameBlockSizes, FRAMEBLOCK_N);
+	CHECK_GL_ERROR;
 	m_pDiffuseModelEffect = m_pShareContent->GetEffect("DiffuseModelEffect");
 	if (!m_pDiffuseModelEffect->GetIsLinked())
 	{
@@ -548,6 +1141,44 @@ int ModelViewWindow::OnInit()
 		m_pBRDFEnvSModelEffect->linkEffect();
 	}
 	CHECK_GL_ERROR;
+	m_pGBufferEffect = m_pShareContent->GetEffect("GBufferEffect");
+	if (!m_pGBufferEffect->GetIsLinked())
+	{
+		m_pGBufferEffect->initEffect();
+		m_pGBufferEffect->attachShaderFromFile("..\\shader\\ModelVS.glsl", GL_VERTEX_SHADER);
+		m_pGBufferEffect->attachShaderFromFile("..\\shader\\GBufferPS.glsl", GL_FRAGMENT_SHADER);
+		m_pGBufferEffect->linkEffect();
+		// the floor may draw before any model sets it, and two sampler types cannot share unit 0
+		m_pGBufferEffect->SetInt("texture_diffuse_array", BRDFModel::Model::TEXTURE_ARRAY_UNIT);
+	}
+	CHECK_GL_ERROR;
+	m_pEnvSDeferredEffect = m_pShareContent->GetEffect("EnvSDeferredEffect");
+	if (!m_pEnvSDeferredEffect->GetIsLinked())
+	{
+		m_pEnvSDeferredEffect->initEffect();
+		m_pEnvSDeferredEffect->attachShaderFromFile("..\\shader\\FinalComposeVS.glsl", GL_VERTEX_SHADER);
+		m_pEnvSDeferredEffect->attachShaderFromFile("..\\shader\\EnvSDeferredPS.glsl", GL_FRAGMENT_SHADER);
+		m_pEnvSDeferredEffect->linkEffect();
+	}
+	CHECK_GL_ERROR;
+	m_pEnvReprojectEffect = m_pShareContent->GetEffect("EnvReprojectEffect");
+	if (!m_pEnvReprojectEffect->GetIsLinked())
+	{
+		m_pEnvReprojectEffect->initEffect();
+		m_pEnvReprojectEffect->attachShaderFromFile("..\\shader\\FinalComposeVS.glsl", GL_VERTEX_SHADER);
+		m_pEnvReprojectEffect->attachShaderFromFile("..\\shader\\EnvReprojectPS.glsl", GL_FRAGMENT_SHADER);
+		m_pEnvReprojectEffect->linkEffect();
+	}
+	CHECK_GL_ERROR;
+	m_pEnvConvergeEffect = m_pShareContent->GetEffect("EnvConvergeEffect");
+	if (!m_pEnvConvergeEffect->GetIsLinked())
+	{
+		m_pEnvConvergeEffect->initEffect();
+		m_pEnvConvergeEffect->attachShaderFromFile("..\\shader\\FinalComposeVS.glsl", GL_VERTEX_SHADER);
+		m_pEnvConvergeEffect->attachShaderFromFile("..\\shader\\EnvConvergePS.glsl", GL_FRAGMENT_SHADER);
+		m_pEnvConvergeEffect->linkEffect();
+	}
+	CHECK_GL_ERROR;
 	m_pBlinnPhongNormalEnvSModelEffect = m_pShareContent->GetEffect("BlinnPhongNormalEnvSModelEffect");
 	if (!m_pBlinnPhongNormalEnvSModelEffect->GetIsLinked())
 	{
@@ -609,14 +1240,20 @@ int ModelViewWindow::OnInit()
 	glGenFramebuffers(1, &m_uiHDRFBO);
 	glGenTextures(1, &m_uiHDRCB);
 	glBindTexture(GL_TEXTURE_2D, m_uiHDRCB);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, m_iSizeW, m_iSizeH, 0, GL_RGB, GL_FLOAT, NULL);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, m_iSizeW, m_iSizeH, 0, GL_RGBA, GL_FLOAT, NULL);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glGenTextures(1, &m_uiHDRMomentCB);
+	glBindTexture(GL_TEXTURE_2D, m_uiHDRMomentCB);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, m_iSizeW, m_iSizeH, 0, GL_RGBA, GL_FLOAT, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 	glGenRenderbuffers(1, &m_uiHDRDB);
 	glBindRenderbuffer(GL_RENDERBUFFER, m_uiHDRDB);
 	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, m_iSizeW, m_iSizeH);
 	glBindFramebuffer(GL_FRAMEBUFFER, m_uiHDRFBO);
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_uiHDRCB, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, m_uiHDRMomentCB, 0);
 	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_uiHDRDB);
 	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
 	{
@@ -643,6 +1280,77 @@ int ModelViewWindow::OnInit()
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 	CHECK_GL_ERROR;
 
+	// G-buffer shares the HDR depth so the skybox is still occluded by the deferred scene
+	{
+		GLenum gbufferFormat[GBUFFER_N] = { GL_RGBA32F, GL_RGBA16F, GL_RGBA16F, GL_RGBA16F, GL_RGBA8 };
+		GLenum gbufferAttach[GBUFFER_N];
+		glGenFramebuffers(1, &m_uiGBufferFBO);
+		glGenTextures(GBUFFER_N, m_uiGBufferTex);
+		glBindFramebuffer(GL_FRAMEBUFFER, m_uiGBufferFBO);
+		for (unsigned int i = 0; i < GBUFFER_N; i++)
+		{
+			glBindTexture(GL_TEXTURE_2D, m_uiGBufferTex[i]);
+			glTexImage2D(GL_TEXTURE_2D, 0, gbufferFormat[i], m_iSizeW, m_iSizeH, 0, GL_RGBA, GL_FLOAT, NULL);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			gbufferAttach[i] = GL_COLOR_ATTACHMENT0 + i;
+			glFramebufferTexture2D(GL_FRAMEBUFFER, gbufferAttach[i], GL_TEXTURE_2D, m_uiGBufferTex[i], 0);
+		}
+		glDrawBuffers(GBUFFER_N, gbufferAttach);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_uiHDRDB);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		{
+			DEBUG_COUT("[!!!]FRAMEBUFFER::CREATION_FAILED" << std::endl);
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+	CHECK_GL_ERROR;
+
+	// previous view of the sums and the G-buffer positions, only filled right before a reprojection
+	{
+		GLenum historyAttach[ENVHISTORY_N];
+		glGenFramebuffers(1, &m_uiEnvHistoryFBO);
+		glGenTextures(ENVHISTORY_N, m_uiEnvHistoryTex);
+		glBindFramebuffer(GL_FRAMEBUFFER, m_uiEnvHistoryFBO);
+		for (unsigned int i = 0; i < ENVHISTORY_N; i++)
+		{
+			glBindTexture(GL_TEXTURE_2D, m_uiEnvHistoryTex[i]);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, m_iSizeW, m_iSizeH, 0, GL_RGBA, GL_FLOAT, NULL);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			historyAttach[i] = GL_COLOR_ATTACHMENT0 + i;
+			glFramebufferTexture2D(GL_FRAMEBUFFER, historyAttach[i], GL_TEXTURE_2D, m_uiEnvHistoryTex[i], 0);
+		}
+		glDrawBuffers(ENVHISTORY_N, historyAttach);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		{
+			DEBUG_COUT("[!!!]FRAMEBUFFER::CREATION_FAILED" << std::endl);
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+	CHECK_GL_ERROR;
+
+	// one texel per tile of the accumulation buffers
+	m_uiConvergeTilesW = (m_iSizeW + CONVERGE_TILE_SIZE - 1) / CONVERGE_TILE_SIZE;
+	m_uiConvergeTilesH = (m_iSizeH + CONVERGE_TILE_SIZE - 1) / CONVERGE_TILE_SIZE;
+	glGenFramebuffers(1, &m_uiConvergeFBO);
+	glGenTextures(1, &m_uiConvergeTex);
+	glBindTexture(GL_TEXTURE_2D, m_uiConvergeTex);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, m_uiConvergeTilesW, m_uiConvergeTilesH, 0, GL_RED, GL_FLOAT, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_uiConvergeFBO);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_uiConvergeTex, 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		DEBUG_COUT("[!!!]FRAMEBUFFER::CREATION_FAILED" << std::endl);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	CHECK_GL_ERROR;
+
 	m_pFinalComposeEffect = m_pShareContent->GetEffect("FinalComposeEffect");
 	if (!m_pFinalComposeEffect->GetIsLinked())
 	{
@@ -669,6 +1377,44 @@ int ModelViewWindow::OnInit()
 		glDrawBuffer(GL_NONE);
 		glReadBuffer(GL_NONE);
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		glGenFramebuffers(1, &m_uiEnvDepthMapFBO);
+		glGenTextures(1, &m_uiEnvDepthMapArrayTex);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, m_uiEnvDepthMapArrayTex);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, ENVSHADOW_MAX_BATCH, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+		glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, borderColor);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, m_uiEnvDepthMapFBO);
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_uiEnvDepthMapArrayTex, 0, 0);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		// 16 bits depth at half resolution, as many layers as the budget allows
+		GLint maxLayers = 0;
+		glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+		m_uiEnvShadowCacheLayers = ENVSHADOW_CACHE_BUDGET_MB * 1024 * 1024 / (ENVSHADOW_CACHE_SIZE * ENVSHADOW_CACHE_SIZE * 2);
+		if (m_uiEnvShadowCacheLayers > (unsigned int)maxLayers) m_uiEnvShadowCacheLayers = maxLayers;
+		if (m_uiEnvShadowCacheLayers > m_uiEnvShadowMaxSamp) m_uiEnvShadowCacheLayers = m_uiEnvShadowMaxSamp;
+		while (glGetError() != GL_NO_ERROR);
+		glGenTextures(1, &m_uiEnvShadowCacheTex);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, m_uiEnvShadowCacheTex);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT16, ENVSHADOW_CACHE_SIZE, ENVSHADOW_CACHE_SIZE, m_uiEnvShadowCacheLayers, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+		if (glGetError() != GL_NO_ERROR)
+		{
+			DEBUG_COUT("[!!!]ENVSHADOWCACHE::CREATION_FAILED" << std::endl);
+			m_uiEnvShadowCacheLayers = 0;
+		}
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+		glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, borderColor);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
 	}
 
 
@@ -686,6 +1432,8 @@ int ModelViewWindow::OnInit()
 
 int ModelViewWindow::OnTick(const float deltaTime)
 {
+	m_fLastFrameTime = deltaTime;
+
 	// Camera control - bgn
 	glm::vec2 cursorMoved = m_v2CurrentCursorPos - m_v2LastCursorPos;
 	if (m_recStatus == REC_NONE)
@@ -717,8 +1465,32 @@ int ModelViewWindow::OnTick(const float deltaTime)
 	m_v2LastCursorPos = m_v2CurrentCursorPos;
 	// Camera control - end
 
+	UpdateModelLoading();
+
+	// Dynamic resolution - bgn
+	float renderScale = 1.f;
+	if (m_bIsDynamicRes && m_recStatus == REC_NONE && (m_bIsCamRotate || m_bIsInRotate))
+	{
+		// start from the interaction scale and keep shrinking while the frames still miss the budget
+		renderScale = (m_fRenderScale < 1.f) ? m_fRenderScale : std::min(std::max(m_fInteractScale, RENDERSCALE_MIN), 1.f);
+		if (m_fLastFrameTime * 1000.f > m_fEnvFrameBudget)
+			renderScale = std::max(renderScale * 0.75f, RENDERSCALE_MIN);
+	}
+	if (renderScale != m_fRenderScale)
+	{
+		m_fRenderScale = renderScale;
+		m_iRenderW = std::max((int)(m_iSizeW * m_fRenderScale), 1);
+		m_iRenderH = std::max((int)(m_iSizeH * m_fRenderScale), 1);
+		// the accumulated samples are laid out for the old size, they are warped to the new one like a camera move
+		m_uiEnvInitSamp = 0;
+		m_bIsEnvReprojectPending = m_bIsEnvReproject && m_bIsEnvDeferred;
+	}
+	// Dynamic resolution - end
 
 	glBindFramebuffer(GL_FRAMEBUFFER, m_uiHDRFBO);
+	glViewport(0, 0, m_iRenderW, m_iRenderH);
+	// the compose pass, the tweak bar and the loaders bind behind the cache's back
+	m_renderState.Invalidate();
 	switch (m_eRenderingMethod)
 	{
 	case RENDERINGMETHOD_DIFFUSEDIRLIGHT:
@@ -749,6 +1521,34 @@ int ModelViewWindow::OnTick(const float deltaTime)
 		RenderMethod_BlinnPhongEnvMapS();
 		break;
 	}
+	m_renderState.SetPolygonMode(GL_FILL);
+	m_renderState.SetBlend(false);
+	m_renderState.SetCullFace(true);
+	m_renderState.SetDepthTest(true);
+	m_renderState.UseProgram(0);
+	m_renderState.BindVertexArray(0);
+
+	// idle once the next tick would draw the same image : the progressive methods are done and nothing is being dragged
+	switch (m_eRenderingMethod)
+	{
+	case RENDERINGMETHOD_DIFFUSEENVMAP:
+	case RENDERINGMETHOD_BLINNPHONGENVMAP:
+		m_bIsRenderIdle = !m_pModel || m_uiEnvInitSamp + ITR_COUNT > m_uiMaxSampling;
+		break;
+	case RENDERINGMETHOD_BRDFENVMAP:
+		m_bIsRenderIdle = !m_pModel || m_uiEnvInitSamp + ITR_COUNT > m_uiNPH * m_uiNTH;
+		break;
+	case RENDERINGMETHOD_DIFFUSEENVMAPS:
+	case RENDERINGMETHOD_BLINNPHONGENVMAPS:
+	case RENDERINGMETHOD_BRDFENVMAPS:
+		m_bIsRenderIdle = !m_pModel || m_uiEnvInitSamp >= m_uiEnvShadowMaxSamp || m_bIsEnvConverged;
+		break;
+	default:
+		m_bIsRenderIdle = true;
+		break;
+	}
+	m_bIsRenderIdle = m_bIsRenderIdle && !m_bIsCamRotate && !m_bIsInRotate && m_recStatus == REC_NONE && m_fRenderScale >= 1.f
+		&& !m_futureModelImport.valid() && !m_pUploadModel;
 
 	// Recording - BGN
 	if (m_recStatus != REC_NONE)
@@ -771,6 +1571,8 @@ int ModelViewWindow::OnTick(const float deltaTime)
 				glBindTexture(GL_TEXTURE_2D, m_uiHDRCB);
 				m_pFinalComposeEffect->SetInt("hdrBuffer", 0);
 				m_pFinalComposeEffect->SetFloat("exposure", m_fExposure);
+				m_pFinalComposeEffect->SetVec2("render_scale", 1.f, 1.f);
+				m_pFinalComposeEffect->SetInt("use_sample_count", GetIsSampleSum() ? 1 : 0);
 				RenderScreenQuad();
 				glBindTexture(GL_TEXTURE_2D, 0);
 				m_pFinalComposeEffect->deactiveEffect();
@@ -821,12 +1623,15 @@ int ModelViewWindow::OnTick(const float deltaTime)
 	// Recording - END
 
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, m_iSizeW, m_iSizeH);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	m_pFinalComposeEffect->activeEffect();
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, m_uiHDRCB);
 	m_pFinalComposeEffect->SetInt("hdrBuffer", 0);
 	m_pFinalComposeEffect->SetFloat("exposure", m_fExposure);
+	m_pFinalComposeEffect->SetVec2("render_scale", (float)m_iRenderW / (float)m_iSizeW, (float)m_iRenderH / (float)m_iSizeH);
+	m_pFinalComposeEffect->SetInt("use_sample_count", GetIsSampleSum() ? 1 : 0);
 	RenderScreenQuad();
 	glBindTexture(GL_TEXTURE_2D, 0);
 	m_pFinalComposeEffect->deactiveEffect();
@@ -864,6 +1669,19 @@ int ModelViewWindow::OnTick(const float deltaTime)
 
 void ModelViewWindow::OnTerminate()
 {
+	// an import still running is waited for, nothing of it is on the GPU yet
+	if (m_futureModelImport.valid())
+		delete m_futureModelImport.get();
+	if (m_pUploadModel)
+	{
+		delete m_pUploadModel;
+		m_pUploadModel = nullptr;
+	}
+	if (m_pModel)
+	{
+		delete m_pModel;
+		m_pModel = nullptr;
+	}
 	NPTwTerminate(m_uiID);
 }
 
@@ -912,32 +1730,85 @@ void ModelViewWindow::OpenModelData()
 	if (file.empty())
 		return;
 
-	if (m_pModel)
+	// an import cannot be cancelled, the newest pick starts when the running one is done
+	if (m_futureModelImport.valid())
+		m_sQueuedImportPath = file;
+	else
+		StartModelImport(file);
+}
+
+void ModelViewWindow::StartModelImport(const std::string& path)
+{
+	if (m_pUploadModel)
 	{
-		delete m_pModel;
-		m_pModel = NULL;
+		delete m_pUploadModel;
+		m_pUploadModel = nullptr;
 	}
 
-	m_pModel = new BRDFModel::Model();
-	if (!m_pModel->LoadModel(file.c_str()))
+	GLint maxTextureSize = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+	m_sImportPath = path;
+	m_futureModelImport = std::async(std::launch::async, [path, maxTextureSize]() -> BRDFModel::Model*
 	{
-		std::string message = "Cannot load file ";
-		message = message + file;
-		NPOSHelper::CreateMessageBox(message.c_str(), "Load BRDF Data Failure", NPOSHelper::MSGBOX_OK);
-		return;
-	}
-	m_sModelName = file.c_str();
-	m_bIsLoadModel = true;
+		BRDFModel::Model* model = new BRDFModel::Model();
+		if (!model->Import(path.c_str(), maxTextureSize))
+		{
+			delete model;
+			return nullptr;
+		}
+		return model;
+	});
 }
 
-void ModelViewWindow::SetBRDFData(const char* path, unsigned int n_th, unsigned int n_ph)
+void ModelViewWindow::UpdateModelLoading()
 {
-	m_bIsBRDFUpdated = false;
-	m_sNewBRDFPath = path;
-	m_uiNewTH = n_th;
-	m_uiNewPH = n_ph;
-}
-
+	if (m_futureModelImport.valid() && m_futureModelImport.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+	{
+		BRDFModel::Model* model = m_futureModelImport.get();
+		if (!m_sQueuedImportPath.empty())
+		{
+			if (model)
+				delete model;
+			StartModelImport(m_sQueuedImportPath);
+			m_sQueuedImportPath.clear();
+			return;
+		}
+
+		if (!model)
+		{
+			std::string message = "Cannot load file ";
+			message = message + m_sImportPath;
+			NPOSHelper::CreateMessageBox(message.c_str(), "Load Model Failure", NPOSHelper::MSGBOX_OK);
+			return;
+		}
+		m_pUploadModel = model;
+	}
+
+	if (!m_pUploadModel || !m_pUploadModel->Upload(MODEL_UPLOAD_BUDGET_MB * 1024 * 1024))
+		return;
+
+	if (m_pModel)
+		delete m_pModel;
+	m_pModel = m_pUploadModel;
+	m_pUploadModel = nullptr;
+	m_uiEnvShadowCacheCount = 0;
+	m_uiEnvInitSamp = 0;
+	m_bIsEnvHistoryValid = false;
+	m_bIsEnvHistorySaved = false;
+	m_sModelName = m_sImportPath;
+	m_bIsLoadModel = true;
+}
+
+void ModelViewWindow::SetBRDFData(const char* path, unsigned int n_th, unsigned int n_ph)
+{
+	m_bIsBRDFUpdated = false;
+	m_sNewBRDFPath = path;
+	m_uiNewTH = n_th;
+	m_uiNewPH = n_ph;
+	// set from the visualizer's tick, the app skips idle windows without input so this one has to wake up
+	m_bIsRenderIdle = false;
+}
+
 
 void ModelViewWindow::SetCubemap(unsigned int side)
 {
@@ -963,6 +1834,13 @@ void ModelViewWindow::LoadCubemap()
 	m_bIsEnvMapLoaded = true;
 }
 
+bool ModelViewWindow::GetIsSampleSum() const
+{
+	return m_eRenderingMethod == RENDERINGMETHOD_DIFFUSEENVMAPS
+		|| m_eRenderingMethod == RENDERINGMETHOD_BLINNPHONGENVMAPS
+		|| m_eRenderingMethod == RENDERINGMETHOD_BRDFENVMAPS;
+}
+
 void ModelViewWindow::SetRenderingMethod(RENDERINGMETHODS method)
 {
 	switch (m_eRenderingMethod)
@@ -1050,6 +1928,10 @@ void ModelViewWindow::UpdateBRDFData()
 	if (!m_bIsBRDFUpdated)
 	{
 		m_bIsBRDFUpdated = true;
+		// the accumulated samples were shaded with the old table
+		m_uiEnvInitSamp = 0;
+		m_bIsEnvHistoryValid = false;
+		m_bIsEnvHistorySaved = false;
 
 		if (m_bIsLoadTexture)
 		{
@@ -1065,7 +1947,10 @@ void ModelViewWindow::UpdateBRDFData()
 
 		int width, height;
 		//if (!NPGLHelper::loadTextureFromFile(m_sNewBRDFPath.c_str(), m_iBRDFEstTex, GL_REPEAT, GL_REPEAT, GL_NEAREST, GL_NEAREST, false))
-		if (!NPGLHelper::loadHDRTextureFromFile(m_sNewBRDFPath.c_str(), m_iBRDFEstTex, GL_REPEAT, GL_REPEAT, GL_NEAREST, GL_NEAREST))
+		bool isLoaded = NPGLHelper::loadBRDFTextureFromFile(m_sNewBRDFPath.c_str(), m_iBRDFEstTex, m_uiNewTH, m_uiNewPH);
+		// the old name may be reused and the loader leaves its texture bound
+		m_renderState.Invalidate();
+		if (!isLoaded)
 		{
 			std::string message = "Cannot load file ";
 			message = message + m_sNewBRDFPath;
@@ -1079,254 +1964,148 @@ void ModelViewWindow::UpdateBRDFData()
 	}
 }
 
-void ModelViewWindow::RenderMethod_DiffuseDirLight()
+void ModelViewWindow::UpdateFrameUniforms(const unsigned int maxSamp)
 {
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-	// Depth rendering
-	if (m_pModel)
-	{
-		m_dirLight.dir._y = -sin(m_fInYaw);
-		m_dirLight.dir._x = -cos(m_fInYaw) * sin(m_fInPitch);
-		m_dirLight.dir._z = -cos(m_fInYaw) * cos(m_fInPitch);
-		Render_ShadowMap(m_dirLight.dir);
-	}
-
-	if (m_bIsWireFrame)
-		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-	else
-		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-
-	UpdateBRDFData();
-	if (/*m_bIsLoadTexture &&*/ m_pModel)
-	{
-		NPMathHelper::Mat4x4 myProj = NPMathHelper::Mat4x4::perspectiveProjection(M_PI * 0.5f, (float)m_iSizeW / (float)m_iSizeH, 0.1f, 100.0f);
-		NPMathHelper::Mat4x4 modelMat = NPMathHelper::Mat4x4::mul(NPMathHelper::Mat4x4::translation(m_v3ModelPos)
-			, NPMathHelper::Mat4x4::mul(NPMathHelper::Mat4x4::rotationTransform(m_v3ModelRot)
-			, NPMathHelper::Mat4x4::scaleTransform(m_fModelScale, m_fModelScale, m_fModelScale)));
-		NPMathHelper::Mat4x4 tranInvModelMat = NPMathHelper::Mat4x4::transpose(NPMathHelper::Mat4x4::inverse(modelMat));
-		m_pDiffuseModelEffect->activeEffect();
-		m_pDiffuseModelEffect->SetMatrix("projection", myProj.GetDataColumnMajor());
-		m_pDiffuseModelEffect->SetMatrix("view", m_Cam.GetViewMatrix());
-		m_pDiffuseModelEffect->SetMatrix("model", modelMat.GetDataColumnMajor());
-		m_pDiffuseModelEffect->SetMatrix("tranInvModel", tranInvModelMat.GetDataColumnMajor());
-
-		m_dirLight.dir._y = -sin(m_fInYaw);
-		m_dirLight.dir._x = -cos(m_fInYaw) * sin(m_fInPitch);
-		m_dirLight.dir._z = -cos(m_fInYaw) * cos(m_fInPitch);
-
-		m_pDiffuseModelEffect->SetVec3("material.ambient", m_modelBlinnPhongMaterial.ambient);
-		m_pDiffuseModelEffect->SetVec3("material.diffuse", m_modelBlinnPhongMaterial.diffuse);
-		m_pDiffuseModelEffect->SetVec3("material.specular", m_modelBlinnPhongMaterial.specular);
-		m_pDiffuseModelEffect->SetFloat("material.shininess", m_modelBlinnPhongMaterial.shininess);
-
-		m_pDiffuseModelEffect->SetVec3("light.ambient", m_dirLight.ambient * m_fLightIntMultiplier);
-		m_pDiffuseModelEffect->SetVec3("light.diffuse", m_dirLight.diffuse * m_fLightIntMultiplier);
-		m_pDiffuseModelEffect->SetVec3("light.specular", m_dirLight.specular * m_fLightIntMultiplier);
-		m_pDiffuseModelEffect->SetVec3("light.dir", m_dirLight.dir);
-
-		m_pDiffuseModelEffect->SetVec3("viewPos", m_Cam.GetPos());
-
-		m_pDiffuseModelEffect->SetFloat("biasMin", m_fShadowBiasMin); CHECK_GL_ERROR;
-		m_pDiffuseModelEffect->SetFloat("biasMax", m_fShadowBiasMax); CHECK_GL_ERROR;
-		m_pDiffuseModelEffect->SetMatrix("shadowMap", m_matShadowMapMat.GetDataColumnMajor()); CHECK_GL_ERROR;
-		glActiveTexture(GL_TEXTURE5); CHECK_GL_ERROR;
-		glBindTexture(GL_TEXTURE_2D, m_uiDepthMapTex); CHECK_GL_ERROR;
-		m_pDiffuseModelEffect->SetInt("texture_shadow", 5); CHECK_GL_ERROR;
-
-		m_pModel->Draw(*m_pDiffuseModelEffect);
-
-
-		m_pDiffuseModelEffect->deactiveEffect();
-	}
-
-	if (m_bIsShowFloor)
-	{
+	CameraBlock camera;
+	NPMathHelper::Mat4x4 myProj = NPMathHelper::Mat4x4::perspectiveProjection(M_PI * 0.5f, (float)m_iSizeW / (float)m_iSizeH, 0.1f, 100.0f);
+	memcpy(camera.view, m_Cam.GetViewMatrix(), sizeof(camera.view));
+	memcpy(camera.projection, myProj.GetDataColumnMajor(), sizeof(camera.projection));
+	NPMathHelper::Vec3 camPos = m_Cam.GetPos();
+	camera.viewPos[0] = camPos._x; camera.viewPos[1] = camPos._y; camera.viewPos[2] = camPos._z; camera.viewPos[3] = 1.f;
+
+	m_dirLight.dir._y = -sin(m_fInYaw);
+	m_dirLight.dir._x = -cos(m_fInYaw) * sin(m_fInPitch);
+	m_dirLight.dir._z = -cos(m_fInYaw) * cos(m_fInPitch);
+	LightBlock light;
+	const NPMathHelper::Vec3 lightVecs[4] = { m_dirLight.dir, m_dirLight.ambient * m_fLightIntMultiplier
+		, m_dirLight.diffuse * m_fLightIntMultiplier, m_dirLight.specular * m_fLightIntMultiplier };
+	float* lightDst[4] = { light.dir, light.ambient, light.diffuse, light.specular };
+	for (unsigned int i = 0; i < 4; i++)
+	{
+		lightDst[i][0] = lightVecs[i]._x; lightDst[i][1] = lightVecs[i]._y; lightDst[i][2] = lightVecs[i]._z; lightDst[i][3] = 0.f;
+	}
+	light.color[0] = m_v3LightColor.x * m_fLightIntMultiplier;
+	light.color[1] = m_v3LightColor.y * m_fLightIntMultiplier;
+	light.color[2] = m_v3LightColor.z * m_fLightIntMultiplier;
+	light.color[3] = 0.f;
+
+	SamplingBlock sampling;
+	sampling.n_th = m_uiNTH;
+	sampling.n_ph = m_uiNPH;
+	sampling.init_samp = m_uiEnvInitSamp;
+	sampling.max_samp = maxSamp;
+	sampling.env_multiplier = m_fEnvMapMultiplier;
+	sampling.pad[0] = sampling.pad[1] = sampling.pad[2] = 0.f;
+
+	const void* blocks[FRAMEBLOCK_N] = { &camera, &light, &sampling };
+	m_frameUniforms.Update(blocks);
+	CHECK_GL_ERROR;
+}
 
-		NPMathHelper::Mat4x4 myProj = NPMathHelper::Mat4x4::perspectiveProjection(M_PI * 0.5f, (float)m_iSizeW / (float)m_iSizeH, 0.1f, 100.0f);
-		NPMathHelper::Mat4x4 modelMat = NPMathHelper::Mat4x4::Identity();
-		NPMathHelper::Mat4x4 tranInvModelMat = NPMathHelper::Mat4x4::transpose(NPMathHelper::Mat4x4::inverse(modelMat));
+NPMathHelper::Mat4x4 ModelViewWindow::GetModelMat()
+{
+	return NPMathHelper::Mat4x4::mul(NPMathHelper::Mat4x4::translation(m_v3ModelPos)
+		, NPMathHelper::Mat4x4::mul(NPMathHelper::Mat4x4::rotationTransform(m_v3ModelRot)
+		, NPMathHelper::Mat4x4::scaleTransform(m_fModelScale, m_fModelScale, m_fModelScale)));
+}
 
-		m_pDiffuseNormalModelEffect->activeEffect();
-		m_pDiffuseNormalModelEffect->SetMatrix("projection", myProj.GetDataColumnMajor());
-		m_pDiffuseNormalModelEffect->SetMatrix("view", m_Cam.GetViewMatrix());
-		m_pDiffuseNormalModelEffect->SetMatrix("model", modelMat.GetDataColumnMajor());
-		m_pDiffuseNormalModelEffect->SetMatrix("tranInvModel", tranInvModelMat.GetDataColumnMajor());
+void ModelViewWindow::SetMaterial(NPGLHelper::Effect& effect, const Material& material)
+{
+	effect.SetVec3("material.ambient", material.ambient);
+	effect.SetVec3("material.diffuse", material.diffuse);
+	effect.SetVec3("material.specular", material.specular);
+	effect.SetFloat("material.shininess", material.shininess);
+}
 
-		m_dirLight.dir._y = -sin(m_fInYaw);
-		m_dirLight.dir._x = -cos(m_fInYaw) * sin(m_fInPitch);
-		m_dirLight.dir._z = -cos(m_fInYaw) * cos(m_fInPitch);
+void ModelViewWindow::SetDirLightShadow(NPGLHelper::Effect& effect)
+{
+	effect.SetFloat("biasMin", m_fShadowBiasMin);
+	effect.SetFloat("biasMax", m_fShadowBiasMax);
+	effect.SetMatrix("shadowMap", m_matShadowMapMat.GetDataColumnMajor());
+}
 
-		m_pDiffuseNormalModelEffect->SetVec3("material.ambient", m_floorMaterial.ambient);
-		m_pDiffuseNormalModelEffect->SetVec3("material.diffuse", m_floorMaterial.diffuse);
-		m_pDiffuseNormalModelEffect->SetVec3("material.specular", m_floorMaterial.specular);
-		m_pDiffuseNormalModelEffect->SetFloat("material.shininess", m_floorMaterial.shininess);
-
-		m_pDiffuseNormalModelEffect->SetVec3("light.ambient", m_dirLight.ambient * m_fLightIntMultiplier);
-		m_pDiffuseNormalModelEffect->SetVec3("light.diffuse", m_dirLight.diffuse * m_fLightIntMultiplier);
-		m_pDiffuseNormalModelEffect->SetVec3("light.specular", m_dirLight.specular * m_fLightIntMultiplier);
-		m_pDiffuseNormalModelEffect->SetVec3("light.dir", m_dirLight.dir);
-
-		m_pDiffuseNormalModelEffect->SetVec3("viewPos", m_Cam.GetPos());
-
-		m_pDiffuseNormalModelEffect->SetFloat("biasMin", m_fShadowBiasMin);
-		m_pDiffuseNormalModelEffect->SetFloat("biasMax", m_fShadowBiasMax);
-		m_pDiffuseNormalModelEffect->SetMatrix("shadowMap", m_matShadowMapMat.GetDataColumnMajor());
-		glActiveTexture(GL_TEXTURE5); CHECK_GL_ERROR;
-		glBindTexture(GL_TEXTURE_2D, m_uiDepthMapTex); CHECK_GL_ERROR;
-		m_pDiffuseNormalModelEffect->SetInt("texture_shadow", 5); CHECK_GL_ERROR;
-
-		glActiveTexture(GL_TEXTURE0); CHECK_GL_ERROR;
-		glBindTexture(GL_TEXTURE_2D, m_iFloorTex); CHECK_GL_ERROR;
-		m_pDiffuseNormalModelEffect->SetInt("texture_diffuse1", 0); CHECK_GL_ERROR;
-
-		glActiveTexture(GL_TEXTURE1); CHECK_GL_ERROR;
-		glBindTexture(GL_TEXTURE_2D, m_iFloorNormalTex); CHECK_GL_ERROR;
-		m_pDiffuseNormalModelEffect->SetInt("texture_normal1", 1); CHECK_GL_ERROR;
-
-		// Draw Floor Plane
-		NPMathHelper::Mat4x4 floorModelMat = NPMathHelper::Mat4x4::Identity();
-		NPMathHelper::Mat4x4 floorTranInvModelMat = NPMathHelper::Mat4x4::transpose(NPMathHelper::Mat4x4::inverse(floorModelMat));
-		m_pDiffuseNormalModelEffect->SetMatrix("model", floorModelMat.GetDataColumnMajor()); CHECK_GL_ERROR;
-		m_pDiffuseNormalModelEffect->SetMatrix("tranInvModel", floorTranInvModelMat.GetDataColumnMajor()); CHECK_GL_ERROR;
-		glBindVertexArray(m_floor.GetVAO()); CHECK_GL_ERROR;
-		glDrawElements(GL_TRIANGLES, m_floor.GetIndicesSize(), GL_UNSIGNED_INT, 0); CHECK_GL_ERROR;
-		glBindVertexArray(0);
+void ModelViewWindow::AddModelDraws(NPGLHelper::RenderPass& pass, NPGLHelper::Effect* effect, const NPMathHelper::Mat4x4& modelMat
+	, const TextureBindings& textures, const NPGLHelper::RenderPass::SetupFunc& setup)
+{
+	const NPMathHelper::Mat4x4 model = modelMat;
+	const NPMathHelper::Mat4x4 tranInvModel = NPMathHelper::Mat4x4::transpose(NPMathHelper::Mat4x4::inverse(modelMat));
+	const Material& material = m_modelBlinnPhongMaterial;
+	m_pModel->Submit(pass, effect, textures, [=, &material](NPGLHelper::Effect& e)
+	{
+		e.SetMatrix("model", model._e);
+		e.SetMatrix("tranInvModel", tranInvModel._e);
+		SetMaterial(e, material);
+		if (setup)
+			setup(e);
+	});
+}
 
-		m_pDiffuseNormalModelEffect->deactiveEffect();
-	}
+void ModelViewWindow::AddFloorDraw(NPGLHelper::RenderPass& pass, NPGLHelper::Effect* effect
+	, const TextureBindings& textures, const NPGLHelper::RenderPass::SetupFunc& setup)
+{
+	TextureBindings bindings;
+	bindings.push_back(NPGLHelper::RenderPass::MakeTexture(0, GL_TEXTURE_2D, m_iFloorTex, "texture_diffuse1"));
+	bindings.push_back(NPGLHelper::RenderPass::MakeTexture(1, GL_TEXTURE_2D, m_iFloorNormalTex, "texture_normal1"));
+	bindings.insert(bindings.end(), textures.begin(), textures.end());
+	const Material& material = m_floorMaterial;
+	pass.AddDraw(effect, m_floor.GetVAO(), (GLsizei)m_floor.GetIndicesSize(), bindings, [=, &material](NPGLHelper::Effect& e)
+	{
+		e.SetMatrix("model", NPMathHelper::Mat4x4::Identity().GetDataColumnMajor());
+		e.SetMatrix("tranInvModel", NPMathHelper::Mat4x4::Identity().GetDataColumnMajor());
+		SetMaterial(e, material);
+		if (setup)
+			setup(e);
+	});
+}
 
-	if (m_bIsWireFrame)
-	{
-		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-	}
+void ModelViewWindow::RenderMethod_DiffuseDirLight()
+{
+	Render_DirLightPass(m_pDiffuseModelEffect, m_pDiffuseNormalModelEffect, false);
 }
 
 void ModelViewWindow::RenderMethod_BlinnPhongDirLight()
 {
 	m_fRenderingProgress = 100.0f;
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-	// Depth rendering
-	if (m_pModel)
-	{
-		m_dirLight.dir._y = -sin(m_fInYaw);
-		m_dirLight.dir._x = -cos(m_fInYaw) * sin(m_fInPitch);
-		m_dirLight.dir._z = -cos(m_fInYaw) * cos(m_fInPitch);
-		Render_ShadowMap(m_dirLight.dir);
-	}
-
-	if (m_bIsWireFrame)
-		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-	else
-		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-
-	UpdateBRDFData();
-	if (/*m_bIsLoadTexture &&*/ m_pModel)
-	{
-		NPMathHelper::Mat4x4 myProj = NPMathHelper::Mat4x4::perspectiveProjection(M_PI * 0.5f, (float)m_iSizeW / (float)m_iSizeH, 0.1f, 100.0f);
-		NPMathHelper::Mat4x4 modelMat = NPMathHelper::Mat4x4::mul(NPMathHelper::Mat4x4::translation(m_v3ModelPos)
-			, NPMathHelper::Mat4x4::mul(NPMathHelper::Mat4x4::rotationTransform(m_v3ModelRot)
-			, NPMathHelper::Mat4x4::scaleTransform(m_fModelScale, m_fModelScale, m_fModelScale)));
-		NPMathHelper::Mat4x4 tranInvModelMat = NPMathHelper::Mat4x4::transpose(NPMathHelper::Mat4x4::inverse(modelMat));
-		m_pBlinnPhongModelEffect->activeEffect();
-		m_pBlinnPhongModelEffect->SetMatrix("projection", myProj.GetDataColumnMajor());
-		m_pBlinnPhongModelEffect->SetMatrix("view", m_Cam.GetViewMatrix());
-		m_pBlinnPhongModelEffect->SetMatrix("model", modelMat.GetDataColumnMajor());
-		m_pBlinnPhongModelEffect->SetMatrix("tranInvModel", tranInvModelMat.GetDataColumnMajor());
-
-		m_dirLight.dir._y = -sin(m_fInYaw);
-		m_dirLight.dir._x = -cos(m_fInYaw) * sin(m_fInPitch);
-		m_dirLight.dir._z = -cos(m_fInYaw) * cos(m_fInPitch);
-
-		m_pBlinnPhongModelEffect->SetVec3("material.ambient", m_modelBlinnPhongMaterial.ambient);
-		m_pBlinnPhongModelEffect->SetVec3("material.diffuse", m_modelBlinnPhongMaterial.diffuse);
-		m_pBlinnPhongModelEffect->SetVec3("material.specular", m_modelBlinnPhongMaterial.specular);
-		m_pBlinnPhongModelEffect->SetFloat("material.shininess", m_modelBlinnPhongMaterial.shininess);
-
-		m_pBlinnPhongModelEffect->SetVec3("light.ambient", m_dirLight.ambient * m_fLightIntMultiplier);
-		m_pBlinnPhongModelEffect->SetVec3("light.diffuse", m_dirLight.diffuse * m_fLightIntMultiplier);
-		m_pBlinnPhongModelEffect->SetVec3("light.specular", m_dirLight.specular * m_fLightIntMultiplier);
-		m_pBlinnPhongModelEffect->SetVec3("light.dir", m_dirLight.dir);
-
-		m_pBlinnPhongModelEffect->SetVec3("viewPos", m_Cam.GetPos());
-
-		m_pBlinnPhongModelEffect->SetFloat("biasMin", m_fShadowBiasMin);
-		m_pBlinnPhongModelEffect->SetFloat("biasMax", m_fShadowBiasMax);
-		m_pBlinnPhongModelEffect->SetMatrix("shadowMap", m_matShadowMapMat.GetDataColumnMajor());
-		glActiveTexture(GL_TEXTURE5); CHECK_GL_ERROR;
-		glBindTexture(GL_TEXTURE_2D, m_uiDepthMapTex); CHECK_GL_ERROR;
-		m_pBlinnPhongModelEffect->SetInt("texture_shadow", 5); CHECK_GL_ERROR;
-
-		m_pModel->Draw(*m_pBlinnPhongModelEffect);
-
-
-		m_pBlinnPhongModelEffect->deactiveEffect();
-	}
+	Render_DirLightPass(m_pBlinnPhongModelEffect, m_pBlinnPhongNormalModelEffect, false);
+}
 
-	if (m_bIsShowFloor)
-	{
+void ModelViewWindow::RenderMethod_BRDFDirLight()
+{
+	Render_DirLightPass(m_pBRDFModelEffect, m_pBlinnPhongNormalModelEffect, true);
+}
 
-		NPMathHelper::Mat4x4 myProj = NPMathHelper::Mat4x4::perspectiveProjection(M_PI * 0.5f, (float)m_iSizeW / (float)m_iSizeH, 0.1f, 100.0f);
-		NPMathHelper::Mat4x4 modelMat = NPMathHelper::Mat4x4::Identity();
-		NPMathHelper::Mat4x4 tranInvModelMat = NPMathHelper::Mat4x4::transpose(NPMathHelper::Mat4x4::inverse(modelMat));
+void ModelViewWindow::RenderMethod_DiffuseEnvMap()
+{
+	Render_EnvMapPass(m_pDiffuseEnvModelEffect, m_uiMaxSampling, false);
+}
 
-		m_pBlinnPhongNormalModelEffect->activeEffect();
-		m_pBlinnPhongNormalModelEffect->SetMatrix("projection", myProj.GetDataColumnMajor());
-		m_pBlinnPhongNormalModelEffect->SetMatrix("view", m_Cam.GetViewMatrix());
-		m_pBlinnPhongNormalModelEffect->SetMatrix("model", modelMat.GetDataColumnMajor());
-		m_pBlinnPhongNormalModelEffect->SetMatrix("tranInvModel", tranInvModelMat.GetDataColumnMajor());
+void ModelViewWindow::RenderMethod_BlinnPhongEnvMap()
+{
+	Render_EnvMapPass(m_pBlinnPhongEnvModelEffect, m_uiMaxSampling, false);
+}
 
-		m_dirLight.dir._y = -sin(m_fInYaw);
-		m_dirLight.dir._x = -cos(m_fInYaw) * sin(m_fInPitch);
-		m_dirLight.dir._z = -cos(m_fInYaw) * cos(m_fInPitch);
+void ModelViewWindow::RenderMethod_BRDFEnvMap()
+{
+	UpdateBRDFData();
+	Render_EnvMapPass(m_pBRDFEnvModelEffect, m_uiNPH * m_uiNTH, true);
+}
 
-		m_pBlinnPhongNormalModelEffect->SetVec3("material.ambient", m_floorMaterial.ambient);
-		m_pBlinnPhongNormalModelEffect->SetVec3("material.diffuse", m_floorMaterial.diffuse);
-		m_pBlinnPhongNormalModelEffect->SetVec3("material.specular", m_floorMaterial.specular);
-		m_pBlinnPhongNormalModelEffect->SetFloat("material.shininess", m_floorMaterial.shininess);
-
-		m_pBlinnPhongNormalModelEffect->SetVec3("light.ambient", m_dirLight.ambient * m_fLightIntMultiplier);
-		m_pBlinnPhongNormalModelEffect->SetVec3("light.diffuse", m_dirLight.diffuse * m_fLightIntMultiplier);
-		m_pBlinnPhongNormalModelEffect->SetVec3("light.specular", m_dirLight.specular * m_fLightIntMultiplier);
-		m_pBlinnPhongNormalModelEffect->SetVec3("light.dir", m_dirLight.dir);
-
-		m_pBlinnPhongNormalModelEffect->SetVec3("viewPos", m_Cam.GetPos());
-
-		m_pBlinnPhongNormalModelEffect->SetFloat("biasMin", m_fShadowBiasMin);
-		m_pBlinnPhongNormalModelEffect->SetFloat("biasMax", m_fShadowBiasMax);
-		m_pBlinnPhongNormalModelEffect->SetMatrix("shadowMap", m_matShadowMapMat.GetDataColumnMajor());
-		glActiveTexture(GL_TEXTURE5); CHECK_GL_ERROR;
-		glBindTexture(GL_TEXTURE_2D, m_uiDepthMapTex); CHECK_GL_ERROR;
-		m_pBlinnPhongNormalModelEffect->SetInt("texture_shadow", 5); CHECK_GL_ERROR;
-
-		glActiveTexture(GL_TEXTURE0); CHECK_GL_ERROR;
-		glBindTexture(GL_TEXTURE_2D, m_iFloorTex); CHECK_GL_ERROR;
-		m_pBlinnPhongNormalModelEffect->SetInt("texture_diffuse1", 0); CHECK_GL_ERROR;
-
-		glActiveTexture(GL_TEXTURE1); CHECK_GL_ERROR;
-		glBindTexture(GL_TEXTURE_2D, m_iFloorNormalTex); CHECK_GL_ERROR;
-		m_pBlinnPhongNormalModelEffect->SetInt("texture_normal1", 1); CHECK_GL_ERROR;
-
-		// Draw Floor Plane
-		NPMathHelper::Mat4x4 floorModelMat = NPMathHelper::Mat4x4::Identity();
-		NPMathHelper::Mat4x4 floorTranInvModelMat = NPMathHelper::Mat4x4::transpose(NPMathHelper::Mat4x4::inverse(floorModelMat));
-		m_pBlinnPhongNormalModelEffect->SetMatrix("model", floorModelMat.GetDataColumnMajor()); CHECK_GL_ERROR;
-		m_pBlinnPhongNormalModelEffect->SetMatrix("tranInvModel", floorTranInvModelMat.GetDataColumnMajor()); CHECK_GL_ERROR;
-		glBindVertexArray(m_floor.GetVAO()); CHECK_GL_ERROR;
-		glDrawElements(GL_TRIANGLES, m_floor.GetIndicesSize(), GL_UNSIGNED_INT, 0); CHECK_GL_ERROR;
-		glBindVertexArray(0);
+void ModelViewWindow::RenderMethod_DiffuseEnvMapS()
+{
+	Render_EnvMapSPass(m_pDiffuseEnvSModelEffect, m_pDiffuseNormalEnvSModelEffect, ENVSSHADING_DIFFUSE, ENVSSHADING_DIFFUSE);
+}
 
-		m_pBlinnPhongNormalModelEffect->deactiveEffect();
-	}
+void ModelViewWindow::RenderMethod_BlinnPhongEnvMapS()
+{
+	Render_EnvMapSPass(m_pBlinnPhongEnvSModelEffect, m_pBlinnPhongNormalEnvSModelEffect, ENVSSHADING_BLINNPHONG, ENVSSHADING_BLINNPHONG);
+}
 
-	if (m_bIsWireFrame)
-	{
-		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-	}
+void ModelViewWindow::RenderMethod_BRDFEnvMapS()
+{
+	Render_EnvMapSPass(m_pBRDFEnvSModelEffect, m_pBlinnPhongNormalEnvSModelEffect, ENVSSHADING_BLINNPHONG, ENVSSHADING_BRDF);
 }
 
-void ModelViewWindow::RenderMethod_BRDFDirLight()
+void ModelViewWindow::Render_DirLightPass(NPGLHelper::Effect* modelEffect, NPGLHelper::Effect* floorEffect, const bool isBRDF)
 {
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -1339,128 +2118,37 @@ void ModelViewWindow::RenderMethod_BRDFDirLight()
 		Render_ShadowMap(m_dirLight.dir);
 	}
 
-	if (m_bIsWireFrame)
-		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-	else
-		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-
 	UpdateBRDFData();
+	UpdateFrameUniforms(0);
+
+	NPGLHelper::RenderPass pass;
+	pass.SetPolygonMode(m_bIsWireFrame ? GL_LINE : GL_FILL);
+	TextureBindings shadowTextures;
+	shadowTextures.push_back(NPGLHelper::RenderPass::MakeTexture(5, GL_TEXTURE_2D, m_uiDepthMapTex, "texture_shadow"));
 	if (/*m_bIsLoadTexture &&*/ m_pModel)
 	{
-		NPMathHelper::Mat4x4 myProj = NPMathHelper::Mat4x4::perspectiveProjection(M_PI * 0.5f, (float)m_iSizeW / (float)m_iSizeH, 0.1f, 100.0f);
-		NPMathHelper::Mat4x4 modelMat = NPMathHelper::Mat4x4::mul(NPMathHelper::Mat4x4::translation(m_v3ModelPos)
-			, NPMathHelper::Mat4x4::mul(NPMathHelper::Mat4x4::rotationTransform(m_v3ModelRot)
-			, NPMathHelper::Mat4x4::scaleTransform(m_fModelScale, m_fModelScale, m_fModelScale)));
-		NPMathHelper::Mat4x4 tranInvModelMat = NPMathHelper::Mat4x4::transpose(NPMathHelper::Mat4x4::inverse(modelMat));
-		m_pBRDFModelEffect->activeEffect();
-		m_pBRDFModelEffect->SetInt("n_th", m_uiNTH);
-		m_pBRDFModelEffect->SetInt("n_ph", m_uiNPH);
-		m_pBRDFModelEffect->SetMatrix("projection", myProj.GetDataColumnMajor());
-		m_pBRDFModelEffect->SetMatrix("view", m_Cam.GetViewMatrix());
-		m_pBRDFModelEffect->SetMatrix("model", modelMat.GetDataColumnMajor());
-		m_pBRDFModelEffect->SetMatrix("tranInvModel", tranInvModelMat.GetDataColumnMajor());
-
-		m_pBRDFModelEffect->SetVec3("material.ambient", m_modelBlinnPhongMaterial.ambient); CHECK_GL_ERROR;
-		m_pBRDFModelEffect->SetVec3("material.diffuse", m_modelBlinnPhongMaterial.diffuse); CHECK_GL_ERROR;
-		m_pBRDFModelEffect->SetVec3("material.specular", m_modelBlinnPhongMaterial.specular); CHECK_GL_ERROR;
-		m_pBRDFModelEffect->SetFloat("material.shininess", m_modelBlinnPhongMaterial.shininess); CHECK_GL_ERROR;
-
-		glm::vec3 lightDir;
-		lightDir.y = -sin(m_fInYaw);
-		lightDir.x = -cos(m_fInYaw) * sin(m_fInPitch);
-		lightDir.z = -cos(m_fInYaw) * cos(m_fInPitch);
-
-		if (m_bIsForceTangent)
-		{
-			m_pBRDFModelEffect->SetVec3("forced_tangent_w", m_v3ForcedTangent);
-		}
-
-		m_pBRDFModelEffect->SetVec3("lightDir", lightDir.x, lightDir.y, lightDir.z);
-		m_pBRDFModelEffect->SetVec3("lightColor", m_v3LightColor.x * m_fLightIntMultiplier
-			, m_v3LightColor.y * m_fLightIntMultiplier, m_v3LightColor.z * m_fLightIntMultiplier);
-		m_pBRDFModelEffect->SetVec3("viewPos", m_Cam.GetPos());
-
-		m_pBRDFModelEffect->SetFloat("biasMin", m_fShadowBiasMin);
-		m_pBRDFModelEffect->SetFloat("biasMax", m_fShadowBiasMax);
-		m_pBRDFModelEffect->SetMatrix("shadowMap", m_matShadowMapMat.GetDataColumnMajor());
-		glActiveTexture(GL_TEXTURE5); CHECK_GL_ERROR;
-		glBindTexture(GL_TEXTURE_2D, m_uiDepthMapTex); CHECK_GL_ERROR;
-		m_pBRDFModelEffect->SetInt("texture_shadow", 5); CHECK_GL_ERROR;
-
-		if (m_bIsLoadTexture)
+		TextureBindings modelTextures = shadowTextures;
+		if (isBRDF && m_bIsLoadTexture)
+			modelTextures.push_back(NPGLHelper::RenderPass::MakeTexture(0, GL_TEXTURE_3D, m_iBRDFEstTex, "texture_brdf"));
+		AddModelDraws(pass, modelEffect, GetModelMat(), modelTextures, [this, isBRDF](NPGLHelper::Effect& effect)
 		{
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, m_iBRDFEstTex);
-			m_pBRDFModelEffect->SetInt("texture_brdf", 0);
-		}
-
-		m_pModel->Draw(*m_pBRDFModelEffect);
-		m_pBRDFModelEffect->deactiveEffect();
+			SetDirLightShadow(effect);
+			if (isBRDF && m_bIsForceTangent)
+				effect.SetVec3("forced_tangent_w", m_v3ForcedTangent);
+		});
 	}
 
 	if (m_bIsShowFloor)
 	{
-
-		NPMathHelper::Mat4x4 myProj = NPMathHelper::Mat4x4::perspectiveProjection(M_PI * 0.5f, (float)m_iSizeW / (float)m_iSizeH, 0.1f, 100.0f);
-		NPMathHelper::Mat4x4 modelMat = NPMathHelper::Mat4x4::Identity();
-		NPMathHelper::Mat4x4 tranInvModelMat = NPMathHelper::Mat4x4::transpose(NPMathHelper::Mat4x4::inverse(modelMat));
-
-		m_pBlinnPhongNormalModelEffect->activeEffect();
-		m_pBlinnPhongNormalModelEffect->SetMatrix("projection", myProj.GetDataColumnMajor());
-		m_pBlinnPhongNormalModelEffect->SetMatrix("view", m_Cam.GetViewMatrix());
-		m_pBlinnPhongNormalModelEffect->SetMatrix("model", modelMat.GetDataColumnMajor());
-		m_pBlinnPhongNormalModelEffect->SetMatrix("tranInvModel", tranInvModelMat.GetDataColumnMajor());
-
-		m_dirLight.dir._y = -sin(m_fInYaw);
-		m_dirLight.dir._x = -cos(m_fInYaw) * sin(m_fInPitch);
-		m_dirLight.dir._z = -cos(m_fInYaw) * cos(m_fInPitch);
-
-		m_pBlinnPhongNormalModelEffect->SetVec3("material.ambient", m_floorMaterial.ambient);
-		m_pBlinnPhongNormalModelEffect->SetVec3("material.diffuse", m_floorMaterial.diffuse);
-		m_pBlinnPhongNormalModelEffect->SetVec3("material.specular", m_floorMaterial.specular);
-		m_pBlinnPhongNormalModelEffect->SetFloat("material.shininess", m_floorMaterial.shininess);
-
-		m_pBlinnPhongNormalModelEffect->SetVec3("light.ambient", m_dirLight.ambient * m_fLightIntMultiplier);
-		m_pBlinnPhongNormalModelEffect->SetVec3("light.diffuse", m_dirLight.diffuse * m_fLightIntMultiplier);
-		m_pBlinnPhongNormalModelEffect->SetVec3("light.specular", m_dirLight.specular * m_fLightIntMultiplier);
-		m_pBlinnPhongNormalModelEffect->SetVec3("light.dir", m_dirLight.dir);
-
-		m_pBlinnPhongNormalModelEffect->SetVec3("viewPos", m_Cam.GetPos());
-
-		m_pBlinnPhongNormalModelEffect->SetFloat("biasMin", m_fShadowBiasMin);
-		m_pBlinnPhongNormalModelEffect->SetFloat("biasMax", m_fShadowBiasMax);
-		m_pBlinnPhongNormalModelEffect->SetMatrix("shadowMap", m_matShadowMapMat.GetDataColumnMajor());
-		glActiveTexture(GL_TEXTURE5); CHECK_GL_ERROR;
-		glBindTexture(GL_TEXTURE_2D, m_uiDepthMapTex); CHECK_GL_ERROR;
-		m_pBlinnPhongNormalModelEffect->SetInt("texture_shadow", 5); CHECK_GL_ERROR;
-
-		glActiveTexture(GL_TEXTURE0); CHECK_GL_ERROR;
-		glBindTexture(GL_TEXTURE_2D, m_iFloorTex); CHECK_GL_ERROR;
-		m_pBlinnPhongNormalModelEffect->SetInt("texture_diffuse1", 0); CHECK_GL_ERROR;
-
-		glActiveTexture(GL_TEXTURE1); CHECK_GL_ERROR;
-		glBindTexture(GL_TEXTURE_2D, m_iFloorNormalTex); CHECK_GL_ERROR;
-		m_pBlinnPhongNormalModelEffect->SetInt("texture_normal1", 1); CHECK_GL_ERROR;
-
-		// Draw Floor Plane
-		NPMathHelper::Mat4x4 floorModelMat = NPMathHelper::Mat4x4::Identity();
-		NPMathHelper::Mat4x4 floorTranInvModelMat = NPMathHelper::Mat4x4::transpose(NPMathHelper::Mat4x4::inverse(floorModelMat));
-		m_pBlinnPhongNormalModelEffect->SetMatrix("model", floorModelMat.GetDataColumnMajor()); CHECK_GL_ERROR;
-		m_pBlinnPhongNormalModelEffect->SetMatrix("tranInvModel", floorTranInvModelMat.GetDataColumnMajor()); CHECK_GL_ERROR;
-		glBindVertexArray(m_floor.GetVAO()); CHECK_GL_ERROR;
-		glDrawElements(GL_TRIANGLES, m_floor.GetIndicesSize(), GL_UNSIGNED_INT, 0); CHECK_GL_ERROR;
-		glBindVertexArray(0);
-
-		m_pBlinnPhongNormalModelEffect->deactiveEffect();
-	}
-
-	if (m_bIsWireFrame)
-	{
-		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+		AddFloorDraw(pass, floorEffect, shadowTextures, [this](NPGLHelper::Effect& effect)
+		{
+			SetDirLightShadow(effect);
+		});
 	}
+	pass.Submit(m_renderState);
 }
 
-void ModelViewWindow::RenderMethod_DiffuseEnvMap()
+void ModelViewWindow::Render_EnvMapPass(NPGLHelper::Effect* modelEffect, const unsigned int maxSamp, const bool isBRDF)
 {
 	if (NPMathHelper::Mat4x4(m_Cam.GetViewMatrix()) != m_matLastCam)
 	{
@@ -1468,848 +2156,156 @@ void ModelViewWindow::RenderMethod_DiffuseEnvMap()
 		m_uiEnvInitSamp = 0;
 	}
 
-	NPMathHelper::Mat4x4 modelMat = NPMathHelper::Mat4x4::mul(NPMathHelper::Mat4x4::translation(m_v3ModelPos)
-		, NPMathHelper::Mat4x4::mul(NPMathHelper::Mat4x4::rotationTransform(m_v3ModelRot)
-		, NPMathHelper::Mat4x4::scaleTransform(m_fModelScale, m_fModelScale, m_fModelScale)));
-
+	NPMathHelper::Mat4x4 modelMat = GetModelMat();
 	if (modelMat != m_matLastModel)
 	{
 		m_matLastModel = modelMat;
 		m_uiEnvInitSamp = 0;
 	}
 
-	if (m_uiEnvInitSamp + ITR_COUNT > m_uiMaxSampling)
+	if (m_uiEnvInitSamp + ITR_COUNT > maxSamp)
 		return;
 
+	UpdateFrameUniforms(maxSamp);
 	if (m_uiEnvInitSamp <= 0)
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	if (m_bIsWireFrame)
-		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-	else
-		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-
+	const GLenum polygonMode = m_bIsWireFrame ? GL_LINE : GL_FILL;
 	if (/*m_bIsLoadTexture &&*/ m_pModel)
 	{
-		if (m_uiEnvInitSamp > 0)
-		{
-			glEnable(GL_BLEND);
-			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-		}
-
-		NPMathHelper::Mat4x4 myProj = NPMathHelper::Mat4x4::perspectiveProjection(M_PI * 0.5f, (float)m_iSizeW / (float)m_iSizeH, 0.1f, 100.0f);
-		NPMathHelper::Mat4x4 tranInvModelMat = NPMathHelper::Mat4x4::transpose(NPMathHelper::Mat4x4::inverse(modelMat));
-		m_pDiffuseEnvModelEffect->activeEffect(); CHECK_GL_ERROR;
-		m_pDiffuseEnvModelEffect->SetMatrix("projection", myProj.GetDataColumnMajor()); CHECK_GL_ERROR;
-		m_pDiffuseEnvModelEffect->SetMatrix("view", m_Cam.GetViewMatrix()); CHECK_GL_ERROR;
-		m_pDiffuseEnvModelEffect->SetMatrix("model", modelMat.GetDataColumnMajor()); CHECK_GL_ERROR;
-		m_pDiffuseEnvModelEffect->SetMatrix("tranInvModel", tranInvModelMat.GetDataColumnMajor()); CHECK_GL_ERROR;
-		m_pDiffuseEnvModelEffect->SetInt("init_samp", m_uiEnvInitSamp); CHECK_GL_ERROR;
-		m_pDiffuseEnvModelEffect->SetInt("max_samp", m_uiMaxSampling); CHECK_GL_ERROR;
-		m_pDiffuseEnvModelEffect->SetFloat("env_multiplier", m_fEnvMapMultiplier); CHECK_GL_ERROR;
-
-		glm::vec3 lightDir;
-		lightDir.y = -sin(m_fInYaw);
-		lightDir.x = -cos(m_fInYaw) * sin(m_fInPitch);
-		lightDir.z = -cos(m_fInYaw) * cos(m_fInPitch);
-		m_pDiffuseEnvModelEffect->SetVec3("viewPos", m_Cam.GetPos()); CHECK_GL_ERROR;
-
-		m_pDiffuseEnvModelEffect->SetVec3("material.ambient", m_modelBlinnPhongMaterial.ambient); CHECK_GL_ERROR;
-		m_pDiffuseEnvModelEffect->SetVec3("material.diffuse", m_modelBlinnPhongMaterial.diffuse); CHECK_GL_ERROR;
-		m_pDiffuseEnvModelEffect->SetVec3("material.specular", m_modelBlinnPhongMaterial.specular); CHECK_GL_ERROR;
-		m_pDiffuseEnvModelEffect->SetFloat("material.shininess", m_modelBlinnPhongMaterial.shininess); CHECK_GL_ERROR;
-
+		NPGLHelper::RenderPass pass;
+		pass.SetPolygonMode(polygonMode);
+		pass.SetBlend(m_uiEnvInitSamp > 0, GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		TextureBindings textures;
 		if (m_bIsEnvMapLoaded)
-		{
-			glActiveTexture(GL_TEXTURE4); CHECK_GL_ERROR;
-			glBindTexture(GL_TEXTURE_CUBE_MAP, m_uiEnvMap); CHECK_GL_ERROR;
-			m_pDiffuseEnvModelEffect->SetInt("envmap", 4); CHECK_GL_ERROR;
-		}
+			textures.push_back(NPGLHelper::RenderPass::MakeTexture(4, GL_TEXTURE_CUBE_MAP, m_uiEnvMap, "envmap"));
+		if (isBRDF && m_bIsLoadTexture)
+			textures.push_back(NPGLHelper::RenderPass::MakeTexture(0, GL_TEXTURE_3D, m_iBRDFEstTex, "texture_brdf"));
+		AddModelDraws(pass, modelEffect, modelMat, textures, nullptr);
+		pass.Submit(m_renderState);
 
-		m_pModel->Draw(*m_pDiffuseEnvModelEffect); CHECK_GL_ERROR;
 		m_uiEnvInitSamp += ITR_COUNT;
-		m_fRenderingProgress = (float)m_uiEnvInitSamp / (float)m_uiMaxSampling * 100.f;
-
-		m_pDiffuseEnvModelEffect->deactiveEffect();
-
-		glDisable(GL_BLEND);
-	}
-
-	if (m_bIsEnvMapLoaded)
-	{
-		NPMathHelper::Mat4x4 myProj = NPMathHelper::Mat4x4::perspectiveProjection(M_PI * 0.5f, (float)m_iSizeW / (float)m_iSizeH, 0.1f, 100.0f);
-		glCullFace(GL_FRONT);
-		NPMathHelper::Mat4x4 noTranCamMath = m_Cam.GetViewMatrix();
-		noTranCamMath._03 = noTranCamMath._13 = noTranCamMath._23 = 0.f;
-		m_pSkyboxEffect->activeEffect();
-		m_pSkyboxEffect->SetMatrix("projection", myProj.GetDataColumnMajor());
-		m_pSkyboxEffect->SetMatrix("view", noTranCamMath.GetDataColumnMajor());
-		m_pSkyboxEffect->SetMatrix("model", NPMathHelper::Mat4x4::scaleTransform(1.0f, 1.0f, 1.0f).GetDataColumnMajor());
-
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, m_uiEnvMap);
-		m_pSkyboxEffect->SetInt("envmap", 0);
-
-		glBindVertexArray(m_skybox.GetVAO());
-		glDrawElements(GL_TRIANGLES, m_skybox.GetIndicesSize(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
-		glBindTexture(GL_TEXTURE_2D, 0);
-		m_pSkyboxEffect->deactiveEffect();
-		glCullFace(GL_BACK);
+		m_fRenderingProgress = (float)m_uiEnvInitSamp / (float)maxSamp * 100.f;
 	}
 
-	if (m_bIsWireFrame)
-	{
-		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-	}
+	Render_Skybox(polygonMode);
 }
 
-void ModelViewWindow::RenderMethod_BlinnPhongEnvMap()
+void ModelViewWindow::Render_EnvMapSPass(NPGLHelper::Effect* modelEffect, NPGLHelper::Effect* floorEffect
+	, const ENVSSHADING floorShading, const ENVSSHADING modelShading)
 {
+	UpdateBRDFData();
+
 	if (NPMathHelper::Mat4x4(m_Cam.GetViewMatrix()) != m_matLastCam)
 	{
+		// the old sums are warped to the new view, SaveEnvHistory decides which ones
+		m_bIsEnvReprojectPending = m_bIsEnvReproject && m_bIsEnvDeferred;
 		m_matLastCam = NPMathHelper::Mat4x4(m_Cam.GetViewMatrix());
 		m_uiEnvInitSamp = 0;
 	}
 
-	NPMathHelper::Mat4x4 modelMat = NPMathHelper::Mat4x4::mul(NPMathHelper::Mat4x4::translation(m_v3ModelPos)
-		, NPMathHelper::Mat4x4::mul(NPMathHelper::Mat4x4::rotationTransform(m_v3ModelRot)
-		, NPMathHelper::Mat4x4::scaleTransform(m_fModelScale, m_fModelScale, m_fModelScale)));
-
+	NPMathHelper::Mat4x4 modelMat = GetModelMat();
 	if (modelMat != m_matLastModel)
 	{
 		m_matLastModel = modelMat;
 		m_uiEnvInitSamp = 0;
+		m_bIsEnvReprojectPending = false;
+		m_bIsEnvHistorySaved = false;
+	}
+
+	if (m_uiEnvInitSamp <= 0)
+	{
+		m_bIsEnvConverged = false;
+		m_uiEnvLastConvergeSamp = 0;
 	}
 
-	if (m_uiEnvInitSamp + ITR_COUNT > m_uiMaxSampling)
+	if (m_uiEnvInitSamp >= m_uiEnvShadowMaxSamp || m_bIsEnvConverged)
 		return;
 
+	UpdateFrameUniforms(m_uiEnvShadowMaxSamp);
+	glDrawBuffers(2, ENV_ACCUM_BUFFERS);
 	if (m_uiEnvInitSamp <= 0)
+	{
+		if (m_bIsEnvReprojectPending)
+			m_bIsEnvReprojectPending = SaveEnvHistory();
+		// the warped pixels already hold the directions before m_uiEnvSampIndex, starting over would add them twice
+		if (!m_bIsEnvReprojectPending && !m_bIsEnvHistorySaved)
+			m_uiEnvSampIndex = 0;
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-	if (m_bIsWireFrame)
-		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-	else
-		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+		glClearBufferfv(GL_COLOR, 1, ENV_ACCUM_ZERO);
+	}
 
 	if (/*m_bIsLoadTexture &&*/ m_pModel)
 	{
-		if (m_uiEnvInitSamp > 0)
-		{
-			glEnable(GL_BLEND);
-			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-		}
+		// Samp Dirs and depth rendering
+		unsigned int sampCount = Render_EnvShadowBatch();
 
 		NPMathHelper::Mat4x4 myProj = NPMathHelper::Mat4x4::perspectiveProjection(M_PI * 0.5f, (float)m_iSizeW / (float)m_iSizeH, 0.1f, 100.0f);
-		NPMathHelper::Mat4x4 tranInvModelMat = NPMathHelper::Mat4x4::transpose(NPMathHelper::Mat4x4::inverse(modelMat));
-		m_pBlinnPhongEnvModelEffect->activeEffect(); CHECK_GL_ERROR;
-		m_pBlinnPhongEnvModelEffect->SetMatrix("projection", myProj.GetDataColumnMajor()); CHECK_GL_ERROR;
-		m_pBlinnPhongEnvModelEffect->SetMatrix("view", m_Cam.GetViewMatrix()); CHECK_GL_ERROR;
-		m_pBlinnPhongEnvModelEffect->SetMatrix("model", modelMat.GetDataColumnMajor()); CHECK_GL_ERROR;
-		m_pBlinnPhongEnvModelEffect->SetMatrix("tranInvModel", tranInvModelMat.GetDataColumnMajor()); CHECK_GL_ERROR;
-		m_pBlinnPhongEnvModelEffect->SetInt("init_samp", m_uiEnvInitSamp); CHECK_GL_ERROR;
-		m_pBlinnPhongEnvModelEffect->SetInt("max_samp", m_uiMaxSampling); CHECK_GL_ERROR;
-		m_pBlinnPhongEnvModelEffect->SetFloat("env_multiplier", m_fEnvMapMultiplier); CHECK_GL_ERROR;
-
-		glm::vec3 lightDir;
-		lightDir.y = -sin(m_fInYaw);
-		lightDir.x = -cos(m_fInYaw) * sin(m_fInPitch);
-		lightDir.z = -cos(m_fInYaw) * cos(m_fInPitch);
-		m_pBlinnPhongEnvModelEffect->SetVec3("viewPos", m_Cam.GetPos()); CHECK_GL_ERROR;
-
-		m_pBlinnPhongEnvModelEffect->SetVec3("material.ambient", m_modelBlinnPhongMaterial.ambient); CHECK_GL_ERROR;
-		m_pBlinnPhongEnvModelEffect->SetVec3("material.diffuse", m_modelBlinnPhongMaterial.diffuse); CHECK_GL_ERROR;
-		m_pBlinnPhongEnvModelEffect->SetVec3("material.specular", m_modelBlinnPhongMaterial.specular); CHECK_GL_ERROR;
-		m_pBlinnPhongEnvModelEffect->SetFloat("material.shininess", m_modelBlinnPhongMaterial.shininess); CHECK_GL_ERROR;
-
-		if (m_bIsEnvMapLoaded)
+		if (m_bIsEnvDeferred)
 		{
-			glActiveTexture(GL_TEXTURE4); CHECK_GL_ERROR;
-			glBindTexture(GL_TEXTURE_CUBE_MAP, m_uiEnvMap); CHECK_GL_ERROR;
-			m_pBlinnPhongEnvModelEffect->SetInt("envmap", 4); CHECK_GL_ERROR;
+			Render_EnvSDeferred(myProj, modelMat, sampCount, floorShading, modelShading);
 		}
+		else
+		{
+			// every batch after the first adds onto the sums, the depth of the first one makes the draw order irrelevant
+			NPGLHelper::RenderPass pass;
+			pass.SetPolygonMode(m_bIsWireFrame ? GL_LINE : GL_FILL);
+			pass.SetBlend(m_uiEnvInitSamp > 0, GL_ONE, GL_ONE);
+			TextureBindings textures;
+			if (m_bIsEnvMapLoaded)
+				textures.push_back(NPGLHelper::RenderPass::MakeTexture(4, GL_TEXTURE_CUBE_MAP, m_uiEnvMap, "envmap"));
+			textures.push_back(NPGLHelper::RenderPass::MakeTexture(5, GL_TEXTURE_2D_ARRAY, m_uiEnvBatchArrayTex, "texture_shadow"));
 
-		m_pModel->Draw(*m_pBlinnPhongEnvModelEffect); CHECK_GL_ERROR;
-		m_uiEnvInitSamp += ITR_COUNT;
-		m_fRenderingProgress = (float)m_uiEnvInitSamp / (float)m_uiMaxSampling * 100.f;
-
-		m_pBlinnPhongEnvModelEffect->deactiveEffect();
+			if (m_bIsShowFloor)
+			{
+				AddFloorDraw(pass, floorEffect, textures, [this, sampCount](NPGLHelper::Effect& effect)
+				{
+					SetEnvShadowBatch(&effect, sampCount);
+				});
+			}
 
-		glDisable(GL_BLEND);
+			const bool isBRDF = (modelShading == ENVSSHADING_BRDF);
+			if (isBRDF && m_bIsLoadTexture)
+				textures.push_back(NPGLHelper::RenderPass::MakeTexture(0, GL_TEXTURE_3D, m_iBRDFEstTex, "texture_brdf"));
+			AddModelDraws(pass, modelEffect, modelMat, textures, [this, sampCount, isBRDF](NPGLHelper::Effect& effect)
+			{
+				SetEnvShadowBatch(&effect, sampCount);
+				if (isBRDF && m_bIsForceTangent)
+					effect.SetVec3("forced_tangent_w", m_v3ForcedTangent);
+			});
+			pass.Submit(m_renderState);
+
+			m_bIsGBufferDirty = true;
+			m_bIsEnvReprojectPending = false;
+			m_bIsEnvHistorySaved = false;
+		}
+		m_uiEnvInitSamp += sampCount;
+		m_uiEnvSampIndex += sampCount;
+		m_fRenderingProgress = (float)m_uiEnvInitSamp / (float)(m_uiEnvShadowMaxSamp)* 100.f;
 	}
 
-	if (m_bIsEnvMapLoaded)
-	{
-		NPMathHelper::Mat4x4 myProj = NPMathHelper::Mat4x4::perspectiveProjection(M_PI * 0.5f, (float)m_iSizeW / (float)m_iSizeH, 0.1f, 100.0f);
-		glCullFace(GL_FRONT);
-		NPMathHelper::Mat4x4 noTranCamMath = m_Cam.GetViewMatrix();
-		noTranCamMath._03 = noTranCamMath._13 = noTranCamMath._23 = 0.f;
-		m_pSkyboxEffect->activeEffect();
-		m_pSkyboxEffect->SetMatrix("projection", myProj.GetDataColumnMajor());
-		m_pSkyboxEffect->SetMatrix("view", noTranCamMath.GetDataColumnMajor());
-		m_pSkyboxEffect->SetMatrix("model", NPMathHelper::Mat4x4::scaleTransform(1.0f, 1.0f, 1.0f).GetDataColumnMajor());
-
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, m_uiEnvMap);
-		m_pSkyboxEffect->SetInt("envmap", 0);
-
-		glBindVertexArray(m_skybox.GetVAO());
-		glDrawElements(GL_TRIANGLES, m_skybox.GetIndicesSize(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
-		glBindTexture(GL_TEXTURE_2D, 0);
-		m_pSkyboxEffect->deactiveEffect();
-		glCullFace(GL_BACK);
-	}
+	glDrawBuffer(GL_COLOR_ATTACHMENT0);
+	UpdateEnvConvergence();
 
-	if (m_bIsWireFrame)
-	{
-		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-	}
+	Render_Skybox(GL_FILL);
 }
 
-void ModelViewWindow::RenderMethod_BRDFEnvMap()
+void ModelViewWindow::Render_Skybox(const GLenum polygonMode)
 {
-	UpdateBRDFData();
+	if (!m_bIsEnvMapLoaded)
+		return;
 
-	if (NPMathHelper::Mat4x4(m_Cam.GetViewMatrix()) != m_matLastCam)
+	NPGLHelper::RenderPass pass;
+	pass.SetPolygonMode(polygonMode);
+	pass.SetCullFace(true, GL_FRONT);
+	TextureBindings textures;
+	textures.push_back(NPGLHelper::RenderPass::MakeTexture(0, GL_TEXTURE_CUBE_MAP, m_uiEnvMap, "envmap"));
+	pass.AddDraw(m_pSkyboxEffect, m_skybox.GetVAO(), (GLsizei)m_skybox.GetIndicesSize(), textures, [](NPGLHelper::Effect& effect)
 	{
-		m_matLastCam = NPMathHelper::Mat4x4(m_Cam.GetViewMatrix());
-		m_uiEnvInitSamp = 0;
-	}
-
-	NPMathHelper::Mat4x4 modelMat = NPMathHelper::Mat4x4::mul(NPMathHelper::Mat4x4::translation(m_v3ModelPos)
-		, NPMathHelper::Mat4x4::mul(NPMathHelper::Mat4x4::rotationTransform(m_v3ModelRot)
-		, NPMathHelper::Mat4x4::scaleTransform(m_fModelScale, m_fModelScale, m_fModelScale)));
-
-	if (modelMat != m_matLastModel)
-	{
-		m_matLastModel = modelMat;
-		m_uiEnvInitSamp = 0;
-	}
-
-	if (m_uiEnvInitSamp + ITR_COUNT > m_uiNPH * m_uiNTH)
-		return;
-
-	if (m_uiEnvInitSamp <= 0)
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-	if (m_bIsWireFrame)
-		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-	else
-		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-
-	if (/*m_bIsLoadTexture &&*/ m_pModel)
-	{
-		if (m_uiEnvInitSamp > 0)
-		{
-			glEnable(GL_BLEND);
-			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-		}
-
-		NPMathHelper::Mat4x4 myProj = NPMathHelper::Mat4x4::perspectiveProjection(M_PI * 0.5f, (float)m_iSizeW / (float)m_iSizeH, 0.1f, 100.0f);
-		NPMathHelper::Mat4x4 tranInvModelMat = NPMathHelper::Mat4x4::transpose(NPMathHelper::Mat4x4::inverse(modelMat));
-		m_pBRDFEnvModelEffect->activeEffect();
-		m_pBRDFEnvModelEffect->SetInt("n_th", m_uiNTH);
-		m_pBRDFEnvModelEffect->SetInt("n_ph", m_uiNPH);
-		m_pBRDFEnvModelEffect->SetMatrix("projection", myProj.GetDataColumnMajor());
-		m_pBRDFEnvModelEffect->SetMatrix("view", m_Cam.GetViewMatrix());
-		m_pBRDFEnvModelEffect->SetMatrix("model", modelMat.GetDataColumnMajor());
-		m_pBRDFEnvModelEffect->SetMatrix("tranInvModel", tranInvModelMat.GetDataColumnMajor());
-		m_pBRDFEnvModelEffect->SetInt("init_samp", m_uiEnvInitSamp);
-		m_pBRDFEnvModelEffect->SetFloat("env_multiplier", m_fEnvMapMultiplier);
-
-		m_pBRDFEnvModelEffect->SetVec3("material.ambient", m_modelBlinnPhongMaterial.ambient); CHECK_GL_ERROR;
-		m_pBRDFEnvModelEffect->SetVec3("material.diffuse", m_modelBlinnPhongMaterial.diffuse); CHECK_GL_ERROR;
-		m_pBRDFEnvModelEffect->SetVec3("material.specular", m_modelBlinnPhongMaterial.specular); CHECK_GL_ERROR;
-		m_pBRDFEnvModelEffect->SetFloat("material.shininess", m_modelBlinnPhongMaterial.shininess); CHECK_GL_ERROR;
-
-		glm::vec3 lightDir;
-		lightDir.y = -sin(m_fInYaw);
-		lightDir.x = -cos(m_fInYaw) * sin(m_fInPitch);
-		lightDir.z = -cos(m_fInYaw) * cos(m_fInPitch);
-		m_pBRDFEnvModelEffect->SetVec3("viewPos", m_Cam.GetPos());
-
-		if (m_bIsLoadTexture)
-		{
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, m_iBRDFEstTex);
-			m_pBRDFEnvModelEffect->SetInt("texture_brdf", 0);
-		}
-
-		if (m_bIsEnvMapLoaded)
-		{
-			glActiveTexture(GL_TEXTURE4);
-			glBindTexture(GL_TEXTURE_CUBE_MAP, m_uiEnvMap);
-			m_pBRDFEnvModelEffect->SetInt("envmap", 4);
-		}
-
-		m_pModel->Draw(*m_pBRDFEnvModelEffect);
-		m_uiEnvInitSamp += ITR_COUNT;
-		m_fRenderingProgress = (float)m_uiEnvInitSamp / (float)(m_uiNPH * m_uiNTH) * 100.f;
-
-		m_pBRDFEnvModelEffect->deactiveEffect();
-
-		glDisable(GL_BLEND);
-	}
-
-	if (m_bIsEnvMapLoaded)
-	{
-		NPMathHelper::Mat4x4 myProj = NPMathHelper::Mat4x4::perspectiveProjection(M_PI * 0.5f, (float)m_iSizeW / (float)m_iSizeH, 0.1f, 100.0f);
-		glCullFace(GL_FRONT);
-		NPMathHelper::Mat4x4 noTranCamMath = m_Cam.GetViewMatrix();
-		noTranCamMath._03 = noTranCamMath._13 = noTranCamMath._23 = 0.f;
-		m_pSkyboxEffect->activeEffect();
-		m_pSkyboxEffect->SetMatrix("projection", myProj.GetDataColumnMajor());
-		m_pSkyboxEffect->SetMatrix("view", noTranCamMath.GetDataColumnMajor());
-		m_pSkyboxEffect->SetMatrix("model", NPMathHelper::Mat4x4::scaleTransform(1.0f, 1.0f, 1.0f).GetDataColumnMajor());
-
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, m_uiEnvMap);
-		m_pSkyboxEffect->SetInt("envmap", 0);
-
-		glBindVertexArray(m_skybox.GetVAO());
-		glDrawElements(GL_TRIANGLES, m_skybox.GetIndicesSize(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
-		glBindTexture(GL_TEXTURE_2D, 0);
-		m_pSkyboxEffect->deactiveEffect();
-		glCullFace(GL_BACK);
-	}
-
-	if (m_bIsWireFrame)
-	{
-		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-	}
-}
-
-void ModelViewWindow::RenderMethod_DiffuseEnvMapS()
-{
-	UpdateBRDFData();
-
-	if (NPMathHelper::Mat4x4(m_Cam.GetViewMatrix()) != m_matLastCam)
-	{
-		m_matLastCam = NPMathHelper::Mat4x4(m_Cam.GetViewMatrix());
-		m_uiEnvInitSamp = 0;
-	}
-
-	NPMathHelper::Mat4x4 modelMat = NPMathHelper::Mat4x4::mul(NPMathHelper::Mat4x4::translation(m_v3ModelPos)
-		, NPMathHelper::Mat4x4::mul(NPMathHelper::Mat4x4::rotationTransform(m_v3ModelRot)
-		, NPMathHelper::Mat4x4::scaleTransform(m_fModelScale, m_fModelScale, m_fModelScale)));
-
-	if (modelMat != m_matLastModel)
-	{
-		m_matLastModel = modelMat;
-		m_uiEnvInitSamp = 0;
-	}
-
-	if (m_uiEnvInitSamp + ITR_COUNT > m_uiEnvShadowMaxSamp)
-		return;
-
-	if (m_uiEnvInitSamp <= 0)
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-	if (/*m_bIsLoadTexture &&*/ m_pModel)
-	{
-		// Samp Dir
-		NPMathHelper::Vec2 hemiSpace = NPSamplingHelper::hammersley2d(m_uiEnvInitSamp / 2, m_uiMaxSampling / 2);
-		NPMathHelper::Vec3 sampDir = NPSamplingHelper::hemisphereSample_uniform(hemiSpace._x, hemiSpace._y);
-		if (m_uiEnvInitSamp % 2 == 1)
-			sampDir._y *= -1;
-
-		// Depth rendering
-		if (m_pModel)
-		{
-			Render_ShadowMap(sampDir*-1.f);
-		}
-
-		if (m_bIsWireFrame)
-			glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-		else
-			glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-
-		if (m_uiEnvInitSamp > 0)
-		{
-			glEnable(GL_BLEND);
-			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-		}
-
-		NPMathHelper::Mat4x4 myProj = NPMathHelper::Mat4x4::perspectiveProjection(M_PI * 0.5f, (float)m_iSizeW / (float)m_iSizeH, 0.1f, 100.0f);
-		if (m_bIsShowFloor)
-		{
-			NPMathHelper::Mat4x4 floorModelMat = NPMathHelper::Mat4x4::Identity();
-			NPMathHelper::Mat4x4 tranInvModelMat = NPMathHelper::Mat4x4::transpose(NPMathHelper::Mat4x4::inverse(floorModelMat));
-			m_pDiffuseNormalEnvSModelEffect->activeEffect();
-			m_pDiffuseNormalEnvSModelEffect->SetMatrix("projection", myProj.GetDataColumnMajor());
-			m_pDiffuseNormalEnvSModelEffect->SetMatrix("view", m_Cam.GetViewMatrix());
-			m_pDiffuseNormalEnvSModelEffect->SetMatrix("model", floorModelMat.GetDataColumnMajor());
-			m_pDiffuseNormalEnvSModelEffect->SetMatrix("tranInvModel", tranInvModelMat.GetDataColumnMajor());
-			m_pDiffuseNormalEnvSModelEffect->SetInt("init_samp", m_uiEnvInitSamp);
-			m_pDiffuseNormalEnvSModelEffect->SetFloat("env_multiplier", m_fEnvMapMultiplier);
-			m_pDiffuseNormalEnvSModelEffect->SetInt("max_samp", m_uiEnvShadowMaxSamp);
-
-			m_pDiffuseNormalEnvSModelEffect->SetVec3("viewPos", m_Cam.GetPos());
-
-			if (m_bIsEnvMapLoaded)
-			{
-				glActiveTexture(GL_TEXTURE4);
-				glBindTexture(GL_TEXTURE_CUBE_MAP, m_uiEnvMap);
-				m_pDiffuseNormalEnvSModelEffect->SetInt("envmap", 4);
-			}
-
-			m_pDiffuseNormalEnvSModelEffect->SetFloat("biasMin", m_fShadowBiasMin);
-			m_pDiffuseNormalEnvSModelEffect->SetFloat("biasMax", m_fShadowBiasMax);
-			m_pDiffuseNormalEnvSModelEffect->SetMatrix("shadowMap", m_matShadowMapMat.GetDataColumnMajor());
-			glActiveTexture(GL_TEXTURE5); CHECK_GL_ERROR;
-			glBindTexture(GL_TEXTURE_2D, m_uiDepthMapTex); CHECK_GL_ERROR;
-			m_pDiffuseNormalEnvSModelEffect->SetInt("texture_shadow", 5); CHECK_GL_ERROR;
-
-			glActiveTexture(GL_TEXTURE0); CHECK_GL_ERROR;
-			glBindTexture(GL_TEXTURE_2D, m_iFloorTex); CHECK_GL_ERROR;
-			m_pDiffuseNormalEnvSModelEffect->SetInt("texture_diffuse1", 0); CHECK_GL_ERROR;
-
-			glActiveTexture(GL_TEXTURE1); CHECK_GL_ERROR;
-			glBindTexture(GL_TEXTURE_2D, m_iFloorNormalTex); CHECK_GL_ERROR;
-			m_pDiffuseNormalEnvSModelEffect->SetInt("texture_normal1", 1); CHECK_GL_ERROR;
-
-			m_pDiffuseNormalEnvSModelEffect->SetVec3("material.ambient", m_floorMaterial.ambient);
-			m_pDiffuseNormalEnvSModelEffect->SetVec3("material.diffuse", m_floorMaterial.diffuse);
-			m_pDiffuseNormalEnvSModelEffect->SetVec3("material.specular", m_floorMaterial.specular);
-			m_pDiffuseNormalEnvSModelEffect->SetFloat("material.shininess", m_floorMaterial.shininess);
-
-			m_pDiffuseNormalEnvSModelEffect->SetVec3("samp_dir_w", sampDir);
-			glBindVertexArray(m_floor.GetVAO()); CHECK_GL_ERROR;
-			glDrawElements(GL_TRIANGLES, m_floor.GetIndicesSize(), GL_UNSIGNED_INT, 0); CHECK_GL_ERROR;
-			glBindVertexArray(0);
-			m_pDiffuseNormalEnvSModelEffect->deactiveEffect();
-		}
-
-		NPMathHelper::Mat4x4 tranInvModelMat = NPMathHelper::Mat4x4::transpose(NPMathHelper::Mat4x4::inverse(modelMat));
-		m_pDiffuseEnvSModelEffect->activeEffect();
-		m_pDiffuseEnvSModelEffect->SetInt("n_th", m_uiNTH);
-		m_pDiffuseEnvSModelEffect->SetInt("n_ph", m_uiNPH);
-		m_pDiffuseEnvSModelEffect->SetMatrix("projection", myProj.GetDataColumnMajor());
-		m_pDiffuseEnvSModelEffect->SetMatrix("view", m_Cam.GetViewMatrix());
-		m_pDiffuseEnvSModelEffect->SetMatrix("model", modelMat.GetDataColumnMajor());
-		m_pDiffuseEnvSModelEffect->SetMatrix("tranInvModel", tranInvModelMat.GetDataColumnMajor());
-		m_pDiffuseEnvSModelEffect->SetInt("init_samp", m_uiEnvInitSamp);
-		m_pDiffuseEnvSModelEffect->SetFloat("env_multiplier", m_fEnvMapMultiplier);
-		m_pDiffuseEnvSModelEffect->SetInt("max_samp", m_uiEnvShadowMaxSamp);
-
-		m_pDiffuseEnvSModelEffect->SetVec3("viewPos", m_Cam.GetPos());
-
-		if (m_bIsEnvMapLoaded)
-		{
-			glActiveTexture(GL_TEXTURE4);
-			glBindTexture(GL_TEXTURE_CUBE_MAP, m_uiEnvMap);
-			m_pDiffuseEnvSModelEffect->SetInt("envmap", 4);
-		}
-
-		m_pDiffuseEnvSModelEffect->SetFloat("biasMin", m_fShadowBiasMin);
-		m_pDiffuseEnvSModelEffect->SetFloat("biasMax", m_fShadowBiasMax);
-		m_pDiffuseEnvSModelEffect->SetMatrix("shadowMap", m_matShadowMapMat.GetDataColumnMajor());
-		glActiveTexture(GL_TEXTURE5); CHECK_GL_ERROR;
-		glBindTexture(GL_TEXTURE_2D, m_uiDepthMapTex); CHECK_GL_ERROR;
-		m_pDiffuseEnvSModelEffect->SetInt("texture_shadow", 5); CHECK_GL_ERROR;
-
-		m_pDiffuseEnvSModelEffect->SetVec3("material.ambient", m_modelBlinnPhongMaterial.ambient);
-		m_pDiffuseEnvSModelEffect->SetVec3("material.diffuse", m_modelBlinnPhongMaterial.diffuse);
-		m_pDiffuseEnvSModelEffect->SetVec3("material.specular", m_modelBlinnPhongMaterial.specular);
-		m_pDiffuseEnvSModelEffect->SetFloat("material.shininess", m_modelBlinnPhongMaterial.shininess);
-		m_pDiffuseEnvSModelEffect->SetVec3("samp_dir_w", sampDir);
-		m_pModel->Draw(*m_pDiffuseEnvSModelEffect);
-		m_uiEnvInitSamp += ITR_COUNT;
-		m_fRenderingProgress = (float)m_uiEnvInitSamp / (float)(m_uiEnvShadowMaxSamp)* 100.f;
-
-		m_pDiffuseEnvSModelEffect->deactiveEffect();
-
-		glDisable(GL_BLEND);
-
-		if (m_bIsWireFrame)
-		{
-			glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-		}
-	}
-
-	if (m_bIsEnvMapLoaded)
-	{
-		NPMathHelper::Mat4x4 myProj = NPMathHelper::Mat4x4::perspectiveProjection(M_PI * 0.5f, (float)m_iSizeW / (float)m_iSizeH, 0.1f, 100.0f);
-		glCullFace(GL_FRONT);
-		NPMathHelper::Mat4x4 noTranCamMath = m_Cam.GetViewMatrix();
-		noTranCamMath._03 = noTranCamMath._13 = noTranCamMath._23 = 0.f;
-		m_pSkyboxEffect->activeEffect();
-		m_pSkyboxEffect->SetMatrix("projection", myProj.GetDataColumnMajor());
-		m_pSkyboxEffect->SetMatrix("view", noTranCamMath.GetDataColumnMajor());
-		m_pSkyboxEffect->SetMatrix("model", NPMathHelper::Mat4x4::scaleTransform(1.0f, 1.0f, 1.0f).GetDataColumnMajor());
-
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, m_uiEnvMap);
-		m_pSkyboxEffect->SetInt("envmap", 0);
-
-		glBindVertexArray(m_skybox.GetVAO());
-		glDrawElements(GL_TRIANGLES, m_skybox.GetIndicesSize(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
-		glBindTexture(GL_TEXTURE_2D, 0);
-		m_pSkyboxEffect->deactiveEffect();
-		glCullFace(GL_BACK);
-	}
-}
-
-void ModelViewWindow::RenderMethod_BlinnPhongEnvMapS()
-{
-	UpdateBRDFData();
-
-	if (NPMathHelper::Mat4x4(m_Cam.GetViewMatrix()) != m_matLastCam)
-	{
-		m_matLastCam = NPMathHelper::Mat4x4(m_Cam.GetViewMatrix());
-		m_uiEnvInitSamp = 0;
-	}
-
-	NPMathHelper::Mat4x4 modelMat = NPMathHelper::Mat4x4::mul(NPMathHelper::Mat4x4::translation(m_v3ModelPos)
-		, NPMathHelper::Mat4x4::mul(NPMathHelper::Mat4x4::rotationTransform(m_v3ModelRot)
-		, NPMathHelper::Mat4x4::scaleTransform(m_fModelScale, m_fModelScale, m_fModelScale)));
-
-	if (modelMat != m_matLastModel)
-	{
-		m_matLastModel = modelMat;
-		m_uiEnvInitSamp = 0;
-	}
-
-	if (m_uiEnvInitSamp + ITR_COUNT > m_uiEnvShadowMaxSamp)
-		return;
-
-	if (m_uiEnvInitSamp <= 0)
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-	if (/*m_bIsLoadTexture &&*/ m_pModel)
-	{
-		// Samp Dir
-		NPMathHelper::Vec2 hemiSpace = NPSamplingHelper::hammersley2d(m_uiEnvInitSamp / 2, m_uiMaxSampling / 2);
-		NPMathHelper::Vec3 sampDir = NPSamplingHelper::hemisphereSample_uniform(hemiSpace._x, hemiSpace._y);
-		if (m_uiEnvInitSamp % 2 == 1)
-			sampDir._y *= -1;
-
-		// Depth rendering
-		if (m_pModel)
-		{
-			Render_ShadowMap(sampDir*-1.f);
-		}
-
-		if (m_bIsWireFrame)
-			glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-		else
-			glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-
-		if (m_uiEnvInitSamp > 0)
-		{
-			glEnable(GL_BLEND);
-			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-		}
-
-		NPMathHelper::Mat4x4 myProj = NPMathHelper::Mat4x4::perspectiveProjection(M_PI * 0.5f, (float)m_iSizeW / (float)m_iSizeH, 0.1f, 100.0f);
-		if (m_bIsShowFloor)
-		{
-			NPMathHelper::Mat4x4 floorModelMat = NPMathHelper::Mat4x4::Identity();
-			NPMathHelper::Mat4x4 tranInvModelMat = NPMathHelper::Mat4x4::transpose(NPMathHelper::Mat4x4::inverse(floorModelMat));
-			m_pBlinnPhongNormalEnvSModelEffect->activeEffect();
-			m_pBlinnPhongNormalEnvSModelEffect->SetMatrix("projection", myProj.GetDataColumnMajor());
-			m_pBlinnPhongNormalEnvSModelEffect->SetMatrix("view", m_Cam.GetViewMatrix());
-			m_pBlinnPhongNormalEnvSModelEffect->SetMatrix("model", floorModelMat.GetDataColumnMajor());
-			m_pBlinnPhongNormalEnvSModelEffect->SetMatrix("tranInvModel", tranInvModelMat.GetDataColumnMajor());
-			m_pBlinnPhongNormalEnvSModelEffect->SetInt("init_samp", m_uiEnvInitSamp);
-			m_pBlinnPhongNormalEnvSModelEffect->SetFloat("env_multiplier", m_fEnvMapMultiplier);
-			m_pBlinnPhongNormalEnvSModelEffect->SetInt("max_samp", m_uiEnvShadowMaxSamp);
-
-			m_pBlinnPhongNormalEnvSModelEffect->SetVec3("viewPos", m_Cam.GetPos());
-
-			if (m_bIsEnvMapLoaded)
-			{
-				glActiveTexture(GL_TEXTURE4);
-				glBindTexture(GL_TEXTURE_CUBE_MAP, m_uiEnvMap);
-				m_pBlinnPhongNormalEnvSModelEffect->SetInt("envmap", 4);
-			}
-
-			m_pBlinnPhongNormalEnvSModelEffect->SetFloat("biasMin", m_fShadowBiasMin);
-			m_pBlinnPhongNormalEnvSModelEffect->SetFloat("biasMax", m_fShadowBiasMax);
-			m_pBlinnPhongNormalEnvSModelEffect->SetMatrix("shadowMap", m_matShadowMapMat.GetDataColumnMajor());
-			glActiveTexture(GL_TEXTURE5); CHECK_GL_ERROR;
-			glBindTexture(GL_TEXTURE_2D, m_uiDepthMapTex); CHECK_GL_ERROR;
-			m_pBlinnPhongNormalEnvSModelEffect->SetInt("texture_shadow", 5); CHECK_GL_ERROR;
-
-			glActiveTexture(GL_TEXTURE0); CHECK_GL_ERROR;
-			glBindTexture(GL_TEXTURE_2D, m_iFloorTex); CHECK_GL_ERROR;
-			m_pBlinnPhongNormalEnvSModelEffect->SetInt("texture_diffuse1", 0); CHECK_GL_ERROR;
-
-			glActiveTexture(GL_TEXTURE1); CHECK_GL_ERROR;
-			glBindTexture(GL_TEXTURE_2D, m_iFloorNormalTex); CHECK_GL_ERROR;
-			m_pBlinnPhongNormalEnvSModelEffect->SetInt("texture_normal1", 1); CHECK_GL_ERROR;
-
-			m_pBlinnPhongNormalEnvSModelEffect->SetVec3("material.ambient", m_floorMaterial.ambient);
-			m_pBlinnPhongNormalEnvSModelEffect->SetVec3("material.diffuse", m_floorMaterial.diffuse);
-			m_pBlinnPhongNormalEnvSModelEffect->SetVec3("material.specular", m_floorMaterial.specular);
-			m_pBlinnPhongNormalEnvSModelEffect->SetFloat("material.shininess", m_floorMaterial.shininess);
-
-			m_pBlinnPhongNormalEnvSModelEffect->SetVec3("samp_dir_w", sampDir);
-			glBindVertexArray(m_floor.GetVAO()); CHECK_GL_ERROR;
-			glDrawElements(GL_TRIANGLES, m_floor.GetIndicesSize(), GL_UNSIGNED_INT, 0); CHECK_GL_ERROR;
-			glBindVertexArray(0);
-			m_pBlinnPhongNormalEnvSModelEffect->deactiveEffect();
-		}
-
-		NPMathHelper::Mat4x4 tranInvModelMat = NPMathHelper::Mat4x4::transpose(NPMathHelper::Mat4x4::inverse(modelMat));
-		m_pBlinnPhongEnvSModelEffect->activeEffect();
-		m_pBlinnPhongEnvSModelEffect->SetInt("n_th", m_uiNTH);
-		m_pBlinnPhongEnvSModelEffect->SetInt("n_ph", m_uiNPH);
-		m_pBlinnPhongEnvSModelEffect->SetMatrix("projection", myProj.GetDataColumnMajor());
-		m_pBlinnPhongEnvSModelEffect->SetMatrix("view", m_Cam.GetViewMatrix());
-		m_pBlinnPhongEnvSModelEffect->SetMatrix("model", modelMat.GetDataColumnMajor());
-		m_pBlinnPhongEnvSModelEffect->SetMatrix("tranInvModel", tranInvModelMat.GetDataColumnMajor());
-		m_pBlinnPhongEnvSModelEffect->SetInt("init_samp", m_uiEnvInitSamp);
-		m_pBlinnPhongEnvSModelEffect->SetFloat("env_multiplier", m_fEnvMapMultiplier);
-		m_pBlinnPhongEnvSModelEffect->SetInt("max_samp", m_uiEnvShadowMaxSamp);
-
-		m_pBlinnPhongEnvSModelEffect->SetVec3("viewPos", m_Cam.GetPos());
-
-		if (m_bIsEnvMapLoaded)
-		{
-			glActiveTexture(GL_TEXTURE4);
-			glBindTexture(GL_TEXTURE_CUBE_MAP, m_uiEnvMap);
-			m_pBlinnPhongEnvSModelEffect->SetInt("envmap", 4);
-		}
-
-		m_pBlinnPhongEnvSModelEffect->SetFloat("biasMin", m_fShadowBiasMin);
-		m_pBlinnPhongEnvSModelEffect->SetFloat("biasMax", m_fShadowBiasMax);
-		m_pBlinnPhongEnvSModelEffect->SetMatrix("shadowMap", m_matShadowMapMat.GetDataColumnMajor());
-		glActiveTexture(GL_TEXTURE5); CHECK_GL_ERROR;
-		glBindTexture(GL_TEXTURE_2D, m_uiDepthMapTex); CHECK_GL_ERROR;
-		m_pBlinnPhongEnvSModelEffect->SetInt("texture_shadow", 5); CHECK_GL_ERROR;
-
-		m_pBlinnPhongEnvSModelEffect->SetVec3("material.ambient", m_modelBlinnPhongMaterial.ambient);
-		m_pBlinnPhongEnvSModelEffect->SetVec3("material.diffuse", m_modelBlinnPhongMaterial.diffuse);
-		m_pBlinnPhongEnvSModelEffect->SetVec3("material.specular", m_modelBlinnPhongMaterial.specular);
-		m_pBlinnPhongEnvSModelEffect->SetFloat("material.shininess", m_modelBlinnPhongMaterial.shininess);
-		m_pBlinnPhongEnvSModelEffect->SetVec3("samp_dir_w", sampDir);
-		m_pModel->Draw(*m_pBlinnPhongEnvSModelEffect);
-		m_uiEnvInitSamp += ITR_COUNT;
-		m_fRenderingProgress = (float)m_uiEnvInitSamp / (float)(m_uiEnvShadowMaxSamp)* 100.f;
-
-		m_pBlinnPhongEnvSModelEffect->deactiveEffect();
-
-		glDisable(GL_BLEND);
-
-		if (m_bIsWireFrame)
-		{
-			glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-		}
-	}
-
-	if (m_bIsEnvMapLoaded)
-	{
-		NPMathHelper::Mat4x4 myProj = NPMathHelper::Mat4x4::perspectiveProjection(M_PI * 0.5f, (float)m_iSizeW / (float)m_iSizeH, 0.1f, 100.0f);
-		glCullFace(GL_FRONT);
-		NPMathHelper::Mat4x4 noTranCamMath = m_Cam.GetViewMatrix();
-		noTranCamMath._03 = noTranCamMath._13 = noTranCamMath._23 = 0.f;
-		m_pSkyboxEffect->activeEffect();
-		m_pSkyboxEffect->SetMatrix("projection", myProj.GetDataColumnMajor());
-		m_pSkyboxEffect->SetMatrix("view", noTranCamMath.GetDataColumnMajor());
-		m_pSkyboxEffect->SetMatrix("model", NPMathHelper::Mat4x4::scaleTransform(1.0f, 1.0f, 1.0f).GetDataColumnMajor());
-
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, m_uiEnvMap);
-		m_pSkyboxEffect->SetInt("envmap", 0);
-
-		glBindVertexArray(m_skybox.GetVAO());
-		glDrawElements(GL_TRIANGLES, m_skybox.GetIndicesSize(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
-		glBindTexture(GL_TEXTURE_2D, 0);
-		m_pSkyboxEffect->deactiveEffect();
-		glCullFace(GL_BACK);
-	}
-}
-
-void ModelViewWindow::RenderMethod_BRDFEnvMapS()
-{
-	UpdateBRDFData();
-
-	if (NPMathHelper::Mat4x4(m_Cam.GetViewMatrix()) != m_matLastCam)
-	{
-		m_matLastCam = NPMathHelper::Mat4x4(m_Cam.GetViewMatrix());
-		m_uiEnvInitSamp = 0;
-	}
-
-	NPMathHelper::Mat4x4 modelMat = NPMathHelper::Mat4x4::mul(NPMathHelper::Mat4x4::translation(m_v3ModelPos)
-		, NPMathHelper::Mat4x4::mul(NPMathHelper::Mat4x4::rotationTransform(m_v3ModelRot)
-		, NPMathHelper::Mat4x4::scaleTransform(m_fModelScale, m_fModelScale, m_fModelScale)));
-
-	if (modelMat != m_matLastModel)
-	{
-		m_matLastModel = modelMat;
-		m_uiEnvInitSamp = 0;
-	}
-
-	if (m_uiEnvInitSamp + ITR_COUNT > m_uiEnvShadowMaxSamp)
-		return;
-
-	if (m_uiEnvInitSamp <= 0)
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-	if (/*m_bIsLoadTexture &&*/ m_pModel)
-	{
-		// Samp Dir
-		NPMathHelper::Vec2 hemiSpace = NPSamplingHelper::hammersley2d(m_uiEnvInitSamp / 2, m_uiMaxSampling / 2);
-		NPMathHelper::Vec3 sampDir = NPSamplingHelper::hemisphereSample_uniform(hemiSpace._x, hemiSpace._y);
-		if (m_uiEnvInitSamp % 2 == 1)
-			sampDir._y *= -1;
-
-		// Depth rendering
-		if (m_pModel)
-		{
-			Render_ShadowMap(sampDir*-1.f);
-		}
-
-		if (m_bIsWireFrame)
-			glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-		else
-			glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-
-		if (m_uiEnvInitSamp > 0)
-		{
-			glEnable(GL_BLEND);
-			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-		}
-
-		NPMathHelper::Mat4x4 myProj = NPMathHelper::Mat4x4::perspectiveProjection(M_PI * 0.5f, (float)m_iSizeW / (float)m_iSizeH, 0.1f, 100.0f);
-		if (m_bIsShowFloor)
-		{
-			NPMathHelper::Mat4x4 floorModelMat = NPMathHelper::Mat4x4::Identity();
-			NPMathHelper::Mat4x4 tranInvModelMat = NPMathHelper::Mat4x4::transpose(NPMathHelper::Mat4x4::inverse(floorModelMat));
-			m_pBlinnPhongNormalEnvSModelEffect->activeEffect();
-			m_pBlinnPhongNormalEnvSModelEffect->SetMatrix("projection", myProj.GetDataColumnMajor());
-			m_pBlinnPhongNormalEnvSModelEffect->SetMatrix("view", m_Cam.GetViewMatrix());
-			m_pBlinnPhongNormalEnvSModelEffect->SetMatrix("model", floorModelMat.GetDataColumnMajor());
-			m_pBlinnPhongNormalEnvSModelEffect->SetMatrix("tranInvModel", tranInvModelMat.GetDataColumnMajor());
-			m_pBlinnPhongNormalEnvSModelEffect->SetInt("init_samp", m_uiEnvInitSamp);
-			m_pBlinnPhongNormalEnvSModelEffect->SetFloat("env_multiplier", m_fEnvMapMultiplier);
-			m_pBlinnPhongNormalEnvSModelEffect->SetInt("max_samp", m_uiEnvShadowMaxSamp);
-
-			m_pBlinnPhongNormalEnvSModelEffect->SetVec3("viewPos", m_Cam.GetPos());
-
-			if (m_bIsEnvMapLoaded)
-			{
-				glActiveTexture(GL_TEXTURE4);
-				glBindTexture(GL_TEXTURE_CUBE_MAP, m_uiEnvMap);
-				m_pBlinnPhongNormalEnvSModelEffect->SetInt("envmap", 4);
-			}
-
-			m_pBlinnPhongNormalEnvSModelEffect->SetFloat("biasMin", m_fShadowBiasMin);
-			m_pBlinnPhongNormalEnvSModelEffect->SetFloat("biasMax", m_fShadowBiasMax);
-			m_pBlinnPhongNormalEnvSModelEffect->SetMatrix("shadowMap", m_matShadowMapMat.GetDataColumnMajor());
-			glActiveTexture(GL_TEXTURE5); CHECK_GL_ERROR;
-			glBindTexture(GL_TEXTURE_2D, m_uiDepthMapTex); CHECK_GL_ERROR;
-			m_pBlinnPhongNormalEnvSModelEffect->SetInt("texture_shadow", 5); CHECK_GL_ERROR;
-
-			glActiveTexture(GL_TEXTURE0); CHECK_GL_ERROR;
-			glBindTexture(GL_TEXTURE_2D, m_iFloorTex); CHECK_GL_ERROR;
-			m_pBlinnPhongNormalEnvSModelEffect->SetInt("texture_diffuse1", 0); CHECK_GL_ERROR;
-
-			glActiveTexture(GL_TEXTURE1); CHECK_GL_ERROR;
-			glBindTexture(GL_TEXTURE_2D, m_iFloorNormalTex); CHECK_GL_ERROR;
-			m_pBlinnPhongNormalEnvSModelEffect->SetInt("texture_normal1", 1); CHECK_GL_ERROR;
-
-			m_pBlinnPhongNormalEnvSModelEffect->SetVec3("material.ambient", m_floorMaterial.ambient);
-			m_pBlinnPhongNormalEnvSModelEffect->SetVec3("material.diffuse", m_floorMaterial.diffuse);
-			m_pBlinnPhongNormalEnvSModelEffect->SetVec3("material.specular", m_floorMaterial.specular);
-			m_pBlinnPhongNormalEnvSModelEffect->SetFloat("material.shininess", m_floorMaterial.shininess);
-
-			m_pBlinnPhongNormalEnvSModelEffect->SetVec3("samp_dir_w", sampDir);
-			glBindVertexArray(m_floor.GetVAO()); CHECK_GL_ERROR;
-			glDrawElements(GL_TRIANGLES, m_floor.GetIndicesSize(), GL_UNSIGNED_INT, 0); CHECK_GL_ERROR;
-			glBindVertexArray(0);
-			m_pBlinnPhongNormalEnvSModelEffect->deactiveEffect();
-		}
-
-		NPMathHelper::Mat4x4 tranInvModelMat = NPMathHelper::Mat4x4::transpose(NPMathHelper::Mat4x4::inverse(modelMat));
-		m_pBRDFEnvSModelEffect->activeEffect();
-		m_pBRDFEnvSModelEffect->SetInt("n_th", m_uiNTH);
-		m_pBRDFEnvSModelEffect->SetInt("n_ph", m_uiNPH);
-		m_pBRDFEnvSModelEffect->SetMatrix("projection", myProj.GetDataColumnMajor());
-		m_pBRDFEnvSModelEffect->SetMatrix("view", m_Cam.GetViewMatrix());
-		m_pBRDFEnvSModelEffect->SetMatrix("model", modelMat.GetDataColumnMajor());
-		m_pBRDFEnvSModelEffect->SetMatrix("tranInvModel", tranInvModelMat.GetDataColumnMajor());
-		m_pBRDFEnvSModelEffect->SetInt("init_samp", m_uiEnvInitSamp);
-		m_pBRDFEnvSModelEffect->SetFloat("env_multiplier", m_fEnvMapMultiplier);
-		m_pBRDFEnvSModelEffect->SetInt("max_samp", m_uiEnvShadowMaxSamp);
-
-		m_pBRDFEnvSModelEffect->SetVec3("material.ambient", m_modelBlinnPhongMaterial.ambient); CHECK_GL_ERROR;
-		m_pBRDFEnvSModelEffect->SetVec3("material.diffuse", m_modelBlinnPhongMaterial.diffuse); CHECK_GL_ERROR;
-		m_pBRDFEnvSModelEffect->SetVec3("material.specular", m_modelBlinnPhongMaterial.specular); CHECK_GL_ERROR;
-		m_pBRDFEnvSModelEffect->SetFloat("material.shininess", m_modelBlinnPhongMaterial.shininess); CHECK_GL_ERROR;
-
-		m_pBRDFEnvSModelEffect->SetVec3("viewPos", m_Cam.GetPos());
-
-		if (m_bIsForceTangent)
-		{
-			m_pBRDFEnvSModelEffect->SetVec3("forced_tangent_w", m_v3ForcedTangent);
-		}
-
-		if (m_bIsLoadTexture)
-		{
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, m_iBRDFEstTex);
-			m_pBRDFEnvSModelEffect->SetInt("texture_brdf", 0);
-		}
-
-		if (m_bIsEnvMapLoaded)
-		{
-			glActiveTexture(GL_TEXTURE4);
-			glBindTexture(GL_TEXTURE_CUBE_MAP, m_uiEnvMap);
-			m_pBRDFEnvSModelEffect->SetInt("envmap", 4);
-		}
-
-		m_pBRDFEnvSModelEffect->SetFloat("biasMin", m_fShadowBiasMin);
-		m_pBRDFEnvSModelEffect->SetFloat("biasMax", m_fShadowBiasMax);
-		m_pBRDFEnvSModelEffect->SetMatrix("shadowMap", m_matShadowMapMat.GetDataColumnMajor());
-		glActiveTexture(GL_TEXTURE5); CHECK_GL_ERROR;
-		glBindTexture(GL_TEXTURE_2D, m_uiDepthMapTex); CHECK_GL_ERROR;
-		m_pBRDFEnvSModelEffect->SetInt("texture_shadow", 5); CHECK_GL_ERROR;
-
-		m_pBRDFEnvSModelEffect->SetVec3("samp_dir_w", sampDir);
-		m_pModel->Draw(*m_pBRDFEnvSModelEffect);
-		m_uiEnvInitSamp += ITR_COUNT;
-		m_fRenderingProgress = (float)m_uiEnvInitSamp / (float)(m_uiEnvShadowMaxSamp)* 100.f;
-
-		m_pBRDFEnvSModelEffect->deactiveEffect();
-
-		glDisable(GL_BLEND);
-
-		if (m_bIsWireFrame)
-		{
-			glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-		}
-	}
-
-	if (m_bIsEnvMapLoaded)
-	{
-		NPMathHelper::Mat4x4 myProj = NPMathHelper::Mat4x4::perspectiveProjection(M_PI * 0.5f, (float)m_iSizeW / (float)m_iSizeH, 0.1f, 100.0f);
-		glCullFace(GL_FRONT);
-		NPMathHelper::Mat4x4 noTranCamMath = m_Cam.GetViewMatrix();
-		noTranCamMath._03 = noTranCamMath._13 = noTranCamMath._23 = 0.f;
-		m_pSkyboxEffect->activeEffect();
-		m_pSkyboxEffect->SetMatrix("projection", myProj.GetDataColumnMajor());
-		m_pSkyboxEffect->SetMatrix("view", noTranCamMath.GetDataColumnMajor());
-		m_pSkyboxEffect->SetMatrix("model", NPMathHelper::Mat4x4::scaleTransform(1.0f, 1.0f, 1.0f).GetDataColumnMajor());
-
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, m_uiEnvMap);
-		m_pSkyboxEffect->SetInt("envmap", 0);
-
-		glBindVertexArray(m_skybox.GetVAO());
-		glDrawElements(GL_TRIANGLES, m_skybox.GetIndicesSize(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
-		glBindTexture(GL_TEXTURE_2D, 0);
-		m_pSkyboxEffect->deactiveEffect();
-		glCullFace(GL_BACK);
-	}
-}
+		effect.SetMatrix("model", NPMathHelper::Mat4x4::scaleTransform(1.0f, 1.0f, 1.0f).GetDataColumnMajor());
+	});
+	pass.Submit(m_renderState);
+}
 
 
 void ModelViewWindow::RenderMethod_DiffuseDirLightInit()
@@ -2353,6 +2349,9 @@ void ModelViewWindow::RenderMethod_DiffuseEnvMapSInit()
 	m_uiEnvInitSamp = 0;
 	m_matLastCam = NPMathHelper::Mat4x4::Identity();
 	m_matLastModel = NPMathHelper::Mat4x4::Identity();
+	m_bIsEnvHistoryValid = false;
+	m_bIsEnvHistorySaved = false;
+	m_bIsEnvReprojectPending = false;
 }
 
 void ModelViewWindow::RenderMethod_BlinnPhongEnvMapSInit()
@@ -2360,6 +2359,9 @@ void ModelViewWindow::RenderMethod_BlinnPhongEnvMapSInit()
 	m_uiEnvInitSamp = 0;
 	m_matLastCam = NPMathHelper::Mat4x4::Identity();
 	m_matLastModel = NPMathHelper::Mat4x4::Identity();
+	m_bIsEnvHistoryValid = false;
+	m_bIsEnvHistorySaved = false;
+	m_bIsEnvReprojectPending = false;
 }
 
 void ModelViewWindow::RenderMethod_BRDFEnvMapSInit()
@@ -2367,6 +2369,9 @@ void ModelViewWindow::RenderMethod_BRDFEnvMapSInit()
 	m_uiEnvInitSamp = 0;
 	m_matLastCam = NPMathHelper::Mat4x4::Identity();
 	m_matLastModel = NPMathHelper::Mat4x4::Identity();
+	m_bIsEnvHistoryValid = false;
+	m_bIsEnvHistorySaved = false;
+	m_bIsEnvReprojectPending = false;
 }
 
 
@@ -2416,7 +2421,7 @@ void ModelViewWindow::RenderMethod_BRDFEnvMapSQuit()
 }
 
 
-void ModelViewWindow::Render_ShadowMap(const NPMathHelper::Vec3 lightDir)
+NPMathHelper::Mat4x4 ModelViewWindow::GetShadowMapMat(const NPMathHelper::Vec3 lightDir)
 {
 	NPMathHelper::Mat4x4 modelMat = NPMathHelper::Mat4x4::mul(NPMathHelper::Mat4x4::translation(m_v3ModelPos)
 		, NPMathHelper::Mat4x4::mul(NPMathHelper::Mat4x4::rotationTransform(m_v3ModelRot)
@@ -2430,30 +2435,324 @@ void ModelViewWindow::Render_ShadowMap(const NPMathHelper::Vec3 lightDir)
 	NPMathHelper::Mat4x4 lightProj = NPMathHelper::Mat4x4::orthogonalProjection(2.0f*space.m_fRadius, 2.0f*space.m_fRadius, 1.f, 2.f*space.m_fRadius);
 	NPMathHelper::Mat4x4 lightView = NPMathHelper::Mat4x4::lookAt(space.m_v3Center - lightDir * (space.m_fRadius + 1.5f)
 		, space.m_v3Center, NPMathHelper::Vec3(0.f, 1.f, 0.f));
-	m_matShadowMapMat = NPMathHelper::Mat4x4::mul(lightProj, lightView);
+	return NPMathHelper::Mat4x4::mul(lightProj, lightView);
+}
+
+void ModelViewWindow::Render_ShadowMap(const NPMathHelper::Vec3 lightDir, const GLuint depthArrayTex, const int layer)
+{
+	const NPMathHelper::Mat4x4 modelMat = GetModelMat();
+	m_matShadowMapMat = GetShadowMapMat(lightDir);
+	const NPMathHelper::Mat4x4 lightMat = m_matShadowMapMat;
 
-	glDisable(GL_CULL_FACE);
-	glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-	glBindFramebuffer(GL_FRAMEBUFFER, m_uiDepthMapFBO);
+	if (depthArrayTex == 0)
+	{
+		glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
+		glBindFramebuffer(GL_FRAMEBUFFER, m_uiDepthMapFBO);
+	}
+	else
+	{
+		if (depthArrayTex == m_uiEnvShadowCacheTex)
+			glViewport(0, 0, ENVSHADOW_CACHE_SIZE, ENVSHADOW_CACHE_SIZE);
+		else
+			glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
+		glBindFramebuffer(GL_FRAMEBUFFER, m_uiEnvDepthMapFBO);
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthArrayTex, 0, layer);
+	}
 
 	glClear(GL_DEPTH_BUFFER_BIT);
-	m_pDepthEffect->activeEffect();
-	m_pDepthEffect->SetMatrix("lightMat", m_matShadowMapMat.GetDataColumnMajor());
-	m_pDepthEffect->SetMatrix("model", modelMat.GetDataColumnMajor());
-	m_pModel->Draw(*m_pDepthEffect);
+
+	// both sides cast, from the position-only stream
+	NPGLHelper::RenderPass pass;
+	pass.SetCullFace(false);
+	m_pModel->Submit(pass, m_pDepthEffect, TextureBindings(), [lightMat, modelMat](NPGLHelper::Effect& effect)
+	{
+		effect.SetMatrix("lightMat", lightMat._e);
+		effect.SetMatrix("model", modelMat._e);
+	}, true);
 	if (m_bIsShowFloor)
 	{
-		m_pDepthEffect->SetMatrix("model", NPMathHelper::Mat4x4::Identity().GetDataColumnMajor());
-		glBindVertexArray(m_floor.GetVAO());
-		glDrawElements(GL_TRIANGLES, m_floor.GetIndicesSize(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
+		pass.AddDraw(m_pDepthEffect, m_floor.GetVAO(), (GLsizei)m_floor.GetIndicesSize(), TextureBindings(), [lightMat](NPGLHelper::Effect& effect)
+		{
+			effect.SetMatrix("lightMat", lightMat._e);
+			effect.SetMatrix("model", NPMathHelper::Mat4x4::Identity().GetDataColumnMajor());
+		});
 	}
-	m_pDepthEffect->deactiveEffect();
+	pass.Submit(m_renderState);
 	glBindFramebuffer(GL_FRAMEBUFFER, m_uiHDRFBO);
-	glViewport(0, 0, m_iSizeW, m_iSizeH);
-	glEnable(GL_CULL_FACE);
+	glViewport(0, 0, m_iRenderW, m_iRenderH);
+}
+
+unsigned int ModelViewWindow::Render_EnvShadowBatch()
+{
+	// Grow the batch by one while the last frame stayed well inside the budget, halve it once it went over
+	float lastFrameMS = m_fLastFrameTime * 1000.f;
+	if (lastFrameMS > m_fEnvFrameBudget)
+		m_uiEnvBatch = (m_uiEnvBatch > 1) ? m_uiEnvBatch / 2 : 1;
+	else if (lastFrameMS < 0.75f * m_fEnvFrameBudget)
+		m_uiEnvBatch++;
+	if (m_uiEnvMaxBatch < 1) m_uiEnvMaxBatch = 1;
+	if (m_uiEnvMaxBatch > ENVSHADOW_MAX_BATCH) m_uiEnvMaxBatch = ENVSHADOW_MAX_BATCH;
+	if (m_uiEnvBatch > m_uiEnvMaxBatch) m_uiEnvBatch = m_uiEnvMaxBatch;
+
+	unsigned int sampCount = m_uiEnvBatch;
+	if (m_uiEnvInitSamp + sampCount > m_uiEnvShadowMaxSamp)
+		sampCount = m_uiEnvShadowMaxSamp - m_uiEnvInitSamp;
+
+	// The cached depth only depends on the sample index, the model transform and the floor, not on the camera
+	if (m_matLastModel != m_matEnvShadowCacheModel || m_bIsShowFloor != m_bIsEnvShadowCacheFloor)
+	{
+		m_matEnvShadowCacheModel = m_matLastModel;
+		m_bIsEnvShadowCacheFloor = m_bIsShowFloor;
+		m_uiEnvShadowCacheCount = 0;
+	}
+
+	// A batch either lies in the cache, with layer = sample index, or in the per frame array
+	// the cache is filled without gaps, an index continued past a reprojection can be beyond it
+	bool isCached = m_uiEnvSampIndex < m_uiEnvShadowCacheLayers && m_uiEnvSampIndex <= m_uiEnvShadowCacheCount;
+	if (isCached)
+	{
+		if (m_uiEnvSampIndex + sampCount > m_uiEnvShadowCacheLayers)
+			sampCount = m_uiEnvShadowCacheLayers - m_uiEnvSampIndex;
+		m_uiEnvBatchArrayTex = m_uiEnvShadowCacheTex;
+		m_uiEnvBatchLayerOffset = m_uiEnvSampIndex;
+	}
+	else
+	{
+		m_uiEnvBatchArrayTex = m_uiEnvDepthMapArrayTex;
+		m_uiEnvBatchLayerOffset = 0;
+	}
+
+	for (unsigned int i = 0; i < sampCount; i++)
+	{
+		unsigned int samp = m_uiEnvSampIndex + i;
+		// any prefix covers the whole sphere, so the convergence test never sees only the cap around the zenith
+		NPMathHelper::Vec2 sphereSpace = NPSamplingHelper::halton2d(samp);
+		NPMathHelper::Vec3 sampDir = NPSamplingHelper::sphereSample_uniform(sphereSpace._x, sphereSpace._y);
+
+		if (!isCached)
+		{
+			Render_ShadowMap(sampDir*-1.f, m_uiEnvDepthMapArrayTex, i);
+		}
+		else if (samp >= m_uiEnvShadowCacheCount)
+		{
+			Render_ShadowMap(sampDir*-1.f, m_uiEnvShadowCacheTex, samp);
+			m_uiEnvShadowCacheCount = samp + 1;
+		}
+		else
+		{
+			m_matShadowMapMat = GetShadowMapMat(sampDir*-1.f);
+		}
+		m_v3EnvSampDir[i] = sampDir;
+		m_matEnvShadowMapMat[i] = m_matShadowMapMat;
+	}
+
+	return sampCount;
+}
+
+void ModelViewWindow::SetEnvShadowBatch(NPGLHelper::Effect* effect, const unsigned int count)
+{
+	// m_uiEnvBatchArrayTex is bound by the caller, on unit 5
+	effect->SetFloat("biasMin", m_fShadowBiasMin);
+	effect->SetFloat("biasMax", m_fShadowBiasMax);
+	effect->SetInt("samp_count", count);
+	effect->SetInt("shadow_layer_offset", m_uiEnvBatchLayerOffset);
+	effect->SetVec3Array("samp_dir_w", m_v3EnvSampDir[0]._e, count);
+	effect->SetMatrixArray("shadowMaps", m_matEnvShadowMapMat[0].GetDataColumnMajor(), count);
+}
+
+void ModelViewWindow::Render_EnvSDeferred(const NPMathHelper::Mat4x4& proj, const NPMathHelper::Mat4x4& modelMat, const unsigned int sampCount
+	, const ENVSSHADING floorShading, const ENVSSHADING modelShading)
+{
+	bool isAccumulate = m_uiEnvInitSamp > 0;
+
+	// The G-buffer only changes with the camera and the model, all later batches shade it without touching the meshes
+	if (m_uiEnvInitSamp <= 0 || m_bIsGBufferDirty)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, m_uiGBufferFBO);
+		glClearColor(0.f, 0.f, 0.f, 0.f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
+
+		NPGLHelper::RenderPass pass;
+		pass.SetPolygonMode(m_bIsWireFrame ? GL_LINE : GL_FILL);
+		if (m_bIsShowFloor)
+		{
+			AddFloorDraw(pass, m_pGBufferEffect, TextureBindings(), [](NPGLHelper::Effect& effect)
+			{
+				effect.SetInt("mat_id", 1);
+				effect.SetInt("use_normal_map", 1);
+				effect.SetInt("use_diffuse_array", 0);
+				effect.SetVec3("forced_tangent_w", 0.f, 0.f, 0.f);
+			});
+		}
+
+		const bool isForceTangent = (modelShading == ENVSSHADING_BRDF && m_bIsForceTangent);
+		AddModelDraws(pass, m_pGBufferEffect, modelMat, TextureBindings(), [this, isForceTangent](NPGLHelper::Effect& effect)
+		{
+			effect.SetInt("mat_id", 2);
+			effect.SetInt("use_normal_map", 0);
+			effect.SetInt("use_diffuse_array", 1);
+			if (isForceTangent)
+				effect.SetVec3("forced_tangent_w", m_v3ForcedTangent);
+			else
+				effect.SetVec3("forced_tangent_w", 0.f, 0.f, 0.f);
+		});
+		pass.Submit(m_renderState);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, m_uiHDRFBO);
+		if (m_bIsEnvReprojectPending)
+		{
+			// the batch below adds onto the warped sums instead of overwriting them
+			Render_EnvReproject(proj);
+			isAccumulate = true;
+		}
+		m_bIsGBufferDirty = false;
+	}
+
+	m_renderState.SetBlend(isAccumulate, GL_ONE, GL_ONE);
+	m_renderState.SetDepthTest(false);
+	m_renderState.SetPolygonMode(GL_FILL);
+	m_renderState.UseProgram(m_pEnvSDeferredEffect->GetProgram());
+	for (unsigned int i = 0; i < GBUFFER_N; i++)
+	{
+		m_renderState.BindTexture(6 + i, GL_TEXTURE_2D, m_uiGBufferTex[i]);
+	}
+	m_pEnvSDeferredEffect->SetInt("gbuffer_position", 6 + GBUFFER_POSITION);
+	m_pEnvSDeferredEffect->SetInt("gbuffer_normal", 6 + GBUFFER_NORMAL);
+	m_pEnvSDeferredEffect->SetInt("gbuffer_tangent", 6 + GBUFFER_TANGENT);
+	m_pEnvSDeferredEffect->SetInt("gbuffer_shading_normal", 6 + GBUFFER_SHADINGNORMAL);
+	m_pEnvSDeferredEffect->SetInt("gbuffer_diffuse", 6 + GBUFFER_DIFFUSE);
+
+	m_pEnvSDeferredEffect->SetVec3("material[0].ambient", m_floorMaterial.ambient);
+	m_pEnvSDeferredEffect->SetVec3("material[0].diffuse", m_floorMaterial.diffuse);
+	m_pEnvSDeferredEffect->SetVec3("material[0].specular", m_floorMaterial.specular);
+	m_pEnvSDeferredEffect->SetFloat("material[0].shininess", m_floorMaterial.shininess);
+	m_pEnvSDeferredEffect->SetInt("shading[0]", floorShading);
+	m_pEnvSDeferredEffect->SetVec3("material[1].ambient", m_modelBlinnPhongMaterial.ambient);
+	m_pEnvSDeferredEffect->SetVec3("material[1].diffuse", m_modelBlinnPhongMaterial.diffuse);
+	m_pEnvSDeferredEffect->SetVec3("material[1].specular", m_modelBlinnPhongMaterial.specular);
+	m_pEnvSDeferredEffect->SetFloat("material[1].shininess", m_modelBlinnPhongMaterial.shininess);
+	m_pEnvSDeferredEffect->SetInt("shading[1]", modelShading);
+
+	if (m_bIsLoadTexture)
+	{
+		m_renderState.BindTexture(0, GL_TEXTURE_3D, m_iBRDFEstTex);
+		m_pEnvSDeferredEffect->SetInt("texture_brdf", 0);
+	}
+
+	if (m_bIsEnvMapLoaded)
+	{
+		m_renderState.BindTexture(4, GL_TEXTURE_CUBE_MAP, m_uiEnvMap);
+		m_pEnvSDeferredEffect->SetInt("envmap", 4);
+	}
+
+	m_renderState.BindTexture(5, GL_TEXTURE_2D_ARRAY, m_uiEnvBatchArrayTex);
+	m_pEnvSDeferredEffect->SetInt("texture_shadow", 5);
+	SetEnvShadowBatch(m_pEnvSDeferredEffect, sampCount);
+
+	RenderScreenQuad();
+	m_renderState.SetDepthTest(true);
+	CHECK_GL_ERROR;
+	m_bIsEnvHistoryValid = true;
+	m_iEnvSumW = m_iRenderW;
+	m_iEnvSumH = m_iRenderH;
+	m_matEnvSumView = m_matLastCam;
+}
+
+bool ModelViewWindow::SaveEnvHistory()
+{
+	// the sums are only usable while the G-buffer still holds the positions they were shaded at, and they do not
+	// replace a saved history of a higher resolution : the converged image survives the reduced frames of a drag
+	if (!m_bIsEnvHistoryValid || m_bIsGBufferDirty
+		|| (m_bIsEnvHistorySaved && m_iEnvSumW * m_iEnvSumH < m_iEnvHistoryW * m_iEnvHistoryH))
+		return m_bIsEnvHistorySaved;
+	m_bIsEnvHistorySaved = true;
+	m_iEnvHistoryW = m_iEnvSumW;
+	m_iEnvHistoryH = m_iEnvSumH;
+	m_matEnvHistoryView = m_matEnvSumView;
+
+	// sums of the old view and the positions they were shaded at, blitted before the clear and the new G-buffer overwrite them
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_uiEnvHistoryFBO);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, m_uiHDRFBO);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0 + ENVHISTORY_SUM);
+	glBlitFramebuffer(0, 0, m_iSizeW, m_iSizeH, 0, 0, m_iSizeW, m_iSizeH, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glReadBuffer(GL_COLOR_ATTACHMENT1);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0 + ENVHISTORY_MOMENT);
+	glBlitFramebuffer(0, 0, m_iSizeW, m_iSizeH, 0, 0, m_iSizeW, m_iSizeH, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, m_uiGBufferFBO);
+	glReadBuffer(GL_COLOR_ATTACHMENT0 + GBUFFER_POSITION);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0 + ENVHISTORY_POSITION);
+	glBlitFramebuffer(0, 0, m_iSizeW, m_iSizeH, 0, 0, m_iSizeW, m_iSizeH, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_uiHDRFBO);
+	CHECK_GL_ERROR;
+	return true;
+}
+
+void ModelViewWindow::Render_EnvReproject(const NPMathHelper::Mat4x4& proj)
+{
+	// every covered pixel gets its old sum, moment and sample count back, or zero when it was not visible before
+	NPMathHelper::Mat4x4 historyViewProj = NPMathHelper::Mat4x4::mul(proj, m_matEnvHistoryView);
+	m_renderState.SetBlend(false);
+	m_renderState.SetDepthTest(false);
+	m_renderState.SetPolygonMode(GL_FILL);
+	m_renderState.UseProgram(m_pEnvReprojectEffect->GetProgram());
+	m_renderState.BindTexture(0, GL_TEXTURE_2D, m_uiGBufferTex[GBUFFER_POSITION]);
+	m_pEnvReprojectEffect->SetInt("gbuffer_position", 0);
+	m_renderState.BindTexture(1, GL_TEXTURE_2D, m_uiEnvHistoryTex[ENVHISTORY_SUM]);
+	m_pEnvReprojectEffect->SetInt("history_sum", 1);
+	m_renderState.BindTexture(2, GL_TEXTURE_2D, m_uiEnvHistoryTex[ENVHISTORY_MOMENT]);
+	m_pEnvReprojectEffect->SetInt("history_moment", 2);
+	m_renderState.BindTexture(3, GL_TEXTURE_2D, m_uiEnvHistoryTex[ENVHISTORY_POSITION]);
+	m_pEnvReprojectEffect->SetInt("history_position", 3);
+	m_pEnvReprojectEffect->SetMatrix("history_view_proj", historyViewProj.GetDataColumnMajor());
+	m_pEnvReprojectEffect->SetFloat("reject_dist", m_fEnvReprojectRejectDist);
+	m_pEnvReprojectEffect->SetVec2("history_size", (float)m_iEnvHistoryW, (float)m_iEnvHistoryH);
+	RenderScreenQuad();
+	m_renderState.SetDepthTest(true);
+	CHECK_GL_ERROR;
+	m_bIsEnvReprojectPending = false;
 }
 
+void ModelViewWindow::UpdateEnvConvergence()
+{
+	if (m_uiEnvInitSamp < CONVERGE_MIN_SAMP || m_uiEnvInitSamp < m_uiEnvLastConvergeSamp + CONVERGE_INTERVAL)
+		return;
+	m_uiEnvLastConvergeSamp = m_uiEnvInitSamp;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, m_uiConvergeFBO);
+	glViewport(0, 0, m_uiConvergeTilesW, m_uiConvergeTilesH);
+	m_renderState.SetBlend(false);
+	m_renderState.SetDepthTest(false);
+	m_renderState.SetPolygonMode(GL_FILL);
+	m_renderState.UseProgram(m_pEnvConvergeEffect->GetProgram());
+	m_renderState.BindTexture(0, GL_TEXTURE_2D, m_uiHDRCB);
+	m_pEnvConvergeEffect->SetInt("sumBuffer", 0);
+	m_renderState.BindTexture(1, GL_TEXTURE_2D, m_uiHDRMomentCB);
+	m_pEnvConvergeEffect->SetInt("momentBuffer", 1);
+	m_pEnvConvergeEffect->SetVec2("render_size", (float)m_iRenderW, (float)m_iRenderH);
+	RenderScreenQuad();
+
+	std::vector<float> tileError(m_uiConvergeTilesW * m_uiConvergeTilesH);
+	glReadPixels(0, 0, m_uiConvergeTilesW, m_uiConvergeTilesH, GL_RED, GL_FLOAT, tileError.data());
+
+	// the sums are drawn into again right after
+	m_renderState.BindTexture(1, GL_TEXTURE_2D, 0);
+	m_renderState.BindTexture(0, GL_TEXTURE_2D, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_uiHDRFBO);
+	glViewport(0, 0, m_iRenderW, m_iRenderH);
+	m_renderState.SetDepthTest(true);
+
+	// stop as soon as the worst tile is under the threshold
+	m_fEnvConvergeError = *std::max_element(tileError.begin(), tileError.end());
+	if (m_fEnvConvergeError < m_fEnvConvergeThreshold)
+	{
+		m_bIsEnvConverged = true;
+		m_fRenderingProgress = 100.f;
+	}
+}
 
 void ModelViewWindow::RenderScreenQuad()
 {
@@ -2467,7 +2766,7 @@ void ModelViewWindow::RenderScreenQuad()
 		};
 		glGenVertexArrays(1, &m_uiVAOQuad);
 		glGenBuffers(1, &m_uiVBOQuad);
-		glBindVertexArray(m_uiVAOQuad);
+		m_renderState.BindVertexArray(m_uiVAOQuad);
 		glBindBuffer(GL_ARRAY_BUFFER, m_uiVBOQuad);
 		glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices, GL_STATIC_DRAW);
 		glEnableVertexAttribArray(0);
@@ -2475,9 +2774,8 @@ void ModelViewWindow::RenderScreenQuad()
 		glEnableVertexAttribArray(1);
 		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid*)( 3 * sizeof(GLfloat)));
 	}
-	glBindVertexArray(m_uiVAOQuad);
+	m_renderState.BindVertexArray(m_uiVAOQuad);
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-	glBindVertexArray(0);
 }
 
 
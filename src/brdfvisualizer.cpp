@@ -2,6 +2,7 @@
 
 #include <iostream>
 #include <string>
+#include <algorithm>
 
 #include "geohelper.h"
 #include "oshelper.h"
@@ -19,6 +20,27 @@ int main()
 	return mainApp.Run(new BRDFVisualizer("BRDF Visualizer", WINDOW_WIDTH, WINDOW_HEIGHT));
 }
 
+// same mapping as GetVectorIndex in BRDFVisualizeVS.glsl
+static void GetVectorIndex(glm::vec3 value, const unsigned int n_th, const unsigned int n_ph, float &th, float &ph)
+{
+	value = glm::normalize(value);
+	float tAngle = acos(value.y);
+	th = tAngle / (0.5f * M_PI) * n_th;
+	glm::vec2 hori(value.x, value.z);
+	if (glm::length(hori) < 1E-6f)
+	{
+		ph = 0.f;
+		return;
+	}
+	hori = glm::normalize(hori);
+	float pAngle;
+	if (hori.x > 0)
+		pAngle = (hori.y >= 0) ? 3.f / 2.f * M_PI + acos(hori.y) : asin(-hori.y);
+	else
+		pAngle = (hori.y >= 0) ? M_PI + asin(hori.y) : 0.5f * M_PI + asin(-hori.x);
+	ph = pAngle / (2.f * M_PI) * n_ph;
+}
+
 void TW_CALL BRDFButton(void * window)
 {
 	BRDFVisualizer* appWin = (BRDFVisualizer*)window;
@@ -59,6 +81,12 @@ BRDFVisualizer::BRDFVisualizer(const char* name, const int sizeW, const int size
 	, m_bIsSceneGUI(true)
 	, m_uiModelWindowWSize(1600)
 	, m_uiModelWindowHSize(900)
+	, m_iBRDFEstTex(0)
+	, m_iSliceTH(0)
+	, m_iSlicePH(0)
+	, m_uiSliceNTH(0)
+	, m_uiSliceNPH(0)
+	, m_bIsSliceLoaded(false)
 {
 }
 
@@ -162,11 +190,12 @@ int BRDFVisualizer::OnTick(const float deltaTime)
 		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 	if (m_bIsLoadTexture)
 	{
+		UpdateBRDFSlice();
+
 		m_pBRDFVisEffect->activeEffect();
 		m_pBRDFVisEffect->SetInt("n_th", m_uiNTH);
 		m_pBRDFVisEffect->SetInt("n_ph", m_uiNPH);
-		m_pBRDFVisEffect->SetFloat("i_yaw", m_fInYaw);
-		m_pBRDFVisEffect->SetFloat("i_pitch", m_fInPitch);
+		m_pBRDFVisEffect->SetVec2("i_index", m_v2SliceIndex.x, m_v2SliceIndex.y);
 		m_pBRDFVisEffect->SetMatrix("projection", myProj.GetDataColumnMajor());
 		m_pBRDFVisEffect->SetMatrix("view", m_Cam.GetViewMatrix());
 		m_pBRDFVisEffect->SetMatrix("model", glm::value_ptr(model));
@@ -217,6 +246,9 @@ int BRDFVisualizer::OnTick(const float deltaTime)
 void BRDFVisualizer::OnTerminate()
 {
 	testObject.ClearGeometry();
+	if (m_iBRDFEstTex)
+		glDeleteTextures(1, &m_iBRDFEstTex);
+	m_BRDFReader.Close();
 
 	NPTwTerminate(m_uiID);
 }
@@ -265,18 +297,30 @@ void BRDFVisualizer::OpenBRDFData()
 	if (file.empty())
 		return;
 
-	int width, height;
-	//if (!NPGLHelper::loadTextureFromFile(file.c_str(), m_iBRDFEstTex, GL_REPEAT, GL_REPEAT, GL_NEAREST, GL_NEAREST, false))
-	if (!NPGLHelper::loadHDRTextureFromFile(file.c_str(), m_iBRDFEstTex, GL_REPEAT, GL_REPEAT, GL_NEAREST, GL_NEAREST))
+	// only the scanline index is kept, UpdateBRDFSlice decodes the incident columns it needs
+	if (!m_BRDFReader.Open(file.c_str()))
 	{
 		std::string message = "Cannot load file ";
 		message = message + file;
 		NPOSHelper::CreateMessageBox(message.c_str(), "Load BRDF Data Failure", NPOSHelper::MSGBOX_OK);
+		m_bIsLoadTexture = false;
 		return;
 	}
 
+	if (!m_iBRDFEstTex)
+	{
+		glGenTextures(1, &m_iBRDFEstTex);
+		glBindTexture(GL_TEXTURE_2D, m_iBRDFEstTex);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
 	m_sBRDFFilePath = m_sBRDFTextureName = file;
 	m_bIsLoadTexture = true;
+	m_bIsSliceLoaded = false;
 
 	ModelViewWindow* modelViewWindow = (ModelViewWindow*)GetOwner()->GetWindow(m_uiModelWindowID);
 	if (modelViewWindow)
@@ -285,6 +329,61 @@ void BRDFVisualizer::OpenBRDFData()
 	}
 }
 
+void BRDFVisualizer::UpdateBRDFSlice()
+{
+	if (!m_uiNTH || !m_uiNPH)
+		return;
+
+	glm::vec3 inVec(cos(m_fInYaw) * sin(m_fInPitch), sin(m_fInYaw), cos(m_fInYaw) * cos(m_fInPitch));
+	GetVectorIndex(inVec, m_uiNTH, m_uiNPH, m_v2SliceIndex.x, m_v2SliceIndex.y);
+	const int baseTH = std::min((int)floor(m_v2SliceIndex.x), (int)m_uiNTH - 1);
+	const int basePH = (int)floor(m_v2SliceIndex.y);
+	if (m_bIsSliceLoaded && baseTH == m_iSliceTH && basePH == m_iSlicePH && m_uiNTH == m_uiSliceNTH && m_uiNPH == m_uiSliceNPH)
+		return;
+	m_iSliceTH = baseTH;
+	m_iSlicePH = basePH;
+	m_uiSliceNTH = m_uiNTH;
+	m_uiSliceNPH = m_uiNPH;
+	m_bIsSliceLoaded = true;
+
+	// column x of the table is the incident direction, row y the outgoing one
+	// the four incident columns around the light become blocks of n_th + 1 rows by n_ph + 1 texels,
+	// the extra column wraps ph and the extra row repeats the last th so the sampler can filter across both
+	const int outSize = m_BRDFReader.GetHeight();
+	const int sliceW = m_uiNPH + 1;
+	const int sliceH = 4 * (m_uiNTH + 1);
+	std::vector<float> column(3 * outSize, 0.f);
+	m_vBRDFSlice.assign(3 * sliceW * sliceH, 0.f);
+	for (int corner = 0; corner < 4; corner++)
+	{
+		const int i_th = std::min(baseTH + (corner & 1), (int)m_uiNTH - 1);
+		const int i_ph = (basePH + (corner >> 1)) % (int)m_uiNPH;
+		const int columnIndex = i_th * m_uiNPH + i_ph;
+		if (columnIndex >= m_BRDFReader.GetWidth() || outSize < (int)(m_uiNTH * m_uiNPH)
+			|| !m_BRDFReader.ReadRegion(columnIndex, 0, 1, outSize, &column[0]))
+		{
+			DEBUG_COUT("Cannot read BRDF column " << columnIndex << " of " << m_sBRDFFilePath);
+			continue;
+		}
+		for (int y = 0; y <= (int)m_uiNTH; y++)
+		{
+			const int o_th = std::min(y, (int)m_uiNTH - 1);
+			float* row = &m_vBRDFSlice[3 * (corner * (m_uiNTH + 1) + y) * sliceW];
+			for (int x = 0; x < sliceW; x++)
+			{
+				const float* src = &column[3 * (o_th * m_uiNPH + x % m_uiNPH)];
+				row[3 * x] = src[0];
+				row[3 * x + 1] = src[1];
+				row[3 * x + 2] = src[2];
+			}
+		}
+	}
+
+	glBindTexture(GL_TEXTURE_2D, m_iBRDFEstTex);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, sliceW, sliceH, 0, GL_RGB, GL_FLOAT, &m_vBRDFSlice[0]);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
 void BRDFVisualizer::OpenModelWindow()
 {
 	if (!(m_uiModelWindowID > 0 && GetOwner() && GetOwner()->GetIsWindowActive(m_uiModelWindowID)))
@@ -2,6 +2,9 @@
 #include "mathhelper.h"
 
 #include <glm/glm.hpp>
+#include <algorithm>
+#include <array>
+#include <assert.h>
 
 using namespace NPMathHelper;
 
@@ -200,4 +203,199 @@ namespace NPGeoHelper
 
 		return result;
 	}
+
+	namespace
+	{
+		// Forsyth's scoring, an LRU cache a bit larger than the hardware one works for all of them
+		const unsigned int VCACHE_SIZE = 32;
+		const float VCACHE_DECAY_POWER = 1.5f;
+		const float VCACHE_LAST_TRI_SCORE = 0.75f;
+		const float VCACHE_VALENCE_SCALE = 2.f;
+		const float VCACHE_VALENCE_POWER = 0.5f;
+
+		float VertexCacheScore(const int cachePos, const unsigned int activeTris)
+		{
+			if (activeTris == 0)
+				return -1.f;
+
+			float score = 0.f;
+			if (cachePos >= 0)
+			{
+				// the three vertices just used score the same whichever order they went in
+				if (cachePos < 3)
+					score = VCACHE_LAST_TRI_SCORE;
+				else
+					score = powf(1.f - (float)(cachePos - 3) / (float)(VCACHE_SIZE - 3), VCACHE_DECAY_POWER);
+			}
+			// vertices with few triangles left are finished first so they leave the cache for good
+			return score + VCACHE_VALENCE_SCALE * powf((float)activeTris, -VCACHE_VALENCE_POWER);
+		}
+	}
+
+	void OptimizeVertexCache(std::vector<unsigned int> &indices, const unsigned int vertexCount)
+	{
+		const unsigned int triCount = (unsigned int)indices.size() / 3;
+		if (triCount == 0)
+			return;
+
+		// pending triangles of each vertex, the first activeTris[v] entries from triOffset[v]
+		// a degenerate triangle such as (1, 1, 3) is listed once per distinct vertex, the same way it is removed
+		auto isFirstCorner = [&indices](const unsigned int i)
+		{
+			const unsigned int base = i - i % 3;
+			for (unsigned int j = base; j < i; j++)
+			{
+				if (indices[j] == indices[i])
+					return false;
+			}
+			return true;
+		};
+		std::vector<unsigned int> activeTris(vertexCount, 0);
+		for (unsigned int i = 0; i < triCount * 3; i++)
+		{
+			if (isFirstCorner(i))
+				activeTris[indices[i]]++;
+		}
+		std::vector<unsigned int> triOffset(vertexCount + 1, 0);
+		for (unsigned int v = 0; v < vertexCount; v++)
+			triOffset[v + 1] = triOffset[v] + activeTris[v];
+		std::vector<unsigned int> vertTris(triOffset[vertexCount]);
+		{
+			std::vector<unsigned int> fill(triOffset.begin(), triOffset.end() - 1);
+			for (unsigned int i = 0; i < triCount * 3; i++)
+			{
+				if (isFirstCorner(i))
+					vertTris[fill[indices[i]]++] = i / 3;
+			}
+		}
+
+		std::vector<int> cachePos(vertexCount, -1);
+		std::vector<float> vertScore(vertexCount);
+		for (unsigned int v = 0; v < vertexCount; v++)
+			vertScore[v] = VertexCacheScore(-1, activeTris[v]);
+		std::vector<float> triScore(triCount);
+		for (unsigned int t = 0; t < triCount; t++)
+			triScore[t] = vertScore[indices[3 * t]] + vertScore[indices[3 * t + 1]] + vertScore[indices[3 * t + 2]];
+		std::vector<bool> triAdded(triCount, false);
+
+		std::vector<unsigned int> result;
+		result.reserve(triCount * 3);
+		std::vector<unsigned int> cache, newCache;
+		int bestTri = -1;
+		unsigned int nextTri = 0;
+		while (result.size() < triCount * 3)
+		{
+			if (bestTri < 0)
+			{
+				// nothing in the cache has triangles left, carry on in input order
+				while (triAdded[nextTri])
+					nextTri++;
+				bestTri = (int)nextTri;
+			}
+
+			triAdded[bestTri] = true;
+			newCache.clear();
+			for (unsigned int k = 0; k < 3; k++)
+			{
+				const unsigned int v = indices[3 * bestTri + k];
+				result.push_back(v);
+				if (std::find(newCache.begin(), newCache.end(), v) != newCache.end())
+					continue;
+				newCache.push_back(v);
+				unsigned int* tris = &vertTris[triOffset[v]];
+				unsigned int* it = std::find(tris, tris + activeTris[v], (unsigned int)bestTri);
+				assert(it != tris + activeTris[v]);
+				*it = tris[--activeTris[v]];
+			}
+			for (auto v : cache)
+			{
+				if (std::find(newCache.begin(), newCache.end(), v) == newCache.end())
+					newCache.push_back(v);
+			}
+
+			// rescore everything that moved in the cache or fell out of it, the best neighbour goes next
+			for (unsigned int i = 0; i < newCache.size(); i++)
+			{
+				const unsigned int v = newCache[i];
+				cachePos[v] = (i < VCACHE_SIZE) ? (int)i : -1;
+				vertScore[v] = VertexCacheScore(cachePos[v], activeTris[v]);
+			}
+			bestTri = -1;
+			float bestScore = -1.f;
+			for (auto v : newCache)
+			{
+				for (unsigned int j = 0; j < activeTris[v]; j++)
+				{
+					const unsigned int t = vertTris[triOffset[v] + j];
+					if (triAdded[t])
+						continue;
+					triScore[t] = vertScore[indices[3 * t]] + vertScore[indices[3 * t + 1]] + vertScore[indices[3 * t + 2]];
+					if (triScore[t] > bestScore)
+					{
+						bestScore = triScore[t];
+						bestTri = (int)t;
+					}
+				}
+			}
+			if (newCache.size() > VCACHE_SIZE)
+				newCache.resize(VCACHE_SIZE);
+			cache.swap(newCache);
+		}
+
+#ifdef _DEBUG
+		// the output has to be the same triangles, only in another order
+		{
+			auto sortedTris = [](const std::vector<unsigned int> &list)
+			{
+				std::vector<std::array<unsigned int, 3>> tris(list.size() / 3);
+				for (size_t t = 0; t < tris.size(); t++)
+					tris[t] = { { list[3 * t], list[3 * t + 1], list[3 * t + 2] } };
+				std::sort(tris.begin(), tris.end());
+				return tris;
+			};
+			assert(sortedTris(result) == sortedTris(indices));
+		}
+#endif
+		indices.swap(result);
+	}
+
+	std::vector<IndexBatch> OptimizeVertexFetch(const std::vector<unsigned int> &indices, const unsigned int vertexCount
+		, const unsigned int maxVertices)
+	{
+		const unsigned int unused = 0xffffffff;
+		std::vector<IndexBatch> result;
+		std::vector<unsigned int> remap(vertexCount, unused);
+		IndexBatch batch;
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
+		{
+			unsigned int newVertices = 0;
+			for (unsigned int k = 0; k < 3; k++)
+			{
+				if (remap[indices[i + k]] == unused)
+					newVertices++;
+			}
+			if (batch.vertices.size() + newVertices > maxVertices)
+			{
+				for (auto v : batch.vertices)
+					remap[v] = unused;
+				result.push_back(std::move(batch));
+				batch = IndexBatch();
+			}
+
+			for (unsigned int k = 0; k < 3; k++)
+			{
+				const unsigned int v = indices[i + k];
+				if (remap[v] == unused)
+				{
+					remap[v] = (unsigned int)batch.vertices.size();
+					batch.vertices.push_back(v);
+				}
+				batch.indices.push_back(remap[v]);
+			}
+		}
+		if (!batch.indices.empty())
+			result.push_back(std::move(batch));
+
+		return result;
+	}
 }
\ No newline at end of file
@@ -5,10 +5,13 @@
 #include <fstream>
 #include <sstream>
 #include <assert.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
 
 #include <SOIL.h>
 
-#include "hdrhelper.h"
+#include "../3rdparty/brdfestimator/src/loadhdr.h"
 
 GLEWContext* glewGetContext()
 {
@@ -20,6 +23,35 @@ GLEWContext* glewGetContext()
 	return nullptr;
 }
 
+namespace
+{
+	// GL_RGB9_E5 texel as GL_UNSIGNED_INT_5_9_9_9_REV, rounding as in EXT_texture_shared_exponent :
+	// 9 bit mantissas with a shared 5 bit exponent biased by 15, negative values and NaN become 0
+	GLuint packRGB9E5(const float* rgb)
+	{
+		const float maxValue = 65408.f;
+		float c[3];
+		for (int i = 0; i < 3; i++)
+			c[i] = (rgb[i] > 0.f) ? std::min(rgb[i], maxValue) : 0.f;
+		const float maxC = std::max(c[0], std::max(c[1], c[2]));
+
+		int exponent = 0;
+		if (maxC > 0.f)
+		{
+			int e;
+			frexp(maxC, &e);
+			exponent = std::max(-16, e - 1) + 16;
+		}
+		if ((GLuint)floor(ldexp(maxC, 24 - exponent) + 0.5f) == 512)
+			exponent++;
+
+		GLuint packed = (GLuint)exponent << 27;
+		for (int i = 0; i < 3; i++)
+			packed |= (GLuint)floor(ldexp(c[i], 24 - exponent) + 0.5f) << (9 * i);
+		return packed;
+	}
+}
+
 namespace NPGLHelper
 {
 	bool loadASCIIFromFile(std::string file, std::string &content)
@@ -93,12 +125,13 @@ namespace NPGLHelper
 	bool loadHDRTextureFromFile(const char* path, GLuint &id, GLint warpS, GLint warpT, GLint minFil, GLint maxFil)
 	{
 		int width, height;
-		FILE* f;
-		fopen_s(&f, path, "rb");
-		NPHDRHelper::RGBE_ReadHeader(f, &width, &height, NULL);
-		float *image = (float *)malloc(sizeof(float) * 3 * width*height);
-		NPHDRHelper::RGBE_ReadPixels_RLE(f, image, width, height);
-		fclose(f);
+		std::vector<float> image;
+		std::string error;
+		if (!loadhdr(path, width, height, image, error))
+		{
+			DEBUG_COUT(path << " : " << error);
+			return false;
+		}
 
 		glGenTextures(1, &id);
 		glBindTexture(GL_TEXTURE_2D, id);
@@ -106,12 +139,93 @@ namespace NPGLHelper
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, width, height, 0, GL_RGB, GL_FLOAT, image);
-		glGenerateMipmap(GL_TEXTURE_2D);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, width, height, 0, GL_RGB, GL_FLOAT, &image[0]);
 		glBindTexture(GL_TEXTURE_2D, 0);
 		return true;
 	}
 
+	bool loadBRDFTextureFromFile(const char* path, GLuint &id, const unsigned int n_th, const unsigned int n_ph)
+	{
+		int width, height;
+		std::vector<float> image;
+		std::string error;
+		if (!loadhdr(path, width, height, image, error))
+		{
+			DEBUG_COUT(path << " : " << error);
+			return false;
+		}
+
+		const int nTH = (int)n_th, nPH = (int)n_ph;
+		if (nTH <= 0 || nPH <= 0 || width < nTH * nPH || height < nTH * nPH)
+		{
+			DEBUG_COUT(path << " : " << width << " x " << height << " does not hold a " << n_th << " x " << n_ph << " table");
+			return false;
+		}
+		// n_th + 1 blocks with the clamped last one, as many rows of them along y as the limit allows (GL 4.3 only promises 2048)
+		GLint maxSize = 0;
+		glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &maxSize);
+		const int blocks = nTH + 1;
+		const int rows = std::min(blocks, (int)maxSize / (nTH + 1));
+		const int slices = (rows > 0) ? (blocks + rows - 1) / rows : 0;
+		const int sizeX = nPH + 1, sizeY = rows * (nTH + 1), sizeZ = slices * (nPH + 1);
+		if (rows <= 0 || sizeX > maxSize || sizeZ > maxSize)
+		{
+			DEBUG_COUT(path << " : a " << n_th << " x " << n_ph << " table exceeds GL_MAX_3D_TEXTURE_SIZE " << maxSize);
+			return false;
+		}
+
+		// the texels are packed straight into a mapped unpack buffer, so the decoded floats are the only
+		// full copy on the CPU and the driver copies into the texture without stalling on the call
+		const GLsizeiptr tableSize = (GLsizeiptr)sizeX * sizeY * sizeZ * sizeof(GLuint);
+		GLuint pbo;
+		glGenBuffers(1, &pbo);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, tableSize, nullptr, GL_STREAM_DRAW);
+		GLuint* dst = (GLuint*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, tableSize, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		if (dst)
+		{
+			for (int z = 0; z < sizeZ; z++)
+			{
+				const int i_ph = (z % (nPH + 1)) % nPH;
+				for (int y = 0; y < sizeY; y++)
+				{
+					// blocks past the last row of the last slice are never read, they get the clamped one as well
+					const int i_th = std::min((z / (nPH + 1)) * rows + y / (nTH + 1), nTH - 1);
+					const int o_th = std::min(y % (nTH + 1), nTH - 1);
+					for (int x = 0; x < sizeX; x++)
+					{
+						const int o_ph = x % nPH;
+						*dst++ = packRGB9E5(&image[3 * ((size_t)(o_th * nPH + o_ph) * width + i_th * nPH + i_ph)]);
+					}
+				}
+			}
+		}
+		if (!dst || !glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER))
+		{
+			DEBUG_COUT(path << " : cannot write the BRDF upload buffer");
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			glDeleteBuffers(1, &pbo);
+			return false;
+		}
+		std::vector<float>().swap(image);
+
+		glGenTextures(1, &id);
+		glBindTexture(GL_TEXTURE_3D, id);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, 0);
+		glTexStorage3D(GL_TEXTURE_3D, 1, GL_RGB9_E5, sizeX, sizeY, sizeZ);
+		glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, sizeX, sizeY, sizeZ, GL_RGB, GL_UNSIGNED_INT_5_9_9_9_REV, 0);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		// the buffer is only released once the pending copy has read it
+		glDeleteBuffers(1, &pbo);
+		glBindTexture(GL_TEXTURE_3D, 0);
+		return true;
+	}
+
 	bool loadTextureFromFile(const char* path, GLuint &id, GLint warpS, GLint warpT, GLint minFil, GLint maxFil, bool sRGB)
 	{
 		int width, height;
@@ -304,6 +418,8 @@ namespace NPGLHelper
 		m_iEBO = -1;
 	}
 
+	std::map<std::string, GLuint> Effect::g_mapUniformBlockBindings;
+
 	Effect::Effect()
 		: m_bIsLinked(false)
 		, m_iProgram(0)
@@ -365,6 +481,7 @@ namespace NPGLHelper
 			DEBUG_COUT("SHADER::LINK_SUCCEED");
 		}
 
+		ReflectUniforms();
 		m_bIsLinked = true;
 
 		return true;
@@ -384,39 +501,521 @@ namespace NPGLHelper
 		return true;
 	}
 
-	void Effect::SetMatrix(const char* var, const float* mat)
+	Effect::UniformID Effect::GetUniformID(const char* var)
 	{
+		auto it = m_mapUniformIDs.find(var);
+		if (it != m_mapUniformIDs.end())
+			return it->second;
+
+		// not reflected, e.g. a single element of an array : resolved once and remembered, misses included
 		assert(m_iProgram >= 0);
-		GLuint matLoc = glGetUniformLocation(m_iProgram, var);
-		glUniformMatrix4fv(matLoc, 1, GL_FALSE, mat);
+		GLint location = glGetUniformLocation(m_iProgram, var);
+		if (location < 0)
+		{
+			m_mapUniformIDs[var] = -1;
+			return -1;
+		}
+		return AddUniform(var, location);
+	}
+
+	Effect::UniformID Effect::AddUniform(const std::string& name, const GLint location)
+	{
+		Uniform uniform;
+		uniform.location = location;
+		uniform.isUploaded = false;
+		m_vUniforms.push_back(uniform);
+		UniformID id = (UniformID)m_vUniforms.size() - 1;
+		m_mapUniformIDs[name] = id;
+		return id;
+	}
+
+	void Effect::ReflectUniforms()
+	{
+		m_vUniforms.clear();
+		m_mapUniformIDs.clear();
+
+		GLint uniformCount = 0;
+		GLint maxNameLength = 0;
+		glGetProgramiv(m_iProgram, GL_ACTIVE_UNIFORMS, &uniformCount);
+		glGetProgramiv(m_iProgram, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+		std::vector<GLchar> nameBuffer(maxNameLength + 1);
+		for (GLint i = 0; i < uniformCount; i++)
+		{
+			GLsizei nameLength = 0;
+			GLint size = 0;
+			GLenum type = 0;
+			glGetActiveUniform(m_iProgram, i, (GLsizei)nameBuffer.size(), &nameLength, &size, &type, nameBuffer.data());
+			std::string name(nameBuffer.data(), nameLength);
+			GLint location = glGetUniformLocation(m_iProgram, name.c_str());
+			if (location < 0)
+				continue; // block members
+
+			// arrays are reported as "name[0]" but set through "name"
+			UniformID id = AddUniform(name, location);
+			if (size > 1 && name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+				m_mapUniformIDs[name.substr(0, name.size() - 3)] = id;
+		}
+
+		GLint blockCount = 0;
+		GLint maxBlockNameLength = 0;
+		glGetProgramiv(m_iProgram, GL_ACTIVE_UNIFORM_BLOCKS, &blockCount);
+		glGetProgramiv(m_iProgram, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxBlockNameLength);
+		std::vector<GLchar> blockNameBuffer(maxBlockNameLength + 1);
+		for (GLint i = 0; i < blockCount; i++)
+		{
+			GLsizei nameLength = 0;
+			glGetActiveUniformBlockName(m_iProgram, i, (GLsizei)blockNameBuffer.size(), &nameLength, blockNameBuffer.data());
+			auto it = g_mapUniformBlockBindings.find(std::string(blockNameBuffer.data(), nameLength));
+			if (it != g_mapUniformBlockBindings.end())
+				glUniformBlockBinding(m_iProgram, i, it->second);
+		}
+	}
+
+	void Effect::SetUniformBlockBinding(const char* block, const GLuint binding)
+	{
+		g_mapUniformBlockBindings[block] = binding;
+	}
+
+	bool Effect::UpdateUniformCache(const UniformID id, const void* value, const size_t size)
+	{
+		if (id < 0 || id >= (UniformID)m_vUniforms.size())
+			return false;
+		Uniform& uniform = m_vUniforms[id];
+		if (uniform.isUploaded && uniform.value.size() == size && memcmp(uniform.value.data(), value, size) == 0)
+			return false;
+		uniform.value.assign((const unsigned char*)value, (const unsigned char*)value + size);
+		uniform.isUploaded = true;
+		return true;
+	}
+
+	void Effect::SetMatrix(const char* var, const float* mat)
+	{
+		SetMatrix(GetUniformID(var), mat);
 	}
 
 	void Effect::SetInt(const char* var, const int value)
 	{
-		assert(m_iProgram >= 0);
-		GLuint valueLoc = glGetUniformLocation(m_iProgram, var);
-		glUniform1i(valueLoc, value);
+		SetInt(GetUniformID(var), value);
 	}
 
 	void Effect::SetFloat(const char* var, const float value)
 	{
-		assert(m_iProgram >= 0);
-		GLuint valueLoc = glGetUniformLocation(m_iProgram, var);
-		glUniform1f(valueLoc, value);
+		SetFloat(GetUniformID(var), value);
+	}
+
+	void Effect::SetVec2(const char* var, const float x, const float y)
+	{
+		SetVec2(GetUniformID(var), x, y);
 	}
 
 	void Effect::SetVec3(const char* var, const float x, const float y, const float z)
 	{
-		assert(m_iProgram >= 0);
-		GLuint valueLoc = glGetUniformLocation(m_iProgram, var);
-		glUniform3f(valueLoc, x, y, z);
+		SetVec3(GetUniformID(var), x, y, z);
 	}
 
 	void Effect::SetVec3(const char* var, const NPMathHelper::Vec3 &value)
 	{
-		assert(m_iProgram >= 0);
-		GLuint valueLoc = glGetUniformLocation(m_iProgram, var);
-		glUniform3f(valueLoc, value._x, value._y, value._z);
+		SetVec3(GetUniformID(var), value._x, value._y, value._z);
+	}
+
+	void Effect::SetMatrixArray(const char* var, const float* mat, const int count)
+	{
+		SetMatrixArray(GetUniformID(var), mat, count);
+	}
+
+	void Effect::SetVec3Array(const char* var, const float* value, const int count)
+	{
+		SetVec3Array(GetUniformID(var), value, count);
+	}
+
+	void Effect::SetMatrix(const UniformID id, const float* mat)
+	{
+		if (UpdateUniformCache(id, mat, sizeof(float) * 16))
+			glProgramUniformMatrix4fv(m_iProgram, m_vUniforms[id].location, 1, GL_FALSE, mat);
+	}
+
+	void Effect::SetInt(const UniformID id, const int value)
+	{
+		if (UpdateUniformCache(id, &value, sizeof(int)))
+			glProgramUniform1i(m_iProgram, m_vUniforms[id].location, value);
+	}
+
+	void Effect::SetFloat(const UniformID id, const float value)
+	{
+		if (UpdateUniformCache(id, &value, sizeof(float)))
+			glProgramUniform1f(m_iProgram, m_vUniforms[id].location, value);
+	}
+
+	void Effect::SetVec2(const UniformID id, const float x, const float y)
+	{
+		const float value[2] = { x, y };
+		if (UpdateUniformCache(id, value, sizeof(value)))
+			glProgramUniform2f(m_iProgram, m_vUniforms[id].location, x, y);
+	}
+
+	void Effect::SetVec3(const UniformID id, const float x, const float y, const float z)
+	{
+		const float value[3] = { x, y, z };
+		if (UpdateUniformCache(id, value, sizeof(value)))
+			glProgramUniform3f(m_iProgram, m_vUniforms[id].location, x, y, z);
+	}
+
+	void Effect::SetVec3(const UniformID id, const NPMathHelper::Vec3 &value)
+	{
+		SetVec3(id, value._x, value._y, value._z);
+	}
+
+	void Effect::SetMatrixArray(const UniformID id, const float* mat, const int count)
+	{
+		if (UpdateUniformCache(id, mat, sizeof(float) * 16 * count))
+			glProgramUniformMatrix4fv(m_iProgram, m_vUniforms[id].location, count, GL_FALSE, mat);
+	}
+
+	void Effect::SetVec3Array(const UniformID id, const float* value, const int count)
+	{
+		if (UpdateUniformCache(id, value, sizeof(float) * 3 * count))
+			glProgramUniform3fv(m_iProgram, m_vUniforms[id].location, count, value);
+	}
+
+	UniformRingBuffer::UniformRingBuffer()
+		: m_uiBuffer(0)
+		, m_pMapped(nullptr)
+		, m_iSlotSize(0)
+		, m_uiSlotCount(0)
+		, m_uiCurrentSlot(0)
+	{
+
+	}
+
+	UniformRingBuffer::~UniformRingBuffer()
+	{
+		Release();
+	}
+
+	bool UniformRingBuffer::Init(const GLsizeiptr* blockSizes, const unsigned int blockCount, const unsigned int slotCount)
+	{
+		Release();
+
+		GLint align = 256;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+		if (align <= 0)
+			align = 256;
+
+		// every block of every slot starts on an offset glBindBufferRange accepts
+		m_iSlotSize = 0;
+		for (unsigned int i = 0; i < blockCount; i++)
+		{
+			m_vBlockOffsets.push_back(m_iSlotSize);
+			m_vBlockSizes.push_back(blockSizes[i]);
+			m_iSlotSize += (blockSizes[i] + align - 1) / align * align;
+		}
+		m_uiSlotCount = (slotCount > 0) ? slotCount : 1;
+		m_uiCurrentSlot = 0;
+		m_vSlotFences.assign(m_uiSlotCount, (GLsync)0);
+
+		const GLsizeiptr totalSize = m_iSlotSize * m_uiSlotCount;
+		glGenBuffers(1, &m_uiBuffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, m_uiBuffer);
+		if (GLEW_ARB_buffer_storage)
+		{
+			const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_UNIFORM_BUFFER, totalSize, nullptr, flags);
+			m_pMapped = (unsigned char*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, totalSize, flags);
+		}
+		else
+		{
+			// no persistent mapping, the slots are filled with glBufferSubData instead
+			glBufferData(GL_UNIFORM_BUFFER, totalSize, nullptr, GL_STREAM_DRAW);
+		}
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		CHECK_GL_ERROR;
+
+		return true;
+	}
+
+	void UniformRingBuffer::Update(const void* const* blockData)
+	{
+		if (m_uiBuffer == 0)
+			return;
+
+		// the slot written last frame is released once the commands reading it are done
+		if (m_vSlotFences[m_uiCurrentSlot])
+			glDeleteSync(m_vSlotFences[m_uiCurrentSlot]);
+		m_vSlotFences[m_uiCurrentSlot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		m_uiCurrentSlot = (m_uiCurrentSlot + 1) % m_uiSlotCount;
+
+		GLsync fence = m_vSlotFences[m_uiCurrentSlot];
+		if (fence)
+		{
+			while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+			glDeleteSync(fence);
+			m_vSlotFences[m_uiCurrentSlot] = (GLsync)0;
+		}
+
+		const GLintptr slotOffset = m_iSlotSize * m_uiCurrentSlot;
+		if (!m_pMapped)
+			glBindBuffer(GL_UNIFORM_BUFFER, m_uiBuffer);
+		for (unsigned int i = 0; i < m_vBlockSizes.size(); i++)
+		{
+			const GLintptr offset = slotOffset + m_vBlockOffsets[i];
+			if (m_pMapped)
+				memcpy(m_pMapped + offset, blockData[i], m_vBlockSizes[i]);
+			else
+				glBufferSubData(GL_UNIFORM_BUFFER, offset, m_vBlockSizes[i], blockData[i]);
+			glBindBufferRange(GL_UNIFORM_BUFFER, i, m_uiBuffer, offset, m_vBlockSizes[i]);
+		}
+		if (!m_pMapped)
+			glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	void UniformRingBuffer::Release()
+	{
+		for (auto it = m_vSlotFences.begin(); it != m_vSlotFences.end(); it++)
+		{
+			if (*it)
+				glDeleteSync(*it);
+		}
+		m_vSlotFences.clear();
+
+		if (m_uiBuffer != 0)
+		{
+			if (m_pMapped)
+			{
+				glBindBuffer(GL_UNIFORM_BUFFER, m_uiBuffer);
+				glUnmapBuffer(GL_UNIFORM_BUFFER);
+				glBindBuffer(GL_UNIFORM_BUFFER, 0);
+			}
+			glDeleteBuffers(1, &m_uiBuffer);
+		}
+		m_uiBuffer = 0;
+		m_pMapped = nullptr;
+		m_vBlockSizes.clear();
+		m_vBlockOffsets.clear();
+		m_iSlotSize = 0;
+	}
+
+	// ~0 marks a value that is not known, the next set always reaches GL
+	static const GLuint STATE_UNKNOWN = ~0u;
+
+	RenderState::RenderState()
+	{
+		Invalidate();
+	}
+
+	void RenderState::Invalidate()
+	{
+		m_uiProgram = STATE_UNKNOWN;
+		m_uiVAO = STATE_UNKNOWN;
+		m_uiIndirectBuffer = STATE_UNKNOWN;
+		m_uiActiveUnit = STATE_UNKNOWN;
+		for (unsigned int i = 0; i < MAX_TEXTURE_UNITS; i++)
+		{
+			m_eTexTargets[i] = STATE_UNKNOWN;
+			m_uiTextures[i] = STATE_UNKNOWN;
+		}
+		m_iBlend = -1;
+		m_eBlendSrc = m_eBlendDst = STATE_UNKNOWN;
+		m_iCullFace = -1;
+		m_eCullFace = STATE_UNKNOWN;
+		m_iDepthTest = -1;
+		m_ePolygonMode = STATE_UNKNOWN;
+	}
+
+	void RenderState::UseProgram(const GLuint program)
+	{
+		if (program == m_uiProgram)
+			return;
+		glUseProgram(program);
+		m_uiProgram = program;
+	}
+
+	void RenderState::BindVertexArray(const GLuint vao)
+	{
+		if (vao == m_uiVAO)
+			return;
+		glBindVertexArray(vao);
+		m_uiVAO = vao;
+	}
+
+	void RenderState::BindDrawIndirectBuffer(const GLuint buffer)
+	{
+		if (buffer == m_uiIndirectBuffer)
+			return;
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer);
+		m_uiIndirectBuffer = buffer;
+	}
+
+	void RenderState::BindTexture(const GLuint unit, const GLenum target, const GLuint texture)
+	{
+		if (unit >= MAX_TEXTURE_UNITS)
+		{
+			glActiveTexture(GL_TEXTURE0 + unit);
+			glBindTexture(target, texture);
+			m_uiActiveUnit = unit;
+			return;
+		}
+		if (m_eTexTargets[unit] == target && m_uiTextures[unit] == texture)
+			return;
+		if (unit != m_uiActiveUnit)
+		{
+			glActiveTexture(GL_TEXTURE0 + unit);
+			m_uiActiveUnit = unit;
+		}
+		glBindTexture(target, texture);
+		m_eTexTargets[unit] = target;
+		m_uiTextures[unit] = texture;
+	}
+
+	void RenderState::SetBlend(const bool enable, const GLenum src, const GLenum dst)
+	{
+		if ((int)enable != m_iBlend)
+		{
+			if (enable)
+				glEnable(GL_BLEND);
+			else
+				glDisable(GL_BLEND);
+			m_iBlend = enable;
+		}
+		if (enable && (src != m_eBlendSrc || dst != m_eBlendDst))
+		{
+			glBlendFunc(src, dst);
+			m_eBlendSrc = src;
+			m_eBlendDst = dst;
+		}
+	}
+
+	void RenderState::SetCullFace(const bool enable, const GLenum face)
+	{
+		if ((int)enable != m_iCullFace)
+		{
+			if (enable)
+				glEnable(GL_CULL_FACE);
+			else
+				glDisable(GL_CULL_FACE);
+			m_iCullFace = enable;
+		}
+		if (enable && face != m_eCullFace)
+		{
+			glCullFace(face);
+			m_eCullFace = face;
+		}
+	}
+
+	void RenderState::SetDepthTest(const bool enable)
+	{
+		if ((int)enable == m_iDepthTest)
+			return;
+		if (enable)
+			glEnable(GL_DEPTH_TEST);
+		else
+			glDisable(GL_DEPTH_TEST);
+		m_iDepthTest = enable;
+	}
+
+	void RenderState::SetPolygonMode(const GLenum mode)
+	{
+		if (mode == m_ePolygonMode)
+			return;
+		glPolygonMode(GL_FRONT_AND_BACK, mode);
+		m_ePolygonMode = mode;
+	}
+
+	RenderPass::RenderPass()
+		: m_ePolygonMode(GL_FILL)
+		, m_bIsBlend(false)
+		, m_eBlendSrc(GL_ONE)
+		, m_eBlendDst(GL_ONE)
+		, m_bIsCullFace(true)
+		, m_eCullFace(GL_BACK)
+		, m_bIsDepthTest(true)
+	{
+
+	}
+
+	void RenderPass::SetBlend(const bool enable, const GLenum src, const GLenum dst)
+	{
+		m_bIsBlend = enable;
+		m_eBlendSrc = src;
+		m_eBlendDst = dst;
+	}
+
+	void RenderPass::SetCullFace(const bool enable, const GLenum face)
+	{
+		m_bIsCullFace = enable;
+		m_eCullFace = face;
+	}
+
+	void RenderPass::AddDraw(Effect* effect, const GLuint vao, const GLsizei count
+		, const std::vector<TextureBinding>& textures, const SetupFunc& setup)
+	{
+		DrawItem item;
+		item.effect = effect;
+		item.vao = vao;
+		item.count = count;
+		item.indirect = 0;
+		item.indexType = GL_UNSIGNED_INT;
+		item.textures = textures;
+		item.setup = setup;
+		m_vItems.push_back(item);
+	}
+
+	void RenderPass::AddMultiDraw(Effect* effect, const GLuint vao, const GLuint indirectBuffer, const GLsizei drawCount
+		, const GLenum indexType, const std::vector<TextureBinding>& textures, const SetupFunc& setup)
+	{
+		DrawItem item;
+		item.effect = effect;
+		item.vao = vao;
+		item.count = drawCount;
+		item.indirect = indirectBuffer;
+		item.indexType = indexType;
+		item.textures = textures;
+		item.setup = setup;
+		m_vItems.push_back(item);
+	}
+
+	void RenderPass::Submit(RenderState& state)
+	{
+		state.SetPolygonMode(m_ePolygonMode);
+		state.SetBlend(m_bIsBlend, m_eBlendSrc, m_eBlendDst);
+		state.SetCullFace(m_bIsCullFace, m_eCullFace);
+		state.SetDepthTest(m_bIsDepthTest);
+
+		// draws sharing a program, then a texture, end up next to each other, the order among equal ones is kept
+		std::stable_sort(m_vItems.begin(), m_vItems.end(), [](const DrawItem& a, const DrawItem& b)
+		{
+			const GLuint programA = a.effect->GetProgram();
+			const GLuint programB = b.effect->GetProgram();
+			if (programA != programB)
+				return programA < programB;
+			const GLuint textureA = a.textures.empty() ? 0 : a.textures[0].id;
+			const GLuint textureB = b.textures.empty() ? 0 : b.textures[0].id;
+			return textureA < textureB;
+		});
+
+		for (auto& item : m_vItems)
+		{
+			state.UseProgram(item.effect->GetProgram());
+			for (auto& texture : item.textures)
+			{
+				state.BindTexture(texture.unit, texture.target, texture.id);
+				if (texture.sampler)
+					item.effect->SetInt(texture.sampler, texture.unit);
+			}
+			if (item.setup)
+				item.setup(*item.effect);
+			state.BindVertexArray(item.vao);
+			if (item.indirect)
+			{
+				state.BindDrawIndirectBuffer(item.indirect);
+				glMultiDrawElementsIndirect(GL_TRIANGLES, item.indexType, 0, item.count, 0);
+			}
+			else
+			{
+				glDrawElements(GL_TRIANGLES, item.count, item.indexType, 0);
+			}
+		}
+		m_vItems.clear();
+		CHECK_GL_ERROR;
 	}
 
 	Window::Window(const char* name, const int sizeW, const int sizeH)
@@ -462,6 +1061,7 @@ namespace NPGLHelper
 		, m_pWindow(nullptr)
 		, m_bIsInit(false)
 		, m_fDeltaTime(0.f)
+		, m_fLastTime(0.f)
 		, m_uiCurrentWindowID(0)
 		, m_uiCurrentMaxID(0)
 		, m_bForceShutdown(false)
@@ -482,7 +1082,20 @@ namespace NPGLHelper
 
 		while (WindowsUpdate())
 		{
-			glfwPollEvents();
+			if (GetIsAllWindowsIdle())
+			{
+				// nothing left to refine anywhere, sleep until input instead of spinning
+#if GLFW_VERSION_MAJOR > 3 || (GLFW_VERSION_MAJOR == 3 && GLFW_VERSION_MINOR >= 2)
+				glfwWaitEventsTimeout(IDLE_WAIT_TIMEOUT);
+#else
+				glfwWaitEvents();
+#endif
+				m_fLastTime = glfwGetTime();
+			}
+			else
+			{
+				glfwPollEvents();
+			}
 			float currentTime = glfwGetTime();
 
 			if (m_fLastTime > 0.f)
@@ -490,6 +1103,9 @@ namespace NPGLHelper
 
 			for (auto it = m_mapWindows.begin(); it != m_mapWindows.end(); it++)
 			{
+				// idle windows keep their last swapped frame, no render, compose or UI redraw
+				if (it->second->GetIsIdle() && !it->second->GetHasInputMSG())
+					continue;
 				SetCurrentWindow(it->first);
 				it->second->ProcessInputMSGQueue();
 				it->second->OnTick(GetDeltaTime());
@@ -578,6 +1194,7 @@ namespace NPGLHelper
 	}
 
 	App* App::g_pMainApp = nullptr;
+	const double App::IDLE_WAIT_TIMEOUT = 0.25;
 	void App::GlobalKeyCallback(GLFWwindow* window, int key, int scancode, int action, int mode)
 	{
 		if (g_pMainApp)
@@ -630,6 +1247,16 @@ namespace NPGLHelper
 		return (m_mapWindows.size() > 0);
 	}
 
+	bool App::GetIsAllWindowsIdle()
+	{
+		for (auto it = m_mapWindows.begin(); it != m_mapWindows.end(); it++)
+		{
+			if (!it->second->GetIsIdle() || it->second->GetHasInputMSG())
+				return false;
+		}
+		return true;
+	}
+
 	void App::TerminateShouldQuitWindows()
 	{
 		std::vector<unsigned int> removeList;
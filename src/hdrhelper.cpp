@@ -3,6 +3,7 @@
 #include <malloc.h>
 #include <string.h>
 #include <ctype.h>
+#include "../3rdparty/brdfestimator/src/savehdr.h"
 
 #ifdef _CPLUSPLUS
 /* define if your compiler understands inline commands */
@@ -70,24 +71,6 @@ namespace NPHDRHelper
 		}
 	}
 
-	/* standard conversion from rgbe to float pixels */
-	/* note: Ward uses ldexp(col+0.5,exp-(128+8)).  However we wanted pixels */
-	/*       in the range [0,1] to map back into the range [0,1].            */
-	static INLINE void
-		rgbe2float(float *red, float *green, float *blue, unsigned char rgbe[4])
-	{
-		float f;
-
-		if (rgbe[3]) {   /*nonzero pixel*/
-			f = ldexp(1.0, rgbe[3] - (int)(128 + 8));
-			*red = rgbe[0] * f;
-			*green = rgbe[1] * f;
-			*blue = rgbe[2] * f;
-		}
-		else
-			*red = *green = *blue = 0.0;
-	}
-
 	/* default minimal header. modify if you want more information in header */
 	int RGBE_WriteHeader(FILE *fp, int width, int height, rgbe_header_info *info)
 	{
@@ -189,208 +172,75 @@ namespace NPHDRHelper
 		return RGBE_RETURN_SUCCESS;
 	}
 
-	/* simple read routine.  will not correctly handle run length encoding */
-	int RGBE_ReadPixels(FILE *fp, float *data, int numpixels)
-	{
-		unsigned char rgbe[4];
-
-		while (numpixels-- > 0) {
-			if (fread(rgbe, sizeof(rgbe), 1, fp) < 1)
-				return rgbe_error(rgbe_read_error, NULL);
-			rgbe2float(&data[RGBE_DATA_RED], &data[RGBE_DATA_GREEN],
-				&data[RGBE_DATA_BLUE], rgbe);
-			data += RGBE_DATA_SIZE;
-		}
-		return RGBE_RETURN_SUCCESS;
-	}
-
 	/* The code below is only needed for the run-length encoded files. */
 	/* Run length encoding adds considerable complexity but does */
 	/* save some space.  For each scanline, each channel (r,g,b,e) is */
 	/* encoded separately for better compression. */
 
-	static int RGBE_WriteBytes_RLE(FILE *fp, unsigned char *data, int numbytes)
-	{
-#define MINRUNLENGTH 4
-		int cur, beg_run, run_count, old_run_count, nonrun_count;
-		unsigned char buf[2];
-
-		cur = 0;
-		while (cur < numbytes) {
-			beg_run = cur;
-			/* find next run of length at least 4 if one exists */
-			run_count = old_run_count = 0;
-			while ((run_count < MINRUNLENGTH) && (beg_run < numbytes)) {
-				beg_run += run_count;
-				old_run_count = run_count;
-				run_count = 1;
-				while ((beg_run + run_count < numbytes) && (run_count < 127)
-					&& (data[beg_run] == data[beg_run + run_count]))
-					run_count++;
-			}
-			/* if data before next big run is a short run then write it as such */
-			if ((old_run_count > 1) && (old_run_count == beg_run - cur)) {
-				buf[0] = 128 + old_run_count;   /*write short run*/
-				buf[1] = data[cur];
-				if (fwrite(buf, sizeof(buf[0]) * 2, 1, fp) < 1)
-					return rgbe_error(rgbe_write_error, NULL);
-				cur = beg_run;
-			}
-			/* write out bytes until we reach the start of the next run */
-			while (cur < beg_run) {
-				nonrun_count = beg_run - cur;
-				if (nonrun_count > 128)
-					nonrun_count = 128;
-				buf[0] = nonrun_count;
-				if (fwrite(buf, sizeof(buf[0]), 1, fp) < 1)
-					return rgbe_error(rgbe_write_error, NULL);
-				if (fwrite(&data[cur], sizeof(data[0])*nonrun_count, 1, fp) < 1)
-					return rgbe_error(rgbe_write_error, NULL);
-				cur += nonrun_count;
-			}
-			/* write out next run if one was found */
-			if (run_count >= MINRUNLENGTH) {
-				buf[0] = 128 + run_count;
-				buf[1] = data[beg_run];
-				if (fwrite(buf, sizeof(buf[0]) * 2, 1, fp) < 1)
-					return rgbe_error(rgbe_write_error, NULL);
-				cur += run_count;
-			}
-		}
-		return RGBE_RETURN_SUCCESS;
-#undef MINRUNLENGTH
-	}
-
+	/* scanlines are converted and run length encoded in parallel by the encoder shared */
+	/* with the estimator, then written a block of scanlines per fwrite. */
 	int RGBE_WritePixels_RLE(FILE *fp, float *data, int scanline_width,
 		int num_scanlines)
 	{
-		unsigned char rgbe[4];
-		unsigned char *buffer;
-		int i, err;
-
 		if ((scanline_width < 8) || (scanline_width > 0x7fff))
 			/* run length encoding is not allowed so write flat*/
 			return RGBE_WritePixels(fp, data, scanline_width*num_scanlines);
-		buffer = (unsigned char *)malloc(sizeof(unsigned char) * 4 * scanline_width);
-		if (buffer == NULL)
-			/* no buffer space so write flat */
-			return RGBE_WritePixels(fp, data, scanline_width*num_scanlines);
-		while (num_scanlines-- > 0) {
-			rgbe[0] = 2;
-			rgbe[1] = 2;
-			rgbe[2] = scanline_width >> 8;
-			rgbe[3] = scanline_width & 0xFF;
-			if (fwrite(rgbe, sizeof(rgbe), 1, fp) < 1) {
-				free(buffer);
-				return rgbe_error(rgbe_write_error, NULL);
-			}
-			for (i = 0; i<scanline_width; i++) {
-				float2rgbe(rgbe, data[RGBE_DATA_RED],
-					data[RGBE_DATA_GREEN], data[RGBE_DATA_BLUE]);
-				buffer[i] = rgbe[0];
-				buffer[i + scanline_width] = rgbe[1];
-				buffer[i + 2 * scanline_width] = rgbe[2];
-				buffer[i + 3 * scanline_width] = rgbe[3];
-				data += RGBE_DATA_SIZE;
-			}
-			/* write out each of the four channels separately run length encoded */
-			/* first red, then green, then blue, then exponent */
-			for (i = 0; i<4; i++) {
-				if ((err = RGBE_WriteBytes_RLE(fp, &buffer[i*scanline_width],
-					scanline_width)) != RGBE_RETURN_SUCCESS) {
-					free(buffer);
-					return err;
-				}
-			}
-		}
-		free(buffer);
-		return RGBE_RETURN_SUCCESS;
+		bool ok = write_rgbe(data, scanline_width, num_scanlines, RGBE_DATA_SIZE, RGBE_DATA_SIZE, RGBE_DATA_SIZE * scanline_width,
+			[fp](const unsigned char* bytes, size_t size) { return fwrite(bytes, 1, size, fp) == size; });
+		return ok ? RGBE_RETURN_SUCCESS : rgbe_error(rgbe_write_error, NULL);
 	}
 
-	int RGBE_ReadPixels_RLE(FILE *fp, float *data, int scanline_width,
-		int num_scanlines)
+	RGBE_StreamReader::RGBE_StreamReader()
+		: m_pDecoder(nullptr)
 	{
-		unsigned char rgbe[4], *scanline_buffer, *ptr, *ptr_end;
-		int i, count;
-		unsigned char buf[2];
+	}
 
-		if ((scanline_width < 8) || (scanline_width > 0x7fff))
-			/* run length encoding is not allowed so read flat*/
-			return RGBE_ReadPixels(fp, data, scanline_width*num_scanlines);
-		scanline_buffer = NULL;
-		/* read in each successive scanline */
-		while (num_scanlines > 0) {
-			if (fread(rgbe, sizeof(rgbe), 1, fp) < 1) {
-				free(scanline_buffer);
-				return rgbe_error(rgbe_read_error, NULL);
-			}
-			if ((rgbe[0] != 2) || (rgbe[1] != 2) || (rgbe[2] & 0x80)) {
-				/* this file is not run length encoded */
-				rgbe2float(&data[0], &data[1], &data[2], rgbe);
-				data += RGBE_DATA_SIZE;
-				free(scanline_buffer);
-				return RGBE_ReadPixels(fp, data, scanline_width*num_scanlines - 1);
-			}
-			if ((((int)rgbe[2]) << 8 | rgbe[3]) != scanline_width) {
-				free(scanline_buffer);
-				return rgbe_error(rgbe_format_error, "wrong scanline width");
-			}
-			if (scanline_buffer == NULL)
-				scanline_buffer = (unsigned char *)
-				malloc(sizeof(unsigned char) * 4 * scanline_width);
-			if (scanline_buffer == NULL)
-				return rgbe_error(rgbe_memory_error, "unable to allocate buffer space");
+	RGBE_StreamReader::~RGBE_StreamReader()
+	{
+		Close();
+	}
 
-			ptr = &scanline_buffer[0];
-			/* read each of the four channels for the scanline into the buffer */
-			for (i = 0; i<4; i++) {
-				ptr_end = &scanline_buffer[(i + 1)*scanline_width];
-				while (ptr < ptr_end) {
-					if (fread(buf, sizeof(buf[0]) * 2, 1, fp) < 1) {
-						free(scanline_buffer);
-						return rgbe_error(rgbe_read_error, NULL);
-					}
-					if (buf[0] > 128) {
-						/* a run of the same value */
-						count = buf[0] - 128;
-						if ((count == 0) || (count > ptr_end - ptr)) {
-							free(scanline_buffer);
-							return rgbe_error(rgbe_format_error, "bad scanline data");
-						}
-						while (count-- > 0)
-							*ptr++ = buf[1];
-					}
-					else {
-						/* a non-run */
-						count = buf[0];
-						if ((count == 0) || (count > ptr_end - ptr)) {
-							free(scanline_buffer);
-							return rgbe_error(rgbe_format_error, "bad scanline data");
-						}
-						*ptr++ = buf[1];
-						if (--count > 0) {
-							if (fread(ptr, sizeof(*ptr)*count, 1, fp) < 1) {
-								free(scanline_buffer);
-								return rgbe_error(rgbe_read_error, NULL);
-							}
-							ptr += count;
-						}
-					}
-				}
-			}
-			/* now convert data from buffer into floats */
-			for (i = 0; i<scanline_width; i++) {
-				rgbe[0] = scanline_buffer[i];
-				rgbe[1] = scanline_buffer[i + scanline_width];
-				rgbe[2] = scanline_buffer[i + 2 * scanline_width];
-				rgbe[3] = scanline_buffer[i + 3 * scanline_width];
-				rgbe2float(&data[RGBE_DATA_RED], &data[RGBE_DATA_GREEN],
-					&data[RGBE_DATA_BLUE], rgbe);
-				data += RGBE_DATA_SIZE;
-			}
-			num_scanlines--;
+	bool RGBE_StreamReader::Open(const char* path)
+	{
+		Close();
+		m_pDecoder = new HDRDecoder(path);
+		if (!m_pDecoder->valid())
+		{
+			fprintf(stderr, "RGBE stream error: %s: %s\n", path, m_pDecoder->error().c_str());
+			Close();
+			return false;
 		}
-		free(scanline_buffer);
-		return RGBE_RETURN_SUCCESS;
+		return true;
+	}
+
+	void RGBE_StreamReader::Close()
+	{
+		delete m_pDecoder;
+		m_pDecoder = nullptr;
+	}
+
+	bool RGBE_StreamReader::GetIsOpen() const
+	{
+		return m_pDecoder != nullptr;
+	}
+
+	int RGBE_StreamReader::GetWidth() const
+	{
+		return (m_pDecoder) ? m_pDecoder->width() : 0;
+	}
+
+	int RGBE_StreamReader::GetHeight() const
+	{
+		return (m_pDecoder) ? m_pDecoder->height() : 0;
+	}
+
+	bool RGBE_StreamReader::ReadRegion(int x, int y, int w, int h, float *data) const
+	{
+		return m_pDecoder && m_pDecoder->decode_region(x, y, w, h, data, RGBE_DATA_SIZE);
+	}
+
+	bool RGBE_StreamReader::ReadScanlines(int y, int h, float *data) const
+	{
+		return ReadRegion(0, y, GetWidth(), h, data);
 	}
 };
\ No newline at end of file
@@ -2,6 +2,8 @@
 
 #include <Windows.h>
 #include <Commdlg.h>
+#include <algorithm>
+#include <ctype.h>
 
 
 namespace NPOSHelper
@@ -49,5 +51,14 @@ namespace NPOSHelper
 	{
 		SetCurrentDirectory(dir.c_str());
 	}
+
+	std::string GetResolvedPath(const std::string &path)
+	{
+		char fullPath[MAX_PATH];
+		DWORD length = GetFullPathName(path.c_str(), MAX_PATH, fullPath, NULL);
+		std::string result = (length > 0 && length < MAX_PATH) ? fullPath : path;
+		std::transform(result.begin(), result.end(), result.begin(), ::tolower);
+		return result;
+	}
 #endif
 }
\ No newline at end of file